@@ -0,0 +1,584 @@
+// Dmitri Ivanov <dmiivanov@gmail.com>
+
+// Micro and macro benchmarks for the fitting hot paths of specfit.  Inputs are
+// synthetic spectra shaped like the ones in sim/txt (0.1 log10(E/eV) bins from
+// 19.0 up, constant exposure, fJ2B_19 - like flux) that are re-binned to the desired
+// number of bins. Results are written in machine-readable JSON (layout follows
+// that of Google benchmark so that the standard comparison tools can be used).
+//
+// Usage:
+//   specfit_bench [-o results.json] [-f name_filter] [-min_time seconds] [-quick]
+
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <vector>
+#include "TString.h"
+#include "TStopwatch.h"
+#include "TRandom3.h"
+#include "TSystem.h"
+#include "TROOT.h"
+#include "specfit.h"
+
+// one measurement: name, parameters (as a JSON object body), iterations, times
+struct bench_result
+{
+  TString name;
+  TString params;
+  Long64_t iterations;
+  Double_t real_time_ns;
+  Double_t cpu_time_ns;
+  Double_t items_per_iteration;
+};
+
+static std::vector<bench_result> bench_results;
+static TString bench_filter = "";
+static Double_t bench_min_time = 0.5;
+static Bool_t bench_quick = false;
+
+// true if the benchmark of the given name should run
+static Bool_t bench_selected(const char *name)
+{
+  return (!bench_filter.Length() || TString(name).Contains(bench_filter));
+}
+
+// run the function repeatedly until it takes at least bench_min_time seconds and record
+// the time per iteration; items_per_iteration is used to report the time per item (bin, call, ...)
+static void bench_run(const char *name, const char *params, void (*fun)(void *arg), void *arg, Double_t items_per_iteration = 1.0)
+{
+  if(!bench_selected(name))
+    return;
+  fun(arg); // warm up (JIT compilation, caches)
+  Long64_t niter = 1;
+  TStopwatch sw;
+  while (true)
+    {
+      sw.Start(true);
+      for (Long64_t i = 0; i < niter; i++)
+	fun(arg);
+      sw.Stop();
+      if(sw.RealTime() >= bench_min_time || niter >= ((Long64_t) 1 << 40))
+	break;
+      // aim at slightly more than the minimum time in the next round
+      Double_t scale = (sw.RealTime() > 1e-9 ? 1.4 * bench_min_time / sw.RealTime() : 100.0);
+      niter = (Long64_t) (niter * TMath::Min(TMath::Max(scale, 2.0), 100.0));
+    }
+  bench_result r;
+  r.name = name;
+  r.params = params;
+  r.iterations = niter;
+  r.real_time_ns = sw.RealTime() / (Double_t) niter * 1e9;
+  r.cpu_time_ns = sw.CpuTime() / (Double_t) niter * 1e9;
+  r.items_per_iteration = items_per_iteration;
+  bench_results.push_back(r);
+  fprintf(stderr, "%-40s %-45s %12.0f ns %12.0f ns(cpu) %12lld iterations\n", name, params, r.real_time_ns, r.cpu_time_ns, niter);
+}
+
+// synthetic flux shaped like the simulated spectra in sim/txt
+static TBPLF1* new_truth_function(const char *name)
+{
+  return new TBPLF1(name, 2, "J", 1e-33, 18.8, 21.0, "const,p1,p2,p3,logEshld,logEgzk", "6.0,-2.8,-2.9,-5.1,19.1,19.7", "0.1,0.1,0.1,0.1,0.1,0.1");
+}
+
+// fill a flux with nbins bins between 19.0 and 20.5 in log10(E/eV) with Poisson-fluctuated
+// numbers of events that follow the truth function
+static void fill_synthetic_flux(TCRFlux *flux, Int_t nbins, UInt_t seed)
+{
+  static TBPLF1 *fTruth = 0;
+  if(!fTruth)
+    fTruth = new_truth_function("fJ_bench_truth");
+  TRandom3 rng(seed);
+  const Double_t log10en_lo = 19.0, log10en_hi = 20.5, exposure = 9.29787e+17;
+  Double_t bsize = (log10en_hi - log10en_lo) / (Double_t) nbins;
+  std::vector<Double_t> log10en(nbins), log10en_bsize(nbins, bsize), nevents(nbins), expo(nbins, exposure);
+  for (Int_t i = 0; i < nbins; i++)
+    {
+      log10en[i] = log10en_lo + ((Double_t) i + 0.5) * bsize;
+      Double_t mu = fTruth->Eval(log10en[i]) * specfit_uti::GetLinBinSize(log10en[i], bsize) * exposure;
+      nevents[i] = (Double_t) rng.Poisson(mu);
+    }
+  flux->Load(log10en, log10en_bsize, nevents, expo);
+}
+
+// fit function with nbreaks break points that starts below the first break of the truth function
+static TBPLF1* new_fit_function(const char *name, Int_t nbreaks)
+{
+  std::vector<TString> parnames;
+  std::vector<Double_t> params, parerrors;
+  parnames.push_back("const");
+  params.push_back(6.0);
+  for (Int_t i = 0; i <= nbreaks; i++)
+    {
+      parnames.push_back(TString::Format("p%d", i + 1));
+      params.push_back(-2.8 - 0.5 * (Double_t) i);
+    }
+  for (Int_t i = 0; i < nbreaks; i++)
+    {
+      parnames.push_back(TString::Format("logE%d", i + 1));
+      params.push_back(19.1 + 1.2 * ((Double_t) i + 0.5) / (Double_t) (nbreaks + 1));
+    }
+  parerrors.resize(params.size(), 0.1);
+  return new TBPLF1(name, nbreaks, "J", 1e-33, 18.8, 21.0, &parnames[0], &params[0], &parerrors[0]);
+}
+
+////////////////////////// TCRFlux::CalcLogLikelihood /////////////////////////////
+
+static void bench_loglikelihood(void *arg)
+{
+  TCRFlux *flux = (TCRFlux*) arg;
+  flux->CalcLogLikelihood(18.0, 21.0);
+}
+
+static void run_loglikelihood_benchmarks()
+{
+  TBPLF1 *fJ = new_truth_function("fJ_bench_lgl");
+  Int_t nbins_max = (bench_quick ? 10000 : 1000000);
+  for (Int_t nbins = 100; nbins <= nbins_max; nbins *= 10)
+    {
+      TCRFlux flux(specfit_uti::get_unique_object_name("bench_lgl"), "bench");
+      fill_synthetic_flux(&flux, nbins, 4357);
+      flux.SetFluxFun(fJ);
+      bench_run("TCRFlux::CalcLogLikelihood", TString::Format("\"nbins\": %d", nbins), bench_loglikelihood, &flux, (Double_t) nbins);
+    }
+  delete fJ;
+}
+
+////////////////////////// TCRFluxFit::Fit /////////////////////////////
+
+struct bench_fit_arg
+{
+  TCRFluxFit *fit;
+  std::vector<Double_t> start;
+};
+
+static void bench_fit(void *arg)
+{
+  bench_fit_arg &a = *(bench_fit_arg*) arg;
+  a.fit->fJ->SetParameters(&a.start[0]); // always start from the same point
+  a.fit->Fit(false);
+}
+
+static void run_fit_benchmarks()
+{
+  Int_t nfluxes_values[] =
+  { 1, 10, 50, 200 };
+  Int_t nnfluxes = (bench_quick ? 2 : (Int_t) (sizeof(nfluxes_values) / sizeof(Int_t)));
+  for (Int_t ifl = 0; ifl < nnfluxes; ifl++)
+    {
+      Int_t nfluxes = nfluxes_values[ifl];
+      for (Int_t nbreaks = 0; nbreaks <= 4; nbreaks++)
+	{
+	  TString name = "TCRFluxFit::Fit";
+	  if(!bench_selected(name))
+	    return;
+	  TBPLF1 *fJ = new_fit_function(specfit_uti::get_unique_object_name("fJ_bench_fit"), nbreaks);
+	  TCRFluxFit fit;
+	  fit.SetFluxFun(fJ);
+	  for (Int_t iflux = 0; iflux < nfluxes; iflux++)
+	    {
+	      TCRFlux tmp(specfit_uti::get_unique_object_name("bench_fit_tmp"), "bench");
+	      fill_synthetic_flux(&tmp, 15, 1000 + iflux);
+	      fit.Add(TString::Format("bench_flux_%d", iflux), "bench", (Int_t) tmp.log10en.size(), &tmp.log10en[0], &tmp.log10en_bsize[0], &tmp.nevents[0], &tmp.exposure[0]);
+	    }
+	  fit.SetEminEmax(18.8, 21.0);
+	  bench_fit_arg a;
+	  a.fit = &fit;
+	  a.start = std::vector<Double_t>(fJ->GetParameters(), fJ->GetParameters() + fJ->GetNpar());
+	  bench_run(name, TString::Format("\"nfluxes\": %d, \"nbreaks\": %d", nfluxes, nbreaks), bench_fit, &a);
+	  delete fit.fE3J;
+	  delete fJ;
+	}
+    }
+}
+
+////////////////////////// TBPLF1::make_formula + compilation /////////////////////////////
+
+struct bench_formula_arg
+{
+  Int_t nbreaks;
+  const char *ftype;
+};
+
+static void bench_make_formula(void *arg)
+{
+  bench_formula_arg &a = *(bench_formula_arg*) arg;
+  TString frm = TBPLF1::make_formula(a.nbreaks, a.ftype, 1e-33, 18.8);
+  (void) frm;
+}
+
+static void bench_make_tbplf1(void *arg)
+{
+  bench_formula_arg &a = *(bench_formula_arg*) arg;
+  TBPLF1 *f = new TBPLF1("fJ_bench_compile", a.nbreaks, a.ftype, 1e-33, 18.8, 21.0);
+  delete f;
+}
+
+static void run_formula_benchmarks()
+{
+  const char *ftypes[] =
+  { "J", "E3J", "J>" };
+  for (Int_t itype = 0; itype < 3; itype++)
+    {
+      for (Int_t nbreaks = 0; nbreaks <= 4; nbreaks++)
+	{
+	  bench_formula_arg a;
+	  a.nbreaks = nbreaks;
+	  a.ftype = ftypes[itype];
+	  TString params = TString::Format("\"nbreaks\": %d, \"ftype\": \"%s\"", nbreaks, ftypes[itype]);
+	  bench_run("TBPLF1::make_formula", params, bench_make_formula, &a);
+	  bench_run("TBPLF1::TBPLF1(compile)", params, bench_make_tbplf1, &a);
+	}
+    }
+}
+
+////////////////////////// TBPLF1::MultiplyAndIntegrate_dE /////////////////////////////
+
+struct bench_integrate_arg
+{
+  TBPLF1 *fJ;
+  TF1 *f;
+};
+
+static void bench_integrate(void *arg)
+{
+  bench_integrate_arg &a = *(bench_integrate_arg*) arg;
+  Double_t result = a.fJ->MultiplyAndIntegrate_dE(a.f, 19.0, 20.5);
+  (void) result;
+}
+
+static void run_integrate_benchmarks()
+{
+  bench_integrate_arg a;
+  a.fJ = new_truth_function("fJ_bench_integrate");
+  a.f = 0;
+  bench_run("TBPLF1::MultiplyAndIntegrate_dE", "\"f\": \"none\"", bench_integrate, &a);
+  a.f = new TF1("f_bench_exposure", "9.29787e+17", 18.0, 21.0);
+  bench_run("TBPLF1::MultiplyAndIntegrate_dE", "\"f\": \"exposure\"", bench_integrate, &a);
+  delete a.f;
+  delete a.fJ;
+}
+
+////////////////////////// TCRFlux::Load (ASCII) /////////////////////////////
+
+struct bench_load_arg
+{
+  TString ascii_file;
+  TCRFlux *flux;
+};
+
+static void bench_load(void *arg)
+{
+  bench_load_arg &a = *(bench_load_arg*) arg;
+  a.flux->Load(a.ascii_file);
+}
+
+static void run_load_benchmarks()
+{
+  Int_t nbins_max = (bench_quick ? 1000 : 100000);
+  for (Int_t nbins = 10; nbins <= nbins_max; nbins *= 10)
+    {
+      bench_load_arg a;
+      a.flux = new TCRFlux(specfit_uti::get_unique_object_name("bench_load"), "bench");
+      fill_synthetic_flux(a.flux, nbins, 4357);
+      a.ascii_file = TString::Format("%s/specfit_bench_%d_%d.txt", gSystem->TempDirectory().Data(), gSystem->GetPid(), nbins);
+      a.flux->to_ascii_file(a.ascii_file);
+      bench_run("TCRFlux::Load(ascii)", TString::Format("\"nbins\": %d", nbins), bench_load, &a, (Double_t) nbins);
+      gSystem->Unlink(a.ascii_file);
+      delete a.flux;
+    }
+}
+
+////////////////////////// specfit_uti::get_fc_errors /////////////////////////////
+
+static void bench_fc_errors(void *arg)
+{
+  (void) arg;
+  Double_t s = 0;
+  for (Int_t n = 0; n < 40; n++)
+    s += specfit_uti::get_fc_errors((Double_t) n).first;
+  (void) s;
+}
+
+static void run_fc_errors_benchmarks()
+{
+  bench_run("specfit_uti::get_fc_errors", "\"n\": \"0-39\"", bench_fc_errors, 0, 40.0);
+}
+
+////////////////////////// TBPLF1 specialized code vs. make_formula /////////////////////////////
+
+// The specialized code of TBPLF1 must give the same values as the formula it replaces: every type with 0 to 4 breaks
+// (4 is evaluated by the formula) is compared through EvalPar and Eval with a TF1 compiled from make_formula, at points
+// that fall into each segment and on the breaks.  Returns the number of mismatches.
+static Int_t check_native_kernels()
+{
+  const char *ftypes[] =
+  { "J", "E3J", "EJ", "J>", "E2J>" };
+  Int_t nbad = 0;
+  for (Int_t itype = 0; itype < (Int_t) (sizeof(ftypes) / sizeof(ftypes[0])); itype++)
+    {
+      for (Int_t nbreaks = 0; nbreaks <= 4; nbreaks++)
+	{
+	  std::vector<Double_t> params;
+	  params.push_back(6.0);
+	  for (Int_t i = 0; i <= nbreaks; i++)
+	    params.push_back(-2.7 - 0.4 * (Double_t) i);
+	  for (Int_t i = 0; i < nbreaks; i++)
+	    params.push_back(18.5 + 2.0 * ((Double_t) i + 1.0) / (Double_t) (nbreaks + 1));
+	  TBPLF1 *f = new TBPLF1(specfit_uti::get_unique_object_name("fJ_bench_kernel"), nbreaks, ftypes[itype], 1e-33, 18.0, 21.0);
+	  f->SetParameters(&params[0]);
+	  TF1 *fref = new TF1(specfit_uti::get_unique_object_name("fJ_bench_formula"), TBPLF1::make_formula(nbreaks, ftypes[itype], 1e-33, 18.0), 18.0,
+	      21.0);
+	  fref->SetParameters(&params[0]);
+	  std::vector<Double_t> xs;
+	  for (Int_t i = 0; i <= 60; i++)
+	    xs.push_back(18.0 + 3.0 * (Double_t) i / 60.0);
+	  for (Int_t i = 0; i < nbreaks; i++)
+	    xs.push_back(params[nbreaks + 2 + i]);
+	  for (Int_t i = 0; i < (Int_t) xs.size(); i++)
+	    {
+	      Double_t x[1] = { xs[i] };
+	      Double_t v_ref = fref->EvalPar(x, &params[0]);
+	      Double_t v_par = f->EvalPar(x, &params[0]);
+	      Double_t v_eval = f->Eval(xs[i]);
+	      Double_t tol = 1e-10 * TMath::Abs(v_ref) + 1e-300;
+	      if(TMath::Abs(v_par - v_ref) > tol || TMath::Abs(v_eval - v_ref) > tol)
+		{
+		  fprintf(stderr, "ERROR: TBPLF1 %s with %d breaks at %.4f: formula %.10e EvalPar %.10e Eval %.10e\n", ftypes[itype], nbreaks, xs[i], v_ref,
+		      v_par, v_eval);
+		  nbad++;
+		}
+	    }
+	  delete fref;
+	  delete f;
+	}
+    }
+  fprintf(stderr, "TBPLF1 specialized code vs. formulas: %d mismatches\n", nbad);
+  return nbad;
+}
+
+////////////////////////// TCRFlux::SelectEnergyRange with an energy response /////////////////////////////
+
+// The bands of the energy response must follow the bins that SelectEnergyRange keeps: the folded expectations of a
+// flux whose range is selected are compared with those of a flux that's loaded with the same bins and the rows of the
+// response trimmed by hand.  Returns the number of mismatches.
+static Int_t check_response_selection()
+{
+  const Int_t nbins = 30, ntrue = 40;
+  const Double_t log10en_min = 19.3, log10en_max = 20.2, sigma = 0.08;
+  TBPLF1 *fJ = new_truth_function("fJ_bench_response");
+  TCRFlux all(specfit_uti::get_unique_object_name("bench_response_all"), "bench");
+  fill_synthetic_flux(&all, nbins, 4357);
+  std::vector<Double_t> true_log10en(ntrue), true_bsize(ntrue, 1.6 / (Double_t) ntrue), true_exposure(ntrue, 9.29787e+17);
+  for (Int_t j = 0; j < ntrue; j++)
+    true_log10en[j] = 18.95 + ((Double_t) j + 0.5) * true_bsize[j];
+  std::vector<Double_t> response(nbins * ntrue);
+  for (Int_t i = 0; i < nbins; i++)
+    {
+      Double_t lo = all.log10en[i] - all.log10en_bsize[i] / 2.0, hi = all.log10en[i] + all.log10en_bsize[i] / 2.0;
+      for (Int_t j = 0; j < ntrue; j++)
+	response[i * ntrue + j] = TMath::Freq((hi - true_log10en[j]) / sigma) - TMath::Freq((lo - true_log10en[j]) / sigma);
+    }
+  TCRFlux trimmed(specfit_uti::get_unique_object_name("bench_response_trimmed"), "bench");
+  std::vector<Double_t> log10en, log10en_bsize, nevents, expo, response_trimmed;
+  for (Int_t i = 0; i < nbins; i++)
+    {
+      if(all.log10en[i] < log10en_min || all.log10en[i] > log10en_max)
+	continue;
+      log10en.push_back(all.log10en[i]);
+      log10en_bsize.push_back(all.log10en_bsize[i]);
+      nevents.push_back(all.nevents[i]);
+      expo.push_back(all.exposure[i]);
+      response_trimmed.insert(response_trimmed.end(), response.begin() + i * ntrue, response.begin() + (i + 1) * ntrue);
+    }
+  trimmed.Load(log10en, log10en_bsize, nevents, expo);
+  Int_t nbad = 0;
+  if(!all.SetResponse(true_log10en, true_bsize, true_exposure, response, 1e-6) || !trimmed.SetResponse(true_log10en, true_bsize, true_exposure, response_trimmed, 1e-6))
+    nbad++;
+  all.SelectEnergyRange(log10en_min, log10en_max);
+  if(!all.HasResponse() || all.log10en.size() != trimmed.log10en.size())
+    {
+      fprintf(stderr, "ERROR: SelectEnergyRange: %d bins kept, %d expected, response %s\n", (Int_t) all.log10en.size(), (Int_t) trimmed.log10en.size(),
+	  (all.HasResponse() ? "kept" : "lost"));
+      nbad++;
+    }
+  else
+    {
+      all.SetFluxFun(fJ);
+      trimmed.SetFluxFun(fJ);
+      all.CalcLogLikelihood(18.0, 21.0);
+      trimmed.CalcLogLikelihood(18.0, 21.0);
+      for (Int_t i = 0; i < (Int_t) all.log10en.size(); i++)
+	{
+	  if(TMath::Abs(all.nevents_fit[i] - trimmed.nevents_fit[i]) > 1e-12 * TMath::Abs(trimmed.nevents_fit[i]))
+	    {
+	      fprintf(stderr, "ERROR: SelectEnergyRange with a response at %.4f: expected %.10e, trimmed by hand %.10e\n", all.log10en[i], all.nevents_fit[i],
+		  trimmed.nevents_fit[i]);
+	      nbad++;
+	    }
+	}
+    }
+  delete fJ;
+  fprintf(stderr, "TCRFlux::SelectEnergyRange with an energy response: %d mismatches\n", nbad);
+  return nbad;
+}
+
+////////////////////////// TCRFlux::CalcLogLikelihood with the sufficient statistics /////////////////////////////
+
+// relative difference that's allowed between the two ways of summing the log likelihood
+static Bool_t suffstat_same(Double_t a, Double_t b)
+{
+  return (TMath::Abs(a - b) <= 1e-9 * TMath::Max(TMath::Max(TMath::Abs(a), TMath::Abs(b)), 1.0));
+}
+
+// The sufficient statistics of the broken power laws (SetBplSuffStat) must give the same log likelihoods, numbers of
+// bins and sums of the numbers of events as the sums over the bins, and FillNeventsFit the same expected numbers of
+// events: the high energy tail of the spectrum has runs of bins without events, and the minimum number of events of
+// the restricted log likelihood, the energy correction, the exposure scale and the energy range are varied.  Returns
+// the number of mismatches.
+static Int_t check_bpl_suffstat()
+{
+  TBPLF1 *fJ = new_truth_function("fJ_bench_suffstat");
+  TF1 *fEnCorr = new TF1("fEnCorr_bench_suffstat", "[0]+[1]*(x-19.5)", 18.0, 21.0);
+  fEnCorr->SetParameters(1.05, 0.02);
+  const Int_t nevents_min_values[] =
+  { 7, 1, 20 };
+  Int_t nbad = 0;
+  for (Int_t icase = 0; icase < 12; icase++)
+    {
+      Int_t nevents_min = nevents_min_values[icase % 3];
+      Bool_t with_encorr = ((icase / 3) % 2 == 1);
+      Double_t scale = (icase / 6 == 1 ? 1.3 : 1.0);
+      Double_t log10en_lo = (icase % 2 ? 19.23 : 18.0), log10en_hi = (icase % 2 ? 20.37 : 21.0);
+      TCRFlux flux(specfit_uti::get_unique_object_name("bench_suffstat"), "bench");
+      fill_synthetic_flux(&flux, 300, 4357 + icase);
+      flux.SetFluxFun(fJ);
+      flux.SetEncorr(with_encorr ? fEnCorr : 0);
+      flux.SetNeventsMinRestricted(nevents_min);
+      flux.exposure_scale = scale;
+      std::pair<Double_t, Double_t> lgl[2][3], nsum[2][3];
+      std::vector<Double_t> nevents_fit[2];
+      for (Int_t k = 0; k < 2; k++)
+	{
+	  flux.SetBplSuffStat(k == 0);
+	  flux.CalcLogLikelihood(log10en_lo, log10en_hi);
+	  flux.FillNeventsFit();
+	  lgl[k][0] = flux.GetLogLikelihood();
+	  lgl[k][1] = flux.GetLogLikelihoodNonzero();
+	  lgl[k][2] = flux.GetLogLikelihoodRestricted();
+	  nsum[k][0] = flux.nevents_sum;
+	  nsum[k][1] = flux.nevents_sum_nonzero;
+	  nsum[k][2] = flux.nevents_sum_restricted;
+	  nevents_fit[k] = flux.nevents_fit;
+	}
+      const char *what[3] =
+      { "all", "nonzero", "restricted" };
+      for (Int_t j = 0; j < 3; j++)
+	{
+	  if(!suffstat_same(lgl[0][j].first, lgl[1][j].first) || lgl[0][j].second != lgl[1][j].second || !suffstat_same(nsum[0][j].first, nsum[1][j].first)
+	      || !suffstat_same(nsum[0][j].second, nsum[1][j].second))
+	    {
+	      fprintf(stderr, "ERROR: sufficient statistics, case %d (%s bins): -2lnL %.10e / %.10e, bins %.0f / %.0f, events %.6e / %.6e, expected %.10e / %.10e\n",
+		  icase, what[j], lgl[0][j].first, lgl[1][j].first, lgl[0][j].second, lgl[1][j].second, nsum[0][j].first, nsum[1][j].first, nsum[0][j].second,
+		  nsum[1][j].second);
+	      nbad++;
+	    }
+	}
+      for (Int_t i = 0; i < (Int_t) flux.log10en.size(); i++)
+	{
+	  if(flux.log10en[i] < log10en_lo || flux.log10en[i] > log10en_hi || suffstat_same(nevents_fit[0][i], nevents_fit[1][i]))
+	    continue;
+	  fprintf(stderr, "ERROR: sufficient statistics, case %d: expected number of events at %.4f %.10e / %.10e\n", icase, flux.log10en[i], nevents_fit[0][i],
+	      nevents_fit[1][i]);
+	  nbad++;
+	}
+    }
+  delete fEnCorr;
+  delete fJ;
+  fprintf(stderr, "TCRFlux::CalcLogLikelihood with the sufficient statistics vs. the sums over the bins: %d mismatches\n", nbad);
+  return nbad;
+}
+
+////////////////////////// output /////////////////////////////
+
+static Bool_t write_json(const char *json_file)
+{
+  FILE *fp = (json_file ? fopen(json_file, "w") : stdout);
+  if(!fp)
+    {
+      fprintf(stderr, "ERROR: failed to open %s for writing!\n", json_file);
+      return false;
+    }
+  char date[64];
+  time_t now = time(0);
+  strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", localtime(&now));
+  fprintf(fp, "{\n");
+  fprintf(fp, "  \"context\": {\n");
+  fprintf(fp, "    \"date\": \"%s\",\n", date);
+  fprintf(fp, "    \"executable\": \"specfit_bench\",\n");
+  fprintf(fp, "    \"root_version\": %d,\n", gROOT->GetVersionInt());
+  fprintf(fp, "    \"min_time\": %g\n", bench_min_time);
+  fprintf(fp, "  },\n");
+  fprintf(fp, "  \"benchmarks\": [\n");
+  for (Int_t i = 0; i < (Int_t) bench_results.size(); i++)
+    {
+      const bench_result &r = bench_results[i];
+      // name encodes the parameters so that runs can be matched up by name
+      TString params_name = r.params;
+      params_name.ReplaceAll("\"", "");
+      params_name.ReplaceAll(": ", ":");
+      params_name.ReplaceAll(", ", "/");
+      fprintf(fp, "    {\n");
+      fprintf(fp, "      \"name\": \"%s/%s\",\n", r.name.Data(), params_name.Data());
+      fprintf(fp, "      \"run_name\": \"%s\",\n", r.name.Data());
+      fprintf(fp, "      \"params\": { %s },\n", r.params.Data());
+      fprintf(fp, "      \"iterations\": %lld,\n", r.iterations);
+      fprintf(fp, "      \"real_time\": %.3f,\n", r.real_time_ns);
+      fprintf(fp, "      \"cpu_time\": %.3f,\n", r.cpu_time_ns);
+      fprintf(fp, "      \"time_unit\": \"ns\",\n");
+      fprintf(fp, "      \"items_per_second\": %.6e\n", r.real_time_ns > 0 ? r.items_per_iteration / r.real_time_ns * 1e9 : 0.0);
+      fprintf(fp, "    }%s\n", (i < (Int_t) bench_results.size() - 1 ? "," : ""));
+    }
+  fprintf(fp, "  ]\n");
+  fprintf(fp, "}\n");
+  if(json_file)
+    fclose(fp);
+  else
+    fflush(fp);
+  return true;
+}
+
+int main(int argc, char **argv)
+{
+  const char *json_file = 0;
+  for (Int_t i = 1; i < argc; i++)
+    {
+      TString arg = argv[i];
+      if(arg == "-o" && i + 1 < argc)
+	json_file = argv[++i];
+      else if(arg == "-f" && i + 1 < argc)
+	bench_filter = argv[++i];
+      else if(arg == "-min_time" && i + 1 < argc)
+	bench_min_time = atof(argv[++i]);
+      else if(arg == "-quick")
+	{
+	  bench_quick = true;
+	  bench_min_time = 0.05;
+	}
+      else
+	{
+	  fprintf(stderr, "usage: %s [-o results.json] [-f name_filter] [-min_time seconds] [-quick]\n", argv[0]);
+	  return 2;
+	}
+    }
+  gROOT->SetBatch(true);
+  // the timings of wrong results are of no use
+  if(check_native_kernels() + check_response_selection() + check_bpl_suffstat())
+    return 1;
+  run_loglikelihood_benchmarks();
+  run_fit_benchmarks();
+  run_formula_benchmarks();
+  run_integrate_benchmarks();
+  run_load_benchmarks();
+  run_fc_errors_benchmarks();
+  return (write_json(json_file) ? 0 : 1);
+}
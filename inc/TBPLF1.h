@@ -12,6 +12,7 @@
 #include <iostream>
 #include <cstdlib>
 #include "TString.h"
+#include <cstdio>
 #include <vector>
 #include "TSPECFITF1.h"
 
@@ -20,7 +21,7 @@ class TBPLF1: public TSPECFITF1
 public:
 
   TBPLF1() :
-      fBplScaleFactor(1.0)
+      fBplScaleFactor(1.0), fBplType("J"), fBplLog10enMin(18.0), fBplFormulaFactor(0), fNativeKernel(-1), fNativeLog10enMin(0)
   {
     ;
   }
@@ -35,8 +36,10 @@ public:
       const Double_t *params,      // values (starting values) of the parameters
       const Double_t *parerrors    // errors (starting step sizes) of the parameters
       ) :
-      TSPECFITF1(name, make_formula(nbreaks, ftype, scalefactor, log10en_min), log10en_min, log10en_max, parnames, params, parerrors), fBplScaleFactor(scalefactor)
+      TSPECFITF1(name, make_formula(nbreaks, ftype, scalefactor, log10en_min), log10en_min, log10en_max, parnames, params, parerrors), fBplScaleFactor(scalefactor), fBplType(ftype), fBplLog10enMin(log10en_min),
+      fBplFormulaFactor(formula_value("%e", scalefactor)), fNativeKernel(-1), fNativeLog10enMin(0)
   {
+    fBplType.ToUpper();
     set_default_title(ftype);
   }
 
@@ -51,8 +54,10 @@ public:
       const Double_t *parerrors = 0 //
 
       ) :
-      TSPECFITF1(name, make_formula(nbreaks, ftype, scalefactor, log10en_min), log10en_min, log10en_max, csparnames, params, parerrors), fBplScaleFactor(scalefactor)
+      TSPECFITF1(name, make_formula(nbreaks, ftype, scalefactor, log10en_min), log10en_min, log10en_max, csparnames, params, parerrors), fBplScaleFactor(scalefactor), fBplType(ftype), fBplLog10enMin(log10en_min),
+      fBplFormulaFactor(formula_value("%e", scalefactor)), fNativeKernel(-1), fNativeLog10enMin(0)
   {
+    fBplType.ToUpper();
     set_default_title(ftype);
   }
   TBPLF1(const char *name,         //
@@ -65,8 +70,10 @@ public:
       const char *csparams,        // comma - separated list of values (starting values) of the parameters as a single C string
       const char *csparerrors      // comma - separated list of errors (starting step sizes) of the parameters as a single C string
       ) :
-      TSPECFITF1(name, make_formula(nbreaks, ftype, scalefactor, log10en_min), log10en_min, log10en_max, csparnames, csparams, csparerrors), fBplScaleFactor(scalefactor)
+      TSPECFITF1(name, make_formula(nbreaks, ftype, scalefactor, log10en_min), log10en_min, log10en_max, csparnames, csparams, csparerrors), fBplScaleFactor(scalefactor), fBplType(ftype), fBplLog10enMin(log10en_min),
+      fBplFormulaFactor(formula_value("%e", scalefactor)), fNativeKernel(-1), fNativeLog10enMin(0)
   {
+    fBplType.ToUpper();
     set_default_title(ftype);
   }
 
@@ -77,7 +84,14 @@ public:
       const char *ftype                          // understands J, E3J, EJ, J>, E2J>
       ) const
   {
-    return new TBPLF1(newname, GetNbreaks(), ftype, GetBplScaleFactor(), GetXmin(), GetXmax(), &GetParNames().front(), GetParameters(), GetParErrors());
+    if(fBplFormulaFactor == 0)
+      {
+	fprintf(stderr, "ERROR: NewTBPLF1: reference energy of '%s' is not known!\n", GetName());
+	return 0;
+      }
+    TBPLF1 *f = new TBPLF1(newname, GetNbreaks(), ftype, GetBplScaleFactor(), GetBplLog10enMin(), GetXmax(), &GetParNames().front(), GetParameters(), GetParErrors());
+    f->SetRange(GetXmin(), GetXmax());
+    return f;
   }
 
   // make flux formulas based on the function type and how many break points
@@ -90,16 +104,57 @@ public:
     return (GetNpar() - 2) / 2;
   }
 
-  Int_t GetBplScaleFactor() const
+  Double_t GetBplScaleFactor() const
   {
     return fBplScaleFactor;
   }
 
+  // type of the function (J, E3J, EJ, J>, E2J>)
+  const char* GetBplType() const
+  {
+    return fBplType.Data();
+  }
+
+  // log10(E/eV) at which the power laws are referenced, it's the lowest energy of the function as constructed
+  Double_t GetBplLog10enMin() const
+  {
+    return fBplLog10enMin;
+  }
+
+  // For the objects written with the older versions of the class (see specfitLinkDef.h): the type and the reference
+  // energy (version 1) and the constant factor (versions 1 and 2) are recovered from the formula.  If that fails the
+  // type is left empty and the function is only evaluated by its formula.
+  Bool_t RestoreFromFormula(Bool_t type_known);
+
+  // For the J type functions, log10 J = log10_offsets[k] + slopes[k] * log10(E/eV) in the segment k = 0 .. nbreaks
+  // of the power law, segment k covers breaks[k-1] <= log10(E/eV) < breaks[k] (no lower limit for the first segment and no
+  // upper limit for the last segment), the same way as in the formula.  Returns false if the function isn't of type J,
+  // its constant factor isn't known, the normalization isn't positive or the breaks aren't in increasing order.
+  Bool_t GetLog10Segments(std::vector<Double_t> &breaks, std::vector<Double_t> &log10_offsets, std::vector<Double_t> &slopes) const;
+
+  // Native evaluation of the J type functions from the power law segments (see GetLog10Segments),
+  // the other types are evaluated by the formula
+  void EvalBatch(const Double_t *x, Double_t *out, size_t n);
+
+  // With 0 to 3 breaks the function is evaluated by code that is specialized at compile time for the number of
+  // breaks and the type of the function (the same expression as the formula); otherwise by the formula
+  virtual Double_t EvalPar(const Double_t *x, const Double_t *params = 0);
+
+  // TF1::Eval of ROOT 6 evaluates the formula directly, so it's routed through EvalPar for the specialized code
+  virtual Double_t Eval(Double_t x, Double_t y = 0, Double_t z = 0, Double_t t = 0) const;
+
+  // whether the function is evaluated by the specialized code
+  Bool_t IsNative()
+  {
+    return (get_native_kernel() >= 0);
+  }
+
   // To re-scale the function
   void Scale(Double_t c)
   {
     TSPECFITF1::Scale(c);
     fBplScaleFactor *= c;
+    fBplFormulaFactor *= formula_value("%e", c);
   }
 
   // Multiply this function (of log10en) by another function f (of log10en) and numerically integrate with respect to linear energy dE
@@ -128,7 +183,27 @@ private:
   // scaling factor of the BPL function
   Double_t fBplScaleFactor;
 
-ClassDef(TBPLF1,1)
+  // type of the function and the energy at which the power laws are referenced
+  TString fBplType;
+  Double_t fBplLog10enMin;
+
+  // constant factor of the formula, as it's written into the formula
+  Double_t fBplFormulaFactor;
+
+  // specialized code for the function, -1 if not yet chosen, -2 if there is none
+  Int_t fNativeKernel;          //!
+  Double_t fNativeLog10enMin;   //! reference energy as it's written into the formula
+
+  // choose the specialized code
+  Int_t get_native_kernel();
+
+  // number as it's written into the formula with the given format
+  static Double_t formula_value(const char *fmt, Double_t value)
+  {
+    return atof(TString::Format(fmt, value).Data());
+  }
+
+ClassDef(TBPLF1,3)
   ;
 
 };
@@ -0,0 +1,118 @@
+// Dmitri Ivanov <dmiivanov@gmail.com>
+
+//
+//  Sums and products of functions that are evaluated by calling the (copies of the) functions
+//  themselves, with the parameters of the composite function passed on to them, instead of
+//  compiling a combined formula.  Inherits from TSPECFITF1 class that customizes ROOT's TF1
+//  for the purposes of fitting cosmic ray flux results.
+//
+
+#ifndef _TCOMPOSITEF1_h_
+#define _TCOMPOSITEF1_h_
+
+#include <vector>
+#include "TObjArray.h"
+#include "TSPECFITF1.h"
+
+class TCOMPOSITEF1: public TSPECFITF1
+{
+public:
+
+  TCOMPOSITEF1() :
+      fOperation('+'), fConstant(0)
+  {
+    ;
+  }
+
+  virtual ~TCOMPOSITEF1();
+
+  // c0 + c1 x f1 + c2 x f2 with the parameters of f1 followed by the parameters of f2
+  // (same as TSPECFITF1::Add with the starting formula c0)
+  static TCOMPOSITEF1* Sum(const char *newname, Double_t c0, const TF1 *f1, const TF1 *f2, Double_t c1 = 1.0, Double_t c2 = 1.0);
+
+  // c0 + c x f
+  static TCOMPOSITEF1* Sum(const char *newname, Double_t c0, const TF1 *f, Double_t c = 1.0);
+
+  // c0 x f1 x f2 with the parameters of f1 followed by the parameters of f2
+  static TCOMPOSITEF1* Product(const char *newname, const TF1 *f1, const TF1 *f2, Double_t c0 = 1.0);
+
+  // '+' for the sums, '*' for the products
+  Char_t GetOperation() const
+  {
+    return fOperation;
+  }
+
+  Double_t GetConstant() const
+  {
+    return fConstant;
+  }
+
+  Int_t GetNchildren() const
+  {
+    return fChildren.GetEntries();
+  }
+
+  // copy of the function i that is being evaluated, its own parameters are not used
+  TF1* GetChild(Int_t i) const
+  {
+    return (TF1*) fChildren.At(i);
+  }
+
+  // coefficient of the function i in the sum
+  Double_t GetChildCoefficient(Int_t i) const
+  {
+    return fCoefficients[i];
+  }
+
+  // index of the first parameter of the function i among the parameters of the composite function
+  Int_t GetChildParOffset(Int_t i) const
+  {
+    return fParOffsets[i];
+  }
+
+  // replace the function i by (a copy of) another function with the same number of parameters,
+  // nothing is compiled and the parameters of the composite function are kept
+  Bool_t SetChild(Int_t i, const TF1 *f);
+
+  // the functions evaluated with their parts of the parameters and combined
+  virtual Double_t EvalPar(const Double_t *x, const Double_t *params = 0);
+
+  // each function is evaluated for all points at once
+  void EvalBatch(const Double_t *x, Double_t *out, size_t n);
+
+  // derivatives of the functions with respect to their parameters combined by the sum and the product rules,
+  // analytic if they are analytic for all functions that have parameters
+  virtual void EvalGradient(const Double_t *x, Double_t *grad, const Double_t *params = 0);
+  virtual Bool_t HasAnalyticGradient() const;
+  virtual Bool_t GenerateGradient();
+
+  // To re-scale the function (multiplies the coefficients)
+  void Scale(Double_t c);
+
+  // formula that's equivalent to the composite function, with the parameter numbers offset by n_offset
+  TString GetCompositeFormula(Int_t n_offset = 0) const;
+
+private:
+
+  TCOMPOSITEF1(const char *name, Char_t operation, Double_t c0, Int_t nfun, const TF1 **f, const Double_t *c);
+
+  // placeholder for the TF1 function pointer, the evaluation is done by EvalPar
+  static Double_t composite_fcn(Double_t *x, Double_t *params);
+
+  // total number of parameters of the functions
+  static Int_t count_parameters(Int_t nfun, const TF1 **f);
+
+  Char_t fOperation;                  // '+' or '*'
+  Double_t fConstant;                 // c0
+  TObjArray fChildren;                // copies of the functions that are combined (owned)
+  std::vector<Double_t> fCoefficients; // coefficients of the functions in the sum
+  std::vector<Int_t> fParOffsets;     // index of the first parameter of each function
+  std::vector<Double_t> fBatchValues; //! values of one function for the batch evaluation
+  std::vector<Double_t> fChildValues; //! values of the functions at one point for the product rule
+
+ClassDef(TCOMPOSITEF1,1)
+  ;
+
+};
+
+#endif
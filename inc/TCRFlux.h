@@ -21,7 +21,8 @@ class TCRFlux: public TNamed
 public:
 
   TCRFlux() :
-      log10en_min_data(0), log10en_max_data(0), nevents_min_restricted(7), fJ(0), fE3J(0), fJ_null(0), fE3J_null(0), fEnCorr(0)
+      log10en_min_data(0), log10en_max_data(0), nevents_min_restricted(7), exposure_scale(1.0), exposure_scale_error(0), exposure_scale_profiled(false), fJ(0), fE3J(0), fJ_null(0), fE3J_null(0), fEnCorr(0), encorr_cache_fun(0),
+      encorr_cache_hits(0), encorr_cache_misses(0), response_encorr_valid(false), bpl_suffstat(true), bpl_suffstat_valid(false), nevents_fit_pending(false), asimov_data(false)
   {
     init_graph_pointers();
   }
@@ -70,12 +71,60 @@ public:
   void SetEncorr(TF1 *fEnCorr_set = 0)
   {
     fEnCorr = fEnCorr_set;
+    ClearEncorrCache();
+  }
+
+  // The energy correction factors at the bin centers are memoized for the last used parameters of the energy
+  // correction function: the log likelihood evaluations where only the flux parameters change (most of the
+  // evaluations during the gradient calculation) don't need to evaluate the energy correction function.
+  // Returns zero if there is no energy correction function, otherwise the array of the correction factors
+  // and (optionally) their log10 values for all energy bins.
+  const Double_t* GetEncorrValues(const Double_t **log10_encorr_values = 0);
+
+  // The cache is cleared automatically when the data or the energy correction function is set;
+  // clear it explicitly if the bins or the formula of the energy correction function are modified otherwise.
+  void ClearEncorrCache();
+
+  // numbers of the energy correction evaluations that were served from the cache and that had to be evaluated
+  Long64_t GetEncorrCacheHits() const
+  {
+    return encorr_cache_hits;
+  }
+  Long64_t GetEncorrCacheMisses() const
+  {
+    return encorr_cache_misses;
+  }
+
+  // Energy response for forward folding: response[i * ntrue + j] is the probability for an event with the energy in the
+  // true energy bin j (log10(E/eV) centers log10en_true, sizes log10en_true_bsize, exposure [m^2 sr s] exposure_true) to be
+  // reconstructed in the energy bin i of the data.  The expected number of events in the bin i is then the sum over j of
+  // response[i * ntrue + j] x J x energy correction x linear bin size x exposure_true x exposure scale, with J evaluated at the
+  // (corrected) true energy bin centers.  Each row is stored as a band between the first and the last entries above
+  // threshold x (largest entry of the row).  Must be set after the data are loaded; cleared when the data are loaded again.
+  // The null hypothesis numbers of events are not folded.
+  Bool_t SetResponse(Int_t ntrue, const Double_t *log10en_true_values, const Double_t *log10en_true_bsize_values, const Double_t *exposure_true_values,
+      const Double_t *response_values_dense, Double_t threshold = 0);
+  Bool_t SetResponse(const std::vector<Double_t> &log10en_true_values, const std::vector<Double_t> &log10en_true_bsize_values,
+      const std::vector<Double_t> &exposure_true_values, const std::vector<Double_t> &response_values_dense, Double_t threshold = 0);
+
+  // Gaussian resolution in log10(E/eV) with the standard deviation sigma_log10en, using the energy bins and the exposure
+  // of the data as the true energy bins (events from outside of the data energy range are not included)
+  // and truncating the response at nsigma standard deviations
+  Bool_t SetGaussianResponse(Double_t sigma_log10en, Double_t nsigma = 5.0);
+
+  // remove the energy response, the fit predictions are evaluated at the bin centers
+  void ClearResponse();
+
+  Bool_t HasResponse() const
+  {
+    return (response_start.size() == log10en.size() + 1 && !response_log10en.empty());
   }
 
   // Set the minimum number of events per bin for calculating the restricted log likelihood
   void SetNeventsMinRestricted(Int_t nevents_min_restricted_value = 7)
   {
     nevents_min_restricted = nevents_min_restricted_value;
+    bpl_suffstat_valid = false;
   }
 
   // contribution to the log likelihood function from this instance
@@ -83,6 +132,39 @@ public:
   // is the number of bins that are contributing
   void CalcLogLikelihood(Double_t log10en_min, Double_t log10en_max);
 
+  // If the flux function is a broken power law of type J (TBPLF1), the sum of nevents x ln(nevents_fit) over the bins
+  // is evaluated from the cumulative sums of nevents, nevents x log10(E/eV) and nevents x ln(acceptance) over the bins
+  // sorted in energy, with one binary search per break point; only the expected numbers of events are evaluated in each bin.
+  // On by default; the sums are rebuilt when the data, the energy range or the energy correction parameters change.
+  void SetBplSuffStat(Bool_t bpl_suffstat_on = true)
+  {
+    bpl_suffstat = bpl_suffstat_on;
+  }
+  Bool_t GetBplSuffStat() const
+  {
+    return bpl_suffstat;
+  }
+
+  // With the sufficient statistics, the expected numbers of events in runs of consecutive bins without events, where
+  // the bins are equally spaced in log10(E/eV) and the acceptance changes by the same factor from bin to bin (e.g. the
+  // high energy tails of the spectra with the exposure that no longer depends on energy), are summed as geometric series
+  // in each power law segment.  The expected numbers of events in these bins are then not stored in nevents_fit by
+  // CalcLogLikelihood, FillNeventsFit() evaluates them (it's called after the fits and before plotting).
+  void FillNeventsFit();
+
+  // Add the derivatives of the contribution to the log likelihood (log_likelihood.first) with respect to the parameters of the
+  // flux function to grad (GetNpar() entries of the flux function) and, if grad_encorr isn't zero, with respect to the parameters
+  // of the energy correction function to grad_encorr (none are added if there's no energy correction).  Uses the fit predictions
+  // of the last CalcLogLikelihood, which must have been called with the same parameters.  Returns false if there's no flux
+  // function or the energy response is set.
+  Bool_t AddLogLikelihoodGradient(Double_t log10en_min, Double_t log10en_max, Double_t *grad, Double_t *grad_encorr = 0);
+
+  // Add the Fisher information of the Poisson numbers of events in the bins, sum over the bins of (d mu / d p_a) (d mu / d p_b) / mu
+  // with mu the expected number of events, to the n x n matrix fisher (row by row) for the parameters of the flux function followed
+  // by the parameters of the energy correction function if with_encorr is true.  The exposure scale is taken as fixed.  Returns false
+  // if there's no flux function, the energy response is set or n is too small.
+  Bool_t AddFisherInformation(Double_t log10en_min, Double_t log10en_max, Int_t n, Double_t *fisher, Bool_t with_encorr = true);
+
   // Set functions that are to be used in evaluating the null hypothesis
   void SetNullFun(TF1 *fJ_null_set, TF1 *fE3J_null_set = 0)
   {
@@ -94,6 +176,17 @@ public:
   // return the number of events expected from the flux function and the number of events observed in the data
   std::pair<Double_t, Double_t> EvalNull();
 
+  // Cumulative sums of the numbers of events expected from the null hypothesis flux function (evaluated over all bins,
+  // regardless of its range) and of the observed numbers of events, over the bins sorted in energy.  Must be rebuilt
+  // after the data, the null hypothesis function or the energy correction parameters change.  Returns false if the
+  // null hypothesis function is not set.
+  Bool_t BuildNullPrefixSums();
+
+  // Same as EvalNull with the range of the null hypothesis function set to log10en_lo, log10en_hi (in the energy scale
+  // of the fit): (expected, observed) numbers of events from the cumulative sums, with a binary search over the bins
+  // instead of evaluating the function in each bin.
+  std::pair<Double_t, Double_t> EvalNullWindow(Double_t log10en_lo, Double_t log10en_hi) const;
+
   // contribution to the log likelihood function from this instance
   // first member of the pair is the log likelihood, second member of the pair
   // is the number of bins that are contributing
@@ -116,6 +209,17 @@ public:
     return log_likelihood_restricted;
   }
 
+  // Append the bins that contribute to the log likelihood in the log10(E/eV) range: the energies corrected with the
+  // energy correction function, the acceptances (expected number of events per unit flux: energy correction
+  // x linear bin size x exposure x exposure scale) and the numbers of events.  Returns the number of appended bins.
+  Int_t GetFitBins(Double_t log10en_min, Double_t log10en_max, std::vector<Double_t> &log10en_corr_values, std::vector<Double_t> &acceptance_values,
+      std::vector<Double_t> &nevents_values);
+
+  // Multiply the fit predictions by a constant factor c and update the log likelihoods analytically,
+  // without evaluating the flux function: for each bin the log likelihood changes by 2 (c - 1) nevents_fit - 2 nevents ln(c).
+  // Used for profiling the linear scale parameters of the fits; the nevents_fit values themselves are not rescaled.
+  void RescaleLogLikelihood(Double_t c);
+
   // graphs for the Flux, E^3 x Flux, numbers of events, fit prediction numbers of events, and the numbers
   // for the null hypothesis.
   TGraphAsymmErrors* GetJ() const;
@@ -144,6 +248,17 @@ public:
   // useful for displaying purposes.
   void RescaleExposure(Double_t c = 1.0);
 
+  // Asimov dataset for forecasts: the exposure (and the acceptance of the energy response) is multiplied by
+  // exposure_factor and the numbers of events in all bins are replaced by the ones expected from the flux function
+  // with its current parameters.  The data are kept: RestoreData() puts them back, and SetAsimovData called again
+  // starts from them; loading new data drops them.  Returns false if there's no flux function.
+  Bool_t SetAsimovData(Double_t exposure_factor = 1.0);
+  void RestoreData();
+  Bool_t IsAsimovData() const
+  {
+    return asimov_data;
+  }
+
   // return the total number of events
   Double_t nEventsTotal();
 
@@ -164,6 +279,25 @@ public:
   Int_t nevents_min_restricted;                             // minimum number of events for calculating restricted log likelihood
   std::pair<Double_t, Double_t> log_likelihood_restricted;  // log likelihood and the number of fit bins for bins that meet the smallest number of events
 
+  // sums of the observed (in bins with non-zero numbers of events) and of the expected numbers of events over
+  // the bins that contribute to log_likelihood, log_likelihood_nonzero and log_likelihood_restricted
+  std::pair<Double_t, Double_t> nevents_sum;
+  std::pair<Double_t, Double_t> nevents_sum_nonzero;
+  std::pair<Double_t, Double_t> nevents_sum_restricted;
+
+  // exposure scale factor, multiplies the exposure in the fit predictions, in the null hypothesis predictions
+  // and in the fluxes calculated from the data; if profiled, TCRFluxFit determines it analytically in the fit
+  Double_t exposure_scale;
+  Double_t exposure_scale_error;  // uncertainty on the exposure scale factor determined by the fit
+  Bool_t exposure_scale_profiled; // whether the exposure scale factor is a fit parameter
+
+  // energy response, see SetResponse
+  std::vector<Double_t> response_log10en;     // log10(E/eV) of the true energy bin centers
+  std::vector<Double_t> response_acceptance;  // linear bin size x exposure [m^2 sr s] of the true energy bins
+  std::vector<Int_t> response_first;          // first true energy bin of the band of each data bin
+  std::vector<Int_t> response_start;          // positions where the bands of the data bins start in response_values, and the end
+  std::vector<Double_t> response_values;      // probabilities of the bands
+
   // Flux versus log10(E/eV) function.  If the pointer to this function is zero then zeros are returned for the log likelihood calculations
   TF1 *fJ;   // flux function that's used for the fits and displaying the results
   TF1 *fE3J; // flux function that's used for displaying the results
@@ -212,9 +346,77 @@ private:
   void clean_graph_if_allocated(TObject*& graph_obj);
   void clean_allocated_graphs();
 
+  // memoized energy correction factors
+  std::vector<Double_t> encorr_cache;       //! energy correction factors at the bin centers
+  std::vector<Double_t> encorr_cache_log10; //! log10 of the energy correction factors
+  std::vector<Double_t> encorr_cache_par;   //! parameters of the energy correction function for which the cache is valid
+  TF1 *encorr_cache_fun;                    //! energy correction function for which the cache is valid
+  Long64_t encorr_cache_hits;               //! number of times the cached values have been used
+  Long64_t encorr_cache_misses;             //! number of times the values had to be evaluated
+
+  // cumulative sums for the null hypothesis windows
+  std::vector<Double_t> null_prefix_log10en;   //! energies log10(E/eV) of the bins in increasing order
+  std::vector<Double_t> null_prefix_expected;  //! expected numbers of events summed over the bins below each bin
+  std::vector<Double_t> null_prefix_observed;  //! observed numbers of events summed over the bins below each bin
+
+  // flux function evaluated for all fitted bins at once
+  std::vector<Int_t> eval_bins;                 //! bins that are evaluated
+  std::vector<Double_t> eval_x;                 //! corrected energies log10(E/eV) of the bins
+  std::vector<Double_t> eval_y;                 //! values of the flux function
+  std::vector<Double_t> eval_grad;              //! derivatives of the flux function with respect to its parameters
+  std::vector<Double_t> eval_grad_encorr;       //! derivatives of the energy correction function with respect to its parameters
+  void eval_nevents_fit(Double_t log10en_min, Double_t log10en_max, const Double_t *encorr_values, const Double_t *log10_encorr_values, Bool_t skip_zero_runs);
+
+  // folding with the energy response
+  std::vector<Double_t> response_encorr;        //! energy correction factors at the true energy bin centers
+  std::vector<Double_t> response_log10_encorr;  //! log10 of the energy correction factors
+  Bool_t response_encorr_valid;                 //! whether they are up to date with the energy correction parameters
+  std::vector<Double_t> response_nevents;       //! expected numbers of events in the true energy bins
+  void fold_response(Double_t log10en_min, Double_t log10en_max);
+  void erase_response_row(Int_t i);
+
+  // sufficient statistics for the broken power law fits (see SetBplSuffStat), over the fit bins sorted in the
+  // corrected energy: cumulative sums of n, n x log10(E/eV) and n ln(acceptance) over the bins below each bin,
+  // for all bins and for the restricted bins, where n is the number of events that enters the log likelihood formula
+  Bool_t bpl_suffstat;                               //! whether to use the sufficient statistics
+  Bool_t bpl_suffstat_valid;                         //! whether the sums below are up to date
+  Double_t bpl_suffstat_log10en_min;                 //! energy range for which the sums have been built
+  Double_t bpl_suffstat_log10en_max;                 //!
+  std::vector<Double_t> bpl_suffstat_log10en;        //! corrected energies log10(E/eV) of the fit bins in increasing order
+  std::vector<Double_t> bpl_suffstat_n;              //! sums of n
+  std::vector<Double_t> bpl_suffstat_nx;             //! sums of n x log10(E/eV)
+  std::vector<Double_t> bpl_suffstat_nlnacc;         //! sums of n ln(acceptance)
+  std::vector<Double_t> bpl_suffstat_n_restricted;   //! same for the bins with at least nevents_min_restricted events
+  std::vector<Double_t> bpl_suffstat_nx_restricted;  //!
+  std::vector<Double_t> bpl_suffstat_nlnacc_restricted; //!
+  Double_t bpl_suffstat_const;                       //! sum of 2 (n ln(n) - n) over all bins
+  Double_t bpl_suffstat_const_restricted;            //! same for the restricted bins
+  std::vector<Int_t> bpl_suffstat_bins;              //! bin indices in the order of the sums
+  // runs of bins without events that are summed as geometric series
+  std::vector<Int_t> bpl_zero_run_start;             //! position of the first bin of the run in the sums
+  std::vector<Int_t> bpl_zero_run_length;            //! number of bins in the run
+  std::vector<Double_t> bpl_zero_run_dx;             //! log10(E/eV) step between the bins
+  std::vector<Double_t> bpl_zero_run_lnacc;          //! ln(acceptance) of the first bin
+  std::vector<Double_t> bpl_zero_run_dlnacc;         //! ln(acceptance) step between the bins
+  std::vector<Bool_t> bpl_zero_run_bin;              //! whether the bin belongs to one of the runs
+  Bool_t nevents_fit_pending;                        //! whether nevents_fit of the bins in the runs is out of date
+  std::vector<Int_t> bpl_segment_bounds;             //! positions in the sums where the power law segments start
+  std::vector<Double_t> bpl_breaks;                  //! break points and power law segments of the flux function
+  std::vector<Double_t> bpl_log10_offsets;           //!
+  std::vector<Double_t> bpl_slopes;                  //!
+  void build_bpl_suffstat(Double_t log10en_min, Double_t log10en_max, const Double_t *encorr_values, const Double_t *log10_encorr_values);
+  Bool_t calc_log_likelihood_bpl(Double_t log10en_min, Double_t log10en_max, const Double_t *encorr_values, const Double_t *log10_encorr_values);
+
+  // data kept while the Asimov dataset is set
+  Bool_t asimov_data;                                //! whether the Asimov dataset is set
+  std::vector<Double_t> data_nevents;                //! numbers of events of the data
+  std::vector<Double_t> data_exposure;               //! exposure of the data
+  std::vector<Double_t> data_response_acceptance;    //! acceptance of the true energy bins of the data
+  void clear_asimov_data();
+
 
   // for the class dictionary generation
-ClassDef(TCRFlux,1)
+ClassDef(TCRFlux,3)
   ;
 
 };
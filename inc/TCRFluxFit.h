@@ -16,14 +16,18 @@
 #include "TMinuit.h"
 #include "TObject.h"
 #include "TCRFlux.h"
+#include "TCRFluxFitStats.h"
 #include "TF1.h"
+#include "TH2D.h"
+#include "TBPLF1.h"
+#include "TSPLINEF1.h"
 #include "specfit_uti.h"
 
 class TCRFluxFit: public TObject
 {
 public:
   TCRFluxFit() :
-      log10en_min(17.0), log10en_max(21.0), nfitpar(0), nfluxpar(0), nencorrpar(0), chi2(0), ndof(0), fJ(0), fE3J(0), fJ_null(0), fE3J_null(0), mFIT(0)
+      log10en_min(17.0), log10en_max(21.0), nfitpar(0), nfluxpar(0), nencorrpar(0), chi2(0), ndof(0), iprofiled_norm(-1), use_irls(false), use_gradient(true), use_formula_gradient(false), minimizer("MIGRAD"), fd_nthreads(1), use_fisher(false), scan_null_max_sigma(0), scan_null_max_lo(0), scan_null_max_hi(0), scan_null_max_nexpected(0), scan_null_max_nobserved(0), forecast_dchi2(0), forecast_pvalue(1), forecast_significance(0), mcmc_acceptance(0), evidence_logz(0), evidence_logz_error(0), evidence_h(0), evidence_niter(0), fJ(0), fE3J(0), fJ_null(0), fE3J_null(0), mFIT(0), iprofiled_fcn(-1), irls_fcn(false), gradient_fcn(false), minimizer_fcn(false), parallel_fcn(false), fisher_fcn(false), spline_fun(0), spline_cast(0)
   {
     ;
   }
@@ -102,6 +106,10 @@ public:
   // and that are actually observed in the data
   std::pair<Double_t, Double_t> EvalNull();
 
+  // scan of the null hypothesis over all windows of nbins steps in [log10en_lo, log10en_hi] (fitted range by default),
+  // returns the map of the local significances owned by the caller, the largest excess is in scan_null_max_*
+  TH2D* ScanNull(Int_t nbins = 50, Double_t log10en_lo = 0, Double_t log10en_hi = 0);
+
   // calculate the overall log likelihood and return the (log likelihood, number of bins) pair
   const std::pair<Double_t, Double_t>& GetLogLikelihood()
   {
@@ -109,12 +117,154 @@ public:
     return log_likelihood;
   }
 
+  // Profile a linear scale parameter of the flux function (such as [0] of TBPLF1) analytically,
+  // so that Minuit doesn't see it.  Use ipar = -1 to minimize over all parameters with Minuit (default).
+  Bool_t SetProfiledNorm(Int_t ipar = 0);
+
+  // fit the exposure scale factor of a flux (TCRFlux::exposure_scale), profiled in the same way
+  Bool_t SetProfiledExposureScale(const char *flux_name, Bool_t profile = true);
+
+  // Profile the normalization and the power law indices of a TBPLF1 J flux function by IRLS,
+  // so that Minuit only minimizes over the break positions and the energy corrections.
+  Bool_t SetIRLS(Bool_t irls_on = true)
+  {
+    use_irls = irls_on;
+    return true;
+  }
+
+  // give Minuit the analytic derivatives if the functions have them (on by default)
+  Bool_t SetAnalyticGradient(Bool_t gradient_on = true)
+  {
+    use_gradient = gradient_on;
+    return true;
+  }
+
+  // differentiate the formulas of the functions for the analytic derivatives (off by default)
+  Bool_t SetFormulaGradient(Bool_t formula_gradient_on = true)
+  {
+    use_formula_gradient = formula_gradient_on;
+    return true;
+  }
+
+  // Minimizer used by Fit: "MIGRAD" (default), "LBFGSB" or "TRUST" (see specfit_min).
+  // Returns false if the name isn't understood.
+  Bool_t SetMinimizer(const char *minimizer_name = "MIGRAD");
+  const char* GetMinimizer() const
+  {
+    return minimizer.Data();
+  }
+
+  // evaluate the finite differences of the FCN with copies of the fit in nthreads threads
+  // (0: as many as the hardware supports, 1: serially, the default)
+  Bool_t SetParallelDerivatives(Int_t nthreads = 0)
+  {
+    fd_nthreads = nthreads;
+    return true;
+  }
+
+  // obtain the errors and fit_covariance from the Fisher information instead of Minuit's HESSE
+  Bool_t SetFisherErrors(Bool_t fisher_on = true)
+  {
+    use_fisher = fisher_on;
+    return true;
+  }
+
+  // covariance matrix of the fit parameters (row by row) from the inverse of the Fisher information,
+  // returns false if there's no fit, if there are energy responses or if the matrix is singular
+  Bool_t CalcFisherCovariance(std::vector<Double_t> &covariance);
+
+  // error of a function of the fit parameters by the delta method, grad has its derivatives
+  Double_t PropagateError(const Double_t *grad);
+
+  // same for a formula of the fit parameters [0], [1], ..., puts the value of the formula into value
+  Double_t PropagateError(const char *expression, Double_t *value = 0);
+
+  // derived quantities and their errors (put into error if it's given) by the delta method:
+  // energy of the break ibreak (0, 1, ..) of a TBPLF1 or TSBPLF1 flux function in EeV
+  Double_t GetBreakEnergyEeV(Int_t ibreak, Double_t *error = 0);
+  // flux function at log10(E/eV)
+  Double_t GetFluxValue(Double_t log10en, Double_t *error = 0);
+  // integral of the flux function J over the energy from log10(E/eV) to the upper end of the range of the function
+  Double_t GetIntegralFlux(Double_t log10en, Double_t *error = 0);
+
+  // Replace the data of flux_name (all fluxes if it's not given) by the Asimov dataset of the fit,
+  // with the exposure multiplied by exposure_factor, until RestoreData().
+  Bool_t SetAsimovData(Double_t exposure_factor = 1.0, const char *flux_name = 0);
+  void RestoreData();
+
+  // Expected errors of the fit parameters for the current data and, if fJ_null_model is given, the
+  // expected significance of the features that it lacks.  Results in forecast_*.
+  Bool_t Forecast(const TF1 *fJ_null_model = 0, Bool_t verbose = true);
+
+  // Gaussian prior of a fit parameter for sampling the posterior (sigma <= 0 removes it),
+  // on top of the uniform prior within the limits of the parameter
+  Bool_t SetPrior(Int_t ipar, Double_t mean, Double_t sigma);
+  void ClearPriors()
+  {
+    prior_mean.clear();
+    prior_sigma.clear();
+  }
+
+  // log of the prior density of the fit parameters par, -TMath::Infinity() outside of the limits
+  Double_t EvalLogPrior(const Double_t *par);
+
+  // log of the posterior density, -1/2 FCN plus the log prior, for npoints points of nfitpar values
+  void EvalLogPosterior(Int_t npoints, const Double_t *par, Double_t *logp);
+
+  // Sample the posterior of the fit parameters with specfit_mcmc, results in mcmc_*.
+  // The samples after the burn-in go to samples_file if it's given.  Requires a fit.
+  Bool_t SampleMCMC(Int_t nsteps = 2000, Int_t nburn = 500, Int_t nwalkers = 0, Int_t nthreads = 0, const char *samples_file = 0, UInt_t seed = 4357,
+      Bool_t verbose = true);
+
+  // quantile q of the samples of the fit parameter ipar from the last SampleMCMC
+  Double_t GetPosteriorQuantile(Int_t ipar, Double_t q) const;
+
+  // Bayesian evidence of the flux function by specfit_nested, results in evidence_*.
+  // Parameters without limits are taken uniform within nsigma_unbounded errors.  Requires a fit.
+  Bool_t ComputeEvidence(Int_t nlive = 400, Int_t nthreads = 0, Double_t nsigma_unbounded = 10.0, Double_t dlogz = 0.1, UInt_t seed = 4357,
+      Bool_t verbose = true);
+
   // Performs the fit, returns true if successful.
   Bool_t Fit(Bool_t verbose = true);
 
+  // Fit of a TSPLINEF1 flux function by Newton's method on its band Hessian, used by Fit when
+  // there are no energy corrections, profiled parameters or energy responses.
+  Bool_t FitSpline(Bool_t verbose = true);
+
+  // Grid search over the break positions of a TBPLF1 J flux function (npts values per break) with
+  // the other parameters profiled by IRLS, then the nbest best cells are polished by Fit.
+  Bool_t GridSearchBreaks(Int_t npts = 20, Int_t nbest = 3, Int_t nthreads = 0, Bool_t verbose = true);
+
+  // Fits from nstarts starting points drawn within the parameter limits, run concurrently.
+  // Returns the number of distinct minima (in minima_*) and leaves the fit at the best one.
+  Int_t MultiStart(Int_t nstarts = 20, Bool_t latin_hypercube = true, Int_t nthreads = 0, UInt_t seed = 4357, Bool_t verbose = true);
+
+  // Fits TBPLF1 J functions with 0, 1, ..., kmax breaks to the same data, results in models_*.
+  // The flux function of this fit is not changed.
+  Bool_t CompareBreakModels(Int_t kmax = 3, Int_t nthreads = 0, Bool_t verbose = true);
+
+  // Independent copy of the fit for running fits in other threads, fitting fJ_set if it's given.
+  // The copies must be made and deleted in the main thread.
+  TCRFluxFit* MakeWorkerCopy(const TF1 *fJ_set = 0) const;
+
+  // function minimized by Minuit: sets the parameters, evaluates the overall log likelihood
+  // and records the performance counters
+  void EvalFCN(Int_t &npar, Double_t *gin, Double_t &f, Double_t *par, Int_t iflag);
+
+  // same for the minimizers of specfit_min, and the record of their iterations
+  Double_t EvalMinimizerFCN(const Double_t *par, Double_t *grad);
+  void AddMinimizerIteration(Int_t iteration, Double_t fval, Double_t edm);
+
+  // function that's minimized for all fit parameters par (not Minuit's), without profiling
+  Double_t EvalFitFCN(const Double_t *par);
+
+  // performance counters and statistics of the last fit
+  TCRFluxFitStats& GetStats();
+
   // To obtain the Minuit pointer for whatever reason.
   // In order for it to behave correctly, the global FCN must be
-  // pointed to use this instance of the class.
+  // pointed to use this instance of the class.  Its errors are stale
+  // if they came from the Fisher information or the parallel Hessian.
   TMinuit* GetMinuit();
 
   Double_t log10en_min; // minimum log10(E/eV) for fitting
@@ -122,8 +272,15 @@ public:
   Int_t nfitpar;        // total number of fit parameters
   Int_t nfluxpar;       // number of flux fit parameters
   Int_t nencorrpar;     // number of energy correction parameters
-  Double_t chi2;        // normalized log likelihood, which in the case of large statistics behaves like chi2
+  Double_t chi2;        // normalized log likelihood, which behaves like chi2 for large statistics
   Double_t ndof;        // number of degrees of freedom
+  Int_t iprofiled_norm; // flux parameter that's profiled analytically, -1 if none
+  Bool_t use_irls;      // profile the TBPLF1 normalization and power law indices by IRLS
+  Bool_t use_gradient;  // give Minuit the analytic derivatives if there are any
+  Bool_t use_formula_gradient; // generate the derivatives of the formulas for that
+  TString minimizer;    // minimizer used by Fit (MIGRAD, LBFGSB, TRUST)
+  Int_t fd_nthreads;    // threads for the finite differences of the FCN
+  Bool_t use_fisher;    // errors of the fit from the Fisher information instead of Minuit's HESSE
   std::map<TString, TCRFlux*> Fluxes;
   std::vector<TCRFlux*> Fluxes_ordered;
   std::pair<Double_t, Double_t> log_likelihood;
@@ -132,6 +289,64 @@ public:
 
   std::vector<Double_t> fit_parameters; // combined fit parameters
   std::vector<Double_t> fit_parerrors;  // uncertainties on combined fit parameters
+  std::vector<Double_t> fit_covariance; // covariance matrix of combined fit parameters (row by row), empty if not available
+
+  std::vector<Double_t> grid_breaks; // break positions of the last grid search, nbreaks values per cell
+  std::vector<Double_t> grid_chi2;   // normalized log likelihood of each cell
+
+  // distinct minima found by the last MultiStart, best first
+  std::vector<Double_t> minima_chi2;                     //! normalized log likelihood at each minimum
+  std::vector<Int_t> minima_nstarts;                     //! number of starts that ended in each minimum
+  std::vector<Int_t> minima_status;                      //! Migrad status of the best fit in each minimum
+  std::vector<std::vector<Double_t> > minima_parameters; //! fit parameters at each minimum
+  std::vector<std::vector<Double_t> > minima_parerrors;  //! uncertainties on the fit parameters at each minimum
+
+  // models fitted by the last CompareBreakModels, models[k] has k breaks
+  std::vector<TBPLF1*> models;        //! fitted functions
+  std::vector<Double_t> models_chi2;  //! -2 ln L
+  std::vector<Int_t> models_npar;     //! number of free parameters
+  std::vector<Double_t> models_nbins; //! number of fitted bins
+  std::vector<Double_t> models_aic;   //! Akaike information criterion
+  std::vector<Double_t> models_bic;   //! Bayesian information criterion
+  std::vector<Double_t> models_dchi2; //! decrease of -2 ln L from the model with one break less
+  std::vector<Double_t> models_pvalue; //! p-value of the decrease
+
+  // most significant excess found by the last ScanNull
+  Double_t scan_null_max_sigma;      //! local significance in sigma units
+  Double_t scan_null_max_lo;         //! start of the window, log10(E/eV)
+  Double_t scan_null_max_hi;         //! end of the window, log10(E/eV)
+  Double_t scan_null_max_nexpected;  //! number of events expected from the null hypothesis in the window
+  Double_t scan_null_max_nobserved;  //! number of events observed in the window
+
+  // results of the last Forecast
+  std::vector<Double_t> forecast_parerrors; //! expected errors of the fit parameters
+  Double_t forecast_dchi2;                  //! increase of -2 ln L from the flux function to the null model
+  Double_t forecast_pvalue;                 //! p-value of the increase
+  Double_t forecast_significance;           //! significance in sigma units
+
+  // priors of the fit parameters (see SetPrior), sigma <= 0 for no Gaussian prior
+  std::vector<Double_t> prior_mean;
+  std::vector<Double_t> prior_sigma;
+
+  // results of the last SampleMCMC
+  std::vector<Double_t> mcmc_samples; //! samples after the burn-in, nfitpar values per sample
+  std::vector<Double_t> mcmc_logp;    //! log posterior densities of the samples
+  std::vector<Double_t> mcmc_mean;    //! posterior means of the fit parameters
+  std::vector<Double_t> mcmc_sigma;   //! posterior standard deviations of the fit parameters
+  std::vector<Double_t> mcmc_tau;     //! autocorrelation times in steps, 0 for the fixed parameters
+  std::vector<Double_t> mcmc_rhat;    //! potential scale reduction factors, 0 for the fixed parameters
+  Double_t mcmc_acceptance;           //! fraction of the accepted moves
+
+  // results of the last ComputeEvidence
+  Double_t evidence_logz;       //! log of the evidence
+  Double_t evidence_logz_error; //! statistical error of the log evidence
+  Double_t evidence_h;          //! information in nats
+  Int_t evidence_niter;         //! number of iterations of the nested sampling
+
+  Int_t GetNminima() const
+  {
+    return (Int_t) minima_chi2.size();
+  }
 
 
   Double_t GetParameter(Int_t ipar) const
@@ -159,6 +374,14 @@ public:
     return (Int_t)fit_parameters.size();
   }
 
+  // Minuit's index of a fit parameter, -1 if the parameter is profiled analytically
+  Int_t GetMinuitParIndex(Int_t ipar) const
+  {
+    if(ipar >= 0 && ipar < (Int_t) minuit_par_index.size())
+      return minuit_par_index[ipar];
+    return ipar;
+  }
+
   // ipar is the parameter index
   // npts, par_lo, par_up are the number of points to consider and upper and lower limits.
   // Default values will lead to using Minuit's default settings
@@ -178,15 +401,102 @@ public:
   // different ways, if necessary.
   std::map<TString, TF1*> fEnCorr;
 
+  // performance counters and statistics, reset at the beginning of each fit
+  TCRFluxFitStats stats;
+
 private:
 
   // minimizer
   TMinuit *mFIT; // the pointer can be obtained via special method by the outside code
 
+  // phase of the FCN calls for the statistics
+  TString fcn_phase_command; //! Minuit's command of the last FCN call
+  TString fcn_phase;         //! phase name made from it
+
+  // analytic profiling of the linear scale parameters
+  Int_t iprofiled_fcn; //! flux parameter that's profiled by the FCN, -1 if none
+  std::vector<Int_t> minuit_par_index; // Minuit's index of each fit parameter, -1 for the profiled parameters
+  std::vector<Double_t> fcn_parameters; //! all fit parameters used in the FCN evaluation
+  Bool_t profiling_on(); // whether any linear scale parameters are profiled
+  void set_fcn_parameters(const Double_t *par); // fill the fcn_parameters from Minuit's parameters
+  void profile_linear_scales(); // set the profiled parameters to their optimal values
+  void get_profiled_values(const Double_t *par, std::vector<Double_t> &values); // profiled values for par
+  void calc_profiled_errors(); // errors on the profiled parameters
+  void profile(const Double_t *par); // log likelihood for Minuit's parameters par
+
+  // Poisson GLM inner fit of the TBPLF1 normalization and power law indices for fixed break positions
+  Bool_t irls_fcn; //! whether the FCN evaluation of the current Minuit instance uses IRLS
+  std::vector<Double_t> irls_x; //! corrected log10(E/eV) of the fitted bins
+  std::vector<Double_t> irls_acc; //! acceptances of the fitted bins
+  std::vector<Double_t> irls_n; //! numbers of events in the fitted bins
+  std::vector<Int_t> irls_col; //! coefficient of the exposure scale of each bin, -1 if it's not profiled
+  std::vector<Double_t> irls_cov; //! covariance matrix of the profiled coefficients at the last solution
+  Bool_t irls_profile(); // solve for the profiled coefficients
+  Bool_t irls_load(std::vector<Double_t> &theta, Double_t &log10scale, Double_t &log10en_ref); // bins and coefficients
+  void irls_store(const std::vector<Double_t> &theta, const std::vector<Bool_t> &profiled); // coefficients to parameters
+
+  // derivatives of the log likelihood from the analytic derivatives of the flux function
+  Bool_t gradient_fcn; //! whether the FCN gives the derivatives
+  std::vector<Double_t> fcn_gradient; //! derivatives with respect to all fit parameters
+  Bool_t calc_gradient(Double_t *gin); // fill Minuit's derivatives
+  Bool_t has_gradient(TF1 *f); // whether f has analytic derivatives
+
+  // minimizers other than Migrad
+  Bool_t minimizer_fcn; //! whether the FCN is evaluated by a minimizer other than Migrad
+  std::vector<Double_t> minimizer_par; //! parameters at which the FCN is evaluated
+  Int_t run_minimizer(Int_t npar, Bool_t verbose); // minimize over Minuit's parameters, returns the status
+
+  // finite differences of the FCN
+  std::vector<Double_t> fd_par; //! starting values of Minuit's parameters
+  std::vector<Double_t> fd_steps; //! step sizes of Minuit's parameters, 0 for the fixed ones
+  std::vector<Double_t> fd_xmin; //! lower limits of Minuit's parameters
+  std::vector<Double_t> fd_xmax; //! upper limits of Minuit's parameters
+  void set_fd_steps(Int_t npar); // fill the above from Minuit's npar parameters
+  Bool_t parallel_fcn; //! whether the finite differences are evaluated in parallel by fd_workers
+  std::vector<TCRFluxFit*> fd_workers; //! copies of the fit, one for each thread
+  std::vector<Double_t> fd_points; //! points at which the FCN is evaluated, nfitpar values per point
+  std::vector<Double_t> fd_values; //! FCN at the points
+  Bool_t start_fd_workers(Int_t nthreads); // make the copies of the fit
+  void stop_fd_workers(); // delete the copies of the fit
+  void eval_fd_points(); // evaluate the FCN at all points
+  Bool_t calc_parallel_gradient(const Double_t *par, Double_t f, Double_t *gin); // derivatives at par
+  Bool_t calc_parallel_hessian(); // errors and the covariance matrix at the minimum
+
+  // errors from the Fisher information
+  Bool_t fisher_fcn; //! whether Fit obtains the errors from the Fisher information
+  Bool_t calc_fisher_errors(); // errors and the covariance matrix at the minimum
+  Bool_t calc_minuit_covariance(); // fit_covariance from Minuit's error matrix
+  const std::vector<Double_t>* get_covariance(); // fit_covariance, from the Fisher information if it's empty
+
+  // limits of the fit parameters, infinite for the ones without limits
+  void get_par_limits(std::vector<Double_t> &lo, std::vector<Double_t> &hi) const;
+
+  // number of threads for running ntasks fits concurrently
+  static Int_t get_nworkers(Int_t nthreads, Int_t ntasks);
+
+  // reason why FitSpline can't be used for the current setup, 0 if it can
+  const char* spline_fit_problem();
+
+  // flux function as a spline, 0 if it isn't one; cast again when fJ changes
+  TF1 *spline_fun;               //!
+  const TSPLINEF1 *spline_cast;  //!
+  const TSPLINEF1* get_spline()
+  {
+    if(fJ != spline_fun)
+      {
+	spline_fun = fJ;
+	spline_cast = dynamic_cast<const TSPLINEF1*>(fJ);
+      }
+    return spline_cast;
+  }
+
   // collector for TCRFlux objects that have been internally created during the lifetime of the class
   TObjArray TCRFlux_Objects_Created_By_This;
 
-ClassDef(TCRFluxFit,1)
+  // collector for the functions that have been copied by MakeWorkerCopy
+  TObjArray TF1_Objects_Created_By_This; //!
+
+ClassDef(TCRFluxFit,8)
   ;
 
 };
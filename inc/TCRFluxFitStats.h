@@ -0,0 +1,118 @@
+// Dmitri Ivanov <dmiivanov@gmail.com>
+
+// Performance counters and statistics that are collected by TCRFluxFit
+// while fitting: numbers of FCN and gradient calls, wall and CPU times spent on each
+// flux contribution and in each Minuit phase (MIGRAD, HESSE, SCAN, ...),
+// hit rates of the caches of memoized evaluations and the Minuit EDM and status
+// at each iteration.  Can be queried from C++ and Python and dumped as JSON.
+
+#ifndef _TCRFluxFitStats_h_
+#define _TCRFluxFitStats_h_
+
+#include <vector>
+#include <map>
+#include "TObject.h"
+#include "TString.h"
+
+class TCRFluxFitStats: public TObject
+{
+public:
+
+  TCRFluxFitStats() :
+      flux_timing(false)
+  {
+    Reset();
+  }
+
+  virtual ~TCRFluxFitStats();
+
+  // clear all counters
+  void Reset();
+
+  // time each flux contribution to the log likelihood (off by default): it takes a couple of
+  // clock readings and map updates per flux and per FCN call
+  void SetFluxTiming(Bool_t flux_timing_on = true)
+  {
+    flux_timing = flux_timing_on;
+  }
+
+  Bool_t GetFluxTiming() const
+  {
+    return flux_timing;
+  }
+
+  // accumulate the time spent on the log likelihood contribution of some flux
+  void AddFluxTime(const char *flux_name, Double_t real_time, Double_t cpu_time);
+
+  // accumulate the time and the number of calls spent in some minimizer phase
+  void AddPhaseTime(const char *phase_name, Double_t real_time, Double_t cpu_time, Long64_t ncalls = 1);
+
+  // set the cumulative numbers of hits and misses of some cache of memoized evaluations
+  void SetCacheCounts(const char *cache_name, Long64_t nhits, Long64_t nmisses);
+
+  // record Minuit's state at an iteration of the minimizer
+  void AddIteration(const char *phase_name, Long64_t ncalls, Double_t fval, Double_t edm, Int_t status);
+
+  // fraction of the lookups that were served from the cache, 0 if the cache has not been used
+  Double_t GetCacheHitRate(const char *cache_name) const;
+
+  // total times and numbers of calls for the phases and fluxes, 0 if not known
+  Double_t GetPhaseRealTime(const char *phase_name) const;
+  Double_t GetPhaseCpuTime(const char *phase_name) const;
+  Long64_t GetPhaseNcalls(const char *phase_name) const;
+  Double_t GetFluxRealTime(const char *flux_name) const;
+  Double_t GetFluxCpuTime(const char *flux_name) const;
+
+  // number of recorded iterations
+  Int_t GetNiterations() const
+  {
+    return (Int_t) iter_ncalls.size();
+  }
+
+  // all statistics as a JSON string
+  TString ToJSON() const;
+
+  // write the JSON string into a file
+  Bool_t DumpJSON(const char *json_file) const;
+
+  // print a summary
+  void Print(Option_t *opt = "") const;
+
+  // get the current wall clock time and the CPU time of the calling thread in seconds, used for timing the code
+  static Double_t get_real_time();
+  static Double_t get_cpu_time();
+
+  Long64_t nfcn;          // number of FCN calls
+  Long64_t ngrad;         // number of FCN calls that have requested the gradient (iflag = 2)
+  Double_t fit_real_time; // wall clock time of the last fit [s]
+  Double_t fit_cpu_time;  // CPU time of the last fit [s]
+  Int_t fit_status;       // status returned by the minimizer in the last fit
+
+  std::map<TString, Double_t> flux_real_time; // wall clock time [s] spent on each flux contribution
+  std::map<TString, Double_t> flux_cpu_time;  // CPU time [s] spent on each flux contribution
+  std::map<TString, Long64_t> flux_ncalls;    // number of log likelihood evaluations for each flux
+
+  std::vector<TString> phase_names;     // Minuit phases in the order in which they first occurred
+  std::map<TString, Double_t> phase_real_time; // wall clock time [s] of the FCN calls in each phase
+  std::map<TString, Double_t> phase_cpu_time;  // CPU time [s] of the FCN calls in each phase
+  std::map<TString, Long64_t> phase_ncalls;    // number of FCN calls in each phase
+
+  std::map<TString, Long64_t> cache_hits;   // numbers of lookups served from the caches
+  std::map<TString, Long64_t> cache_misses; // numbers of lookups that had to be evaluated
+
+  std::vector<TString> iter_phase;  // phase of each recorded iteration
+  std::vector<Long64_t> iter_ncalls; // number of FCN calls at each iteration
+  std::vector<Double_t> iter_fval;  // smallest FCN value at each iteration
+  std::vector<Double_t> iter_edm;   // estimated distance to minimum at each iteration
+  std::vector<Int_t> iter_status;   // Minuit's convergence flag at each iteration
+
+private:
+
+  Bool_t flux_timing;
+
+ClassDef(TCRFluxFitStats,1)
+  ;
+
+};
+
+#endif
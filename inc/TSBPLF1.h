@@ -0,0 +1,184 @@
+// Dmitri Ivanov <dmiivanov@gmail.com>
+
+//
+//  Smoothly broken power law functions with arbitrary number of break points.  Each break k
+//  has a width w_k in log10(E/eV) over which the power law index changes:
+//
+//  log10 J = log10(scalefactor x [0]) + [1] x (x - x0) + sum_k ([k+2] - [k+1]) x w_k x log10(1 + 10^((x - b_k) / w_k))
+//
+//  with x = log10(E/eV), x0 the lowest energy, the power law indices [1] .. [nbreaks+1], the break
+//  points b_k = [nbreaks+2+k] and the widths w_k = [2*nbreaks+2+k].  As the widths go to zero the function
+//  becomes the TBPLF1 function with the same parameters (a width that's not positive gives a sharp break).
+//  The function and its derivatives with respect to the parameters are evaluated natively, without a formula.
+//  Inherits from TSPECFITF1 class that customizes ROOT's TF1 for the purposes of fitting cosmic ray flux results.
+//
+
+#ifndef _TSBPLF1_h_
+#define _TSBPLF1_h_
+
+#include <vector>
+#include "TString.h"
+#include "TSPECFITF1.h"
+
+class TSBPLF1: public TSPECFITF1
+{
+public:
+
+  TSBPLF1() :
+      fSbplScaleFactor(1.0), fSbplType("J"), fSbplLog10enMin(18.0), fSbplTypeIndex(-1)
+  {
+    ;
+  }
+
+  TSBPLF1(const char *name,        // name of the class
+      Int_t nbreaks,               // number of break points
+      const char *ftype,           // understands J, E3J, EJ, J>, E2J>
+      Double_t scalefactor,        // scaling factor at the lowest energy
+      Double_t log10en_min,        // lowest energy  (log10(E/eV))
+      Double_t log10en_max,        // highest energy (log10(E/eV))
+      const TString *parnames,     // parameter names as an array of TString type objects
+      const Double_t *params,      // values (starting values) of the parameters
+      const Double_t *parerrors    // errors (starting step sizes) of the parameters
+      ) :
+      TSPECFITF1(name, sbpl_fcn, log10en_min, log10en_max, get_npar(nbreaks)), fSbplScaleFactor(scalefactor), fSbplType(ftype), fSbplLog10enMin(log10en_min),
+      fSbplTypeIndex(-1)
+  {
+    init(ftype);
+    if(parnames)
+      SetParNames(parnames);
+    if(params)
+      SetParameters(params);
+    if(parerrors)
+      SetParErrors(parerrors);
+  }
+
+  TSBPLF1(const char *name,         //
+      Int_t nbreaks,                //
+      const char *ftype = "J",      //
+      Double_t scalefactor = 1.0,   //
+      Double_t log10en_min = 18.0,  //
+      Double_t log10en_max = 21.0,  //
+      const char *csparnames = 0,   // comma-separated parameter names as a simple C-string
+      const Double_t *params = 0,   //
+      const Double_t *parerrors = 0 //
+      ) :
+      TSPECFITF1(name, sbpl_fcn, log10en_min, log10en_max, get_npar(nbreaks)), fSbplScaleFactor(scalefactor), fSbplType(ftype), fSbplLog10enMin(log10en_min),
+      fSbplTypeIndex(-1)
+  {
+    init(ftype);
+    if(csparnames)
+      SetParNamesCS(csparnames);
+    if(params)
+      SetParameters(params);
+    if(parerrors)
+      SetParErrors(parerrors);
+  }
+
+  TSBPLF1(const char *name,        //
+      Int_t nbreaks,               //
+      const char *ftype,           //
+      Double_t scalefactor,        //
+      Double_t log10en_min,        //
+      Double_t log10en_max,        //
+      const char *csparnames,      //
+      const char *csparams,        // comma - separated list of values (starting values) of the parameters as a single C string
+      const char *csparerrors      // comma - separated list of errors (starting step sizes) of the parameters as a single C string
+      ) :
+      TSPECFITF1(name, sbpl_fcn, log10en_min, log10en_max, get_npar(nbreaks)), fSbplScaleFactor(scalefactor), fSbplType(ftype), fSbplLog10enMin(log10en_min),
+      fSbplTypeIndex(-1)
+  {
+    init(ftype);
+    if(csparnames)
+      SetParNamesCS(csparnames);
+    if(csparams)
+      SetParametersCS(csparams);
+    if(csparerrors)
+      SetParErrorsCS(csparerrors);
+  }
+
+  // Translate all parameters of the current instance into a new function of a different type (E.G. E^3 x J, J>, etc)
+  TSBPLF1* NewTSBPLF1(const char *newname,  // name of the new (constructed) function
+      const char *ftype                     // understands J, E3J, EJ, J>, E2J>
+      ) const;
+
+  // get the number of break points depending on how many parameters there are in the function
+  Int_t GetNbreaks() const
+  {
+    return (GetNpar() - 2) / 3;
+  }
+
+  Double_t GetSbplScaleFactor() const
+  {
+    return fSbplScaleFactor;
+  }
+
+  // type of the function (J, E3J, EJ, J>, E2J>)
+  const char* GetSbplType() const
+  {
+    return fSbplType.Data();
+  }
+
+  // log10(E/eV) at which the power laws are referenced, it's the lowest energy of the function as constructed
+  Double_t GetSbplLog10enMin() const
+  {
+    return fSbplLog10enMin;
+  }
+
+  // J, E3J and EJ in closed form; J> and E2J> (integral flux above E) by Gauss-Legendre quadrature over
+  // the breaks and in closed form above the last break
+  virtual Double_t EvalPar(const Double_t *x, const Double_t *params = 0);
+
+  // analytic derivatives for J, E3J and EJ, numerical for J> and E2J>
+  virtual void EvalGradient(const Double_t *x, Double_t *grad, const Double_t *params = 0);
+  virtual Bool_t HasAnalyticGradient() const;
+
+  // formula that's equivalent to the function (J, E3J and EJ only, an empty string for the integral types),
+  // with the parameter numbers offset by n_offset
+  TString GetSbplFormula(Int_t n_offset = 0) const;
+
+  // To re-scale the function
+  void Scale(Double_t c)
+  {
+    fSbplScaleFactor *= c;
+  }
+
+private:
+
+  // set the type and the title
+  void init(const char *ftype);
+
+  // title according to the type of the function
+  void set_default_title(const char *ftype);
+
+  // type of the function as an index, -1 if not known
+  Int_t get_type();
+
+  // number of parameters for the number of break points
+  static Int_t get_npar(Int_t nbreaks)
+  {
+    return 3 * (nbreaks > 0 ? nbreaks : 0) + 2;
+  }
+
+  // placeholder for the TF1 function pointer, the evaluation is done by EvalPar
+  static Double_t sbpl_fcn(Double_t *x, Double_t *params);
+
+  // integral over log10(E/eV) from x to infinity of ln(10) x 10^(x-x0) x (J without the constant factors)
+  Double_t integrate_shape(Double_t x, const Double_t *params);
+
+  // scaling factor of the function
+  Double_t fSbplScaleFactor;
+
+  // type of the function and the energy at which the power laws are referenced
+  TString fSbplType;
+  Double_t fSbplLog10enMin;
+
+  Int_t fSbplTypeIndex;                 //! type of the function as an index, -1 if not yet known
+  std::vector<Double_t> fSbplNodes;     //! ends of the integration intervals
+  std::vector<Double_t> fSbplTerms;     //! softplus terms of the breaks at one point
+
+ClassDef(TSBPLF1,1)
+  ;
+
+};
+
+#endif
@@ -31,8 +31,9 @@ public:
       const Double_t *params,      // values (starting values) of the parameters
       const Double_t *parerrors    // errors (starting step sizes) of the parameters
       ) :
-      TF1(name, frm, log10en_min, log10en_max)
+      TF1()
   {
+    init_formula(name, frm, log10en_min, log10en_max);
     if(parnames)
       SetParNames(parnames);
     if(params)
@@ -49,8 +50,9 @@ public:
       const Double_t *params = 0,   //
       const Double_t *parerrors = 0 //
       ) :
-      TF1(name, frm, log10en_min, log10en_max)
+      TF1()
   {
+    init_formula(name, frm, log10en_min, log10en_max);
     if(csparnames)
       SetParNamesCS(csparnames);
     if(params)
@@ -66,8 +68,9 @@ public:
       const char *csparams,        // comma - separated list of values (starting values) of the parameters as a single C string
       const char *csparerrors      // comma - separated list of errors (starting step sizes) of the parameters as a single C string
       ) :
-      TF1(name, frm, log10en_min, log10en_max)
+      TF1()
   {
+    init_formula(name, frm, log10en_min, log10en_max);
     if(csparnames)
       SetParNamesCS(csparnames);
     if(csparams)
@@ -159,9 +162,66 @@ public:
   // Scale the function formula by a constant factor
   void Scale(Double_t c);
 
+  // Evaluate the function with its current parameters at n points x, out[i] = Eval(x[i]).  The parameters are bound
+  // once for all points and the vectorized formula evaluation is used if ROOT provides it and the function is vectorized;
+  // derived classes override it with native kernels.
+  virtual void EvalBatch(const Double_t *x, Double_t *out, size_t n);
+
+  // same for any TF1 function, using the TSPECFITF1 method if f is a TSPECFITF1 function
+  static void EvalBatch(TF1 *f, const Double_t *x, Double_t *out, size_t n);
+
+  // Derivatives of the function with respect to its parameters at x (grad has GetNpar() entries), for the parameters params
+  // or the current parameters.  Numerical (TF1::GradientPar) unless the derived class evaluates them analytically or the
+  // derivatives of the formula have been generated by GenerateGradient.
+  virtual void EvalGradient(const Double_t *x, Double_t *grad, const Double_t *params = 0);
+
+  // whether EvalGradient is analytic
+  virtual Bool_t HasAnalyticGradient() const;
+
+  // Generate the code for the derivatives of the formula with respect to the parameters (automatic differentiation
+  // of the formula by ROOT, available since ROOT 6.20 if ROOT has been built with clad).  Returns HasAnalyticGradient().
+  // Expressions that can't be differentiated are remembered for the rest of the process and not tried again.
+  virtual Bool_t GenerateGradient();
+
+  // same for any TF1 function, with the current parameters
+  static void EvalGradient(TF1 *f, const Double_t *x, Double_t *grad);
+  static Bool_t HasAnalyticGradient(const TF1 *f);
+  static Bool_t GenerateGradient(TF1 *f);
+
   // offset the parameters in the formula of the function by some integer value n_offset
+  // (for TCOMPOSITEF1 and TSBPLF1 functions, the equivalent formula)
   static TString GetExpFormula(const TF1 *f, Int_t n_offset);
 
+  // Compiled formulas are shared by all functions with the same expression: the first function with some expression
+  // compiles it into a prototype that is kept for the rest of the process, the other functions (also the ones made by
+  // Add, Multiply, Scale, MakeCopy and by the derived classes) copy the compiled prototype instead of compiling it again.
+  // Returns the prototype for the expression (parameters at their default values), zero if the expression isn't valid.
+  static const TF1* GetFormulaPrototype(const char *frm);
+
+  // number of cached expressions, numbers of lookups that were served from the cache and that had to be compiled
+  static Int_t GetFormulaCacheSize();
+  static Long64_t GetFormulaCacheHits();
+  static Long64_t GetFormulaCacheMisses();
+
+  // delete the cached prototypes (the functions that were made from them are not affected)
+  static void ClearFormulaCache();
+
+protected:
+
+  // for the derived classes that evaluate the function natively by overriding EvalPar, without a formula
+  TSPECFITF1(const char *name, Double_t (*fcn)(Double_t*, Double_t*), Double_t log10en_min, Double_t log10en_max, Int_t npar) :
+      TF1(name, fcn, log10en_min, log10en_max, npar)
+  {
+    ;
+  }
+
+private:
+
+  // set up the function with the formula from the cached prototype, name it and add it to ROOT's list of functions
+  void init_formula(const char *name, const char *frm, Double_t log10en_min, Double_t log10en_max);
+
+public:
+
 ClassDef(TSPECFITF1,1)
   ;
 
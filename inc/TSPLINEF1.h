@@ -0,0 +1,210 @@
+// Dmitri Ivanov <dmiivanov@gmail.com>
+
+//
+//  Model-independent flux function: log10 J is a cubic B-spline on knots that are equally spaced
+//  in log10(E/eV) between the lowest and the highest energies of the function,
+//
+//  log10 J = log10(scalefactor) + sum_j [j] x B_j(x)
+//
+//  with the coefficients [0] .. [ncoef-1] as the parameters (ncoef - 3 intervals between the knots).
+//  Below the lowest and above the highest energies log10 J continues linearly.  Each energy depends on
+//  4 neighboring coefficients only, and the roughness penalty
+//
+//  smoothing x sum_j ([j-1] - 2 [j] + [j+1])^2
+//
+//  (added to -2 ln(likelihood) by TCRFluxFit) couples 3 neighbors, so the Hessian of the fit is a band
+//  matrix that TCRFluxFit::FitSpline solves directly.  Inherits from TSPECFITF1 class that customizes
+//  ROOT's TF1 for the purposes of fitting cosmic ray flux results.
+//
+
+#ifndef _TSPLINEF1_h_
+#define _TSPLINEF1_h_
+
+#include <vector>
+#include "TString.h"
+#include "TSPECFITF1.h"
+
+class TSPLINEF1: public TSPECFITF1
+{
+public:
+
+  TSPLINEF1() :
+      fSplineScaleFactor(1.0), fSplineType("J"), fSplineLog10enMin(18.0), fSplineLog10enMax(21.0), fSplineSmoothing(1.0), fSplineTypeIndex(-1)
+  {
+    ;
+  }
+
+  TSPLINEF1(const char *name,      // name of the class
+      Int_t ncoef,                 // number of the spline coefficients (at least 4)
+      const char *ftype,           // understands J, E3J, EJ
+      Double_t scalefactor,        // scaling factor of the flux
+      Double_t log10en_min,        // lowest energy  (log10(E/eV)), the first knot
+      Double_t log10en_max,        // highest energy (log10(E/eV)), the last knot
+      const TString *parnames,     // parameter names as an array of TString type objects
+      const Double_t *params,      // values (starting values) of the parameters
+      const Double_t *parerrors    // errors (starting step sizes) of the parameters
+      ) :
+      TSPECFITF1(name, spline_fcn, log10en_min, log10en_max, get_npar(ncoef)), fSplineScaleFactor(scalefactor), fSplineType(ftype),
+	  fSplineLog10enMin(log10en_min), fSplineLog10enMax(log10en_max), fSplineSmoothing(1.0), fSplineTypeIndex(-1)
+  {
+    init(ftype);
+    if(parnames)
+      SetParNames(parnames);
+    if(params)
+      SetParameters(params);
+    if(parerrors)
+      SetParErrors(parerrors);
+  }
+
+  TSPLINEF1(const char *name,       //
+      Int_t ncoef,                  //
+      const char *ftype = "J",      //
+      Double_t scalefactor = 1.0,   //
+      Double_t log10en_min = 18.0,  //
+      Double_t log10en_max = 21.0,  //
+      const char *csparnames = 0,   // comma-separated parameter names as a simple C-string
+      const Double_t *params = 0,   //
+      const Double_t *parerrors = 0 //
+      ) :
+      TSPECFITF1(name, spline_fcn, log10en_min, log10en_max, get_npar(ncoef)), fSplineScaleFactor(scalefactor), fSplineType(ftype),
+	  fSplineLog10enMin(log10en_min), fSplineLog10enMax(log10en_max), fSplineSmoothing(1.0), fSplineTypeIndex(-1)
+  {
+    init(ftype);
+    if(csparnames)
+      SetParNamesCS(csparnames);
+    if(params)
+      SetParameters(params);
+    if(parerrors)
+      SetParErrors(parerrors);
+  }
+
+  TSPLINEF1(const char *name,      //
+      Int_t ncoef,                 //
+      const char *ftype,           //
+      Double_t scalefactor,        //
+      Double_t log10en_min,        //
+      Double_t log10en_max,        //
+      const char *csparnames,      //
+      const char *csparams,        // comma - separated list of values (starting values) of the parameters as a single C string
+      const char *csparerrors      // comma - separated list of errors (starting step sizes) of the parameters as a single C string
+      ) :
+      TSPECFITF1(name, spline_fcn, log10en_min, log10en_max, get_npar(ncoef)), fSplineScaleFactor(scalefactor), fSplineType(ftype),
+	  fSplineLog10enMin(log10en_min), fSplineLog10enMax(log10en_max), fSplineSmoothing(1.0), fSplineTypeIndex(-1)
+  {
+    init(ftype);
+    if(csparnames)
+      SetParNamesCS(csparnames);
+    if(csparams)
+      SetParametersCS(csparams);
+    if(csparerrors)
+      SetParErrorsCS(csparerrors);
+  }
+
+  // Translate all parameters of the current instance into a new function of a different type (E.G. E^3 x J)
+  TSPLINEF1* NewTSPLINEF1(const char *newname,  // name of the new (constructed) function
+      const char *ftype                         // understands J, E3J, EJ
+      ) const;
+
+  // number of the spline coefficients
+  Int_t GetNcoef() const
+  {
+    return GetNpar();
+  }
+
+  Double_t GetSplineScaleFactor() const
+  {
+    return fSplineScaleFactor;
+  }
+
+  // type of the function (J, E3J, EJ)
+  const char* GetSplineType() const
+  {
+    return fSplineType.Data();
+  }
+
+  // energies of the first and the last knots
+  Double_t GetSplineLog10enMin() const
+  {
+    return fSplineLog10enMin;
+  }
+  Double_t GetSplineLog10enMax() const
+  {
+    return fSplineLog10enMax;
+  }
+
+  // weight of the roughness penalty (1 by default)
+  void SetSmoothing(Double_t smoothing)
+  {
+    fSplineSmoothing = smoothing;
+  }
+  Double_t GetSmoothing() const
+  {
+    return fSplineSmoothing;
+  }
+
+  // log10 J - log10(scalefactor) = sum over k = 0 .. 3 of basis[k] x [first + k] at x (log10 J for the J type)
+  void GetBasis(Double_t x, Int_t &first, Double_t *basis) const;
+
+  virtual Double_t EvalPar(const Double_t *x, const Double_t *params = 0);
+
+  // derivatives with respect to the coefficients, only 4 of them are not zero
+  virtual void EvalGradient(const Double_t *x, Double_t *grad, const Double_t *params = 0);
+  virtual Bool_t HasAnalyticGradient() const
+  {
+    return true;
+  }
+
+  // roughness penalty for the parameters params or the current parameters
+  Double_t GetPenalty(const Double_t *params = 0) const;
+
+  // add the derivatives of the penalty with respect to the coefficients to grad
+  void AddPenaltyGradient(Double_t *grad, const Double_t *params = 0) const;
+
+  // add the Hessian of the penalty to a band matrix with m >= 2 sub-diagonals stored as in specfit_uti::band_cholesky_decompose
+  void AddPenaltyHessian(Int_t m, std::vector<Double_t> &h) const;
+
+  // To re-scale the function
+  void Scale(Double_t c)
+  {
+    fSplineScaleFactor *= c;
+  }
+
+private:
+
+  // set the type, the title and the parameter names
+  void init(const char *ftype);
+
+  // title according to the type of the function
+  void set_default_title(const char *ftype);
+
+  // type of the function as an index, -1 if not known
+  Int_t get_type();
+
+  // number of parameters for the number of coefficients
+  static Int_t get_npar(Int_t ncoef)
+  {
+    return (ncoef > 4 ? ncoef : 4);
+  }
+
+  // placeholder for the TF1 function pointer, the evaluation is done by EvalPar
+  static Double_t spline_fcn(Double_t *x, Double_t *params);
+
+  // scaling factor of the function
+  Double_t fSplineScaleFactor;
+
+  // type of the function and the energies of the first and the last knots
+  TString fSplineType;
+  Double_t fSplineLog10enMin;
+  Double_t fSplineLog10enMax;
+
+  // weight of the roughness penalty
+  Double_t fSplineSmoothing;
+
+  Int_t fSplineTypeIndex; //! type of the function as an index, -1 if not yet known
+
+ClassDef(TSPLINEF1,1)
+  ;
+
+};
+
+#endif
@@ -7,9 +7,18 @@
 
 #include "TCRFlux.h"
 #include "TCRFluxFit.h"
+#include "TCRFluxFitStats.h"
 #include "TSPECFITF1.h"
 #include "TBPLF1.h"
+#include "TSBPLF1.h"
+#include "TSPLINEF1.h"
+#include "TCOMPOSITEF1.h"
 #include "specfit_uti.h"
 #include "specfit_canv.h"
+#include "specfit_trace.h"
+#include "specfit_min.h"
+#include "specfit_irls.h"
+#include "specfit_mcmc.h"
+#include "specfit_nested.h"
 
 #endif
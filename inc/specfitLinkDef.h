@@ -7,9 +7,22 @@ using namespace std;
 #pragma link off all functions;
 #pragma link C++ class TCRFlux;
 #pragma link C++ class TCRFluxFit;
+#pragma link C++ class TCRFluxFitStats;
 #pragma link C++ class TSPECFITF1;
 #pragma link C++ class TBPLF1;
+// TBPLF1 of version 1 has neither the type nor the reference energy, version 2 doesn't have the factor of the formula
+#pragma read sourceClass="TBPLF1" targetClass="TBPLF1" version="[1]" source="" target="fBplType,fBplLog10enMin,fBplFormulaFactor" code="{ newObj->RestoreFromFormula(false); }"
+#pragma read sourceClass="TBPLF1" targetClass="TBPLF1" version="[2]" source="" target="fBplFormulaFactor" code="{ newObj->RestoreFromFormula(true); }"
+#pragma link C++ class TSBPLF1;
+#pragma link C++ class TSPLINEF1;
+#pragma link C++ class TCOMPOSITEF1;
 #pragma link C++ namespace specfit_uti;
 #pragma link C++ namespace specfit_canv;
+#pragma link C++ namespace specfit_trace;
+#pragma link C++ class specfit_trace::scope;
+#pragma link C++ namespace specfit_min;
+#pragma link C++ namespace specfit_irls;
+#pragma link C++ namespace specfit_mcmc;
+#pragma link C++ namespace specfit_nested;
 
 #endif
@@ -0,0 +1,38 @@
+// Dmitri Ivanov <dmiivanov@gmail.com>
+
+// Poisson GLM of the TBPLF1 J function for fixed break positions, solved by iteratively reweighted
+// least squares.  Used by TCRFluxFit to profile the normalization, the power law indices and the
+// exposure scales (see TCRFluxFit::SetIRLS) and to evaluate the grid of TCRFluxFit::GridSearchBreaks.
+
+#ifndef _specfit_irls_h_
+#define _specfit_irls_h_
+
+#include <vector>
+#include "TObject.h"
+
+namespace specfit_irls
+{
+  // fitted bins and the coefficients that are solved for
+  struct problem
+  {
+    Int_t nbreaks;                    // number of break points
+    Double_t log10scale;              // log10 of the scale factor of the function
+    Double_t log10en_ref;             // log10(E/eV) at which the power laws are referenced
+    const std::vector<Double_t> *x;   // corrected log10(E/eV) of the fitted bins
+    const std::vector<Double_t> *acc; // acceptances of the fitted bins
+    const std::vector<Double_t> *n;   // numbers of events in the fitted bins
+    const std::vector<Int_t> *col;    // coefficient of the exposure scale of each bin, -1 if it's not profiled
+    std::vector<Bool_t> profiled;     // which coefficients are solved for, the others are kept as they are
+  };
+
+  // The TBPLF1 J function is c * scalefactor * 10^(p1 (min(x,b1)-x0) + p2 (clip(x,b1,b2)-b1) + ... + pK+1 (max(x,bK)-bK)),
+  // so for fixed breaks b the expected number of events in bin i is mu_i = acc_i * 10^(log10(scalefactor) + z_i.theta) with
+  // theta = (log10(c), p1, ..., pK+1, log10 of the profiled exposure scales).  Newton's method on the deviance D:
+  // g = ln10 Z^T (mu - n), H = ln10^2 Z^T diag(mu) Z, theta -> theta - H^-1 g, with step halving if D doesn't decrease.
+  // H^-1 is the covariance matrix of the coefficients for fixed breaks.  Starts from theta and replaces it with the solution,
+  // returns the deviance or -1 if the solution can't be found.  Doesn't modify any shared state and can be called from
+  // several threads.
+  Double_t solve(const problem &p, const Double_t *breaks, std::vector<Double_t> &theta, std::vector<Double_t> *cov = 0);
+}
+
+#endif
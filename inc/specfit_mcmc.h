@@ -0,0 +1,44 @@
+// Dmitri Ivanov <dmiivanov@gmail.com>
+
+// Markov chain Monte Carlo sampling of a probability density of a few tens of variables, used by
+// TCRFluxFit::SampleMCMC for the posterior distributions of the fit parameters, and the diagnostics
+// of the convergence of the chains.  The densities of many points are requested at once, so that
+// the caller can evaluate them in parallel.
+
+#ifndef _specfit_mcmc_h_
+#define _specfit_mcmc_h_
+
+#include <vector>
+#include "TObject.h"
+
+class TRandom;
+
+namespace specfit_mcmc
+{
+  // log densities of npoints points x (n values per point) into logp, -TMath::Infinity() where the density is zero
+  typedef void (*log_density)(Int_t npoints, const Double_t *x, Double_t *logp, void *arg);
+
+  // called after each step with the positions (n values per walker) and the log densities of the walkers,
+  // the sampling stops if it returns false
+  typedef Bool_t (*monitor)(Int_t istep, Int_t nwalkers, const Double_t *x, const Double_t *logp, void *arg);
+
+  // Affine-invariant ensemble sampler (Goodman and Weare) with the stretch move of scale a: the walkers are split into
+  // two halves and each walker of a half moves along the line to a random walker of the other half, so the log densities
+  // of a half are evaluated by one call of fcn.  x has the starting positions of the nwalkers walkers (an even number of
+  // at least 2 n + 2, with finite densities) on input and their last positions on output, logp their log densities.
+  // The positions after each step are appended to chain (n values per walker per step) if it's given.  Returns the
+  // fraction of the accepted moves.
+  Double_t ensemble(Int_t n, log_density fcn, void *arg, Int_t nwalkers, Double_t *x, Double_t *logp, Int_t nsteps, TRandom *rnd,
+      std::vector<Double_t> *chain = 0, monitor mon = 0, Double_t a = 2.0);
+
+  // integrated autocorrelation time in steps of the variable i of the chain (n values per walker per step, nsteps steps of
+  // nwalkers walkers) from the step first_step on: the autocorrelation function is averaged over the walkers and summed
+  // within the window of Sokal, 5 times the time
+  Double_t autocorrelation_time(Int_t n, Int_t nwalkers, Int_t nsteps, const Double_t *chain, Int_t i, Int_t first_step = 0);
+
+  // potential scale reduction factor (Gelman and Rubin) of the variable i with the walkers as the chains, close to 1 when
+  // the walkers have converged to the same distribution
+  Double_t gelman_rubin(Int_t n, Int_t nwalkers, Int_t nsteps, const Double_t *chain, Int_t i, Int_t first_step = 0);
+}
+
+#endif
@@ -0,0 +1,41 @@
+// Dmitri Ivanov <dmiivanov@gmail.com>
+
+// Minimizers of smooth functions of a few tens of parameters with simple bounds, used by TCRFluxFit
+// as alternatives to Minuit's Migrad (see TCRFluxFit::SetMinimizer).  The function is minimized
+// over the variables whose lower bound is below the upper bound (-TMath::Infinity() and
+// TMath::Infinity() for no bound), the variables with equal bounds are kept at their values.
+// The convergence is declared, as in Migrad, when the estimated distance to the minimum,
+// 1/2 g^T H^-1 g over the variables that are not held at their bounds, falls below edm_max.
+//
+// Return codes: 0 converged, 1 maximum number of iterations reached, 2 no further decrease
+// of the function could be found, 3 the function isn't finite at the starting point.
+
+#ifndef _specfit_min_h_
+#define _specfit_min_h_
+
+#include "TObject.h"
+
+namespace specfit_min
+{
+  // function to minimize: returns the value at x and puts the derivatives into grad (n entries)
+  typedef Double_t (*objective)(const Double_t *x, Double_t *grad, void *arg);
+
+  // called after each iteration with the function value and the estimated distance to the minimum
+  typedef void (*monitor)(Int_t iteration, Double_t fval, Double_t edm, void *arg);
+
+  // Limited-memory BFGS with bounds: the quasi-Newton direction from the last m steps over the free variables
+  // (the ones that aren't held at their bounds by the gradient) and a backtracking line search along the
+  // projection of the direction onto the bounds.  One function and gradient evaluation per iteration, mostly.
+  // x has the starting values on input and the solution on output.
+  Int_t lbfgsb(Int_t n, objective fcn, void *arg, Double_t *x, const Double_t *xmin, const Double_t *xmax, Int_t *niter = 0,
+      Double_t *fval = 0, Int_t maxiter = 1000, Double_t edm_max = 2e-4, Int_t m = 10, monitor mon = 0);
+
+  // Trust-region Newton method: the Hessian is obtained from the differences of the gradients (n additional
+  // gradient evaluations per iteration), the step minimizes the quadratic model within the trust region over
+  // the free variables and is projected onto the bounds.  Fewer iterations than lbfgsb for strongly
+  // correlated parameters.
+  Int_t trust_region(Int_t n, objective fcn, void *arg, Double_t *x, const Double_t *xmin, const Double_t *xmax, Int_t *niter = 0,
+      Double_t *fval = 0, Int_t maxiter = 200, Double_t edm_max = 2e-4, monitor mon = 0);
+}
+
+#endif
@@ -0,0 +1,39 @@
+// Dmitri Ivanov <dmiivanov@gmail.com>
+
+// Nested sampling (Skilling) of the evidence, the integral of the likelihood over the prior, used by
+// TCRFluxFit::ComputeEvidence for the Bayesian comparison of the flux models.  The prior is the uniform
+// distribution in the unit hypercube, which the caller maps onto the parameters.  The likelihoods of
+// many points are requested at once, so that the caller can evaluate them in parallel.
+
+#ifndef _specfit_nested_h_
+#define _specfit_nested_h_
+
+#include <vector>
+#include "TObject.h"
+
+class TRandom;
+
+namespace specfit_nested
+{
+  // log likelihoods of npoints points u of the unit hypercube (n values per point) into logl
+  typedef void (*log_likelihood)(Int_t npoints, const Double_t *u, Double_t *logl, void *arg);
+
+  // called after each iteration with the current estimates of the log evidence and of the log of the remaining prior volume
+  typedef void (*monitor)(Int_t iteration, Double_t logz, Double_t logx, Double_t logl_min, void *arg);
+
+  // Nested sampling with nlive live points: at each iteration the nreplace live points of the lowest likelihoods are
+  // removed together (the prior volume shrinks by the factors of the order statistics, e^(-1/nlive), e^(-1/(nlive-1)), ..)
+  // and replaced by points of higher likelihoods, found by nreplace random walks of nwalk steps that start from the
+  // remaining live points and are evaluated by one call of fcn per step.  The steps are Gaussian with the widths of the
+  // live points scaled to keep about half of the steps accepted.  The sampling stops when the largest likelihood of the
+  // live points times the remaining prior volume would change the log evidence by less than dlogz, then the live points
+  // are added.  Puts the log evidence, its error sqrt(h / nlive) and the information h (nats) into logz, logz_error and h.
+  // The removed and the final live points (n values per point) and their log weights, log(likelihood x prior volume),
+  // are appended to samples and log_weights if they are given (posterior weights are exp(log_weights - logz)).
+  // Returns the number of iterations, -1 if the sampling couldn't start.
+  Int_t run(Int_t n, log_likelihood fcn, void *arg, Int_t nlive, TRandom *rnd, Double_t &logz, Double_t &logz_error, Double_t &h, Int_t nreplace = 1,
+      Int_t nwalk = 25, Double_t dlogz = 0.1, Int_t maxiter = 1000000, std::vector<Double_t> *samples = 0, std::vector<Double_t> *log_weights = 0,
+      monitor mon = 0);
+}
+
+#endif
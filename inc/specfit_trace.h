@@ -0,0 +1,94 @@
+// Dmitri Ivanov <dmiivanov@gmail.com>
+
+// Opt-in timeline tracing of the specfit pipeline (loading, energy range selection, formula compilation,
+// fitting, null hypothesis evaluation, graphs, saving plots).  The events are recorded in memory and
+// written in the Chrome trace-event JSON format, which can be viewed with chrome://tracing or
+// https://ui.perfetto.dev.  Each thread gets its own lane.  When tracing is disabled a traced scope
+// costs one check of a flag.
+
+#ifndef _specfit_trace_h_
+#define _specfit_trace_h_
+
+#include "TObject.h"
+#include "TString.h"
+#if __cplusplus >= 201103L
+#include <atomic>
+#endif
+
+namespace specfit_trace
+{
+  // start recording the events, they will be written into the JSON file
+  // when Write() or Disable() is called
+  void Enable(const char *json_file = "specfit_trace.json");
+
+  // stop recording the events and write them into the JSON file
+  Bool_t Disable();
+
+  // whether the events are being recorded
+  Bool_t IsEnabled();
+
+  // write the events recorded so far into the JSON file, by default into the
+  // file that was given to Enable()
+  Bool_t Write(const char *json_file = 0);
+
+  // discard the events recorded so far
+  void Clear();
+
+  // name the lane of the calling thread in the timeline (the thread that enables the tracing is called "main")
+  void SetThreadName(const char *thread_name);
+
+  // begin and end an event on the lane of the calling thread; events can be nested
+  // and must be ended in the reverse order (mainly for Python and ROOT macros, C++ code uses SPECFIT_TRACE)
+  void Begin(const char *name, const char *category = "specfit");
+  void End();
+
+  // time in microseconds since the tracing was enabled
+  Double_t get_time_us();
+
+  // record a completed event that started at ts_us and lasted dur_us microseconds
+  void add_event(const char *name, const char *category, Double_t ts_us, Double_t dur_us);
+
+  // flag that is checked by the traced scopes, use IsEnabled() to query it; it's atomic since the threads that
+  // evaluate the FCN read it while the main thread may switch the tracing
+#if __cplusplus >= 201103L
+  extern std::atomic<bool> enabled;
+  inline Bool_t is_on()
+  {
+    return enabled.load(std::memory_order_relaxed);
+  }
+#else
+  extern Bool_t enabled;
+  inline Bool_t is_on()
+  {
+    return enabled;
+  }
+#endif
+
+  // records an event that lasts for the lifetime of the object
+  class scope
+  {
+  public:
+    scope(const char *name, const char *category = "specfit") :
+	fName(name), fCategory(category), fStart(-1)
+    {
+      if(is_on())
+	fStart = get_time_us();
+    }
+    ~scope()
+    {
+      if(fStart >= 0 && is_on())
+	add_event(fName, fCategory, fStart, get_time_us() - fStart);
+    }
+  private:
+    const char *fName;
+    const char *fCategory;
+    Double_t fStart;
+  };
+}
+
+// to trace the rest of the enclosing C++ block: SPECFIT_TRACE("Fit", "fit");
+#define SPECFIT_TRACE_CONCAT_(a, b) a##b
+#define SPECFIT_TRACE_CONCAT(a, b) SPECFIT_TRACE_CONCAT_(a, b)
+#define SPECFIT_TRACE(...) specfit_trace::scope SPECFIT_TRACE_CONCAT(specfit_trace_scope_, __LINE__)(__VA_ARGS__)
+
+#endif
@@ -7,6 +7,7 @@
 #include "TF1.h"
 #include "TGraphErrors.h"
 #include <algorithm>
+#include <vector>
 
 namespace specfit_uti
 {
@@ -29,12 +30,21 @@ namespace specfit_uti
   // from the chance probability
   Double_t pchance2sigma(Double_t pchance, Bool_t pwarning = true);
 
+  // significance in sigma units from the natural log of the chance probability, for probabilities that are too small
+  // for a Double_t; a zero probability (-TMath::Infinity()) gives max_sigma
+  Double_t log_pchance2sigma(Double_t log_pchance, Double_t max_sigma = 100.0);
+
   // express chance probability in sigma units
   Double_t Sigma2Pchance(Double_t pchange_in_sigma);
 
   // get the chance probability of a Poisson fluctuation
   Double_t PoissonPchance(Int_t nobserved, Double_t nexpected, Bool_t in_sigma_units = true);
 
+  // same as PoissonPchance but from the regularized incomplete gamma functions, which takes the same time
+  // for any number of events; for scanning many windows (no warnings).  The significance of the chance probabilities
+  // that underflow is from the log of the leading term of the tail, and an excess over zero expected events is 100 sigma
+  Double_t PoissonPchanceFast(Int_t nobserved, Double_t nexpected, Bool_t in_sigma_units = true);
+
   // to obtain E^{3}J function from J if J was constructed using formula
   TF1* get_e3j_from_j(TF1 *f_J);
 
@@ -47,6 +57,34 @@ namespace specfit_uti
    // Ratio of the fluxes using binning
    TGraphErrors* FluxRatio_Energy_Bins(const TGraphErrors* flux1, const TGraphErrors* flux2, Int_t nbins, Double_t log10en_lo, Double_t log10en_up, Bool_t ok_to_extrapolate = false);
 
+   // Cholesky decomposition A = L L^T of a symmetric positive definite n x n matrix stored row by row;
+   // L replaces the lower triangle of a, returns false if the matrix is not positive definite
+   Bool_t cholesky_decompose(Int_t n, std::vector<Double_t> &a);
+
+   // solve A x = b using the Cholesky decomposition of A, b is replaced by x
+   void cholesky_solve(Int_t n, const std::vector<Double_t> &l, std::vector<Double_t> &b);
+
+   // inverse of A using its Cholesky decomposition
+   void cholesky_invert(Int_t n, const std::vector<Double_t> &l, std::vector<Double_t> &a_inv);
+
+   // Same for a symmetric positive definite band matrix with m sub-diagonals, stored row by row as the lower band:
+   // A(i,j) for j = i - m, ..., i is a[i * (m + 1) + m - (i - j)] (the entries with j < 0 are not used).  The decomposition
+   // takes n (m + 1)^2 operations instead of n^3 / 3; L replaces a, returns false if the matrix is not positive definite
+   Bool_t band_cholesky_decompose(Int_t n, Int_t m, std::vector<Double_t> &a);
+
+   // solve A x = b using the band Cholesky decomposition of A, b is replaced by x
+   void band_cholesky_solve(Int_t n, Int_t m, const std::vector<Double_t> &l, std::vector<Double_t> &b);
+
+   // diagonal of the inverse of A using its band Cholesky decomposition
+   void band_cholesky_invert_diagonal(Int_t n, Int_t m, const std::vector<Double_t> &l, std::vector<Double_t> &a_inv_diag);
+
+   // call fun(i, arg) for i = 0, ..., n - 1 using nthreads threads (0: as many as the hardware supports);
+   // fun must be thread safe.  Runs in the calling thread if the library is built without C++11 threads.
+   void parallel_for(Int_t n, void (*fun)(Int_t i, void *arg), void *arg, Int_t nthreads = 0);
+
+   // number of threads that parallel_for would use
+   Int_t get_nthreads(Int_t nthreads = 0);
+
 
 }
 #endif
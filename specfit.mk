@@ -57,7 +57,7 @@ specfit_so              = $(SPECFITLIBDIR)/libspecfit$(SO)
 # what objects to link
 specfit_so_header_list  = specfit specfitLinkDef
 # list of all shared library sources (without suffixes)
-specfit_so_source_list  = TCRFlux TCRFluxFit TSPECFITF1 TBPLF1 specfit_uti specfit_canv
+specfit_so_source_list  = TCRFlux TCRFluxFit TCRFluxFitGrid TCRFluxFitMultiStart TCRFluxFitMCMC TCRFluxFitNested TCRFluxFitStats TSPECFITF1 TBPLF1 TSBPLF1 TSPLINEF1 TCOMPOSITEF1 specfit_uti specfit_canv specfit_trace specfit_min specfit_irls specfit_mcmc specfit_nested
 # construction of headers with full paths
 specfit_so_headers      = $(addsuffix .h, $(addprefix $(SPECFITINCDIR)/, $(specfit_so_header_list)))
 # construction of all object files with full paths
@@ -67,11 +67,20 @@ specfit_so_objects     += $(SPECFITTMPDIR)/libspecfitDict$(OBJ)
 
 htmldoc=$(SPECFIT)/htmldoc
 
+# benchmark executable (not built by default, use 'make bench')
+SPECFITBINDIR=$(SPECFIT)/bin
+specfit_bench           = $(SPECFITBINDIR)/specfit_bench$(EXE)
+specfit_bins            = $(specfit_bench)
+
 #################### TARGETS ###################
-.PHONY: all htmldoc clean cleanall
+.PHONY: all htmldoc bench clean cleanall
 all: $(specfit_so)
 htmldoc: $(htmldoc)
 
+# build and run the benchmarks, results go to bench.json
+bench: $(specfit_bench) ; \
+$(specfit_bench) -o $(SPECFIT)/bench.json
+
 $(specfit_so): $(specfit_so_objects); \
 $(CPP) $(OPTOPT) -shared $^ $(ROOTLIBS) -o $@; \
 find $(SPECFITTMPDIR) -name "*.pcm" -exec cp {} $(SPECFITLIBDIR)/. \;
@@ -79,6 +88,10 @@ find $(SPECFITTMPDIR) -name "*.pcm" -exec cp {} $(SPECFITLIBDIR)/. \;
 $(htmldoc): $(SPECFIT)/generate_specfit_htmldoc.C $(specfit_so) ; \
 root -l -b -q $(SPECFIT) $(<F) >& /dev/null
 
+$(specfit_bench): $(SPECFIT)/bench/specfit_bench.cxx $(specfit_so) ; \
+mkdir -p $(SPECFITBINDIR) && \
+$(CPP) $(CPPFLAGS) $(INCS) $< -o $@ -L$(SPECFITLIBDIR) -lspecfit $(ROOTLIBS) -Wl,-rpath,$(SPECFITLIBDIR)
+
 # dictionary generation
 $(SPECFITTMPDIR)/libspecfitDict.cxx: $(specfit_so_headers) ; \
 rootcint -f $@ $(ROOTCINTFLAGS) $(INCS) $(<F) $(filter %LinkDef.h, $^)
@@ -37,7 +37,7 @@ import ROOT;  ROOT.PyConfig.IgnoreCommandLineOptions = True
 # variable for the main directory to the directory where this script was found
 if(not os.environ.get("SPECFIT")):
     os.environ["SPECFIT"] = os.path.dirname(os.path.abspath(__file__))
-from specfit_cpplib import TCRFluxFit, TCRFlux, TSPECFITF1, specfit_uti, specfit_canv
+from specfit_cpplib import TCRFluxFit, TCRFlux, TSPECFITF1, TBPLF1, TCOMPOSITEF1, specfit_uti, specfit_canv, specfit_trace
 from flux_functions import FLUX_FUNCTIONS
 from encorr_functions import CONSTANT_ENCORR_FUNCTIONS, NONLINEAR_ENCORR_FUNCTIONS
 
@@ -75,7 +75,7 @@ spectrum_list = []
 # as shown below.
 def SetEncorrFunctions(constant_encorr_function,nonlinear_encorr_function):
     '''apply the energy scale correction functions to the simulated fluxes'''
-    encorr_function = TSPECFITF1.Add("fENCORR","1.0",constant_encorr_function, nonlinear_encorr_function,1.0,1.0)
+    encorr_function = TCOMPOSITEF1.Sum("fENCORR",1.0,constant_encorr_function, nonlinear_encorr_function,1.0,1.0)
     for _,data in AvailableSpectrumData.items():
         data[2] = encorr_function
 
@@ -203,8 +203,46 @@ parser.add_argument("-q", action = "store_true", dest="quit_after_finishing",hel
 parser.add_argument("-s", action = "store", dest="basename", default = None, \
                         help = "Save plots, provide \'some_basename_\'; use \'{:s}_\' to substitute date_time_ for some_basename_"\
                         .format("%"+_dt_tok_))
+parser.add_argument("-profile_norm", action = "store_true", dest="profile_norm", \
+                        help = "Profile the normalization of the flux function analytically instead of minimizing over it with Migrad")
+parser.add_argument("-irls", action = "store_true", dest="irls", \
+                        help = "Fit the normalization and the power law indices of a broken power law (J) by IRLS for each set of break positions, Migrad minimizes over the breaks")
+parser.add_argument("-minimizer", action = "store", dest="minimizer", default = "MIGRAD", choices = ["MIGRAD", "LBFGSB", "TRUST"], \
+                        help = "Minimizer of the fit: Minuit's Migrad, L-BFGS-B or trust-region Newton with the parameter limits, the latter two followed by Minuit's HESSE, (Default:  %(default)s)")
+parser.add_argument("-fd_threads", action = "store", type=int, dest="fd_threads", default = 1, \
+                        help = "Evaluate the numerical derivatives of the fit (gradient and Hessian) with this many threads (0: all), when there are no analytic derivatives, (Default:  %(default)s)")
+parser.add_argument("-formula_gradient", action = "store_true", dest="formula_gradient", \
+                        help = "Differentiate the formulas of the fit functions (ROOT 6.20 and above, built with clad) and give Minuit the derivatives of the log likelihood")
+parser.add_argument("-fisher", action = "store_true", dest="fisher", \
+                        help = "Errors of the fit from the Fisher information instead of Minuit's HESSE, and the break energies in EeV with their errors")
+parser.add_argument("-forecast", action = "store", type=float, dest="forecast", default = None, \
+                        help = "Expected errors of the fit parameters (and the expected significance of the shoulder feature) on the Asimov dataset of the fitted model with the exposure multiplied by this factor")
+parser.add_argument("-mcmc", action = "store", type=int, dest="mcmc_nsteps", default = None, \
+                        help = "Sample the posterior distribution of the fit parameters with this many steps of the ensemble MCMC sampler after the fit (the first quarter is the burn-in)")
+parser.add_argument("-mcmc_samples", action = "store", dest="mcmc_samples", default = None, \
+                        help = "Text file for the MCMC samples, if -mcmc is used")
+parser.add_argument("-evidence", action = "store", type=int, dest="evidence_nlive", default = None, \
+                        help = "After the fit, compute the Bayesian evidence by nested sampling with this many live points for each flux function that starts at the same energy as the chosen one and print the log Bayes factors")
+parser.add_argument("-resolution", action = "store", type=float, dest="resolution", default = None, \
+                        help = "Fold the fit predictions with a Gaussian energy resolution of this standard deviation in log10(E/eV)")
+parser.add_argument("-grid", action = "store", type=int, dest="grid_npts", default = None, \
+                        help = "Search for the best break positions on a grid with this many points per break (evaluated in parallel), then polish the best ones with full fits")
+parser.add_argument("-multistart", action = "store", type=int, dest="multistart", default = None, \
+                        help = "Run this many fits concurrently from Latin hypercube starting points within the parameter limits and report the distinct minima")
+parser.add_argument("-compare", action = "store", type=int, dest="compare_kmax", default = None, \
+                        help = "Before the fit, compare broken power law models with 0 up to this many breaks (-2lnL, AIC, BIC, Wilks p-values)")
+parser.add_argument("-scan_null", action = "store", type=int, dest="scan_null_nbins", default = None, \
+                        help = "Also scan the null hypothesis over all energy windows on a grid with this many bins and report the most significant excess")
+parser.add_argument("-stats", action = "store", dest="stats_file", default = None, \
+                        help = "Write the performance counters of the fit (FCN calls, timing, cache hit rates, EDM per iteration) into a JSON file")
+parser.add_argument("-trace", action = "store", dest="trace_file", default = None, \
+                        help = "Record the timeline of the run (loading, fitting, plotting, ...) into a JSON file in Chrome trace-event format")
 args = parser.parse_args()
 
+# timeline tracing, if requested
+if args.trace_file:
+    specfit_trace.Enable(args.trace_file)
+
 
 if args.logEshld_fixed != None:
     if(len(args.logEshld_fixed) > 0):
@@ -283,6 +321,16 @@ if logEshld_fixed != None:
 
 
 Fit.SetFluxFun(flux_function)
+if args.profile_norm:
+    Fit.SetProfiledNorm(0)
+if args.irls:
+    Fit.SetIRLS(True)
+Fit.SetMinimizer(args.minimizer)
+Fit.SetParallelDerivatives(args.fd_threads)
+Fit.SetFisherErrors(args.fisher)
+Fit.SetFormulaGradient(args.formula_gradient)
+if args.stats_file:
+    Fit.GetStats().SetFluxTiming()
 for key,data in SpectrumFitData.items():
     name=key
     obj,title,fEnCorr=data
@@ -295,10 +343,63 @@ for key,data in SpectrumFitData.items():
 # set the energy range and do the fit
 Fit.SelectEnergyRange(float(args.log10en_min),float(args.log10en_max))
 
+# energy resolution of the measurements, if requested
+if args.resolution:
+    for iflux in range(Fit.GetNfluxes()):
+        Fit.GetFlux(iflux).SetGaussianResponse(args.resolution)
+
 # do the fit and if it's successful, calculate statistical significance of the shoulder effect,
 # and plot the results
 globals()["__n_specfit_plots__"] = int(0)
-if Fit.Fit():
+if args.compare_kmax is not None:
+    Fit.CompareBreakModels(args.compare_kmax)
+if args.grid_npts:
+    fit_ok = Fit.GridSearchBreaks(args.grid_npts)
+elif args.multistart:
+    fit_ok = Fit.MultiStart(args.multistart) > 0
+else:
+    fit_ok = Fit.Fit()
+if fit_ok:
+    # performance counters and statistics of the fit, if requested
+    if args.stats_file:
+        Fit.GetStats().DumpJSON(args.stats_file)
+
+    # expected errors of the fit parameters for the exposure multiplied by the factor, if requested; the shoulder
+    # functions are forecast below, after the shoulder is found, together with the test against the null model
+    if args.forecast and flux_function.GetName() not in ["fJ3B_18", "fJ2B_19"]:
+        Fit.SetAsimovData(args.forecast)
+        Fit.Forecast()
+        Fit.RestoreData()
+
+    # posterior distributions of the fit parameters, if requested
+    if args.mcmc_nsteps:
+        Fit.SampleMCMC(args.mcmc_nsteps,args.mcmc_nsteps//4,0,0,args.mcmc_samples)
+
+    # Bayesian evidences of the flux functions that describe the same energy range, if requested
+    if args.evidence_nlive:
+        evidences=[]
+        for f in FLUX_FUNCTIONS.values():
+            if f.GetXmin() != flux_function.GetXmin():
+                continue
+            Fit.SetFluxFun(f)
+            if Fit.Fit(False) and Fit.ComputeEvidence(args.evidence_nlive,0,10.0,0.1,4357,False):
+                evidences.append((f.GetName(),Fit.evidence_logz,Fit.evidence_logz_error,Fit.chi2))
+        Fit.SetFluxFun(flux_function)
+        Fit.Fit(False)
+        if evidences:
+            logz_best=max([e[1] for e in evidences])
+            sys.stdout.write("{:<12s} {:>12s} {:>10s} {:>12s} {:>12s}\n".format("function","log Z","error","-2lnL","ln B"))
+            for name,logz,logz_error,chi2 in sorted(evidences,key=lambda e: -e[1]):
+                sys.stdout.write("{:<12s} {:12.4f} {:10.4f} {:12.4f} {:12.4f}\n".format(name,logz,logz_error,chi2,logz-logz_best))
+            sys.stdout.flush()
+
+    # break energies in EeV and their errors by the delta method, if requested
+    if args.fisher and hasattr(Fit.fJ, "GetNbreaks"):
+        for ibreak in range(Fit.fJ.GetNbreaks()):
+            error = np.zeros(1)
+            energy = Fit.GetBreakEnergyEeV(ibreak, error)
+            sys.stdout.write("break {:d}: {:.3f} +/- {:.3f} EeV\n".format(ibreak, energy, error[0]))
+
     # do the statistical significance calculation for the shoulder feature at ~19.1
     # Null hypothesis means no shoulder feature.  Calculate how many events one would expect,
     # in the ansence of the feature, and then compare with the number of events observed
@@ -321,7 +422,29 @@ if Fit.Fit():
             format(logEshld,logEgzk,x.first,x.second,pch,pch_sigma)
         sys.stdout.write(result+"\n")
         sys.stdout.flush()
-
+        # median expected significance of the shoulder for the exposure multiplied by the factor
+        if args.forecast:
+            # null model: the broken power law without the shoulder break and the power law index after it
+            nb=flux_function.GetNbreaks()
+            ishld=flux_function.GetParNumber("logEshld")
+            keep=[i for i in range(flux_function.GetNpar()) if i not in [ishld, ishld-nb]]
+            fJ_null_model=TBPLF1("fJ_null_model",nb-1,"J",flux_function.GetBplScaleFactor(),flux_function.GetBplLog10enMin(),\
+                                     flux_function.GetXmax(),",".join([flux_function.GetParName(i) for i in keep]),\
+                                     ",".join([repr(flux_function.GetParameter(i)) for i in keep]),\
+                                     ",".join([repr(max(flux_function.GetParError(i),0.01)) for i in keep]))
+            Fit.SetAsimovData(args.forecast)
+            Fit.Forecast(fJ_null_model)
+            Fit.RestoreData()
+        if args.scan_null_nbins:
+            hScanNull=Fit.ScanNull(args.scan_null_nbins)
+            if hScanNull:
+                result="most significant window ({:.2f} - {:.2f}) n_expect: {:.3f} n_observe: {:.0f} ({:.1f} sigma)".\
+                    format(Fit.scan_null_max_lo,Fit.scan_null_max_hi,Fit.scan_null_max_nexpected,Fit.scan_null_max_nobserved,\
+                               Fit.scan_null_max_sigma)
+                sys.stdout.write(result+"\n")
+                sys.stdout.flush()
+
+    specfit_trace.Begin("plots","plot")
     # Show 3 types of plots for EACH individual spectrum measurement
     plot_type=["nevent,a,e1p", "j,a,e1p", "e3j,a,e1p"]
     # initialize correct number of canvases needed to fit all the plots
@@ -339,6 +462,7 @@ if Fit.Fit():
     specfit_canv.Update()
     if specfit_canv.get_ncanvases():
         specfit_canv.cd(1)
+    specfit_trace.End()
 
     def get_fit_stats(fit):
         '''print out the fit statistics from the TFluxFit object'''
@@ -392,6 +516,11 @@ else:
     sys.stdout.write("You can also use the keyword \'{:s}_\' instead of \'my_plots_\' to have\n".format(_dt_tok_)) 
     sys.stdout.write("date and time as basename for your plots, using YYYYMMDD_HHMMSS_ format\n")
 
+# write the timeline of the run
+if args.trace_file:
+    if specfit_trace.Write():
+        sys.stdout.write("\nTimeline written into \'{:s}\', open it with chrome://tracing or https://ui.perfetto.dev\n".format(args.trace_file))
+
 if(not args.quit_after_finishing):
     sys.stdout.write("\nTo switch between root and py command modes, type \'root\' or \'py\' and hit <ENTER>\n")
     sys.stdout.write("(to quit, type \'.q\' and press <ENTER>)\n\n")
@@ -1,9 +1,92 @@
+#include <algorithm>
 #include "TBPLF1.h"
 #include "specfit_uti.h"
 #include "TMath.h"
 
 ClassImp(TBPLF1);
 
+// Broken power laws with NB breaks of type TYPE, evaluated the same way as the formulas from make_formula.
+// The number of breaks is known at compile time so the loops over the breaks are unrolled.
+namespace
+{
+  enum bpl_type
+  {
+    bpl_J = 0, bpl_E3J, bpl_EJ, bpl_JG, bpl_E2JG, bpl_ntypes
+  };
+  const Int_t bpl_max_native_breaks = 3;
+
+  // contribution of the power law segment between the breaks to the integral flux, see make_formula
+  inline Double_t bpl_tail(Double_t pcf, Double_t pw, Double_t d_lo, Double_t d_hi)
+  {
+    return TMath::Power(10.0, pcf) * (TMath::Power(10.0, pw * d_hi) - TMath::Power(10.0, pw * d_lo)) / pw;
+  }
+
+  template<Int_t NB, Int_t TYPE> Double_t bpl_native(Double_t x, const Double_t *p, Double_t factor, Double_t x0)
+  {
+    // power law indices p[1] .. p[NB+1], breaks p[NB+2] .. p[2NB+1]
+    const Double_t *b = p + NB + 2;
+    Double_t d = x - x0;
+    // sums of the power coefficients of the prior breaks (get_pcf)
+    Double_t pcf[NB + 1];
+    pcf[0] = 0;
+    for (Int_t j = 0; j < NB; j++)
+      pcf[j + 1] = pcf[j] + (p[j + 1] - p[j + 2]) * (b[j] - x0);
+    Double_t v = factor * p[0];
+    if(TYPE == bpl_J || TYPE == bpl_E3J || TYPE == bpl_EJ)
+      {
+	if(TYPE == bpl_E3J)
+	  v *= TMath::Power(10.0, 3.0 * x);
+	if(TYPE == bpl_EJ)
+	  v *= TMath::Power(10.0, x);
+	if(NB == 0)
+	  return v * TMath::Power(10.0, p[1] * d);
+	Double_t s = 0;
+	if(x < b[0])
+	  s += TMath::Power(10.0, p[1] * d);
+	for (Int_t k = 1; k < NB; k++)
+	  {
+	    if(b[k - 1] <= x && x < b[k])
+	      s += TMath::Power(10.0, pcf[k] + p[k + 1] * d);
+	  }
+	if(b[NB - 1] <= x)
+	  s += TMath::Power(10.0, pcf[NB] + p[NB + 1] * d);
+	return v * s;
+      }
+    if(TYPE == bpl_E2JG)
+      v *= TMath::Power(10.0, 2.0 * x);
+    v *= TMath::Power(10.0, x0);
+    if(NB == 0)
+      return v * ((x < x0 ? -1.0 / (1 + p[1]) : 0.0) - (x0 <= x ? TMath::Power(10.0, (1 + p[1]) * d) / (1 + p[1]) : 0.0));
+    // integrals over the segments above each break, the last one extends to infinity
+    Double_t tail[NB + 1];
+    tail[NB] = 0;
+    for (Int_t j = NB - 1; j >= 0; j--)
+      {
+	Double_t pw = 1.0 + p[j + 2];
+	tail[j] = tail[j + 1]
+	    + (j < NB - 1 ? bpl_tail(pcf[j + 1], pw, b[j] - x0, b[j + 1] - x0) : -TMath::Power(10.0, pcf[j + 1] + pw * (b[j] - x0)) / pw);
+      }
+    Double_t s = 0;
+    if(x <= b[0])
+      s += bpl_tail(0.0, 1.0 + p[1], d, b[0] - x0) + tail[0];
+    for (Int_t i = 0; i < NB - 1; i++)
+      {
+	if(b[i] < x && x <= b[i + 1])
+	  s += bpl_tail(pcf[i + 1], 1.0 + p[i + 2], d, b[i + 1] - x0) + tail[i + 1];
+      }
+    if(b[NB - 1] < x)
+      s -= TMath::Power(10.0, pcf[NB] + (1 + p[NB + 1]) * d) / (1 + p[NB + 1]);
+    return v * s;
+  }
+
+  typedef Double_t (*bpl_native_kernel)(Double_t, const Double_t*, Double_t, Double_t);
+
+#define BPL_NATIVE_KERNELS(NB) bpl_native<NB, bpl_J>, bpl_native<NB, bpl_E3J>, bpl_native<NB, bpl_EJ>, bpl_native<NB, bpl_JG>, bpl_native<NB, bpl_E2JG>
+  const bpl_native_kernel bpl_native_kernels[(bpl_max_native_breaks + 1) * bpl_ntypes] =
+    { BPL_NATIVE_KERNELS(0), BPL_NATIVE_KERNELS(1), BPL_NATIVE_KERNELS(2), BPL_NATIVE_KERNELS(3) };
+#undef BPL_NATIVE_KERNELS
+}
+
 
 // make flux formulas based on the function type and how many break points
 TString TBPLF1::make_formula(Int_t nbreaks, const char *ftype, Double_t scalefactor, Double_t log10en_min)
@@ -134,6 +217,145 @@ TString TBPLF1::get_pcf(Int_t ibreak, Int_t nbreaaks, Double_t log10en_min)
 }
 
 
+Int_t TBPLF1::get_native_kernel()
+{
+  if(fNativeKernel != -1)
+    return fNativeKernel;
+  TString s_ftype = fBplType;
+  s_ftype.ToUpper();
+  Int_t itype = -1;
+  if(s_ftype == "J")
+    itype = bpl_J;
+  else if(s_ftype == "E3J")
+    itype = bpl_E3J;
+  else if(s_ftype == "EJ")
+    itype = bpl_EJ;
+  else if(s_ftype == "J>")
+    itype = bpl_JG;
+  else if(s_ftype == "E2J>")
+    itype = bpl_E2JG;
+  Int_t nbreaks = GetNbreaks();
+  // objects written before the formula factor was stored are evaluated by the formula
+  if(itype < 0 || nbreaks > bpl_max_native_breaks || GetNpar() != 2 * nbreaks + 2 || fBplFormulaFactor == 0)
+    {
+      fNativeKernel = -2;
+      return fNativeKernel;
+    }
+  fNativeLog10enMin = formula_value("%f", fBplLog10enMin);
+  fNativeKernel = nbreaks * bpl_ntypes + itype;
+  return fNativeKernel;
+}
+
+Bool_t TBPLF1::RestoreFromFormula(Bool_t type_known)
+{
+  fNativeKernel = -1;
+  fBplFormulaFactor = formula_value("%e", fBplScaleFactor);
+  if(type_known)
+    return true;
+  // the type from the factors of the formula, see make_formula
+  TString frm = TF1::GetExpFormula();
+  frm.ReplaceAll(" ", "");
+  frm.ReplaceAll("x[0]", "x");
+  if(frm.Contains("(1+[1])"))
+    fBplType = (frm.Contains("2.0*x") ? "E2J>" : "J>");
+  else if(frm.Contains("3.0*x"))
+    fBplType = "E3J";
+  else if(frm.Contains("(x)"))
+    fBplType = "EJ";
+  else
+    fBplType = "J";
+  // reference energy from the first (x-log10en_min)
+  Int_t i = frm.Index("(x-");
+  if(i >= 0)
+    fBplLog10enMin = atof(frm.Data() + i + 3);
+  // the specialized code must give the values of the formula
+  Bool_t ok = (i >= 0 && fBplScaleFactor > 0);
+  if(ok && get_native_kernel() >= 0)
+    {
+      for (Int_t k = 0; k <= 10 && ok; k++)
+	{
+	  Double_t x = GetXmin() + (GetXmax() - GetXmin()) * (Double_t) k / 10.0;
+	  Double_t v_frm = TSPECFITF1::EvalPar(&x, 0);
+	  ok = (TMath::Abs(EvalPar(&x, 0) - v_frm) <= 1e-6 * TMath::Abs(v_frm));
+	}
+    }
+  if(!ok)
+    {
+      fprintf(stderr, "WARNING: TBPLF1 '%s': type of the formula is not recognized, it's evaluated by the formula\n", GetName());
+      fBplType = "";
+      fBplFormulaFactor = 0;
+    }
+  fNativeKernel = -1;
+  return ok;
+}
+
+Double_t TBPLF1::EvalPar(const Double_t *x, const Double_t *params)
+{
+  Int_t ikernel = get_native_kernel();
+  if(ikernel < 0)
+    return TSPECFITF1::EvalPar(x, params);
+  return bpl_native_kernels[ikernel](x[0], (params ? params : GetParameters()), fBplFormulaFactor, fNativeLog10enMin);
+}
+
+Double_t TBPLF1::Eval(Double_t x, Double_t y, Double_t z, Double_t t) const
+{
+  // the choice of the specialized code is cached on the first call
+  TBPLF1 *self = const_cast<TBPLF1*>(this);
+  if(self->get_native_kernel() < 0)
+    return TSPECFITF1::Eval(x, y, z, t);
+  Double_t xx[4] = { x, y, z, t };
+  return self->EvalPar(xx, 0);
+}
+
+Bool_t TBPLF1::GetLog10Segments(std::vector<Double_t> &breaks, std::vector<Double_t> &log10_offsets, std::vector<Double_t> &slopes) const
+{
+  if(fBplType != "J")
+    return false;
+  // objects of the older versions whose formula wasn't recognized
+  if(fBplFormulaFactor == 0)
+    return false;
+  Int_t nbreaks = GetNbreaks();
+  // scale factor and reference energy with the precision with which they are written into the formula
+  Double_t scalefactor = fBplFormulaFactor;
+  Double_t log10en_ref = formula_value("%f", fBplLog10enMin);
+  Double_t norm = scalefactor * GetParameter(0);
+  if(!(norm > 0))
+    return false;
+  breaks.resize(nbreaks);
+  log10_offsets.resize(nbreaks + 1);
+  slopes.resize(nbreaks + 1);
+  Double_t pcf = 0; // sum of the power coefficients of the prior breaks, see get_pcf
+  for (Int_t k = 0; k <= nbreaks; k++)
+    {
+      if(k > 0)
+	{
+	  breaks[k - 1] = GetParameter(nbreaks + 1 + k);
+	  if(k > 1 && breaks[k - 1] < breaks[k - 2])
+	    return false;
+	  pcf += (GetParameter(k) - GetParameter(k + 1)) * (breaks[k - 1] - log10en_ref);
+	}
+      slopes[k] = GetParameter(k + 1);
+      log10_offsets[k] = TMath::Log10(norm) + pcf - slopes[k] * log10en_ref;
+    }
+  return true;
+}
+
+void TBPLF1::EvalBatch(const Double_t *x, Double_t *out, size_t n)
+{
+  std::vector<Double_t> breaks, log10_offsets, slopes;
+  if(!GetLog10Segments(breaks, log10_offsets, slopes))
+    {
+      TSPECFITF1::EvalBatch(x, out, n);
+      return;
+    }
+  for (size_t i = 0; i < n; i++)
+    {
+      // segment k has k breaks at or below x
+      Int_t k = (Int_t) (std::upper_bound(breaks.begin(), breaks.end(), x[i]) - breaks.begin());
+      out[i] = TMath::Exp(TMath::Ln10() * (log10_offsets[k] + slopes[k] * x[i]));
+    }
+}
+
 Double_t TBPLF1::MultiplyAndIntegrate_dE(const TF1* f, Double_t log10en_start, Double_t log10en_end, Double_t esprel) const
 {
 #if ROOT_VERSION_CODE >= ROOT_VERSION(6,0,0)
@@ -0,0 +1,224 @@
+#include "TCOMPOSITEF1.h"
+#include "specfit_uti.h"
+#include "TMath.h"
+
+ClassImp(TCOMPOSITEF1);
+
+TCOMPOSITEF1::TCOMPOSITEF1(const char *name, Char_t operation, Double_t c0, Int_t nfun, const TF1 **f, const Double_t *c) :
+    TSPECFITF1(name, composite_fcn, 18.0, 21.0, count_parameters(nfun, f)), fOperation(operation), fConstant(c0)
+{
+  fChildren.SetOwner(true);
+  std::vector<TString> parnames;
+  std::vector<Double_t> params, parerrors, parmin, parmax;
+  Double_t xmin = 0, xmax = 0;
+  for (Int_t i = 0; i < nfun; i++)
+    {
+      fChildren.Add(f[i]->Clone(specfit_uti::get_unique_object_name(TString(name) + "_" + TString(f[i]->GetName()))));
+      fCoefficients.push_back(c ? c[i] : 1.0);
+      fParOffsets.push_back((Int_t) params.size());
+      for (Int_t ipar = 0; ipar < f[i]->GetNpar(); ipar++)
+	{
+	  Double_t lo = 0, hi = 0;
+	  f[i]->GetParLimits(ipar, lo, hi);
+	  parnames.push_back(f[i]->GetParName(ipar));
+	  params.push_back(f[i]->GetParameter(ipar));
+	  parerrors.push_back(f[i]->GetParError(ipar));
+	  parmin.push_back(lo);
+	  parmax.push_back(hi);
+	}
+      // domain of the function is determined by the functions that are combined
+      xmin = (i == 0 ? f[i]->GetXmin() : TMath::Min(xmin, f[i]->GetXmin()));
+      xmax = (i == 0 ? f[i]->GetXmax() : TMath::Max(xmax, f[i]->GetXmax()));
+    }
+  if(params.size())
+    {
+      SetParNames(&parnames[0]);
+      SetParameters(&params[0]);
+      SetParErrors(&parerrors[0]);
+      for (Int_t ipar = 0; ipar < (Int_t) params.size(); ipar++)
+	{
+	  if(parmin[ipar] != 0 || parmax[ipar] != 0)
+	    SetParLimits(ipar, parmin[ipar], parmax[ipar]);
+	}
+    }
+  SetRange(xmin, xmax);
+}
+
+TCOMPOSITEF1::~TCOMPOSITEF1()
+{
+  fChildren.Delete();
+}
+
+TCOMPOSITEF1* TCOMPOSITEF1::Sum(const char *newname, Double_t c0, const TF1 *f1, const TF1 *f2, Double_t c1, Double_t c2)
+{
+  const TF1 *f[2] = { f1, f2 };
+  Double_t c[2] = { c1, c2 };
+  return new TCOMPOSITEF1(newname, '+', c0, 2, f, c);
+}
+
+TCOMPOSITEF1* TCOMPOSITEF1::Sum(const char *newname, Double_t c0, const TF1 *f, Double_t c)
+{
+  return new TCOMPOSITEF1(newname, '+', c0, 1, &f, &c);
+}
+
+TCOMPOSITEF1* TCOMPOSITEF1::Product(const char *newname, const TF1 *f1, const TF1 *f2, Double_t c0)
+{
+  const TF1 *f[2] = { f1, f2 };
+  return new TCOMPOSITEF1(newname, '*', c0, 2, f, 0);
+}
+
+Bool_t TCOMPOSITEF1::SetChild(Int_t i, const TF1 *f)
+{
+  if(i < 0 || i >= GetNchildren() || !f)
+    {
+      fprintf(stderr, "ERROR: SetChild: function %d doesn't exist in '%s'!\n", i, GetName());
+      return false;
+    }
+  if(f->GetNpar() != GetChild(i)->GetNpar())
+    {
+      fprintf(stderr, "ERROR: SetChild: function '%s' has %d parameters, expected %d!\n", f->GetName(), f->GetNpar(), GetChild(i)->GetNpar());
+      return false;
+    }
+  TObject *f_old = fChildren.RemoveAt(i);
+  fChildren.AddAt(f->Clone(specfit_uti::get_unique_object_name(TString(GetName()) + "_" + TString(f->GetName()))), i);
+  delete f_old;
+  return true;
+}
+
+Double_t TCOMPOSITEF1::EvalPar(const Double_t *x, const Double_t *params)
+{
+  if(!params)
+    params = GetParameters();
+  Double_t value = fConstant;
+  for (Int_t i = 0; i < fChildren.GetEntriesFast(); i++)
+    {
+      Double_t fi = GetChild(i)->EvalPar(x, params + fParOffsets[i]);
+      if(fOperation == '+')
+	value += fCoefficients[i] * fi;
+      else
+	value *= fi;
+    }
+  return value;
+}
+
+void TCOMPOSITEF1::EvalBatch(const Double_t *x, Double_t *out, size_t n)
+{
+  const Double_t *params = GetParameters();
+  for (size_t k = 0; k < n; k++)
+    out[k] = fConstant;
+  if(!n)
+    return;
+  fBatchValues.resize(n);
+  for (Int_t i = 0; i < fChildren.GetEntriesFast(); i++)
+    {
+      TF1 *f = GetChild(i);
+      if(f->GetNpar())
+	f->SetParameters(params + fParOffsets[i]);
+      TSPECFITF1::EvalBatch(f, x, &fBatchValues[0], n);
+      if(fOperation == '+')
+	{
+	  for (size_t k = 0; k < n; k++)
+	    out[k] += fCoefficients[i] * fBatchValues[k];
+	}
+      else
+	{
+	  for (size_t k = 0; k < n; k++)
+	    out[k] *= fBatchValues[k];
+	}
+    }
+}
+
+void TCOMPOSITEF1::EvalGradient(const Double_t *x, Double_t *grad, const Double_t *params)
+{
+  if(!params)
+    params = GetParameters();
+  Int_t nfun = fChildren.GetEntriesFast();
+  if(fOperation == '*')
+    {
+      fChildValues.resize(nfun);
+      for (Int_t i = 0; i < nfun; i++)
+	fChildValues[i] = GetChild(i)->EvalPar(x, params + fParOffsets[i]);
+    }
+  for (Int_t i = 0; i < nfun; i++)
+    {
+      TF1 *f = GetChild(i);
+      Int_t npar = f->GetNpar();
+      if(!npar)
+	continue;
+      Double_t *grad_i = grad + fParOffsets[i];
+      f->SetParameters(params + fParOffsets[i]);
+      TSPECFITF1::EvalGradient(f, x, grad_i);
+      // coefficient of the function in the sum, the constant times the other functions in the product
+      Double_t c = fCoefficients[i];
+      if(fOperation == '*')
+	{
+	  c = fConstant;
+	  for (Int_t j = 0; j < nfun; j++)
+	    {
+	      if(j != i)
+		c *= fChildValues[j];
+	    }
+	}
+      for (Int_t ipar = 0; ipar < npar; ipar++)
+	grad_i[ipar] *= c;
+    }
+}
+
+Bool_t TCOMPOSITEF1::HasAnalyticGradient() const
+{
+  for (Int_t i = 0; i < fChildren.GetEntriesFast(); i++)
+    {
+      if(GetChild(i)->GetNpar() && !TSPECFITF1::HasAnalyticGradient(GetChild(i)))
+	return false;
+    }
+  return true;
+}
+
+Bool_t TCOMPOSITEF1::GenerateGradient()
+{
+  for (Int_t i = 0; i < fChildren.GetEntriesFast(); i++)
+    {
+      if(GetChild(i)->GetNpar())
+	TSPECFITF1::GenerateGradient(GetChild(i));
+    }
+  return HasAnalyticGradient();
+}
+
+void TCOMPOSITEF1::Scale(Double_t c)
+{
+  fConstant *= c;
+  if(fOperation == '+')
+    {
+      for (Int_t i = 0; i < (Int_t) fCoefficients.size(); i++)
+	fCoefficients[i] *= c;
+    }
+}
+
+TString TCOMPOSITEF1::GetCompositeFormula(Int_t n_offset) const
+{
+  TString frm = TString::Format("%.9e", fConstant);
+  for (Int_t i = 0; i < fChildren.GetEntriesFast(); i++)
+    {
+      TString frm_i = TSPECFITF1::GetExpFormula(GetChild(i), n_offset + fParOffsets[i]);
+      if(fOperation == '+')
+	frm += TString::Format(" + %.9e * (%s)", fCoefficients[i], frm_i.Data());
+      else
+	frm += TString::Format(" * (%s)", frm_i.Data());
+    }
+  return TString("(") + frm + ")";
+}
+
+Int_t TCOMPOSITEF1::count_parameters(Int_t nfun, const TF1 **f)
+{
+  Int_t npar = 0;
+  for (Int_t i = 0; i < nfun; i++)
+    npar += f[i]->GetNpar();
+  return npar;
+}
+
+Double_t TCOMPOSITEF1::composite_fcn(Double_t *x, Double_t *params)
+{
+  (void) (x);
+  (void) (params);
+  return 0;
+}
@@ -2,18 +2,22 @@
 
 #include <cstdio>
 #include <cstdlib>
+#include <cmath>
 #include "TCRFlux.h"
+#include "TBPLF1.h"
 #include "TMath.h"
 #include "TTree.h"
 #include "TROOT.h"
 #include "specfit_uti.h"
+#include "specfit_trace.h"
 #include "TAxis.h"
 
 // for the class dictionary generation
 ClassImp(TCRFlux);
 
 TCRFlux::TCRFlux(const char *name, const char *title) :
-    log10en_min_data(0), log10en_max_data(0), nevents_min_restricted(7), fJ(0), fE3J(0), fJ_null(0), fE3J_null(0), fEnCorr(0)
+    log10en_min_data(0), log10en_max_data(0), nevents_min_restricted(7), exposure_scale(1.0), exposure_scale_error(0), exposure_scale_profiled(false), fJ(0), fE3J(0), fJ_null(0), fE3J_null(0), fEnCorr(0), encorr_cache_fun(0),
+    encorr_cache_hits(0), encorr_cache_misses(0), response_encorr_valid(false), bpl_suffstat(true), bpl_suffstat_valid(false), nevents_fit_pending(false), asimov_data(false)
 {
   SetName(name);
   SetTitle(title);
@@ -34,6 +38,7 @@ TCRFlux::~TCRFlux()
 // col4: exposure [m^2 sr s] for each energy bin center value
 Bool_t TCRFlux::Load(const char *ascii_file)
 {
+  SPECFIT_TRACE("TCRFlux::Load", "io");
   TTree *t = new TTree("t", "");
   if(!t->ReadFile(ascii_file, "log10en/D:log10en_bsize/D:nevents/D:exposure/D"))
     {
@@ -63,6 +68,9 @@ Bool_t TCRFlux::Load(Int_t nbins,                   // number of bins for the sp
   exposure = std::vector<Double_t>(exposure_values, exposure_values + nbins);
   nevents_fit = std::vector<Double_t>(nevents.size(), 0);
   find_min_max_log10en();
+  ClearEncorrCache();
+  ClearResponse();
+  clear_asimov_data();
   return true;
 }
 
@@ -83,6 +91,9 @@ Bool_t TCRFlux::Load(const std::vector<Double_t> &log10en_values,  // energies l
   exposure = exposure_values;
   nevents_fit = std::vector<Double_t>(nevents.size(), 0);
   find_min_max_log10en();
+  ClearEncorrCache();
+  ClearResponse();
+  clear_asimov_data();
   return true;
 }
 
@@ -93,6 +104,9 @@ void TCRFlux::resize(Int_t nbins)
   nevents.resize(nbins);
   exposure.resize(nbins);
   nevents_fit.resize(nbins);
+  ClearEncorrCache();
+  ClearResponse();
+  clear_asimov_data();
 }
 
 // determine the energy range of the spectrum measurement
@@ -118,6 +132,9 @@ void TCRFlux::find_min_max_log10en()
 // this selects the data only within the desirable energy range
 void TCRFlux::SelectEnergyRange(Double_t log10en_min, Double_t log10en_max)
 {
+  SPECFIT_TRACE("TCRFlux::SelectEnergyRange", "setup");
+  // HasResponse compares the number of the bands with the number of bins, which changes as the bins are erased
+  Bool_t has_response = HasResponse();
   for (Int_t i = 0; i < (Int_t) log10en.size(); i++)
     {
       if(log10en[i] < log10en_min || log10en[i] > log10en_max)
@@ -127,10 +144,234 @@ void TCRFlux::SelectEnergyRange(Double_t log10en_min, Double_t log10en_max)
 	  nevents.erase(nevents.begin() + i);
 	  exposure.erase(exposure.begin() + i);
 	  nevents_fit.erase(nevents_fit.begin() + i);
+	  if(has_response)
+	    erase_response_row(i);
+	  if(asimov_data)
+	    {
+	      data_nevents.erase(data_nevents.begin() + i);
+	      data_exposure.erase(data_exposure.begin() + i);
+	    }
 	  i--;
 	}
     }
   find_min_max_log10en();
+  ClearEncorrCache();
+}
+
+const Double_t* TCRFlux::GetEncorrValues(const Double_t **log10_encorr_values)
+{
+  if(log10_encorr_values)
+    (*log10_encorr_values) = 0;
+  if(!fEnCorr || !log10en.size())
+    return 0;
+  Int_t npar = fEnCorr->GetNpar();
+  const Double_t *par = fEnCorr->GetParameters();
+  Bool_t valid = (fEnCorr == encorr_cache_fun && encorr_cache.size() == log10en.size() && (Int_t) encorr_cache_par.size() == npar);
+  for (Int_t ipar = 0; valid && ipar < npar; ipar++)
+    valid = (encorr_cache_par[ipar] == par[ipar]);
+  if(valid)
+    encorr_cache_hits++;
+  else
+    {
+      encorr_cache_misses++;
+      bpl_suffstat_valid = false;
+      response_encorr_valid = false;
+      encorr_cache_fun = fEnCorr;
+      encorr_cache_par.assign(par, par + npar);
+      encorr_cache.resize(log10en.size());
+      encorr_cache_log10.resize(log10en.size());
+      TSPECFITF1::EvalBatch(fEnCorr, &log10en[0], &encorr_cache[0], log10en.size());
+      for (Int_t i = 0; i < (Int_t) log10en.size(); i++)
+	encorr_cache_log10[i] = TMath::Log10(encorr_cache[i]);
+    }
+  if(log10_encorr_values)
+    (*log10_encorr_values) = &encorr_cache_log10[0];
+  return &encorr_cache[0];
+}
+
+void TCRFlux::ClearEncorrCache()
+{
+  encorr_cache.clear();
+  encorr_cache_log10.clear();
+  encorr_cache_par.clear();
+  encorr_cache_fun = 0;
+  encorr_cache_hits = 0;
+  encorr_cache_misses = 0;
+  bpl_suffstat_valid = false;
+  response_encorr_valid = false;
+}
+
+Bool_t TCRFlux::SetResponse(Int_t ntrue, const Double_t *log10en_true_values, const Double_t *log10en_true_bsize_values, const Double_t *exposure_true_values,
+    const Double_t *response_values_dense, Double_t threshold)
+{
+  ClearResponse();
+  if(!log10en.size())
+    {
+      fprintf(stderr, "ERROR: SetResponse: the data must be loaded before setting the energy response!\n");
+      return false;
+    }
+  if(ntrue < 1 || !log10en_true_values || !log10en_true_bsize_values || !exposure_true_values || !response_values_dense)
+    {
+      fprintf(stderr, "ERROR: SetResponse: true energy bins or the response matrix are not given!\n");
+      return false;
+    }
+  response_log10en.assign(log10en_true_values, log10en_true_values + ntrue);
+  response_acceptance.resize(ntrue);
+  for (Int_t j = 0; j < ntrue; j++)
+    response_acceptance[j] = specfit_uti::GetLinBinSize(log10en_true_values[j], log10en_true_bsize_values[j]) * exposure_true_values[j];
+  response_start.push_back(0);
+  for (Int_t i = 0; i < (Int_t) log10en.size(); i++)
+    {
+      const Double_t *row = response_values_dense + (Long64_t) i * ntrue;
+      Double_t rmax = 0;
+      for (Int_t j = 0; j < ntrue; j++)
+	rmax = TMath::Max(rmax, row[j]);
+      Int_t jfirst = 0, jlast = -1;
+      for (Int_t j = 0; j < ntrue; j++)
+	{
+	  if(row[j] > 0 && row[j] > threshold * rmax)
+	    {
+	      if(jlast < 0)
+		jfirst = j;
+	      jlast = j;
+	    }
+	}
+      response_first.push_back(jfirst);
+      if(jlast >= 0)
+	response_values.insert(response_values.end(), row + jfirst, row + jlast + 1);
+      response_start.push_back((Int_t) response_values.size());
+    }
+  return true;
+}
+
+Bool_t TCRFlux::SetResponse(const std::vector<Double_t> &log10en_true_values, const std::vector<Double_t> &log10en_true_bsize_values,
+    const std::vector<Double_t> &exposure_true_values, const std::vector<Double_t> &response_values_dense, Double_t threshold)
+{
+  if(log10en_true_values.size() != log10en_true_bsize_values.size() || log10en_true_values.size() != exposure_true_values.size()
+      || response_values_dense.size() != log10en_true_values.size() * log10en.size())
+    {
+      fprintf(stderr, "ERROR: SetResponse: sizes of the arrays are not consistent with the numbers of true energy bins and data bins!\n");
+      return false;
+    }
+  if(log10en_true_values.empty())
+    {
+      ClearResponse();
+      fprintf(stderr, "ERROR: SetResponse: true energy bins or the response matrix are not given!\n");
+      return false;
+    }
+  return SetResponse((Int_t) log10en_true_values.size(), &log10en_true_values[0], &log10en_true_bsize_values[0], &exposure_true_values[0],
+      &response_values_dense[0], threshold);
+}
+
+Bool_t TCRFlux::SetGaussianResponse(Double_t sigma_log10en, Double_t nsigma)
+{
+  ClearResponse();
+  if(!log10en.size())
+    {
+      fprintf(stderr, "ERROR: SetGaussianResponse: the data must be loaded before setting the energy response!\n");
+      return false;
+    }
+  if(!(sigma_log10en > 0) || !(nsigma > 0))
+    {
+      fprintf(stderr, "ERROR: SetGaussianResponse: resolution and the truncation must be positive!\n");
+      return false;
+    }
+  // true energy bins are the data bins in increasing order of energy, so that the bands are contiguous
+  std::vector<std::pair<Double_t, Int_t> > bins;
+  for (Int_t j = 0; j < (Int_t) log10en.size(); j++)
+    bins.push_back(std::make_pair(log10en[j], j));
+  std::sort(bins.begin(), bins.end());
+  Int_t ntrue = (Int_t) bins.size();
+  response_log10en.resize(ntrue);
+  response_acceptance.resize(ntrue);
+  for (Int_t j = 0; j < ntrue; j++)
+    {
+      Int_t k = bins[j].second;
+      response_log10en[j] = log10en[k];
+      response_acceptance[j] = specfit_uti::GetLinBinSize(log10en[k], log10en_bsize[k]) * exposure[k];
+    }
+  response_start.push_back(0);
+  for (Int_t i = 0; i < (Int_t) log10en.size(); i++)
+    {
+      Double_t lo = log10en[i] - log10en_bsize[i] / 2.0;
+      Double_t hi = log10en[i] + log10en_bsize[i] / 2.0;
+      Int_t jfirst = (Int_t) (std::lower_bound(response_log10en.begin(), response_log10en.end(), lo - nsigma * sigma_log10en) - response_log10en.begin());
+      Int_t jend = (Int_t) (std::upper_bound(response_log10en.begin(), response_log10en.end(), hi + nsigma * sigma_log10en) - response_log10en.begin());
+      response_first.push_back(jfirst);
+      for (Int_t j = jfirst; j < jend; j++)
+	response_values.push_back(TMath::Freq((hi - response_log10en[j]) / sigma_log10en) - TMath::Freq((lo - response_log10en[j]) / sigma_log10en));
+      response_start.push_back((Int_t) response_values.size());
+    }
+  return true;
+}
+
+void TCRFlux::ClearResponse()
+{
+  response_log10en.clear();
+  response_acceptance.clear();
+  response_first.clear();
+  response_start.clear();
+  response_values.clear();
+  response_encorr.clear();
+  response_log10_encorr.clear();
+  response_encorr_valid = false;
+  data_response_acceptance.clear();
+}
+
+void TCRFlux::erase_response_row(Int_t i)
+{
+  Int_t nvalues = response_start[i + 1] - response_start[i];
+  response_values.erase(response_values.begin() + response_start[i], response_values.begin() + response_start[i + 1]);
+  response_first.erase(response_first.begin() + i);
+  response_start.erase(response_start.begin() + i + 1);
+  for (Int_t k = i + 1; k < (Int_t) response_start.size(); k++)
+    response_start[k] -= nvalues;
+}
+
+// expected numbers of events in the true energy bins that are needed by the data bins in the energy range, then the
+// band of each data bin times these numbers
+void TCRFlux::fold_response(Double_t log10en_min, Double_t log10en_max)
+{
+  Int_t ntrue = (Int_t) response_log10en.size();
+  if(fEnCorr && !response_encorr_valid)
+    {
+      response_encorr.resize(ntrue);
+      response_log10_encorr.resize(ntrue);
+      TSPECFITF1::EvalBatch(fEnCorr, &response_log10en[0], &response_encorr[0], ntrue);
+      for (Int_t j = 0; j < ntrue; j++)
+	response_log10_encorr[j] = TMath::Log10(response_encorr[j]);
+      response_encorr_valid = true;
+    }
+  Int_t jmin = ntrue, jmax = 0;
+  for (Int_t i = 0; i < (Int_t) log10en.size(); i++)
+    {
+      if(log10en[i] < log10en_min || log10en[i] > log10en_max || response_start[i + 1] == response_start[i])
+	continue;
+      jmin = TMath::Min(jmin, response_first[i]);
+      jmax = TMath::Max(jmax, response_first[i] + response_start[i + 1] - response_start[i]);
+    }
+  response_nevents.resize(ntrue);
+  if(jmax > jmin)
+    {
+      eval_x.resize(jmax - jmin);
+      for (Int_t j = jmin; j < jmax; j++)
+	eval_x[j - jmin] = response_log10en[j] + (fEnCorr ? response_log10_encorr[j] : 0.0);
+      TSPECFITF1::EvalBatch(fJ, &eval_x[0], &response_nevents[jmin], eval_x.size());
+    }
+  for (Int_t j = jmin; j < jmax; j++)
+    response_nevents[j] *= (fEnCorr ? response_encorr[j] : 1.0) * response_acceptance[j] * exposure_scale;
+  for (Int_t i = 0; i < (Int_t) log10en.size(); i++)
+    {
+      if(log10en[i] < log10en_min || log10en[i] > log10en_max)
+	continue;
+      const Double_t *r = (response_values.empty() ? 0 : &response_values[0]) + response_start[i];
+      const Double_t *n = (response_nevents.empty() ? 0 : &response_nevents[0]) + response_first[i];
+      Int_t nband = response_start[i + 1] - response_start[i];
+      Double_t nfit = 0;
+      for (Int_t k = 0; k < nband; k++)
+	nfit += r[k] * n[k];
+      nevents_fit[i] = nfit;
+    }
 }
 
 // contribution to the log likelihood function from this instance
@@ -142,21 +383,36 @@ void TCRFlux::CalcLogLikelihood(Double_t log10en_min, Double_t log10en_max)
   log_likelihood = std::make_pair(0, 0);
   log_likelihood_nonzero = std::make_pair(0, 0);
   log_likelihood_restricted = std::make_pair(0, 0);
+  nevents_sum = std::make_pair(0, 0);
+  nevents_sum_nonzero = std::make_pair(0, 0);
+  nevents_sum_restricted = std::make_pair(0, 0);
+
+  // energy correction factors for all bins, if the energy correction function is being applied
+  const Double_t *log10_encorr_values = 0;
+  const Double_t *encorr_values = GetEncorrValues(&log10_encorr_values);
+
+  // fit predictions folded with the energy response
+  Bool_t folded = (fJ && HasResponse());
+  if(folded)
+    fold_response(log10en_min, log10en_max);
+
+  // broken power laws without evaluating the logarithms in each bin
+  nevents_fit_pending = false;
+  if(!folded && bpl_suffstat && fJ && calc_log_likelihood_bpl(log10en_min, log10en_max, encorr_values, log10_encorr_values))
+    return;
+
+  // numbers of events from the fit function, evaluated for all bins at once
+  if(fJ && !folded)
+    eval_nevents_fit(log10en_min, log10en_max, encorr_values, log10_encorr_values, false);
 
   for (Int_t i = 0; i < (Int_t) log10en.size(); i++)
     {
       // apply the energy limits
       if(log10en[i] < log10en_min || log10en[i] > log10en_max)
 	continue;
-      // number of events from the fit function
-      Double_t bsize = specfit_uti::GetLinBinSize(log10en[i], log10en_bsize[i]);
-      // correct the fit predictions appropriately if the energy correction function is being applied
-      Double_t encorr = (fEnCorr ? fEnCorr->Eval(log10en[i]) : 1.0);
-      Double_t log10en_corr = log10en[i] + TMath::Log10(encorr);
       Double_t lgl = 0; // contribution to log likelihood from the bin
       if(fJ)
 	{
-	  nevents_fit[i] = fJ->Eval(log10en_corr) * (encorr * bsize) * exposure[i];
 	  // log likelihood formula when number of events is zero
 	  lgl = 2.0 * nevents_fit[i];
 	  // log likelihood formula when number of events is not zero
@@ -171,25 +427,416 @@ void TCRFlux::CalcLogLikelihood(Double_t log10en_min, Double_t log10en_max)
 	  lgl = 0;
 	}
 
+      // observed events that enter the log likelihood formula
+      Double_t nobserved = (nevents[i] > 1e-3 ? nevents[i] : 0.0);
+
       log_likelihood.first += lgl;
       log_likelihood.second++;
+      nevents_sum.first += nobserved;
+      nevents_sum.second += nevents_fit[i];
 
       if(nevents[i] > 0)
 	{
 	  log_likelihood_nonzero.first += lgl;
 	  log_likelihood_nonzero.second++;
+	  nevents_sum_nonzero.first += nobserved;
+	  nevents_sum_nonzero.second += nevents_fit[i];
 	}
       if(nevents[i] >= nevents_min_restricted)
 	{
 	  log_likelihood_restricted.first += lgl;
 	  log_likelihood_restricted.second++;
+	  nevents_sum_restricted.first += nobserved;
+	  nevents_sum_restricted.second += nevents_fit[i];
 	}
     }
 }
+
+void TCRFlux::build_bpl_suffstat(Double_t log10en_min, Double_t log10en_max, const Double_t *encorr_values, const Double_t *log10_encorr_values)
+{
+  bpl_suffstat_valid = false;
+  std::vector<std::pair<Double_t, Int_t> > bins;
+  for (Int_t i = 0; i < (Int_t) log10en.size(); i++)
+    {
+      if(log10en[i] < log10en_min || log10en[i] > log10en_max)
+	continue;
+      bins.push_back(std::make_pair(log10en[i] + (encorr_values ? log10_encorr_values[i] : 0.0), i));
+    }
+  std::sort(bins.begin(), bins.end());
+  Int_t nbins = (Int_t) bins.size();
+  std::vector<Double_t> lnacc_values(nbins, 0);
+  std::vector<Bool_t> zero_values(nbins, false);
+  bpl_suffstat_bins.resize(nbins);
+  bpl_suffstat_log10en.resize(nbins);
+  bpl_suffstat_n.assign(nbins + 1, 0);
+  bpl_suffstat_nx.assign(nbins + 1, 0);
+  bpl_suffstat_nlnacc.assign(nbins + 1, 0);
+  bpl_suffstat_n_restricted.assign(nbins + 1, 0);
+  bpl_suffstat_nx_restricted.assign(nbins + 1, 0);
+  bpl_suffstat_nlnacc_restricted.assign(nbins + 1, 0);
+  bpl_suffstat_const = 0;
+  bpl_suffstat_const_restricted = 0;
+  for (Int_t j = 0; j < nbins; j++)
+    {
+      Int_t i = bins[j].second;
+      Double_t x = bins[j].first;
+      // observed events that enter the log likelihood formula and the acceptance without the exposure scale factor
+      Double_t n = (nevents[i] > 1e-3 ? nevents[i] : 0.0);
+      Double_t acc = (encorr_values ? encorr_values[i] : 1.0) * specfit_uti::GetLinBinSize(log10en[i], log10en_bsize[i]) * exposure[i];
+      Double_t nlnacc = 0, c = 0;
+      if(n > 0)
+	{
+	  // the logarithm is undefined, use the evaluation in each bin
+	  if(!(acc > 0))
+	    return;
+	  nlnacc = n * TMath::Log(acc);
+	  c = 2.0 * (n * TMath::Log(n) - n);
+	}
+      Bool_t restricted = (nevents[i] >= nevents_min_restricted);
+      // bins that contribute only their expected numbers of events to the log likelihood
+      if(nevents[i] <= 0 && !restricted && acc > 0)
+	{
+	  zero_values[j] = true;
+	  lnacc_values[j] = TMath::Log(acc);
+	}
+      bpl_suffstat_bins[j] = i;
+      bpl_suffstat_log10en[j] = x;
+      bpl_suffstat_n[j + 1] = bpl_suffstat_n[j] + n;
+      bpl_suffstat_nx[j + 1] = bpl_suffstat_nx[j] + n * x;
+      bpl_suffstat_nlnacc[j + 1] = bpl_suffstat_nlnacc[j] + nlnacc;
+      bpl_suffstat_n_restricted[j + 1] = bpl_suffstat_n_restricted[j] + (restricted ? n : 0.0);
+      bpl_suffstat_nx_restricted[j + 1] = bpl_suffstat_nx_restricted[j] + (restricted ? n * x : 0.0);
+      bpl_suffstat_nlnacc_restricted[j + 1] = bpl_suffstat_nlnacc_restricted[j] + (restricted ? nlnacc : 0.0);
+      bpl_suffstat_const += c;
+      if(restricted)
+	bpl_suffstat_const_restricted += c;
+    }
+
+  // runs of bins without events with equal steps in log10(E/eV) and in ln(acceptance)
+  const Int_t zero_run_min_length = 4;
+  const Double_t zero_run_tolerance = 1e-9;
+  bpl_zero_run_start.clear();
+  bpl_zero_run_length.clear();
+  bpl_zero_run_dx.clear();
+  bpl_zero_run_lnacc.clear();
+  bpl_zero_run_dlnacc.clear();
+  bpl_zero_run_bin.assign(log10en.size(), false);
+  Int_t j = 0;
+  while (j < nbins)
+    {
+      if(!zero_values[j])
+	{
+	  j++;
+	  continue;
+	}
+      Int_t jend = j + 1;
+      Double_t dx = 0, dlnacc = 0;
+      if(jend < nbins && zero_values[jend])
+	{
+	  dx = bpl_suffstat_log10en[jend] - bpl_suffstat_log10en[j];
+	  dlnacc = lnacc_values[jend] - lnacc_values[j];
+	  while (jend + 1 < nbins && zero_values[jend + 1]
+	      && TMath::Abs(bpl_suffstat_log10en[jend + 1] - bpl_suffstat_log10en[jend] - dx) <= zero_run_tolerance
+	      && TMath::Abs(lnacc_values[jend + 1] - lnacc_values[jend] - dlnacc) <= zero_run_tolerance)
+	    jend++;
+	  jend++;
+	}
+      if(jend - j >= zero_run_min_length)
+	{
+	  bpl_zero_run_start.push_back(j);
+	  bpl_zero_run_length.push_back(jend - j);
+	  bpl_zero_run_dx.push_back(dx);
+	  bpl_zero_run_lnacc.push_back(lnacc_values[j]);
+	  bpl_zero_run_dlnacc.push_back(dlnacc);
+	  for (Int_t jrun = j; jrun < jend; jrun++)
+	    bpl_zero_run_bin[bpl_suffstat_bins[jrun]] = true;
+	}
+      j = jend;
+    }
+
+  bpl_suffstat_log10en_min = log10en_min;
+  bpl_suffstat_log10en_max = log10en_max;
+  bpl_suffstat_valid = true;
+}
+
+// With ln(nevents_fit) = ln(acceptance) + ln(exposure_scale) + ln(10) x (log10_offset + slope x log10(E/eV)) in each
+// segment of the broken power law, the log likelihood is 2 sum(nevents_fit) + sum(2 (n ln(n) - n)) - 2 sum(n ln(nevents_fit))
+// where the last sum is obtained from the cumulative sums of the segments.  Returns false if it's not applicable.
+Bool_t TCRFlux::calc_log_likelihood_bpl(Double_t log10en_min, Double_t log10en_max, const Double_t *encorr_values, const Double_t *log10_encorr_values)
+{
+  const TBPLF1 *fbpl = dynamic_cast<const TBPLF1*>(fJ);
+  if(!fbpl || !(exposure_scale > 0) || !fbpl->GetLog10Segments(bpl_breaks, bpl_log10_offsets, bpl_slopes))
+    return false;
+  if(!bpl_suffstat_valid || bpl_suffstat_log10en_min != log10en_min || bpl_suffstat_log10en_max != log10en_max)
+    build_bpl_suffstat(log10en_min, log10en_max, encorr_values, log10_encorr_values);
+  if(!bpl_suffstat_valid)
+    return false;
+
+  // sums of n ln(nevents_fit) over the segments
+  Int_t nbins = (Int_t) bpl_suffstat_log10en.size();
+  Double_t ln_exposure_scale = TMath::Log(exposure_scale);
+  Double_t nlnmu = ln_exposure_scale * bpl_suffstat_n[nbins];
+  Double_t nlnmu_restricted = ln_exposure_scale * bpl_suffstat_n_restricted[nbins];
+  Int_t nsegments = (Int_t) bpl_slopes.size();
+  bpl_segment_bounds.resize(nsegments + 1);
+  bpl_segment_bounds[0] = 0;
+  bpl_segment_bounds[nsegments] = nbins;
+  Int_t jlo = 0;
+  for (Int_t k = 0; k < nsegments; k++)
+    {
+      Int_t jhi = nbins;
+      if(k < (Int_t) bpl_breaks.size())
+	jhi = (Int_t) (std::lower_bound(bpl_suffstat_log10en.begin() + jlo, bpl_suffstat_log10en.end(), bpl_breaks[k]) - bpl_suffstat_log10en.begin());
+      bpl_segment_bounds[k + 1] = jhi;
+      nlnmu += (bpl_suffstat_nlnacc[jhi] - bpl_suffstat_nlnacc[jlo])
+	  + TMath::Ln10() * (bpl_log10_offsets[k] * (bpl_suffstat_n[jhi] - bpl_suffstat_n[jlo]) + bpl_slopes[k] * (bpl_suffstat_nx[jhi] - bpl_suffstat_nx[jlo]));
+      nlnmu_restricted += (bpl_suffstat_nlnacc_restricted[jhi] - bpl_suffstat_nlnacc_restricted[jlo])
+	  + TMath::Ln10()
+	      * (bpl_log10_offsets[k] * (bpl_suffstat_n_restricted[jhi] - bpl_suffstat_n_restricted[jlo])
+		  + bpl_slopes[k] * (bpl_suffstat_nx_restricted[jhi] - bpl_suffstat_nx_restricted[jlo]));
+      jlo = jhi;
+    }
+
+  // expected numbers of events in the runs of bins without events: in each power law segment, a geometric series
+  // with the first term mu0 = acceptance x exposure_scale x 10^(log10_offset + slope x log10(E/eV)) and the ratio
+  // q = exp(dlnacc + ln(10) x slope x dx), the sum of L terms is mu0 (q^L - 1) / (q - 1)
+  Double_t nevents_fit_runs = 0;
+  for (Int_t irun = 0; irun < (Int_t) bpl_zero_run_start.size(); irun++)
+    {
+      Int_t jstart = bpl_zero_run_start[irun];
+      Int_t jend = jstart + bpl_zero_run_length[irun];
+      for (Int_t k = 0; k < nsegments; k++)
+	{
+	  Int_t j0 = TMath::Max(jstart, bpl_segment_bounds[k]);
+	  Int_t j1 = TMath::Min(jend, bpl_segment_bounds[k + 1]);
+	  if(j1 <= j0)
+	    continue;
+	  Double_t ln_mu0 = bpl_zero_run_lnacc[irun] + (Double_t) (j0 - jstart) * bpl_zero_run_dlnacc[irun] + ln_exposure_scale
+	      + TMath::Ln10() * (bpl_log10_offsets[k] + bpl_slopes[k] * bpl_suffstat_log10en[j0]);
+	  Double_t ln_q = bpl_zero_run_dlnacc[irun] + TMath::Ln10() * bpl_slopes[k] * bpl_zero_run_dx[irun];
+	  Double_t nterms = (Double_t) (j1 - j0);
+	  nevents_fit_runs += TMath::Exp(ln_mu0) * (ln_q != 0 ? expm1(nterms * ln_q) / expm1(ln_q) : nterms);
+	}
+      log_likelihood.second += (Double_t) (jend - jstart);
+      nevents_fit_pending = true;
+    }
+  log_likelihood.first += 2.0 * nevents_fit_runs;
+  nevents_sum.second += nevents_fit_runs;
+
+  // expected numbers of events in the other bins
+  eval_nevents_fit(log10en_min, log10en_max, encorr_values, log10_encorr_values, nevents_fit_pending);
+  for (Int_t i = 0; i < (Int_t) log10en.size(); i++)
+    {
+      if(log10en[i] < log10en_min || log10en[i] > log10en_max)
+	continue;
+      if(nevents_fit_pending && bpl_zero_run_bin[i])
+	continue;
+      Double_t nobserved = (nevents[i] > 1e-3 ? nevents[i] : 0.0);
+      log_likelihood.first += 2.0 * nevents_fit[i];
+      log_likelihood.second++;
+      nevents_sum.first += nobserved;
+      nevents_sum.second += nevents_fit[i];
+      if(nevents[i] > 0)
+	{
+	  log_likelihood_nonzero.first += 2.0 * nevents_fit[i];
+	  log_likelihood_nonzero.second++;
+	  nevents_sum_nonzero.first += nobserved;
+	  nevents_sum_nonzero.second += nevents_fit[i];
+	}
+      if(nevents[i] >= nevents_min_restricted)
+	{
+	  log_likelihood_restricted.first += 2.0 * nevents_fit[i];
+	  log_likelihood_restricted.second++;
+	  nevents_sum_restricted.first += nobserved;
+	  nevents_sum_restricted.second += nevents_fit[i];
+	}
+    }
+  // the bins with events are in the non-zero subset, so it has the same sum as all bins
+  log_likelihood.first += bpl_suffstat_const - 2.0 * nlnmu;
+  log_likelihood_nonzero.first += bpl_suffstat_const - 2.0 * nlnmu;
+  log_likelihood_restricted.first += bpl_suffstat_const_restricted - 2.0 * nlnmu_restricted;
+  return true;
+}
+
+void TCRFlux::eval_nevents_fit(Double_t log10en_min, Double_t log10en_max, const Double_t *encorr_values, const Double_t *log10_encorr_values,
+    Bool_t skip_zero_runs)
+{
+  eval_bins.clear();
+  eval_x.clear();
+  for (Int_t i = 0; i < (Int_t) log10en.size(); i++)
+    {
+      if(log10en[i] < log10en_min || log10en[i] > log10en_max)
+	continue;
+      if(skip_zero_runs && bpl_zero_run_bin[i])
+	continue;
+      eval_bins.push_back(i);
+      // correct the fit predictions appropriately if the energy correction function is being applied
+      eval_x.push_back(log10en[i] + (encorr_values ? log10_encorr_values[i] : 0.0));
+    }
+  if(eval_x.empty())
+    return;
+  eval_y.resize(eval_x.size());
+  TSPECFITF1::EvalBatch(fJ, &eval_x[0], &eval_y[0], eval_x.size());
+  for (Int_t k = 0; k < (Int_t) eval_bins.size(); k++)
+    {
+      Int_t i = eval_bins[k];
+      Double_t bsize = specfit_uti::GetLinBinSize(log10en[i], log10en_bsize[i]);
+      Double_t encorr = (encorr_values ? encorr_values[i] : 1.0);
+      nevents_fit[i] = eval_y[k] * (encorr * bsize) * exposure_scale * exposure[i];
+    }
+}
+
+Bool_t TCRFlux::AddLogLikelihoodGradient(Double_t log10en_min, Double_t log10en_max, Double_t *grad, Double_t *grad_encorr)
+{
+  if(!fJ || HasResponse())
+    return false;
+  const Double_t *log10_encorr_values = 0;
+  const Double_t *encorr_values = GetEncorrValues(&log10_encorr_values);
+  Int_t npar = fJ->GetNpar();
+  eval_grad.resize(npar);
+  Int_t nencorrpar = ((grad_encorr && encorr_values) ? fEnCorr->GetNpar() : 0);
+  eval_grad_encorr.resize(nencorrpar);
+  for (Int_t i = 0; i < (Int_t) log10en.size(); i++)
+    {
+      if(log10en[i] < log10en_min || log10en[i] > log10en_max)
+	continue;
+      // derivative of the bin's log likelihood with respect to the expected number of events, which is
+      // the flux function times the acceptance
+      Double_t dlgl = 2.0;
+      if(nevents[i] > 1e-3)
+	{
+	  if(!(nevents_fit[i] > 0))
+	    continue;
+	  dlgl = 2.0 * (1.0 - nevents[i] / nevents_fit[i]);
+	}
+      Double_t bsize = specfit_uti::GetLinBinSize(log10en[i], log10en_bsize[i]);
+      Double_t encorr = (encorr_values ? encorr_values[i] : 1.0);
+      Double_t log10en_corr = log10en[i] + (encorr_values ? log10_encorr_values[i] : 0.0);
+      Double_t c = dlgl * (encorr * bsize) * exposure_scale * exposure[i];
+      TSPECFITF1::EvalGradient(fJ, &log10en_corr, &eval_grad[0]);
+      for (Int_t ipar = 0; ipar < npar; ipar++)
+	grad[ipar] += c * eval_grad[ipar];
+      if(!nencorrpar)
+	continue;
+      // the expected number of events is J(x + log10(encorr)) x encorr x acceptance, its derivative with respect to encorr
+      // is (J'(x + log10(encorr)) / ln(10) + J(x + log10(encorr))) x acceptance
+      Double_t dj = fJ->Derivative(log10en_corr) / TMath::Ln10() + fJ->Eval(log10en_corr);
+      Double_t c_encorr = dlgl * dj * bsize * exposure_scale * exposure[i];
+      TSPECFITF1::EvalGradient(fEnCorr, &log10en[i], &eval_grad_encorr[0]);
+      for (Int_t ipar = 0; ipar < nencorrpar; ipar++)
+	grad_encorr[ipar] += c_encorr * eval_grad_encorr[ipar];
+    }
+  return true;
+}
+
+Bool_t TCRFlux::AddFisherInformation(Double_t log10en_min, Double_t log10en_max, Int_t n, Double_t *fisher, Bool_t with_encorr)
+{
+  if(!fJ || HasResponse())
+    return false;
+  const Double_t *log10_encorr_values = 0;
+  const Double_t *encorr_values = GetEncorrValues(&log10_encorr_values);
+  Int_t npar = fJ->GetNpar();
+  Int_t nencorrpar = ((with_encorr && encorr_values) ? fEnCorr->GetNpar() : 0);
+  if(npar + nencorrpar > n)
+    {
+      fprintf(stderr, "ERROR: AddFisherInformation: matrix must have at least %d rows\n", npar + nencorrpar);
+      return false;
+    }
+  // derivatives of the expected number of events with respect to the flux parameters followed by the energy correction parameters
+  eval_grad.resize(npar + nencorrpar);
+  eval_grad_encorr.resize(nencorrpar);
+  for (Int_t i = 0; i < (Int_t) log10en.size(); i++)
+    {
+      if(log10en[i] < log10en_min || log10en[i] > log10en_max)
+	continue;
+      Double_t acc = specfit_uti::GetLinBinSize(log10en[i], log10en_bsize[i]) * exposure_scale * exposure[i];
+      Double_t encorr = (encorr_values ? encorr_values[i] : 1.0);
+      Double_t log10en_corr = log10en[i] + (encorr_values ? log10_encorr_values[i] : 0.0);
+      Double_t j = fJ->Eval(log10en_corr);
+      Double_t mu = j * encorr * acc;
+      if(!(mu > 0))
+	continue;
+      TSPECFITF1::EvalGradient(fJ, &log10en_corr, &eval_grad[0]);
+      for (Int_t ipar = 0; ipar < npar; ipar++)
+	eval_grad[ipar] *= encorr * acc;
+      if(nencorrpar)
+	{
+	  // same as in AddLogLikelihoodGradient
+	  Double_t dj = fJ->Derivative(log10en_corr) / TMath::Ln10() + j;
+	  TSPECFITF1::EvalGradient(fEnCorr, &log10en[i], &eval_grad_encorr[0]);
+	  for (Int_t ipar = 0; ipar < nencorrpar; ipar++)
+	    eval_grad[npar + ipar] = dj * acc * eval_grad_encorr[ipar];
+	}
+      for (Int_t a = 0; a < npar + nencorrpar; a++)
+	{
+	  Double_t ga = eval_grad[a] / mu;
+	  for (Int_t b = 0; b < npar + nencorrpar; b++)
+	    fisher[a * n + b] += ga * eval_grad[b];
+	}
+    }
+  return true;
+}
+
+void TCRFlux::FillNeventsFit()
+{
+  if(!nevents_fit_pending || !fJ)
+    return;
+  const Double_t *log10_encorr_values = 0;
+  const Double_t *encorr_values = GetEncorrValues(&log10_encorr_values);
+  for (Int_t i = 0; i < (Int_t) bpl_zero_run_bin.size() && i < (Int_t) log10en.size(); i++)
+    {
+      if(!bpl_zero_run_bin[i])
+	continue;
+      Double_t bsize = specfit_uti::GetLinBinSize(log10en[i], log10en_bsize[i]);
+      Double_t encorr = (encorr_values ? encorr_values[i] : 1.0);
+      Double_t log10en_corr = log10en[i] + (encorr_values ? log10_encorr_values[i] : 0.0);
+      nevents_fit[i] = fJ->Eval(log10en_corr) * (encorr * bsize) * exposure_scale * exposure[i];
+    }
+  nevents_fit_pending = false;
+}
+
+// Append the bins that contribute to the log likelihood in the log10(E/eV) range
+Int_t TCRFlux::GetFitBins(Double_t log10en_min, Double_t log10en_max, std::vector<Double_t> &log10en_corr_values, std::vector<Double_t> &acceptance_values,
+    std::vector<Double_t> &nevents_values)
+{
+  const Double_t *log10_encorr_values = 0;
+  const Double_t *encorr_values = GetEncorrValues(&log10_encorr_values);
+  Int_t nbins = 0;
+  for (Int_t i = 0; i < (Int_t) log10en.size(); i++)
+    {
+      if(log10en[i] < log10en_min || log10en[i] > log10en_max)
+	continue;
+      Double_t bsize = specfit_uti::GetLinBinSize(log10en[i], log10en_bsize[i]);
+      Double_t encorr = (encorr_values ? encorr_values[i] : 1.0);
+      log10en_corr_values.push_back(log10en[i] + (encorr_values ? log10_encorr_values[i] : 0.0));
+      acceptance_values.push_back((encorr * bsize) * exposure_scale * exposure[i]);
+      nevents_values.push_back(nevents[i]);
+      nbins++;
+    }
+  return nbins;
+}
+
+// Multiply the fit predictions by a constant factor c and update the log likelihoods analytically
+void TCRFlux::RescaleLogLikelihood(Double_t c)
+{
+  if(c <= 0)
+    {
+      fprintf(stderr, "ERROR: RescaleLogLikelihood: scale factor must be positive!\n");
+      return;
+    }
+  Double_t ln_c = TMath::Log(c);
+  log_likelihood.first += 2.0 * (c - 1.0) * nevents_sum.second - 2.0 * ln_c * nevents_sum.first;
+  log_likelihood_nonzero.first += 2.0 * (c - 1.0) * nevents_sum_nonzero.second - 2.0 * ln_c * nevents_sum_nonzero.first;
+  log_likelihood_restricted.first += 2.0 * (c - 1.0) * nevents_sum_restricted.second - 2.0 * ln_c * nevents_sum_restricted.first;
+  nevents_sum.second *= c;
+  nevents_sum_nonzero.second *= c;
+  nevents_sum_restricted.second *= c;
+}
 // count the number of events between the minimum and maximum energies and (if the null hypothesis flux function is provided)
 // return the number of events expected from the flux function and the number of events observed in the data
 std::pair<Double_t, Double_t> TCRFlux::EvalNull()
 {
+  SPECFIT_TRACE("TCRFlux::EvalNull", "null");
   std::pair<Double_t, Double_t> nexpect_nobserve = std::make_pair(0, 0);
   bins_null.clear();
   nevents_null.clear();
@@ -201,6 +848,8 @@ std::pair<Double_t, Double_t> TCRFlux::EvalNull()
   Double_t encorr_en_max = (fEnCorr ? fEnCorr->Eval(fJ_null->GetXmax()) : 1.0);
   Double_t log10en_min_corr = fJ_null->GetXmin() + TMath::Log10(encorr_en_min);
   Double_t log10en_max_corr = fJ_null->GetXmax() + TMath::Log10(encorr_en_max);
+  const Double_t *log10_encorr_values = 0;
+  const Double_t *encorr_values = GetEncorrValues(&log10_encorr_values);
   for (Int_t i = 0; i < (Int_t) log10en.size(); i++)
     {
       // apply the energy limits with energy correction that's appropriate for the experiment
@@ -208,10 +857,10 @@ std::pair<Double_t, Double_t> TCRFlux::EvalNull()
 	continue;
       Double_t bsize = specfit_uti::GetLinBinSize(log10en[i], log10en_bsize[i]);
       // correct the predictions appropriately if the energy correction function is being applied
-      Double_t encorr = (fEnCorr ? fEnCorr->Eval(log10en[i]) : 1.0);
-      Double_t log10en_corr = log10en[i] + TMath::Log10(encorr);
+      Double_t encorr = (encorr_values ? encorr_values[i] : 1.0);
+      Double_t log10en_corr = log10en[i] + (encorr_values ? log10_encorr_values[i] : 0.0);
       // number of events expected from the given flux function
-      Double_t nexpect = fJ_null->Eval(log10en_corr) * (encorr * bsize) * exposure[i];
+      Double_t nexpect = fJ_null->Eval(log10en_corr) * (encorr * bsize) * exposure_scale * exposure[i];
       bins_null.push_back(i);
       nevents_null.push_back(nexpect);
       nexpect_nobserve.first += nexpect;
@@ -222,8 +871,50 @@ std::pair<Double_t, Double_t> TCRFlux::EvalNull()
   return nexpect_nobserve;
 }
 
+Bool_t TCRFlux::BuildNullPrefixSums()
+{
+  null_prefix_log10en.clear();
+  null_prefix_expected.assign(1, 0.0);
+  null_prefix_observed.assign(1, 0.0);
+  if(!fJ_null)
+    return false;
+  const Double_t *log10_encorr_values = 0;
+  const Double_t *encorr_values = GetEncorrValues(&log10_encorr_values);
+  std::vector<std::pair<Double_t, Int_t> > order(log10en.size());
+  for (Int_t i = 0; i < (Int_t) log10en.size(); i++)
+    order[i] = std::make_pair(log10en[i], i);
+  std::sort(order.begin(), order.end());
+  for (Int_t k = 0; k < (Int_t) order.size(); k++)
+    {
+      Int_t i = order[k].second;
+      Double_t bsize = specfit_uti::GetLinBinSize(log10en[i], log10en_bsize[i]);
+      Double_t encorr = (encorr_values ? encorr_values[i] : 1.0);
+      Double_t log10en_corr = log10en[i] + (encorr_values ? log10_encorr_values[i] : 0.0);
+      Double_t nexpect = fJ_null->Eval(log10en_corr) * (encorr * bsize) * exposure_scale * exposure[i];
+      null_prefix_log10en.push_back(log10en[i]);
+      null_prefix_expected.push_back(null_prefix_expected.back() + nexpect);
+      null_prefix_observed.push_back(null_prefix_observed.back() + nevents[i]);
+    }
+  return true;
+}
+
+std::pair<Double_t, Double_t> TCRFlux::EvalNullWindow(Double_t log10en_lo, Double_t log10en_hi) const
+{
+  if(!null_prefix_log10en.size())
+    return std::make_pair(0.0, 0.0);
+  // window in the energy scale of the experiment, same as in EvalNull
+  Double_t log10en_min_corr = log10en_lo + (fEnCorr ? TMath::Log10(fEnCorr->Eval(log10en_lo)) : 0.0);
+  Double_t log10en_max_corr = log10en_hi + (fEnCorr ? TMath::Log10(fEnCorr->Eval(log10en_hi)) : 0.0);
+  Int_t ilo = (Int_t) (std::lower_bound(null_prefix_log10en.begin(), null_prefix_log10en.end(), log10en_min_corr) - null_prefix_log10en.begin());
+  Int_t ihi = (Int_t) (std::upper_bound(null_prefix_log10en.begin(), null_prefix_log10en.end(), log10en_max_corr) - null_prefix_log10en.begin());
+  if(ihi <= ilo)
+    return std::make_pair(0.0, 0.0);
+  return std::make_pair(null_prefix_expected[ihi] - null_prefix_expected[ilo], null_prefix_observed[ihi] - null_prefix_observed[ilo]);
+}
+
 TGraphAsymmErrors* TCRFlux::GetJ() const
 {
+  SPECFIT_TRACE("TCRFlux::GetJ", "graph");
   TGraphAsymmErrors *g = new TGraphAsymmErrors(nevents.size());
   g->SetName(specfit_uti::get_unique_object_name(TString("g") + TString(GetName()) + "_J"));
   g->SetTitle(TString::Format("%s;log_{10}(E/eV);J [ eV^{-1} m^{-2} sr^{-1} s^{-1} ]", GetTitle()));
@@ -235,9 +926,9 @@ TGraphAsymmErrors* TCRFlux::GetJ() const
     {
       Double_t bsize = specfit_uti::GetLinBinSize(log10en[i], log10en_bsize[i]);
       Double_t encorr = (fEnCorr ? fEnCorr->Eval(log10en[i]) : 1.0);
-      Double_t j = 1.0 / encorr / bsize / exposure[i] * nevents[i];
-      Double_t j_e1 = 1.0 / encorr / bsize / exposure[i] * specfit_uti::get_fc_error_low(nevents[i]);
-      Double_t j_e2 = 1.0 / encorr / bsize / exposure[i] * specfit_uti::get_fc_error_high(nevents[i]);
+      Double_t j = 1.0 / encorr / bsize / (exposure_scale * exposure[i]) * nevents[i];
+      Double_t j_e1 = 1.0 / encorr / bsize / (exposure_scale * exposure[i]) * specfit_uti::get_fc_error_low(nevents[i]);
+      Double_t j_e2 = 1.0 / encorr / bsize / (exposure_scale * exposure[i]) * specfit_uti::get_fc_error_high(nevents[i]);
       g->SetPoint(i, log10en[i] + TMath::Log10(encorr), j);
       g->SetPointError(i, 0, 0, j_e1, j_e2);
       if(nevents[i] > 0.5)
@@ -272,6 +963,7 @@ TGraphAsymmErrors* TCRFlux::GetJ() const
 
 TGraphErrors* TCRFlux::GetJ_simple_errors() const
 {
+  SPECFIT_TRACE("TCRFlux::GetJ_simple_errors", "graph");
   TGraphErrors *g = new TGraphErrors(nevents.size());
   g->SetName(specfit_uti::get_unique_object_name(TString("g") + TString(GetName()) + "_J"));
   g->SetTitle(TString::Format("%s;log_{10}(E/eV);J [ eV^{-1} m^{-2} sr^{-1} s^{-1} ]", GetTitle()));
@@ -283,8 +975,8 @@ TGraphErrors* TCRFlux::GetJ_simple_errors() const
     {
       Double_t bsize = specfit_uti::GetLinBinSize(log10en[i], log10en_bsize[i]);
       Double_t encorr = (fEnCorr ? fEnCorr->Eval(log10en[i]) : 1.0);
-      Double_t j = 1.0 / encorr / bsize / exposure[i] * nevents[i];
-      Double_t j_e1 = 1.0 / encorr / bsize / exposure[i] * TMath::Sqrt(nevents[i]);
+      Double_t j = 1.0 / encorr / bsize / (exposure_scale * exposure[i]) * nevents[i];
+      Double_t j_e1 = 1.0 / encorr / bsize / (exposure_scale * exposure[i]) * TMath::Sqrt(nevents[i]);
       g->SetPoint(i, log10en[i] + TMath::Log10(encorr), j);
       g->SetPointError(i, 0, j_e1);
       if(nevents[i] > 0.5)
@@ -319,6 +1011,7 @@ TGraphErrors* TCRFlux::GetJ_simple_errors() const
 
 TGraphAsymmErrors* TCRFlux::GetE3J() const
 {
+  SPECFIT_TRACE("TCRFlux::GetE3J", "graph");
   TGraphAsymmErrors *g = new TGraphAsymmErrors(nevents.size());
   g->SetName(specfit_uti::get_unique_object_name(TString("g") + TString(GetName()) + "_E3J"));
   g->SetTitle(TString::Format("%s;log_{10}(E/eV);E^{3} J [ eV^{-2} m^{-2} sr^{-1} s^{-1} ]", GetTitle()));
@@ -331,9 +1024,9 @@ TGraphAsymmErrors* TCRFlux::GetE3J() const
       Double_t bsize = specfit_uti::GetLinBinSize(log10en[i], log10en_bsize[i]);
       Double_t e3 = TMath::Power(10.0, 3.0 * log10en[i]);
       Double_t encorr = (fEnCorr ? fEnCorr->Eval(log10en[i]) : 1.0);
-      Double_t e3j = encorr * encorr * e3 / bsize / exposure[i] * nevents[i];
-      Double_t e3j_e1 = encorr * encorr * e3 / bsize / exposure[i] * specfit_uti::get_fc_error_low(nevents[i]);
-      Double_t e3j_e2 = encorr * encorr * e3 / bsize / exposure[i] * specfit_uti::get_fc_error_high(nevents[i]);
+      Double_t e3j = encorr * encorr * e3 / bsize / (exposure_scale * exposure[i]) * nevents[i];
+      Double_t e3j_e1 = encorr * encorr * e3 / bsize / (exposure_scale * exposure[i]) * specfit_uti::get_fc_error_low(nevents[i]);
+      Double_t e3j_e2 = encorr * encorr * e3 / bsize / (exposure_scale * exposure[i]) * specfit_uti::get_fc_error_high(nevents[i]);
       g->SetPoint(i, log10en[i] + TMath::Log10(encorr), e3j);
       g->SetPointError(i, 0, 0, e3j_e1, e3j_e2);
       if(nevents[i] > 0.5)
@@ -368,6 +1061,7 @@ TGraphAsymmErrors* TCRFlux::GetE3J() const
 
 TGraphErrors* TCRFlux::GetE3J_simple_errors() const
 {
+  SPECFIT_TRACE("TCRFlux::GetE3J_simple_errors", "graph");
   TGraphErrors *g = new TGraphErrors(nevents.size());
   g->SetName(specfit_uti::get_unique_object_name(TString("g") + TString(GetName()) + "_E3J"));
   g->SetTitle(TString::Format("%s;log_{10}(E/eV);E^{3} J [ eV^{-2} m^{-2} sr^{-1} s^{-1} ]", GetTitle()));
@@ -380,8 +1074,8 @@ TGraphErrors* TCRFlux::GetE3J_simple_errors() const
       Double_t bsize = specfit_uti::GetLinBinSize(log10en[i], log10en_bsize[i]);
       Double_t e3 = TMath::Power(10.0, 3.0 * log10en[i]);
       Double_t encorr = (fEnCorr ? fEnCorr->Eval(log10en[i]) : 1.0);
-      Double_t e3j = encorr * encorr * e3 / bsize / exposure[i] * nevents[i];
-      Double_t e3j_e1 = encorr * encorr * e3 / bsize / exposure[i] * TMath::Sqrt(nevents[i]);
+      Double_t e3j = encorr * encorr * e3 / bsize / (exposure_scale * exposure[i]) * nevents[i];
+      Double_t e3j_e1 = encorr * encorr * e3 / bsize / (exposure_scale * exposure[i]) * TMath::Sqrt(nevents[i]);
       g->SetPoint(i, log10en[i] + TMath::Log10(encorr), e3j);
       g->SetPointError(i, 0, e3j_e1);
       if(nevents[i] > 0.5)
@@ -417,6 +1111,7 @@ TGraphErrors* TCRFlux::GetE3J_simple_errors() const
 
 TGraphAsymmErrors* TCRFlux::GetNevents() const
 {
+  SPECFIT_TRACE("TCRFlux::GetNevents", "graph");
   TGraphAsymmErrors *g = new TGraphAsymmErrors(nevents.size());
   g->SetName(specfit_uti::get_unique_object_name(TString("g") + TString(GetName()) + "_N"));
   g->SetTitle(TString::Format("%s;log_{10}(E/eV);N_{EVENTS} / BIN", GetTitle()));
@@ -445,6 +1140,7 @@ TGraphAsymmErrors* TCRFlux::GetNevents() const
 
 TGraphErrors* TCRFlux::GetNevents_simple_errors() const
 {
+  SPECFIT_TRACE("TCRFlux::GetNevents_simple_errors", "graph");
   TGraphErrors *g = new TGraphErrors(nevents.size());
   g->SetName(specfit_uti::get_unique_object_name(TString("g") + TString(GetName()) + "_N"));
   g->SetTitle(TString::Format("%s;log_{10}(E/eV);N_{EVENTS} / BIN", GetTitle()));
@@ -472,6 +1168,7 @@ TGraphErrors* TCRFlux::GetNevents_simple_errors() const
 
 TGraph* TCRFlux::GetExposure() const
 {
+  SPECFIT_TRACE("TCRFlux::GetExposure", "graph");
   TGraph *g = new TGraphErrors(exposure.size());
   g->SetName(specfit_uti::get_unique_object_name(TString("g") + TString(GetName()) + "_exposure"));
   g->SetTitle(TString::Format("%s;log_{10}(E/eV);Exposure", GetTitle()));
@@ -497,6 +1194,7 @@ TGraph* TCRFlux::GetExposure() const
 
 TGraph* TCRFlux::GetNeventsFit() const
 {
+  SPECFIT_TRACE("TCRFlux::GetNeventsFit", "graph");
   TGraph *g = new TGraph(nevents_fit.size());
   g->SetName(specfit_uti::get_unique_object_name(TString("g") + TString(GetName()) + "_N_fit"));
   g->SetTitle(TString::Format("%s;log_{10}(E/eV);N_{EVENTS}^{FIT} / BIN", GetTitle()));
@@ -518,6 +1216,7 @@ TGraph* TCRFlux::GetNeventsFit() const
 
 TGraph* TCRFlux::GetNeventsNull() const
 {
+  SPECFIT_TRACE("TCRFlux::GetNeventsNull", "graph");
   TGraph *g = new TGraph(bins_null.size());
   g->SetName(specfit_uti::get_unique_object_name(TString("g") + TString(GetName()) + "_N_null"));
   g->SetTitle(TString::Format("%s;log_{10}(E/eV);N_{EVENTS}^{NULL} / BIN", GetTitle()));
@@ -541,6 +1240,7 @@ TGraph* TCRFlux::GetNeventsNull() const
 // Divide this flux by another flux described by TCRFlux object and return the result as TGraphErrors
 TGraphErrors* TCRFlux::FluxRatio_Energy_Bins(const TCRFlux* other, Bool_t ok_to_extrapolate) const
 {
+  SPECFIT_TRACE("TCRFlux::FluxRatio_Energy_Bins", "graph");
   if(log10en.empty())
     {
       fprintf(stderr,"warning: this instance is empty %s, can't form ratio with %s!\n", GetName(), other->GetName());
@@ -579,6 +1279,7 @@ TGraphErrors* TCRFlux::FluxRatio_Energy_Bins(const TCRFlux* other, Bool_t ok_to_
 
 void TCRFlux::Plot(const char *what, const char *draw_opt)
 {
+  SPECFIT_TRACE("TCRFlux::Plot", "graph");
   TString s_what(what);
   s_what.ToLower();
   if(s_what == "e3j")
@@ -613,6 +1314,7 @@ void TCRFlux::Plot(const char *what, const char *draw_opt)
 	}
       if(!nevents_fit.empty())
 	{
+	  FillNeventsFit();
 	  clean_graph_if_allocated((TObject*&)_gNeventsFit);
 	  _gNeventsFit = GetNeventsFit();
 	  _gNeventsFit->Draw("L,same");
@@ -681,8 +1383,62 @@ void TCRFlux::RescaleExposure(Double_t c)
   // useful for displaying purposes.
   for (std::vector<Double_t>::iterator it = exposure.begin(); it != exposure.end(); it++)
     (*it) *= c;
+  bpl_suffstat_valid = false;
+}
+
+Bool_t TCRFlux::SetAsimovData(Double_t exposure_factor)
+{
+  if(!fJ)
+    {
+      fprintf(stderr, "ERROR: SetAsimovData: flux function is not set for '%s'!\n", GetName());
+      return false;
+    }
+  if(!asimov_data)
+    {
+      data_nevents = nevents;
+      data_exposure = exposure;
+      data_response_acceptance = response_acceptance;
+    }
+  // a response that's been set since is that of the data
+  if(data_response_acceptance.size() != response_acceptance.size())
+    data_response_acceptance = response_acceptance;
+  exposure = data_exposure;
+  for (Int_t i = 0; i < (Int_t) exposure.size(); i++)
+    exposure[i] *= exposure_factor;
+  response_acceptance = data_response_acceptance;
+  for (Int_t j = 0; j < (Int_t) response_acceptance.size(); j++)
+    response_acceptance[j] *= exposure_factor;
+  asimov_data = true;
+  // expected numbers of events in all bins, the sufficient statistics of the data don't apply
+  bpl_suffstat_valid = false;
+  CalcLogLikelihood(log10en_min_data, log10en_max_data);
+  FillNeventsFit();
+  nevents = nevents_fit;
+  bpl_suffstat_valid = false;
+  return true;
 }
 
+void TCRFlux::RestoreData()
+{
+  if(!asimov_data)
+    return;
+  nevents = data_nevents;
+  exposure = data_exposure;
+  // unless the response has been set again since
+  if(data_response_acceptance.size() == response_acceptance.size())
+    response_acceptance = data_response_acceptance;
+  clear_asimov_data();
+  bpl_suffstat_valid = false;
+}
+
+// the data kept while the Asimov dataset is set are dropped, e.g. when new data are loaded
+void TCRFlux::clear_asimov_data()
+{
+  data_nevents.clear();
+  data_exposure.clear();
+  data_response_acceptance.clear();
+  asimov_data = false;
+}
 
 Double_t TCRFlux::nEventsTotal()
 {
@@ -1,10 +1,21 @@
 // Dmitri Ivanov <dmiivanov@gmail.com>
 
 #include "TCRFluxFit.h"
+#include "specfit_trace.h"
+#include "specfit_min.h"
+#include "specfit_irls.h"
+#include "TSBPLF1.h"
 #include <cstdio>
 #include <cstdlib>
 #include "TTree.h"
 #include "TAxis.h"
+#include "TMath.h"
+#include "TROOT.h"
+#if __cplusplus >= 201103L
+#define SPECFIT_THREAD_LOCAL thread_local
+#else
+#define SPECFIT_THREAD_LOCAL
+#endif
 
 ClassImp(TCRFluxFit);
 
@@ -14,6 +25,7 @@ TCRFluxFit::~TCRFluxFit()
   // we keep track of it separately
   if(mFIT)
     delete mFIT;
+  stop_fd_workers();
 
   // be sure the clean up any TCRFlux objects that were created by this class
   if(TCRFlux_Objects_Created_By_This.GetEntries())
@@ -23,6 +35,7 @@ TCRFluxFit::~TCRFluxFit()
 	;
     }
   TCRFlux_Objects_Created_By_This.Clear();
+  TF1_Objects_Created_By_This.Delete();
   Fluxes.clear();
   Fluxes_ordered.clear();
 }
@@ -31,6 +44,7 @@ TCRFluxFit::~TCRFluxFit()
 // E^3 J function is optional, it's mainly used for plotting the results
 void TCRFluxFit::SetFluxFun(TF1 *fJ_set, TF1 *fE3J_set)
 {
+  SPECFIT_TRACE("TCRFluxFit::SetFluxFun", "setup");
   fJ = fJ_set;
   // if E^3 J function was not given then attempt to construct it from
   // the J function
@@ -47,6 +61,7 @@ void TCRFluxFit::SetFluxFun(TF1 *fJ_set, TF1 *fE3J_set)
 // E^3 J function is optional, it's mainly used for plotting the results
 void TCRFluxFit::SetNullFun(TF1 *fJ_null_set, TF1 *fE3J_null_set)
 {
+  SPECFIT_TRACE("TCRFluxFit::SetNullFun", "setup");
   fJ_null = fJ_null_set;
   // if E^3 J function was not given then attempt to construct it from
   // the J function
@@ -116,6 +131,7 @@ Bool_t TCRFluxFit::Add(const char *name, const char *title, Int_t nbins, const D
 // col4: exposure [m^2 sr s] for each energy bin center value
 Bool_t TCRFluxFit::Add(const char *name, const char *title, const char *ascii_file, TF1 *fEnCorr_set)
 {
+  SPECFIT_TRACE("TCRFluxFit::Add", "io");
   TTree *t = new TTree("t", "");
   if(!t->ReadFile(ascii_file, "log10en/D:log10en_bsize/D:nevents/D:exposure/D"))
     {
@@ -134,6 +150,7 @@ Bool_t TCRFluxFit::Add(const char *name, const char *title, const char *ascii_fi
 
 void TCRFluxFit::SelectEnergyRange(Double_t log10en_min, Double_t log10en_max)
 {
+  SPECFIT_TRACE("TCRFluxFit::SelectEnergyRange", "setup");
   for (std::map<TString, TCRFlux*>::iterator iflux = Fluxes.begin(); iflux != Fluxes.end(); iflux++)
     {
       TCRFlux &flux = *iflux->second;
@@ -219,10 +236,19 @@ void TCRFluxFit::CalcLogLikelihood()
   log_likelihood = std::make_pair(0, 0);
   log_likelihood_nonzero = std::make_pair(0, 0);
   log_likelihood_restricted = std::make_pair(0, 0);
+  Bool_t flux_timing = stats.GetFluxTiming();
   for (std::map<TString, TCRFlux*>::iterator iflux = Fluxes.begin(); iflux != Fluxes.end(); iflux++)
     {
       TCRFlux &flux = *iflux->second;
-      flux.CalcLogLikelihood(log10en_min, log10en_max);
+      if(flux_timing)
+	{
+	  Double_t real_time = TCRFluxFitStats::get_real_time();
+	  Double_t cpu_time = TCRFluxFitStats::get_cpu_time();
+	  flux.CalcLogLikelihood(log10en_min, log10en_max);
+	  stats.AddFluxTime(iflux->first, TCRFluxFitStats::get_real_time() - real_time, TCRFluxFitStats::get_cpu_time() - cpu_time);
+	}
+      else
+	flux.CalcLogLikelihood(log10en_min, log10en_max);
       log_likelihood.first += flux.log_likelihood.first;
       log_likelihood.second += flux.log_likelihood.second;
       log_likelihood_nonzero.first += flux.log_likelihood_nonzero.first;
@@ -236,6 +262,7 @@ void TCRFluxFit::CalcLogLikelihood()
 // and that are actually observed in the data
 std::pair<Double_t, Double_t> TCRFluxFit::EvalNull()
 {
+  SPECFIT_TRACE("TCRFluxFit::EvalNull", "null");
   std::pair<Double_t, Double_t> nexpected_nobserved = std::make_pair(0, 0);
   for (std::map<TString, TCRFlux*>::iterator iflux = Fluxes.begin(); iflux != Fluxes.end(); iflux++)
     {
@@ -247,23 +274,623 @@ std::pair<Double_t, Double_t> TCRFluxFit::EvalNull()
   return nexpected_nobserved;
 }
 
-static TCRFluxFit *pointer_to_global_instance_of_TCRFluxFit = 0;
+TH2D* TCRFluxFit::ScanNull(Int_t nbins, Double_t log10en_lo, Double_t log10en_hi)
+{
+  SPECFIT_TRACE("TCRFluxFit::ScanNull", "null");
+  scan_null_max_sigma = 0;
+  scan_null_max_lo = 0;
+  scan_null_max_hi = 0;
+  scan_null_max_nexpected = 0;
+  scan_null_max_nobserved = 0;
+  if(!fJ_null)
+    {
+      fprintf(stderr, "ERROR: set the null hypothesis function before scanning!\n");
+      return 0;
+    }
+  if(nbins < 1)
+    {
+      fprintf(stderr, "ERROR: ScanNull: number of bins must be positive!\n");
+      return 0;
+    }
+  if(!(log10en_lo < log10en_hi))
+    {
+      log10en_lo = log10en_min;
+      log10en_hi = log10en_max;
+    }
+  for (Int_t iflux = 0; iflux < (Int_t) Fluxes_ordered.size(); iflux++)
+    Fluxes_ordered[iflux]->BuildNullPrefixSums();
+  Double_t d = (log10en_hi - log10en_lo) / (Double_t) nbins;
+  TH2D *h = new TH2D(specfit_uti::get_unique_object_name("hScanNull"), "Null hypothesis scan;window start log_{10}(E/eV);window end log_{10}(E/eV);significance [#sigma]",
+      nbins, log10en_lo - 0.5 * d, log10en_hi - 0.5 * d, nbins, log10en_lo + 0.5 * d, log10en_hi + 0.5 * d);
+  h->SetDirectory(0);
+  h->SetStats(false);
+  for (Int_t i = 0; i < nbins; i++)
+    {
+      for (Int_t j = i + 1; j <= nbins; j++)
+	{
+	  Double_t lo = log10en_lo + (Double_t) i * d;
+	  Double_t hi = log10en_lo + (Double_t) j * d;
+	  Double_t nexpected = 0, nobserved = 0;
+	  for (Int_t iflux = 0; iflux < (Int_t) Fluxes_ordered.size(); iflux++)
+	    {
+	      std::pair<Double_t, Double_t> x = Fluxes_ordered[iflux]->EvalNullWindow(lo, hi);
+	      nexpected += x.first;
+	      nobserved += x.second;
+	    }
+	  Int_t n = TMath::Nint(nobserved);
+	  Double_t sigma = specfit_uti::PoissonPchanceFast(n, nexpected, true);
+	  if((Double_t) n < nexpected)
+	    sigma = -sigma;
+	  h->SetBinContent(i + 1, j, sigma);
+	  if(sigma > scan_null_max_sigma)
+	    {
+	      scan_null_max_sigma = sigma;
+	      scan_null_max_lo = lo;
+	      scan_null_max_hi = hi;
+	      scan_null_max_nexpected = nexpected;
+	      scan_null_max_nobserved = nobserved;
+	    }
+	}
+    }
+  return h;
+}
+
+// each thread fits with its own instance (see MakeWorkerCopy)
+static SPECFIT_THREAD_LOCAL TCRFluxFit *pointer_to_global_instance_of_TCRFluxFit = 0;
 static void fcn_for_mFIT(Int_t &npar, Double_t *gin, Double_t &f, Double_t *par, Int_t iflag)
 {
-  (void) (npar);
-  (void) (gin);
-  (void) (iflag);
   f = 0;
   if(pointer_to_global_instance_of_TCRFluxFit)
+    pointer_to_global_instance_of_TCRFluxFit->EvalFCN(npar, gin, f, par, iflag);
+}
+
+void TCRFluxFit::EvalFCN(Int_t &npar, Double_t *gin, Double_t &f, Double_t *par, Int_t iflag)
+{
+  (void) (npar);
+  Double_t real_time = TCRFluxFitStats::get_real_time();
+  Double_t cpu_time = TCRFluxFitStats::get_cpu_time();
+  if(fcn_parameters.size())
+    {
+      // Minuit's parameters don't include the profiled ones
+      profile(par);
+      f = log_likelihood.first;
+    }
+  else
+    {
+      SetParameters(par);
+      f = GetLogLikelihood().first;
+    }
+  // roughness penalty of a spline flux function
+  const TSPLINEF1 *fspline = get_spline();
+  if(fspline)
+    f += fspline->GetPenalty();
+  if(iflag == 2 && gin && gradient_fcn)
+    calc_gradient(gin);
+  else if(iflag == 2 && gin && parallel_fcn)
+    calc_parallel_gradient(par, f, gin);
+  stats.nfcn++;
+  if(iflag == 2)
+    stats.ngrad++;
+  // Minuit keeps the name of the command that's being executed, the phase name is made when it changes
+  if(!fcn_phase.Length() || (mFIT ? mFIT->fCfrom != fcn_phase_command : fcn_phase_command.Length() > 0))
+    {
+      fcn_phase_command = (mFIT ? mFIT->fCfrom : TString(""));
+      fcn_phase = fcn_phase_command.Strip(TString::kBoth);
+      fcn_phase.ToLower();
+      if(!fcn_phase.Length())
+	fcn_phase = "fcn";
+    }
+  const TString &phase = fcn_phase;
+  stats.AddPhaseTime(phase, TCRFluxFitStats::get_real_time() - real_time, TCRFluxFitStats::get_cpu_time() - cpu_time);
+  // the minimizer has made a new iteration when its estimated distance to the minimum has changed
+  if(mFIT && !minimizer_fcn && (!stats.GetNiterations() || mFIT->fEDM != stats.iter_edm.back() || phase != stats.iter_phase.back()))
+    stats.AddIteration(phase, stats.nfcn, mFIT->fAmin, mFIT->fEDM, mFIT->fISW[3]);
+}
+
+// the minimizers of specfit_min evaluate the FCN and report the iterations through these
+static Double_t fcn_for_minimizer(const Double_t *par, Double_t *grad, void *arg)
+{
+  return ((TCRFluxFit*) arg)->EvalMinimizerFCN(par, grad);
+}
+static void iteration_for_minimizer(Int_t iteration, Double_t fval, Double_t edm, void *arg)
+{
+  ((TCRFluxFit*) arg)->AddMinimizerIteration(iteration, fval, edm);
+}
+
+Double_t TCRFluxFit::EvalMinimizerFCN(const Double_t *par, Double_t *grad)
+{
+  Int_t npar = (Int_t) fd_steps.size();
+  minimizer_par.assign(par, par + npar);
+  for (Int_t i = 0; i < npar; i++)
+    grad[i] = 0;
+  Double_t f = 0;
+  Bool_t grad_fcn = (gradient_fcn || parallel_fcn);
+  EvalFCN(npar, grad, f, &minimizer_par[0], (grad_fcn ? 2 : 4));
+  if(grad_fcn || !TMath::Finite(f))
+    return f;
+  // central differences with a thousandth of the step size, one-sided at the limits
+  for (Int_t i = 0; i < npar; i++)
+    {
+      if(fd_steps[i] == 0)
+	continue;
+      Double_t h = 1e-3 * TMath::Abs(fd_steps[i]);
+      Double_t x_lo = TMath::Max(par[i] - h, fd_xmin[i]);
+      Double_t x_hi = TMath::Min(par[i] + h, fd_xmax[i]);
+      Double_t f_lo = f, f_hi = f;
+      if(x_lo < par[i])
+	{
+	  minimizer_par[i] = x_lo;
+	  EvalFCN(npar, 0, f_lo, &minimizer_par[0], 4);
+	}
+      if(x_hi > par[i])
+	{
+	  minimizer_par[i] = x_hi;
+	  EvalFCN(npar, 0, f_hi, &minimizer_par[0], 4);
+	}
+      minimizer_par[i] = par[i];
+      if(x_hi > x_lo)
+	grad[i] = (f_hi - f_lo) / (x_hi - x_lo);
+    }
+  return f;
+}
+
+void TCRFluxFit::AddMinimizerIteration(Int_t iteration, Double_t fval, Double_t edm)
+{
+  (void) (iteration);
+  TString phase = minimizer;
+  phase.ToLower();
+  stats.AddIteration(phase, stats.nfcn, fval, edm, 0);
+}
+
+Int_t TCRFluxFit::run_minimizer(Int_t npar, Bool_t verbose)
+{
+  SPECFIT_TRACE("TCRFluxFit::run_minimizer", "fit");
+  // starting values of Minuit's parameters
+  std::vector<Double_t> x(npar);
+  set_fd_steps(npar);
+  for (Int_t k = 0; k < npar; k++)
+    x[k] = fd_par[k];
+  // the FCN takes the name of the phase from Minuit
+  TString phase = minimizer;
+  phase.ToLower();
+  mFIT->fCfrom = phase;
+  Int_t niter = 0;
+  Double_t fval = 0;
+  minimizer_fcn = true;
+  Int_t status = 0;
+  if(minimizer == "LBFGSB")
+    status = specfit_min::lbfgsb(npar, fcn_for_minimizer, this, &x[0], &fd_xmin[0], &fd_xmax[0], &niter, &fval, 1000, 2e-4, 10,
+	iteration_for_minimizer);
+  else
+    status = specfit_min::trust_region(npar, fcn_for_minimizer, this, &x[0], &fd_xmin[0], &fd_xmax[0], &niter, &fval, 200, 2e-4,
+	iteration_for_minimizer);
+  minimizer_fcn = false;
+  if(verbose)
+    fprintf(stdout, "%s: status %d after %d iterations, FCN = %.6f\n", phase.Data(), status, niter, fval);
+  // Minuit's error analysis at the solution, unless Fit evaluates the Hessian in parallel or uses the Fisher information
+  for (Int_t k = 0; k < npar; k++)
+    {
+      TString name;
+      Double_t value = 0, error = 0, lo = 0, hi = 0;
+      Int_t iint = 0;
+      mFIT->mnpout(k, name, value, error, lo, hi, iint);
+      if(iint > 0)
+	mFIT->DefineParameter(k, name, x[k], error, lo, hi);
+    }
+  if(parallel_fcn || fisher_fcn)
+    return status;
+  SPECFIT_TRACE("TMinuit::Hesse", "fit");
+  Int_t hesse_status = mFIT->Command("HESSE");
+  if(!status && hesse_status)
+    status = 4;
+  return status;
+}
+
+void TCRFluxFit::set_fd_steps(Int_t npar)
+{
+  // the fixed parameters have zero step sizes and equal limits
+  fd_par.assign(npar, 0);
+  fd_steps.assign(npar, 0);
+  fd_xmin.resize(npar);
+  fd_xmax.resize(npar);
+  for (Int_t k = 0; k < npar; k++)
+    {
+      TString name;
+      Double_t lo = 0, hi = 0;
+      Int_t iint = 0;
+      mFIT->mnpout(k, name, fd_par[k], fd_steps[k], lo, hi, iint);
+      if(iint <= 0)
+	{
+	  fd_steps[k] = 0;
+	  fd_xmin[k] = fd_xmax[k] = fd_par[k];
+	}
+      else if(lo < hi)
+	{
+	  fd_xmin[k] = lo;
+	  fd_xmax[k] = hi;
+	}
+      else
+	{
+	  fd_xmin[k] = -TMath::Infinity();
+	  fd_xmax[k] = TMath::Infinity();
+	}
+    }
+}
+
+Bool_t TCRFluxFit::calc_gradient(Double_t *gin)
+{
+  fcn_gradient.assign(nfitpar, 0);
+  for (Int_t iflux = 0; iflux < (Int_t) Fluxes_ordered.size(); iflux++)
+    {
+      if(!Fluxes_ordered[iflux]->AddLogLikelihoodGradient(log10en_min, log10en_max, &fcn_gradient[0], (nencorrpar ? &fcn_gradient[nfluxpar] : 0)))
+	return false;
+    }
+  const TSPLINEF1 *fspline = get_spline();
+  if(fspline)
+    fspline->AddPenaltyGradient(&fcn_gradient[0]);
+  for (Int_t i = 0; i < nfitpar; i++)
+    {
+      if(minuit_par_index[i] >= 0)
+	gin[minuit_par_index[i]] = fcn_gradient[i];
+    }
+  return true;
+}
+
+// check that the function is proportional to the parameter ipar in the xmin to xmax range
+static Bool_t is_linear_scale(TF1 *f, Int_t ipar, Double_t xmin, Double_t xmax)
+{
+  Double_t p = f->GetParameter(ipar);
+  Double_t p1 = (p != 0 ? p : 1.0);
+  Int_t nnonzero = 0;
+  Bool_t linear = true;
+  for (Int_t i = 0; i < 5 && linear; i++)
+    {
+      Double_t x = xmin + (xmax - xmin) * ((Double_t) i + 0.5) / 5.0;
+      f->SetParameter(ipar, p1);
+      Double_t y1 = f->Eval(x);
+      f->SetParameter(ipar, 2.0 * p1);
+      Double_t y2 = f->Eval(x);
+      if(y1 == 0)
+	continue;
+      nnonzero++;
+      linear = (TMath::Abs(y2 - 2.0 * y1) <= 1e-9 * TMath::Abs(2.0 * y1));
+    }
+  f->SetParameter(ipar, p);
+  return (linear && nnonzero > 0);
+}
+
+Bool_t TCRFluxFit::SetMinimizer(const char *minimizer_name)
+{
+  TString name(minimizer_name);
+  name.ToUpper();
+  if(name != "MIGRAD" && name != "LBFGSB" && name != "TRUST")
+    {
+      fprintf(stderr, "ERROR: SetMinimizer: minimizer '%s' not understood; use 'MIGRAD', 'LBFGSB', or 'TRUST'!\n", minimizer_name);
+      return false;
+    }
+  minimizer = name;
+  return true;
+}
+
+Bool_t TCRFluxFit::SetProfiledNorm(Int_t ipar)
+{
+  if(ipar < -1 || (fJ && ipar >= fJ->GetNpar()))
+    {
+      fprintf(stderr, "ERROR: SetProfiledNorm: ipar must be -1 (no profiling) or in 0 to %d range\n", (fJ ? fJ->GetNpar() - 1 : 0));
+      return false;
+    }
+  iprofiled_norm = ipar;
+  return true;
+}
+
+Bool_t TCRFluxFit::SetProfiledExposureScale(const char *flux_name, Bool_t profile)
+{
+  TCRFlux *flux = GetFlux(flux_name);
+  if(!flux)
+    return false;
+  flux->exposure_scale_profiled = profile;
+  return true;
+}
+
+Bool_t TCRFluxFit::profiling_on()
+{
+  if(iprofiled_fcn >= 0 || irls_fcn)
+    return true;
+  for (Int_t iflux = 0; iflux < (Int_t) Fluxes_ordered.size(); iflux++)
+    {
+      if(Fluxes_ordered[iflux]->exposure_scale_profiled)
+	return true;
+    }
+  return false;
+}
+
+// fill the fcn_parameters from Minuit's parameters, the profiled parameters keep their last values
+void TCRFluxFit::set_fcn_parameters(const Double_t *par)
+{
+  for (Int_t i = 0; i < (Int_t) fcn_parameters.size(); i++)
+    {
+      if(minuit_par_index[i] >= 0)
+	fcn_parameters[i] = par[minuit_par_index[i]];
+    }
+}
+
+// For the Poisson likelihood the optimal factor c that multiplies the predictions is sum(observed) / sum(expected)
+// and the log likelihood of the rescaled predictions follows analytically (TCRFlux::RescaleLogLikelihood).
+// The normalization is determined by the fluxes whose exposure scales are not profiled, and each profiled exposure
+// scale absorbs the remaining factor for its flux.
+void TCRFluxFit::profile_linear_scales()
+{
+  Double_t nobserved = 0, nexpected = 0;
+  for (Int_t iflux = 0; iflux < (Int_t) Fluxes_ordered.size(); iflux++)
+    {
+      TCRFlux &flux = *Fluxes_ordered[iflux];
+      if(flux.exposure_scale_profiled)
+	continue;
+      nobserved += flux.nevents_sum.first;
+      nexpected += flux.nevents_sum.second;
+    }
+  // with no observed or expected events the optimal factors are degenerate, keep the parameters as they are
+  Double_t c_norm = 1.0;
+  if(iprofiled_fcn >= 0 && nobserved > 0 && nexpected > 0)
+    {
+      c_norm = nobserved / nexpected;
+      fcn_parameters[iprofiled_fcn] *= c_norm;
+    }
+  log_likelihood = std::make_pair(0, 0);
+  log_likelihood_nonzero = std::make_pair(0, 0);
+  log_likelihood_restricted = std::make_pair(0, 0);
+  for (Int_t iflux = 0; iflux < (Int_t) Fluxes_ordered.size(); iflux++)
+    {
+      TCRFlux &flux = *Fluxes_ordered[iflux];
+      Double_t c = c_norm;
+      if(flux.exposure_scale_profiled && flux.nevents_sum.first > 0 && flux.nevents_sum.second > 0)
+	{
+	  c = flux.nevents_sum.first / flux.nevents_sum.second;
+	  flux.exposure_scale *= c / c_norm;
+	}
+      if(c != 1.0)
+	flux.RescaleLogLikelihood(c);
+      log_likelihood.first += flux.log_likelihood.first;
+      log_likelihood.second += flux.log_likelihood.second;
+      log_likelihood_nonzero.first += flux.log_likelihood_nonzero.first;
+      log_likelihood_nonzero.second += flux.log_likelihood_nonzero.second;
+      log_likelihood_restricted.first += flux.log_likelihood_restricted.first;
+      log_likelihood_restricted.second += flux.log_likelihood_restricted.second;
+    }
+}
+
+// load the fitted bins for the current parameters and the coefficients that correspond to them,
+// returns false if the problem is not well defined
+Bool_t TCRFluxFit::irls_load(std::vector<Double_t> &theta, Double_t &log10scale, Double_t &log10en_ref)
+{
+  SetParameters(&fcn_parameters[0]);
+  TBPLF1 *fbpl = (TBPLF1*) fJ;
+  Int_t nbpl = fbpl->GetNbreaks() + 2;
+  // the formula of the function uses the scale factor and the reference energy as printed
+  log10scale = TString::Format("%e", fbpl->GetBplScaleFactor()).Atof();
+  if(!(log10scale > 0))
+    return false;
+  log10scale = TMath::Log10(log10scale);
+  log10en_ref = TString::Format("%f", fbpl->GetBplLog10enMin()).Atof();
+  irls_x.clear();
+  irls_acc.clear();
+  irls_n.clear();
+  irls_col.clear();
+  theta.assign(fcn_parameters.begin(), fcn_parameters.begin() + nbpl);
+  theta[0] = (theta[0] > 0 ? TMath::Log10(theta[0]) : 0.0);
+  for (Int_t iflux = 0; iflux < (Int_t) Fluxes_ordered.size(); iflux++)
+    {
+      TCRFlux &flux = *Fluxes_ordered[iflux];
+      Int_t nbins_flux = flux.GetFitBins(log10en_min, log10en_max, irls_x, irls_acc, irls_n);
+      Int_t col = -1;
+      if(flux.exposure_scale_profiled)
+	{
+	  if(!(flux.exposure_scale > 0))
+	    return false;
+	  col = (Int_t) theta.size();
+	  theta.push_back(TMath::Log10(flux.exposure_scale));
+	  for (Int_t i = (Int_t) irls_acc.size() - nbins_flux; i < (Int_t) irls_acc.size(); i++)
+	    irls_acc[i] /= flux.exposure_scale;
+	}
+      irls_col.insert(irls_col.end(), nbins_flux, col);
+    }
+  for (Int_t i = 0; i < (Int_t) irls_acc.size(); i++)
+    {
+      if(!(irls_acc[i] > 0))
+	return false;
+    }
+  return (irls_n.size() > 0);
+}
+
+// store the coefficients into the normalization, the power law indices and the exposure scales
+void TCRFluxFit::irls_store(const std::vector<Double_t> &theta, const std::vector<Bool_t> &profiled)
+{
+  Int_t nbpl = ((TBPLF1*) fJ)->GetNbreaks() + 2;
+  for (Int_t q = 0; q < nbpl; q++)
+    {
+      if(profiled[q])
+	fcn_parameters[q] = (q == 0 ? TMath::Power(10.0, theta[q]) : theta[q]);
+    }
+  for (Int_t iflux = 0, q = nbpl; iflux < (Int_t) Fluxes_ordered.size(); iflux++)
+    {
+      TCRFlux &flux = *Fluxes_ordered[iflux];
+      if(flux.exposure_scale_profiled)
+	flux.exposure_scale = TMath::Power(10.0, theta[q++]);
+    }
+  SetParameters(&fcn_parameters[0]);
+}
+
+// solve for the normalization, the power law indices and the exposure scales that are not given to Minuit
+Bool_t TCRFluxFit::irls_profile()
+{
+  specfit_irls::problem p;
+  std::vector<Double_t> theta;
+  if(!irls_load(theta, p.log10scale, p.log10en_ref))
+    return false;
+  p.nbreaks = ((TBPLF1*) fJ)->GetNbreaks();
+  p.x = &irls_x;
+  p.acc = &irls_acc;
+  p.n = &irls_n;
+  p.col = &irls_col;
+  p.profiled.assign(theta.size(), true);
+  for (Int_t q = 0; q < p.nbreaks + 2; q++)
+    p.profiled[q] = (minuit_par_index[q] < 0);
+  if(!p.profiled[0] && !(fcn_parameters[0] > 0))
+    return false;
+  Double_t deviance = specfit_irls::solve(p, &fcn_parameters[p.nbreaks + 2], theta, &irls_cov);
+  if(deviance < 0)
+    return false;
+  irls_store(theta, p.profiled);
+  log_likelihood = std::make_pair(deviance, (Double_t) irls_n.size());
+  return true;
+}
+
+// evaluate the log likelihood for Minuit's parameters with the profiled parameters at their optimal values
+void TCRFluxFit::profile(const Double_t *par)
+{
+  set_fcn_parameters(par);
+  if(irls_fcn && irls_profile())
+    return;
+  SetParameters(&fcn_parameters[0]);
+  CalcLogLikelihood();
+  profile_linear_scales();
+}
+
+// profiled fit parameters followed by the profiled exposure scales of the fluxes for the given Minuit parameters
+void TCRFluxFit::get_profiled_values(const Double_t *par, std::vector<Double_t> &values)
+{
+  profile(par);
+  values.clear();
+  for (Int_t i = 0; i < (Int_t) fcn_parameters.size(); i++)
+    {
+      if(minuit_par_index[i] < 0)
+	values.push_back(fcn_parameters[i]);
+    }
+  for (Int_t iflux = 0; iflux < (Int_t) Fluxes_ordered.size(); iflux++)
+    {
+      if(Fluxes_ordered[iflux]->exposure_scale_profiled)
+	values.push_back(Fluxes_ordered[iflux]->exposure_scale);
+    }
+}
+
+// The variance of a profiled parameter q is its variance with the other parameters fixed plus
+// g^T C g where C is Minuit's covariance matrix and g the derivatives of the profiled optimum of q with
+// respect to Minuit's parameters, which is the same as inverting the full Hessian matrix.  With the other
+// parameters fixed, the variance of ln(normalization) is 1 / N and that of ln(exposure scale) of a flux is 1 / N_flux
+// (+ 1 / N if the normalization is also profiled), N being the number of events that determine the normalization.
+void TCRFluxFit::calc_profiled_errors()
+{
+  Int_t npar = mFIT->GetNumPars();
+  std::vector<Double_t> par(npar, 0), err(npar, 0);
+  for (Int_t i = 0; i < npar; i++)
+    mFIT->GetParameter(i, par[i], err[i]);
+
+  // profiled values at the minimum
+  std::vector<Double_t> values;
+  get_profiled_values(npar ? &par[0] : 0, values);
+  Int_t nvalues = (Int_t) values.size();
+
+  // variances with the other parameters fixed
+  std::vector<Double_t> variances;
+  if(irls_fcn && (Int_t) irls_cov.size() == nvalues * nvalues)
+    {
+      // covariance matrix of the IRLS coefficients: log10 of the normalization, power law indices,
+      // log10 of the profiled exposure scales
+      Int_t q = 0;
+      for (Int_t i = 0; i < nfitpar; i++)
+	{
+	  if(minuit_par_index[i] >= 0)
+	    continue;
+	  Double_t dvalue = (i == 0 ? values[q] * TMath::Ln10() : 1.0);
+	  variances.push_back(dvalue * dvalue * irls_cov[q * nvalues + q]);
+	  q++;
+	}
+      for (; q < nvalues; q++)
+	variances.push_back(values[q] * values[q] * TMath::Ln10() * TMath::Ln10() * irls_cov[q * nvalues + q]);
+    }
+  else
+    {
+      Double_t nobserved = 0;
+      for (Int_t iflux = 0; iflux < (Int_t) Fluxes_ordered.size(); iflux++)
+	{
+	  if(!Fluxes_ordered[iflux]->exposure_scale_profiled)
+	    nobserved += Fluxes_ordered[iflux]->nevents_sum.first;
+	}
+      Double_t var_ln_norm = (nobserved > 0 ? 1.0 / nobserved : 0.0);
+      if(iprofiled_fcn >= 0)
+	variances.push_back(values[0] * values[0] * var_ln_norm);
+      for (Int_t iflux = 0; iflux < (Int_t) Fluxes_ordered.size(); iflux++)
+	{
+	  TCRFlux &flux = *Fluxes_ordered[iflux];
+	  if(!flux.exposure_scale_profiled)
+	    continue;
+	  Double_t var_ln_scale = (flux.nevents_sum.first > 0 ? 1.0 / flux.nevents_sum.first : 0.0) + (iprofiled_fcn >= 0 ? var_ln_norm : 0.0);
+	  variances.push_back(flux.exposure_scale * flux.exposure_scale * var_ln_scale);
+	}
+    }
+
+  // Minuit's covariance matrix of the variable parameters
+  std::vector<Int_t> ivar;
+  for (Int_t i = 0; i < npar; i++)
+    {
+      TString chnam = "";
+      Double_t val = 0, e = 0, xlolim = 0, xuplim = 0;
+      Int_t iuint = 0;
+      mFIT->mnpout(i, chnam, val, e, xlolim, xuplim, iuint);
+      if(iuint > 0)
+	ivar.push_back(i);
+    }
+  Int_t nvar = (Int_t) ivar.size();
+  if(nvar)
+    {
+      std::vector<Double_t> emat(nvar * nvar, 0);
+      mFIT->mnemat(&emat[0], nvar);
+      // derivatives of the profiled values with respect to the variable parameters
+      std::vector<std::vector<Double_t> > g(nvalues, std::vector<Double_t>(nvar, 0));
+      for (Int_t k = 0; k < nvar; k++)
+	{
+	  Int_t i = ivar[k];
+	  Double_t h = 1e-3 * (err[i] > 0 ? err[i] : TMath::Max(1.0, TMath::Abs(par[i])));
+	  std::vector<Double_t> p = par, v_up, v_lo;
+	  p[i] = par[i] + h;
+	  get_profiled_values(&p[0], v_up);
+	  p[i] = par[i] - h;
+	  get_profiled_values(&p[0], v_lo);
+	  for (Int_t q = 0; q < nvalues; q++)
+	    g[q][k] = (v_up[q] - v_lo[q]) / (2.0 * h);
+	}
+      for (Int_t q = 0; q < nvalues; q++)
+	{
+	  for (Int_t k = 0; k < nvar; k++)
+	    {
+	      for (Int_t l = 0; l < nvar; l++)
+		variances[q] += g[q][k] * emat[k * nvar + l] * g[q][l];
+	    }
+	}
+      // back to the minimum
+      get_profiled_values(npar ? &par[0] : 0, values);
+    }
+
+  // store the results
+  Int_t q = 0;
+  for (Int_t i = 0; i < nfitpar; i++)
+    {
+      if(minuit_par_index[i] >= 0)
+	continue;
+      fit_parameters[i] = fcn_parameters[i];
+      fit_parerrors[i] = TMath::Sqrt(TMath::Max(variances[q++], 0.0));
+    }
+  for (Int_t iflux = 0; iflux < (Int_t) Fluxes_ordered.size(); iflux++)
     {
-      TCRFluxFit &fit = (*pointer_to_global_instance_of_TCRFluxFit);
-      fit.SetParameters(par);
-      f = fit.GetLogLikelihood().first;
+      TCRFlux &flux = *Fluxes_ordered[iflux];
+      if(flux.exposure_scale_profiled)
+	flux.exposure_scale_error = TMath::Sqrt(TMath::Max(variances[q++], 0.0));
     }
 }
 
 Bool_t TCRFluxFit::Fit(Bool_t verbose)
 {
+  SPECFIT_TRACE("TCRFluxFit::Fit", "fit");
   if(!Fluxes.size())
     {
       fprintf(stderr, "ERROR: add some flux results before fitting!\n");
@@ -275,6 +902,19 @@ Bool_t TCRFluxFit::Fit(Bool_t verbose)
       return false;
     }
 
+  // spline flux functions are fitted with the band Hessian
+  spline_fun = 0;
+  if(get_spline() && !spline_fit_problem())
+    return FitSpline(verbose);
+
+  // start collecting the performance statistics for this fit
+  stats.Reset();
+  fit_covariance.clear();
+  for (std::map<TString, TCRFlux*>::iterator iflux = Fluxes.begin(); iflux != Fluxes.end(); iflux++)
+    iflux->second->ClearEncorrCache();
+  Double_t real_time = TCRFluxFitStats::get_real_time();
+  Double_t cpu_time = TCRFluxFitStats::get_cpu_time();
+
   nfluxpar = fJ->GetNpar(); // contribution to the number of fit parameters from the flux fit function
 
   // additional fit parameters if there are energy correction functions involved
@@ -283,28 +923,123 @@ Bool_t TCRFluxFit::Fit(Bool_t verbose)
   TF1 *fEnCorr_first = (fEnCorr.size() ? fEnCorr.begin()->second : 0);
   nencorrpar = (fEnCorr_first ? fEnCorr_first->GetNpar() : 0);
 
-  // Initialize the Minuit minimizer
   nfitpar = nfluxpar + nencorrpar;
+
+  // names, starting values, step sizes, and limits of all fit parameters
+  std::vector<TString> parnames(nfitpar);
+  std::vector<Double_t> parstart(nfitpar), parstep(nfitpar), parmin(nfitpar, 0), parmax(nfitpar, 0);
+  for (Int_t i = 0; i < nfluxpar; i++)
+    {
+      parnames[i] = fJ->GetParName(i);
+      parstart[i] = fJ->GetParameter(i);
+      parstep[i] = fJ->GetParError(i);
+      fJ->GetParLimits(i, parmin[i], parmax[i]);
+    }
+  // parameters that correspond to the energy correction function
+  for (Int_t i = 0; i < nencorrpar; i++)
+    {
+      parnames[nfluxpar + i] = fEnCorr_first->GetParName(i);
+      parstart[nfluxpar + i] = fEnCorr_first->GetParameter(i);
+      parstep[nfluxpar + i] = fEnCorr_first->GetParError(i);
+      fEnCorr_first->GetParLimits(i, parmin[nfluxpar + i], parmax[nfluxpar + i]);
+    }
+
+  // normalization and power law indices of a broken power law are found by IRLS in each FCN evaluation
+  irls_fcn = false;
+  if(use_irls)
+    {
+      TBPLF1 *fbpl = dynamic_cast<TBPLF1*>(fJ);
+      if(!fbpl || TString(fbpl->GetBplType()) != "J")
+	{
+	  fprintf(stderr, "ERROR: IRLS requires the flux function to be a TBPLF1 function of type J!\n");
+	  return false;
+	}
+      for (std::map<TString, TCRFlux*>::iterator iflux = Fluxes.begin(); iflux != Fluxes.end(); iflux++)
+	{
+	  if(iflux->second->HasResponse())
+	    {
+	      fprintf(stderr, "ERROR: IRLS can't be used with the energy response of flux '%s'!\n", iflux->first.Data());
+	      return false;
+	    }
+	}
+      irls_fcn = true;
+    }
+
+  // linear scale parameters that are profiled analytically are not given to Minuit
+  iprofiled_fcn = -1;
+  if(irls_fcn)
+    ; // the normalization is profiled by IRLS
+  else if(iprofiled_norm >= nfluxpar)
+    {
+      fprintf(stderr, "ERROR: profiled normalization parameter %d is not a parameter of the flux function!\n", iprofiled_norm);
+      return false;
+    }
+  if(iprofiled_norm >= 0)
+    {
+      if(parstep[iprofiled_norm] == 0)
+	fprintf(stderr, "WARNING: normalization parameter '%s' is fixed, it will not be profiled\n", parnames[iprofiled_norm].Data());
+      else if(!is_linear_scale(fJ, iprofiled_norm, TMath::Max(log10en_min, fJ->GetXmin()), TMath::Min(log10en_max, fJ->GetXmax())))
+	{
+	  fprintf(stderr, "ERROR: flux function is not proportional to parameter '%s', it can't be profiled!\n", parnames[iprofiled_norm].Data());
+	  return false;
+	}
+      else
+	iprofiled_fcn = iprofiled_norm;
+    }
+  Int_t nprofiled_exposure_scales = 0;
+  for (Int_t iflux = 0; iflux < (Int_t) Fluxes_ordered.size(); iflux++)
+    {
+      Fluxes_ordered[iflux]->exposure_scale_error = 0;
+      if(Fluxes_ordered[iflux]->exposure_scale_profiled)
+	nprofiled_exposure_scales++;
+    }
+  Bool_t norm_profiled = (iprofiled_fcn >= 0 || (irls_fcn && parstep[0] != 0));
+  if(norm_profiled && nprofiled_exposure_scales == (Int_t) Fluxes_ordered.size())
+    {
+      fprintf(stderr, "ERROR: normalization can't be profiled together with the exposure scales of all fluxes!\n");
+      return false;
+    }
+  Int_t nminuitpar = 0;
+  minuit_par_index.assign(nfitpar, -1);
+  for (Int_t i = 0; i < nfitpar; i++)
+    {
+      Bool_t irls_profiled = (irls_fcn && i < ((TBPLF1*) fJ)->GetNbreaks() + 2 && parstep[i] != 0);
+      if(i != iprofiled_fcn && !irls_profiled)
+	minuit_par_index[i] = nminuitpar++;
+    }
+  fcn_parameters.clear();
+  if(profiling_on())
+    fcn_parameters = parstart;
+
+  // derivatives of the log likelihood are evaluated if the flux function and the energy correction functions have
+  // analytic derivatives (the derivatives of the formulas are generated if that's asked for) and nothing is profiled
+  gradient_fcn = (use_gradient && !profiling_on() && has_gradient(fJ));
+  for (std::map<TString, TF1*>::iterator ienc = fEnCorr.begin(); ienc != fEnCorr.end() && gradient_fcn && nencorrpar; ienc++)
+    gradient_fcn = has_gradient(ienc->second);
+  for (Int_t iflux = 0; iflux < (Int_t) Fluxes_ordered.size() && gradient_fcn; iflux++)
+    gradient_fcn = !Fluxes_ordered[iflux]->HasResponse();
+
+  // otherwise the finite differences of the FCN can be evaluated in parallel by copies of the fit
+  parallel_fcn = (fd_nthreads != 1 && !gradient_fcn && !profiling_on() && start_fd_workers(fd_nthreads));
+
+  // errors from the Fisher information, which needs the expected numbers of events without the energy responses
+  fisher_fcn = use_fisher;
+  for (Int_t iflux = 0; iflux < (Int_t) Fluxes_ordered.size() && fisher_fcn; iflux++)
+    fisher_fcn = !Fluxes_ordered[iflux]->HasResponse();
+
+  // Initialize the Minuit minimizer
   if(mFIT)
     delete mFIT;
-  mFIT = new TMinuit(nfitpar);
+  mFIT = new TMinuit(nminuitpar);
 
   if(!verbose)
     mFIT->SetPrintLevel(-1);
 
   // declare the parameters
-  for (Int_t i = 0; i < nfluxpar; i++)
-    {
-      Double_t parmin = 0, parmax = 0;
-      fJ->GetParLimits(i, parmin, parmax);
-      mFIT->DefineParameter(i, fJ->GetParName(i), fJ->GetParameter(i), fJ->GetParError(i), parmin, parmax);
-    }
-  // declare the parameters that correspond to the energy correction function
-  for (Int_t i = 0; i < nencorrpar; i++)
+  for (Int_t i = 0; i < nfitpar; i++)
     {
-      Double_t parmin = 0, parmax = 0;
-      fEnCorr_first->GetParLimits(i, parmin, parmax);
-      mFIT->DefineParameter(nfluxpar + i, fEnCorr_first->GetParName(i), fEnCorr_first->GetParameter(i), fEnCorr_first->GetParError(i), parmin, parmax);
+      if(minuit_par_index[i] >= 0)
+	mFIT->DefineParameter(minuit_par_index[i], parnames[i], parstart[i], parstep[i], parmin[i], parmax[i]);
     }
 
   // function to minimize
@@ -314,14 +1049,57 @@ Bool_t TCRFluxFit::Fit(Bool_t verbose)
   // We expect that the change of -2 *  log (likelihood) by 1 will correspond to 1 sigma errors
   mFIT->SetErrorDef(1.0);
 
+  // derivatives from the FCN, the generated derivatives of the formulas are checked against the numerical ones
+  if((gradient_fcn && use_formula_gradient) && !parallel_fcn)
+    mFIT->Command("SET GRAD");
+  else if(gradient_fcn || parallel_fcn)
+    mFIT->Command("SET GRAD 1");
+
+  // the Hessian is evaluated in parallel or the Fisher information is used after the minimization instead of Migrad's HESSE
+  if(parallel_fcn)
+    set_fd_steps(nminuitpar);
+  if(parallel_fcn || fisher_fcn)
+    mFIT->Command("SET STRATEGY 0");
+
   // Perform minimization
-  mFIT->Migrad();
+  if(nminuitpar && minimizer != "MIGRAD")
+    stats.fit_status = run_minimizer(nminuitpar, verbose);
+  else if(nminuitpar)
+    {
+      SPECFIT_TRACE("TMinuit::Migrad", "fit");
+      stats.fit_status = mFIT->Migrad();
+    }
 
   // Get the best fit parameters
-  fit_parameters.resize(nfitpar);
-  fit_parerrors.resize(nfitpar);
+  fit_parameters = parstart;
+  fit_parerrors.assign(nfitpar, 0);
   for (Int_t i = 0; i < nfitpar; i++)
-    mFIT->GetParameter(i, fit_parameters[i], fit_parerrors[i]);
+    {
+      if(minuit_par_index[i] >= 0)
+	mFIT->GetParameter(minuit_par_index[i], fit_parameters[i], fit_parerrors[i]);
+    }
+
+  // values of the profiled parameters at the minimum and their errors
+  if(profiling_on())
+    calc_profiled_errors();
+
+  // errors and the covariance matrix from the Fisher information or from the Hessian of the FCN evaluated in parallel,
+  // or else Minuit's error matrix.  Minuit isn't told about the former two, its errors and matrix stay those of Migrad
+  fit_covariance.clear();
+  if(fisher_fcn)
+    calc_fisher_errors();
+  else if(parallel_fcn)
+    calc_parallel_hessian();
+  else if(nminuitpar)
+    calc_minuit_covariance();
+  fisher_fcn = false;
+  if(parallel_fcn)
+    {
+      // Minuit computes the derivatives itself if it's used again
+      stop_fd_workers();
+      parallel_fcn = false;
+      mFIT->Command("SET NOGRAD");
+    }
 
   // set the best fit parameters to the corresponding functions
   SetFluxPar(&fit_parameters[0], &fit_parerrors[0]); // flux fit function
@@ -331,38 +1109,977 @@ Bool_t TCRFluxFit::Fit(Bool_t verbose)
 
   // calculate the overall log likelihood again, using the best fit parameters
   CalcLogLikelihood();
+  for (std::map<TString, TCRFlux*>::iterator iflux = Fluxes.begin(); iflux != Fluxes.end(); iflux++)
+    iflux->second->FillNeventsFit();
 
   // calculate the chi2 = (normalized log likelihood) and the
   // number of degrees of freedom = (number of fitted bins) - (total number of fit parameters)
   chi2 = log_likelihood.first;
-  ndof = log_likelihood.second - (Double_t) nfitpar;
+  ndof = log_likelihood.second - (Double_t) nfitpar - (Double_t) nprofiled_exposure_scales;
+
+  stats.fit_real_time = TCRFluxFitStats::get_real_time() - real_time;
+  stats.fit_cpu_time = TCRFluxFitStats::get_cpu_time() - cpu_time;
 
   // return success
   return true;
 }
 
-TMinuit* TCRFluxFit::GetMinuit()
+const char* TCRFluxFit::spline_fit_problem()
 {
-  // To obtain the Minuit pointer for whatever reason.
-  // In order for it to behave correctly, the global FCN must be
-  // pointed to use this instance of the class.
-  pointer_to_global_instance_of_TCRFluxFit = this;
-  return mFIT;
+  TSPLINEF1 *fspline = dynamic_cast<TSPLINEF1*>(fJ);
+  if(!fspline || TString(fspline->GetSplineType()) != "J")
+    return "flux function must be a TSPLINEF1 function of type J";
+  TF1 *fEnCorr_first = (fEnCorr.size() ? fEnCorr.begin()->second : 0);
+  if(fEnCorr_first && fEnCorr_first->GetNpar())
+    return "energy correction parameters can't be fitted";
+  if(use_irls || iprofiled_norm >= 0)
+    return "parameters can't be profiled";
+  for (Int_t iflux = 0; iflux < (Int_t) Fluxes_ordered.size(); iflux++)
+    {
+      if(Fluxes_ordered[iflux]->exposure_scale_profiled)
+	return "exposure scales can't be profiled";
+      if(Fluxes_ordered[iflux]->HasResponse())
+	return "energy responses can't be used";
+    }
+  return 0;
 }
 
-TGraph* TCRFluxFit::scan_parameter(Int_t ipar, Int_t npts, Double_t par_lo, Double_t par_up, Bool_t calc_deltas)
+// -2 ln(likelihood ratio) of the spline fit, same as TCRFlux::CalcLogLikelihood, and the expected numbers of events
+static Double_t spline_deviance(const std::vector<Double_t> &n, const std::vector<Double_t> &acc, const std::vector<Int_t> &first,
+    const std::vector<Double_t> &basis, Double_t log10scale, const std::vector<Double_t> &c, std::vector<Double_t> &mu)
 {
-  TMinuit *m = GetMinuit();
+  Int_t nbins = (Int_t) n.size();
+  Double_t deviance = 0;
+  mu.resize(nbins);
+  for (Int_t i = 0; i < nbins; i++)
+    {
+      const Double_t *b = &basis[4 * i];
+      const Double_t *ci = &c[first[i]];
+      mu[i] = acc[i] * TMath::Power(10.0, log10scale + b[0] * ci[0] + b[1] * ci[1] + b[2] * ci[2] + b[3] * ci[3]);
+      if(n[i] > 1e-3)
+	deviance += 2.0 * ((mu[i] - n[i]) + n[i] * TMath::Log(n[i] / mu[i]));
+      else
+	deviance += 2.0 * mu[i];
+    }
+  return deviance;
+}
+
+Bool_t TCRFluxFit::FitSpline(Bool_t verbose)
+{
+  SPECFIT_TRACE("TCRFluxFit::FitSpline", "fit");
+  if(!Fluxes.size())
+    {
+      fprintf(stderr, "ERROR: add some flux results before fitting!\n");
+      return false;
+    }
+  const char *problem = spline_fit_problem();
+  if(problem)
+    {
+      fprintf(stderr, "ERROR: FitSpline: %s!\n", problem);
+      return false;
+    }
+  TSPLINEF1 *fspline = (TSPLINEF1*) fJ;
+  if(!(fspline->GetSplineScaleFactor() > 0))
+    {
+      fprintf(stderr, "ERROR: FitSpline: scale factor of the spline must be positive!\n");
+      return false;
+    }
+
+  stats.Reset();
+  fit_covariance.clear();
+  for (std::map<TString, TCRFlux*>::iterator iflux = Fluxes.begin(); iflux != Fluxes.end(); iflux++)
+    iflux->second->ClearEncorrCache();
+  Double_t real_time = TCRFluxFitStats::get_real_time();
+  Double_t cpu_time = TCRFluxFitStats::get_cpu_time();
+
+  nfluxpar = fJ->GetNpar();
+  nencorrpar = 0;
+  nfitpar = nfluxpar;
+  iprofiled_fcn = -1;
+  irls_fcn = false;
+  fcn_parameters.clear();
+
+  // fitted bins and the spline basis at their energies
+  std::vector<Double_t> x, acc, n;
+  for (Int_t iflux = 0; iflux < (Int_t) Fluxes_ordered.size(); iflux++)
+    Fluxes_ordered[iflux]->GetFitBins(log10en_min, log10en_max, x, acc, n);
+  Int_t nbins = (Int_t) n.size();
+  if(!nbins)
+    {
+      fprintf(stderr, "ERROR: FitSpline: no bins in the fitted energy range!\n");
+      return false;
+    }
+  std::vector<Int_t> first(nbins);
+  std::vector<Double_t> basis(4 * nbins);
+  for (Int_t i = 0; i < nbins; i++)
+    fspline->GetBasis(x[i], first[i], &basis[4 * i]);
+
+  Int_t ncoef = nfitpar;
+  const Int_t m = 3;
+  const Double_t ln10 = TMath::Ln10();
+  Double_t log10scale = TMath::Log10(fspline->GetSplineScaleFactor());
+  std::vector<Double_t> c(fJ->GetParameters(), fJ->GetParameters() + ncoef);
+  std::vector<Bool_t> fixed(ncoef), held(ncoef, false);
+  for (Int_t j = 0; j < ncoef; j++)
+    fixed[j] = (fJ->GetParError(j) == 0);
+
+  std::vector<Double_t> mu, mu_new, c_new, g, h, l, step;
+  Double_t objective = spline_deviance(n, acc, first, basis, log10scale, c, mu) + fspline->GetPenalty(&c[0]);
+  stats.nfcn++;
+  Bool_t converged = false;
+  Bool_t decomposed = false;
+  Int_t iter = 0;
+  for (iter = 0; iter < 100; iter++)
+    {
+      // gradient and band Hessian of the deviance plus the penalty
+      g.assign(ncoef, 0);
+      h.assign(ncoef * (m + 1), 0);
+      for (Int_t i = 0; i < nbins; i++)
+	{
+	  const Double_t *b = &basis[4 * i];
+	  Double_t r = 2.0 * ln10 * (mu[i] - (n[i] > 1e-3 ? n[i] : 0.0));
+	  Double_t w = 2.0 * ln10 * ln10 * mu[i];
+	  for (Int_t a = 0; a < 4; a++)
+	    {
+	      g[first[i] + a] += r * b[a];
+	      for (Int_t q = 0; q <= a; q++)
+		h[(first[i] + a) * (m + 1) + m - (a - q)] += w * b[a] * b[q];
+	    }
+	}
+      fspline->AddPenaltyGradient(&g[0], &c[0]);
+      fspline->AddPenaltyHessian(m, h);
+      // fixed coefficients and the ones that neither the data nor the penalty constrain are left as they are
+      Double_t hmax = 0;
+      for (Int_t j = 0; j < ncoef; j++)
+	hmax = TMath::Max(hmax, h[j * (m + 1) + m]);
+      for (Int_t j = 0; j < ncoef; j++)
+	{
+	  held[j] = (fixed[j] || !(h[j * (m + 1) + m] > 1e-12 * hmax));
+	  if(!held[j])
+	    continue;
+	  g[j] = 0;
+	  for (Int_t q = 0; q < m; q++)
+	    h[j * (m + 1) + q] = 0;
+	  for (Int_t i = j + 1; i < ncoef && i <= j + m; i++)
+	    h[i * (m + 1) + m - (i - j)] = 0;
+	  h[j * (m + 1) + m] = 1.0;
+	}
+      l = h;
+      decomposed = specfit_uti::band_cholesky_decompose(ncoef, m, l);
+      if(!decomposed)
+	{
+	  l = h;
+	  for (Int_t j = 0; j < ncoef; j++)
+	    l[j * (m + 1) + m] += 1e-10 * hmax;
+	  decomposed = specfit_uti::band_cholesky_decompose(ncoef, m, l);
+	  if(!decomposed)
+	    break;
+	}
+      step.resize(ncoef);
+      for (Int_t j = 0; j < ncoef; j++)
+	step[j] = -g[j];
+      specfit_uti::band_cholesky_solve(ncoef, m, l, step);
+      // Newton decrement
+      Double_t decrement = 0;
+      for (Int_t j = 0; j < ncoef; j++)
+	decrement -= g[j] * step[j];
+      if(decrement < 1e-10)
+	{
+	  converged = true;
+	  break;
+	}
+      // step halving
+      Double_t objective_new = objective;
+      Bool_t accepted = false;
+      c_new = c;
+      for (Double_t t = 1.0; t > 1e-10; t *= 0.5)
+	{
+	  for (Int_t j = 0; j < ncoef; j++)
+	    c_new[j] = c[j] + t * step[j];
+	  objective_new = spline_deviance(n, acc, first, basis, log10scale, c_new, mu_new) + fspline->GetPenalty(&c_new[0]);
+	  stats.nfcn++;
+	  if(objective_new <= objective)
+	    {
+	      accepted = true;
+	      break;
+	    }
+	}
+      if(!accepted)
+	{
+	  converged = (decrement < 1e-6);
+	  break;
+	}
+      c.swap(c_new);
+      mu.swap(mu_new);
+      objective = objective_new;
+      stats.AddIteration("newton", stats.nfcn, objective, 0.5 * decrement, 0);
+    }
+  stats.fit_status = (converged ? 0 : 4);
+  if(!converged)
+    fprintf(stderr, "WARNING: FitSpline: Newton's method has not converged after %d iterations\n", iter);
+
+  // errors and the covariance matrix from the inverse of the Hessian of -2 ln(likelihood), for which the change by 1
+  // corresponds to 1 sigma; the columns of the inverse are solved with the band Cholesky factor, the held coefficients
+  // have zero rows
+  fit_parameters = c;
+  fit_parerrors.assign(nfitpar, 0);
+  if(decomposed)
+    {
+      fit_covariance.assign(nfitpar * nfitpar, 0);
+      std::vector<Double_t> column;
+      for (Int_t j = 0; j < ncoef; j++)
+	{
+	  if(held[j])
+	    continue;
+	  column.assign(ncoef, 0);
+	  column[j] = 1.0;
+	  specfit_uti::band_cholesky_solve(ncoef, m, l, column);
+	  for (Int_t i = 0; i < ncoef; i++)
+	    {
+	      if(!held[i])
+		fit_covariance[i * nfitpar + j] = 2.0 * column[i];
+	    }
+	  fit_parerrors[j] = TMath::Sqrt(TMath::Max(fit_covariance[j * nfitpar + j], 0.0));
+	}
+    }
+  SetFluxPar(&fit_parameters[0], &fit_parerrors[0]);
+
+  // Minuit instance at the solution, for the scans of the parameters and the other methods that use it
+  if(mFIT)
+    delete mFIT;
+  mFIT = new TMinuit(nfitpar);
+  if(!verbose)
+    mFIT->SetPrintLevel(-1);
+  minuit_par_index.assign(nfitpar, -1);
+  for (Int_t i = 0; i < nfitpar; i++)
+    {
+      Double_t lo = 0, hi = 0;
+      fJ->GetParLimits(i, lo, hi);
+      minuit_par_index[i] = i;
+      mFIT->DefineParameter(i, fJ->GetParName(i), fit_parameters[i], (fixed[i] ? 0.0 : fit_parerrors[i]), lo, hi);
+    }
+  pointer_to_global_instance_of_TCRFluxFit = this;
+  mFIT->SetFCN(fcn_for_mFIT);
+  mFIT->SetErrorDef(1.0);
+  gradient_fcn = use_gradient;
+  if(gradient_fcn)
+    mFIT->Command("SET GRAD 1");
+
+  CalcLogLikelihood();
+  for (std::map<TString, TCRFlux*>::iterator iflux = Fluxes.begin(); iflux != Fluxes.end(); iflux++)
+    iflux->second->FillNeventsFit();
+  chi2 = log_likelihood.first;
+  ndof = log_likelihood.second - (Double_t) nfitpar;
+
+  stats.fit_real_time = TCRFluxFitStats::get_real_time() - real_time;
+  stats.fit_cpu_time = TCRFluxFitStats::get_cpu_time() - cpu_time;
+  stats.AddPhaseTime("newton", stats.fit_real_time, stats.fit_cpu_time, stats.nfcn);
+  if(verbose)
+    fprintf(stdout, "FitSpline: %d coefficients, %d bins, %d iterations, -2 ln(likelihood) %.6e, penalty %.6e\n", ncoef, nbins, iter, chi2,
+	fspline->GetPenalty());
+  return converged;
+}
+
+// number of threads for running ntasks fits concurrently, switches on ROOT's thread safety if more than one
+Int_t TCRFluxFit::get_nworkers(Int_t nthreads, Int_t ntasks)
+{
+  Int_t nworkers = TMath::Max(TMath::Min(specfit_uti::get_nthreads(nthreads), ntasks), 1);
+#if ROOT_VERSION_CODE >= ROOT_VERSION(6,6,0)
+  if(nworkers > 1)
+    ROOT::EnableThreadSafety();
+#else
+  nworkers = 1; // older versions of ROOT can't run fits concurrently
+#endif
+  return nworkers;
+}
+
+TCRFluxFit* TCRFluxFit::MakeWorkerCopy(const TF1 *fJ_set) const
+{
+  if(!fJ_set)
+    fJ_set = fJ;
+  TCRFluxFit *w = new TCRFluxFit();
+  w->log10en_min = log10en_min;
+  w->log10en_max = log10en_max;
+  w->iprofiled_norm = iprofiled_norm;
+  w->use_irls = use_irls;
+  w->use_gradient = use_gradient;
+  w->use_formula_gradient = use_formula_gradient;
+  w->minimizer = minimizer;
+  // the copies run in parallel themselves, their finite differences are evaluated serially
+  w->fd_nthreads = 1;
+  w->use_fisher = use_fisher;
+  w->stats.SetFluxTiming(stats.GetFluxTiming());
+  if(fJ_set)
+    {
+      w->fJ = (TF1*) fJ_set->Clone(specfit_uti::get_unique_object_name(TString(fJ_set->GetName()) + "_worker"));
+      w->TF1_Objects_Created_By_This.Add(w->fJ);
+    }
+  // the energy correction functions can be shared by several fluxes
+  std::map<TF1*, TF1*> fEnCorr_copies;
+  for (Int_t iflux = 0; iflux < (Int_t) Fluxes_ordered.size(); iflux++)
+    {
+      const TCRFlux &flux = *Fluxes_ordered[iflux];
+      TF1 *fEnCorr_copy = 0;
+      std::map<TString, TF1*>::const_iterator ienc = fEnCorr.find(flux.GetName());
+      if(ienc != fEnCorr.end() && ienc->second)
+	{
+	  if(fEnCorr_copies.find(ienc->second) == fEnCorr_copies.end())
+	    {
+	      fEnCorr_copies[ienc->second] = (TF1*) ienc->second->Clone(specfit_uti::get_unique_object_name(TString(ienc->second->GetName()) + "_worker"));
+	      w->TF1_Objects_Created_By_This.Add(fEnCorr_copies[ienc->second]);
+	    }
+	  fEnCorr_copy = fEnCorr_copies[ienc->second];
+	}
+      w->Add(flux.GetName(), flux.GetTitle(), (Int_t) flux.log10en.size(), (flux.log10en.size() ? &flux.log10en[0] : 0),
+	  (flux.log10en_bsize.size() ? &flux.log10en_bsize[0] : 0), (flux.nevents.size() ? &flux.nevents[0] : 0), (flux.exposure.size() ? &flux.exposure[0] : 0),
+	  fEnCorr_copy);
+      TCRFlux &flux_copy = *w->Fluxes_ordered.back();
+      flux_copy.SetNeventsMinRestricted(flux.nevents_min_restricted);
+      flux_copy.exposure_scale = flux.exposure_scale;
+      flux_copy.exposure_scale_profiled = flux.exposure_scale_profiled;
+      flux_copy.response_log10en = flux.response_log10en;
+      flux_copy.response_acceptance = flux.response_acceptance;
+      flux_copy.response_first = flux.response_first;
+      flux_copy.response_start = flux.response_start;
+      flux_copy.response_values = flux.response_values;
+    }
+  return w;
+}
+
+// state shared by the threads that evaluate the FCN at the points of the finite differences
+namespace
+{
+  struct fd_context
+  {
+    const std::vector<TCRFluxFit*> *workers; // one copy of the fit for each thread
+    Int_t npar;                              // number of fit parameters
+    Int_t npoints;                           // number of points
+    const Double_t *points;                  // fit parameters of each point, npar values per point
+    Double_t *values;                        // FCN at each point
+  };
+}
+
+// thread iworker evaluates the points iworker, iworker + nworkers, ...
+static void fd_worker(Int_t iworker, void *arg)
+{
+  fd_context &c = *(fd_context*) arg;
+  TCRFluxFit &w = *(*c.workers)[iworker];
+  for (Int_t i = iworker; i < c.npoints; i += (Int_t) c.workers->size())
+    c.values[i] = w.EvalFitFCN(c.points + i * c.npar);
+}
+
+Double_t TCRFluxFit::EvalFitFCN(const Double_t *par)
+{
+  SetParameters(par);
+  Double_t f = GetLogLikelihood().first;
+  const TSPLINEF1 *fspline = get_spline();
+  if(fspline)
+    f += fspline->GetPenalty();
+  return f;
+}
+
+Bool_t TCRFluxFit::has_gradient(TF1 *f)
+{
+  if(use_formula_gradient)
+    return TSPECFITF1::GenerateGradient(f);
+  return TSPECFITF1::HasAnalyticGradient(f);
+}
+
+Bool_t TCRFluxFit::start_fd_workers(Int_t nthreads)
+{
+  stop_fd_workers();
+  // worker copies of the fit are made in this thread
+  Int_t nworkers = get_nworkers(nthreads, 2 * nfitpar);
+  if(nworkers < 2)
+    return false;
+  for (Int_t iworker = 0; iworker < nworkers; iworker++)
+    {
+      TCRFluxFit *w = MakeWorkerCopy();
+      w->nfluxpar = nfluxpar;
+      w->nencorrpar = nencorrpar;
+      w->nfitpar = nfitpar;
+      fd_workers.push_back(w);
+    }
+  return true;
+}
+
+void TCRFluxFit::stop_fd_workers()
+{
+  for (Int_t iworker = 0; iworker < (Int_t) fd_workers.size(); iworker++)
+    delete fd_workers[iworker];
+  fd_workers.clear();
+}
+
+void TCRFluxFit::eval_fd_points()
+{
+  if(fd_workers.empty())
+    {
+      for (Int_t i = 0; i < (Int_t) fd_values.size(); i++)
+	fd_values[i] = EvalFitFCN(&fd_points[i * nfitpar]);
+      stats.nfcn += (Long64_t) fd_values.size();
+      return;
+    }
+  fd_context c;
+  c.workers = &fd_workers;
+  c.npar = nfitpar;
+  c.npoints = (Int_t) fd_values.size();
+  c.points = &fd_points[0];
+  c.values = &fd_values[0];
+  specfit_uti::parallel_for((Int_t) fd_workers.size(), fd_worker, &c, (Int_t) fd_workers.size());
+  stats.nfcn += c.npoints;
+}
+
+Bool_t TCRFluxFit::calc_parallel_gradient(const Double_t *par, Double_t f, Double_t *gin)
+{
+  // central differences with a thousandth of the step size, one-sided at the limits
+  std::vector<Double_t> x_lo(par, par + nfitpar), x_hi(par, par + nfitpar);
+  std::vector<Int_t> i_lo(nfitpar, -1), i_hi(nfitpar, -1);
+  fd_points.clear();
+  for (Int_t i = 0; i < nfitpar; i++)
+    {
+      if(fd_steps[i] == 0)
+	continue;
+      Double_t h = 1e-3 * TMath::Abs(fd_steps[i]);
+      x_lo[i] = TMath::Max(par[i] - h, fd_xmin[i]);
+      x_hi[i] = TMath::Min(par[i] + h, fd_xmax[i]);
+      if(x_lo[i] < par[i])
+	{
+	  i_lo[i] = (Int_t) (fd_points.size() / nfitpar);
+	  fd_points.insert(fd_points.end(), par, par + nfitpar);
+	  fd_points[i_lo[i] * nfitpar + i] = x_lo[i];
+	}
+      if(x_hi[i] > par[i])
+	{
+	  i_hi[i] = (Int_t) (fd_points.size() / nfitpar);
+	  fd_points.insert(fd_points.end(), par, par + nfitpar);
+	  fd_points[i_hi[i] * nfitpar + i] = x_hi[i];
+	}
+    }
+  fd_values.assign(fd_points.size() / nfitpar, 0);
+  if(fd_values.size())
+    eval_fd_points();
+  for (Int_t i = 0; i < nfitpar; i++)
+    {
+      gin[i] = 0;
+      if(x_hi[i] > x_lo[i])
+	gin[i] = ((i_hi[i] >= 0 ? fd_values[i_hi[i]] : f) - (i_lo[i] >= 0 ? fd_values[i_lo[i]] : f)) / (x_hi[i] - x_lo[i]);
+    }
+  return true;
+}
+
+Bool_t TCRFluxFit::calc_parallel_hessian()
+{
+  SPECFIT_TRACE("TCRFluxFit::calc_parallel_hessian", "fit");
+  Double_t real_time = TCRFluxFitStats::get_real_time();
+  Double_t cpu_time = TCRFluxFitStats::get_cpu_time();
+  // parameters that are varied by a tenth of their errors, within the limits
+  const std::vector<Double_t> &x = fit_parameters;
+  std::vector<Int_t> ivar;
+  std::vector<Double_t> h;
+  for (Int_t i = 0; i < nfitpar; i++)
+    {
+      if(fd_steps[i] == 0)
+	continue;
+      Double_t hi = 0.1 * (fit_parerrors[i] > 0 ? fit_parerrors[i] : TMath::Abs(fd_steps[i]));
+      hi = TMath::Min(hi, TMath::Min(x[i] - fd_xmin[i], fd_xmax[i] - x[i]));
+      if(!(hi > 0))
+	continue;
+      ivar.push_back(i);
+      h.push_back(hi);
+    }
+  Int_t nvar = (Int_t) ivar.size();
+  if(!nvar)
+    return false;
+  // the minimum, x +/- h_a for each parameter a and x +/- h_a +/- h_b for each pair a < b
+  fd_points.assign(x.begin(), x.end());
+  for (Int_t a = 0; a < nvar; a++)
+    {
+      for (Int_t sa = 1; sa >= -1; sa -= 2)
+	{
+	  fd_points.insert(fd_points.end(), x.begin(), x.end());
+	  fd_points[fd_points.size() - nfitpar + ivar[a]] += sa * h[a];
+	}
+    }
+  for (Int_t a = 0; a < nvar; a++)
+    {
+      for (Int_t b = a + 1; b < nvar; b++)
+	{
+	  for (Int_t sa = 1; sa >= -1; sa -= 2)
+	    {
+	      for (Int_t sb = 1; sb >= -1; sb -= 2)
+		{
+		  fd_points.insert(fd_points.end(), x.begin(), x.end());
+		  fd_points[fd_points.size() - nfitpar + ivar[a]] += sa * h[a];
+		  fd_points[fd_points.size() - nfitpar + ivar[b]] += sb * h[b];
+		}
+	    }
+	}
+    }
+  fd_values.assign(fd_points.size() / nfitpar, 0);
+  eval_fd_points();
+  const Double_t *v = &fd_values[0];
+  std::vector<Double_t> hessian(nvar * nvar);
+  for (Int_t a = 0; a < nvar; a++)
+    hessian[a * nvar + a] = (v[1 + 2 * a] - 2.0 * v[0] + v[2 + 2 * a]) / (h[a] * h[a]);
+  Int_t ipoint = 1 + 2 * nvar;
+  for (Int_t a = 0; a < nvar; a++)
+    {
+      for (Int_t b = a + 1; b < nvar; b++, ipoint += 4)
+	hessian[a * nvar + b] = hessian[b * nvar + a] = (v[ipoint] - v[ipoint + 1] - v[ipoint + 2] + v[ipoint + 3]) / (4.0 * h[a] * h[b]);
+    }
+  stats.AddPhaseTime("hesse", TCRFluxFitStats::get_real_time() - real_time, TCRFluxFitStats::get_cpu_time() - cpu_time, (Long64_t) fd_values.size());
+  // the FCN is -2 ln(likelihood), the covariance matrix is 2 H^-1
+  if(!specfit_uti::cholesky_decompose(nvar, hessian))
+    {
+      fprintf(stderr, "WARNING: Hessian of the FCN is not positive definite, the errors are from the minimizer\n");
+      return false;
+    }
+  std::vector<Double_t> hessian_inv;
+  specfit_uti::cholesky_invert(nvar, hessian, hessian_inv);
+  fit_covariance.assign(nfitpar * nfitpar, 0);
+  for (Int_t a = 0; a < nvar; a++)
+    {
+      for (Int_t b = 0; b < nvar; b++)
+	fit_covariance[ivar[a] * nfitpar + ivar[b]] = 2.0 * hessian_inv[a * nvar + b];
+      fit_parerrors[ivar[a]] = TMath::Sqrt(fit_covariance[ivar[a] * nfitpar + ivar[a]]);
+    }
+  return true;
+}
+
+Bool_t TCRFluxFit::CalcFisherCovariance(std::vector<Double_t> &covariance)
+{
+  SPECFIT_TRACE("TCRFluxFit::CalcFisherCovariance", "fit");
+  if(!fJ || !nfitpar || (Int_t) fit_parameters.size() != nfitpar)
+    {
+      fprintf(stderr, "ERROR: CalcFisherCovariance: there are no fit parameters, run Fit first!\n");
+      return false;
+    }
+  SetParameters(&fit_parameters[0]);
+  std::vector<Double_t> fisher(nfitpar * nfitpar, 0);
+  for (Int_t iflux = 0; iflux < (Int_t) Fluxes_ordered.size(); iflux++)
+    {
+      if(!Fluxes_ordered[iflux]->AddFisherInformation(log10en_min, log10en_max, nfitpar, &fisher[0], nencorrpar > 0))
+	{
+	  fprintf(stderr, "ERROR: CalcFisherCovariance: no Fisher information for flux '%s' (energy response?)\n", Fluxes_ordered[iflux]->GetName());
+	  return false;
+	}
+    }
+  // the FCN is -2 ln(likelihood) plus the penalty, the covariance matrix is 2 x the inverse of its expected Hessian
+  // 2 I + P, which is (I + P / 2)^-1; the band matrix of the penalty with nfluxpar - 1 sub-diagonals is its lower triangle
+  const TSPLINEF1 *fspline = get_spline();
+  if(fspline)
+    {
+      Int_t m = nfluxpar - 1;
+      std::vector<Double_t> h(nfluxpar * (m + 1), 0);
+      fspline->AddPenaltyHessian(m, h);
+      for (Int_t a = 0; a < nfluxpar; a++)
+	{
+	  for (Int_t b = 0; b <= a; b++)
+	    {
+	      Double_t v = 0.5 * h[a * (m + 1) + m - (a - b)];
+	      fisher[a * nfitpar + b] += v;
+	      if(b != a)
+		fisher[b * nfitpar + a] += v;
+	    }
+	}
+    }
+  // fixed parameters have zero errors
+  std::vector<Int_t> ivar;
+  for (Int_t i = 0; i < nfitpar; i++)
+    {
+      if(i < (Int_t) fit_parerrors.size() && fit_parerrors[i] != 0)
+	ivar.push_back(i);
+    }
+  Int_t nvar = (Int_t) ivar.size();
+  if(!nvar)
+    {
+      fprintf(stderr, "ERROR: CalcFisherCovariance: all fit parameters are fixed!\n");
+      return false;
+    }
+  std::vector<Double_t> info(nvar * nvar);
+  for (Int_t a = 0; a < nvar; a++)
+    {
+      for (Int_t b = 0; b < nvar; b++)
+	info[a * nvar + b] = fisher[ivar[a] * nfitpar + ivar[b]];
+    }
+  if(!specfit_uti::cholesky_decompose(nvar, info))
+    {
+      fprintf(stderr, "ERROR: CalcFisherCovariance: Fisher information matrix is singular\n");
+      return false;
+    }
+  std::vector<Double_t> info_inv;
+  specfit_uti::cholesky_invert(nvar, info, info_inv);
+  covariance.assign(nfitpar * nfitpar, 0);
+  for (Int_t a = 0; a < nvar; a++)
+    {
+      for (Int_t b = 0; b < nvar; b++)
+	covariance[ivar[a] * nfitpar + ivar[b]] = info_inv[a * nvar + b];
+    }
+  return true;
+}
+
+Bool_t TCRFluxFit::calc_fisher_errors()
+{
+  Double_t real_time = TCRFluxFitStats::get_real_time();
+  Double_t cpu_time = TCRFluxFitStats::get_cpu_time();
+  std::vector<Double_t> covariance;
+  Bool_t ok = CalcFisherCovariance(covariance);
+  stats.AddPhaseTime("fisher", TCRFluxFitStats::get_real_time() - real_time, TCRFluxFitStats::get_cpu_time() - cpu_time, 0);
+  if(!ok)
+    {
+      fprintf(stderr, "WARNING: errors are from the minimizer\n");
+      return false;
+    }
+  fit_covariance = covariance;
+  for (Int_t i = 0; i < nfitpar; i++)
+    fit_parerrors[i] = TMath::Sqrt(TMath::Max(fit_covariance[i * nfitpar + i], 0.0));
+  return true;
+}
+
+Bool_t TCRFluxFit::calc_minuit_covariance()
+{
+  fit_covariance.clear();
+  // Minuit's matrix lacks the correlations with the profiled parameters
+  if(!mFIT || mFIT->fISW[1] < 1 || profiling_on())
+    return false;
+  Int_t nvar = mFIT->GetNumFreePars();
+  if(nvar < 1)
+    return false;
+  // matrix of the free Minuit parameters in Minuit's internal order
+  std::vector<Double_t> emat(nvar * nvar, 0);
+  mFIT->mnemat(&emat[0], nvar);
+  // internal index of each fit parameter, -1 for the fixed ones
+  std::vector<Int_t> ivar(nfitpar, -1);
+  for (Int_t i = 0; i < nfitpar; i++)
+    {
+      if(minuit_par_index[i] >= 0)
+	ivar[i] = mFIT->fNiofex[minuit_par_index[i]] - 1;
+      if(ivar[i] >= nvar)
+	return false;
+    }
+  fit_covariance.assign(nfitpar * nfitpar, 0);
+  for (Int_t a = 0; a < nfitpar; a++)
+    {
+      if(ivar[a] < 0)
+	continue;
+      for (Int_t b = 0; b < nfitpar; b++)
+	{
+	  if(ivar[b] >= 0)
+	    fit_covariance[a * nfitpar + b] = emat[ivar[a] * nvar + ivar[b]];
+	}
+    }
+  return true;
+}
+
+const std::vector<Double_t>* TCRFluxFit::get_covariance()
+{
+  if(nfitpar && (Int_t) fit_covariance.size() == nfitpar * nfitpar)
+    return &fit_covariance;
+  if(!CalcFisherCovariance(fit_covariance))
+    {
+      fit_covariance.clear();
+      return 0;
+    }
+  return &fit_covariance;
+}
+
+Double_t TCRFluxFit::PropagateError(const Double_t *grad)
+{
+  const std::vector<Double_t> *cov = get_covariance();
+  if(!cov)
+    return 0;
+  Double_t variance = 0;
+  for (Int_t a = 0; a < nfitpar; a++)
+    {
+      for (Int_t b = 0; b < nfitpar; b++)
+	variance += grad[a] * (*cov)[a * nfitpar + b] * grad[b];
+    }
+  return TMath::Sqrt(TMath::Max(variance, 0.0));
+}
+
+Double_t TCRFluxFit::PropagateError(const char *expression, Double_t *value)
+{
+  if(value)
+    *value = 0;
+  const std::vector<Double_t> *cov = get_covariance();
+  if(!cov)
+    return 0;
+  TF1 f(specfit_uti::get_unique_object_name("delta_method"), expression, 0, 1);
+  if(f.GetNpar() > nfitpar)
+    {
+      fprintf(stderr, "ERROR: PropagateError: '%s' has %d parameters, the fit has %d\n", expression, f.GetNpar(), nfitpar);
+      return 0;
+    }
+  // central differences with a thousandth of the errors
+  std::vector<Double_t> p(fit_parameters), grad(nfitpar, 0);
+  Double_t x = 0;
+  Double_t v = f.EvalPar(&x, &p[0]);
+  if(value)
+    *value = v;
+  for (Int_t i = 0; i < f.GetNpar(); i++)
+    {
+      Double_t h = 1e-3 * TMath::Sqrt(TMath::Max((*cov)[i * nfitpar + i], 0.0));
+      if(!(h > 0))
+	continue;
+      p[i] = fit_parameters[i] + h;
+      Double_t v_hi = f.EvalPar(&x, &p[0]);
+      p[i] = fit_parameters[i] - h;
+      Double_t v_lo = f.EvalPar(&x, &p[0]);
+      p[i] = fit_parameters[i];
+      grad[i] = (v_hi - v_lo) / (2.0 * h);
+    }
+  return PropagateError(&grad[0]);
+}
+
+Double_t TCRFluxFit::GetBreakEnergyEeV(Int_t ibreak, Double_t *error)
+{
+  if(error)
+    *error = 0;
+  Int_t nbreaks = -1;
+  if(dynamic_cast<TBPLF1*>(fJ))
+    nbreaks = ((TBPLF1*) fJ)->GetNbreaks();
+  else if(dynamic_cast<TSBPLF1*>(fJ))
+    nbreaks = ((TSBPLF1*) fJ)->GetNbreaks();
+  if(ibreak < 0 || ibreak >= nbreaks || (Int_t) fit_parameters.size() != nfitpar)
+    {
+      fprintf(stderr, "ERROR: GetBreakEnergyEeV: there's no fitted break %d of a TBPLF1 or TSBPLF1 flux function\n", ibreak);
+      return 0;
+    }
+  Int_t ib = nbreaks + 2 + ibreak;
+  Double_t e = TMath::Power(10.0, fit_parameters[ib] - 18.0);
+  if(error)
+    {
+      std::vector<Double_t> grad(nfitpar, 0);
+      grad[ib] = TMath::Ln10() * e;
+      *error = PropagateError(&grad[0]);
+    }
+  return e;
+}
+
+Double_t TCRFluxFit::GetFluxValue(Double_t log10en, Double_t *error)
+{
+  if(error)
+    *error = 0;
+  if(!fJ || !nfluxpar || (Int_t) fit_parameters.size() != nfitpar)
+    {
+      fprintf(stderr, "ERROR: GetFluxValue: there are no fit parameters, run Fit first!\n");
+      return 0;
+    }
+  SetFluxPar(&fit_parameters[0]);
+  Double_t j = fJ->Eval(log10en);
+  if(error)
+    {
+      std::vector<Double_t> grad(nfitpar, 0);
+      TSPECFITF1::EvalGradient(fJ, &log10en, &grad[0]);
+      *error = PropagateError(&grad[0]);
+    }
+  return j;
+}
+
+Double_t TCRFluxFit::GetIntegralFlux(Double_t log10en, Double_t *error)
+{
+  if(error)
+    *error = 0;
+  if(!fJ || !nfluxpar || (Int_t) fit_parameters.size() != nfitpar)
+    {
+      fprintf(stderr, "ERROR: GetIntegralFlux: there are no fit parameters, run Fit first!\n");
+      return 0;
+    }
+  SetFluxPar(&fit_parameters[0]);
+  Double_t xmax = fJ->GetXmax();
+  if(!(log10en < xmax))
+    return 0;
+  // Simpson's rule for the integral of J x dE / dx = J x ln(10) x 10^x over x = log10(E/eV) and of its derivatives
+  const Int_t nintervals = 200;
+  Double_t h = (xmax - log10en) / (Double_t) nintervals;
+  std::vector<Double_t> grad(nfitpar, 0), grad_x(nfluxpar);
+  Double_t integral = 0;
+  for (Int_t i = 0; i <= nintervals; i++)
+    {
+      Double_t x = log10en + h * (Double_t) i;
+      Double_t w = (i == 0 || i == nintervals ? 1.0 : (i % 2 ? 4.0 : 2.0)) * h / 3.0 * TMath::Ln10() * TMath::Power(10.0, x);
+      integral += w * fJ->Eval(x);
+      if(!error)
+	continue;
+      TSPECFITF1::EvalGradient(fJ, &x, &grad_x[0]);
+      for (Int_t ipar = 0; ipar < nfluxpar; ipar++)
+	grad[ipar] += w * grad_x[ipar];
+    }
+  if(error)
+    *error = PropagateError(&grad[0]);
+  return integral;
+}
+
+Bool_t TCRFluxFit::SetAsimovData(Double_t exposure_factor, const char *flux_name)
+{
+  if(!fJ || !nfitpar || (Int_t) fit_parameters.size() != nfitpar)
+    {
+      fprintf(stderr, "ERROR: SetAsimovData: there are no fit parameters, run Fit first!\n");
+      return false;
+    }
+  if(flux_name && Fluxes.find(flux_name) == Fluxes.end())
+    {
+      fprintf(stderr, "ERROR: SetAsimovData: flux '%s' not found!\n", flux_name);
+      return false;
+    }
+  SetParameters(&fit_parameters[0]);
+  for (Int_t iflux = 0; iflux < (Int_t) Fluxes_ordered.size(); iflux++)
+    {
+      TCRFlux &flux = *Fluxes_ordered[iflux];
+      if(flux_name && TString(flux_name) != flux.GetName())
+	continue;
+      if(!flux.SetAsimovData(exposure_factor))
+	return false;
+    }
+  CalcLogLikelihood();
+  return true;
+}
+
+void TCRFluxFit::RestoreData()
+{
+  for (Int_t iflux = 0; iflux < (Int_t) Fluxes_ordered.size(); iflux++)
+    Fluxes_ordered[iflux]->RestoreData();
+  if(fJ && nfitpar && (Int_t) fit_parameters.size() == nfitpar)
+    {
+      SetParameters(&fit_parameters[0]);
+      CalcLogLikelihood();
+      for (Int_t iflux = 0; iflux < (Int_t) Fluxes_ordered.size(); iflux++)
+	Fluxes_ordered[iflux]->FillNeventsFit();
+    }
+}
+
+Bool_t TCRFluxFit::Forecast(const TF1 *fJ_null_model, Bool_t verbose)
+{
+  SPECFIT_TRACE("TCRFluxFit::Forecast", "fit");
+  forecast_parerrors.clear();
+  forecast_dchi2 = 0;
+  forecast_pvalue = 1;
+  forecast_significance = 0;
+  std::vector<Double_t> covariance;
+  if(!CalcFisherCovariance(covariance))
+    return false;
+  forecast_parerrors.assign(nfitpar, 0);
+  for (Int_t i = 0; i < nfitpar; i++)
+    forecast_parerrors[i] = TMath::Sqrt(TMath::Max(covariance[i * nfitpar + i], 0.0));
+  if(verbose)
+    {
+      fprintf(stdout, "%20s %14s %14s %14s\n", "parameter", "value", "error", "expected error");
+      for (Int_t i = 0; i < nfitpar; i++)
+	{
+	  TString name = (i < nfluxpar ? TString(fJ->GetParName(i)) : TString::Format("encorr%d", i - nfluxpar));
+	  fprintf(stdout, "%20s %14.6e %14.6e %14.6e\n", name.Data(), fit_parameters[i], GetParError(i), forecast_parerrors[i]);
+	}
+      fflush(stdout);
+    }
+  if(!fJ_null_model)
+    return true;
+  // -2 ln L at the fit parameters, the minimum on the Asimov dataset
+  SetParameters(&fit_parameters[0]);
+  CalcLogLikelihood();
+  Double_t chi2_model = log_likelihood.first;
+  TCRFluxFit *w = MakeWorkerCopy(fJ_null_model);
+  Bool_t ok = w->Fit(false);
+  Double_t chi2_null = w->chi2;
+  delete w;
+  CalcLogLikelihood();
+  if(!ok)
+    {
+      fprintf(stderr, "ERROR: Forecast: failed to fit the null model '%s'!\n", fJ_null_model->GetName());
+      return false;
+    }
+  // degrees of freedom from the numbers of the free parameters
+  Int_t ndf = 0;
+  for (Int_t i = 0; i < fJ->GetNpar(); i++)
+    ndf += (fJ->GetParError(i) != 0 ? 1 : 0);
+  for (Int_t i = 0; i < fJ_null_model->GetNpar(); i++)
+    ndf -= (fJ_null_model->GetParError(i) != 0 ? 1 : 0);
+  ndf = TMath::Max(ndf, 1);
+  forecast_dchi2 = TMath::Max(chi2_null - chi2_model, 0.0);
+  forecast_pvalue = TMath::Prob(forecast_dchi2, ndf);
+  if(ndf == 1)
+    forecast_significance = TMath::Sqrt(forecast_dchi2);
+  else if(forecast_pvalue >= 1e-300)
+    forecast_significance = specfit_uti::pchance2sigma(forecast_pvalue, false);
+  else
+    {
+      // the p-value underflows: the log of the chi2 tail Q(a, y), a = ndf / 2, y = dchi2 / 2, from its asymptotic
+      // expansion y^(a-1) e^(-y) / Gamma(a) (1 + (a-1)/y + (a-1)(a-2)/y^2)
+      Double_t a = 0.5 * (Double_t) ndf, y = 0.5 * forecast_dchi2;
+      Double_t log_pvalue = (a - 1.0) * TMath::Log(y) - y - TMath::LnGamma(a) + TMath::Log(1.0 + (a - 1.0) / y + (a - 1.0) * (a - 2.0) / (y * y));
+      forecast_significance = specfit_uti::log_pchance2sigma(log_pvalue);
+    }
+  if(verbose)
+    {
+      fprintf(stdout, "null model %s: d(-2lnL) = %.4f for %d degrees of freedom, p-value = %.4e (%.2f sigma)\n", fJ_null_model->GetName(), forecast_dchi2, ndf,
+	  forecast_pvalue, forecast_significance);
+      fflush(stdout);
+    }
+  return true;
+}
+
+void TCRFluxFit::get_par_limits(std::vector<Double_t> &lo, std::vector<Double_t> &hi) const
+{
+  lo.assign(nfitpar, -TMath::Infinity());
+  hi.assign(nfitpar, TMath::Infinity());
+  TF1 *fEnCorr_first = (fEnCorr.size() ? fEnCorr.begin()->second : 0);
+  for (Int_t i = 0; i < nfitpar; i++)
+    {
+      Double_t a = 0, b = 0;
+      if(i < nfluxpar)
+	fJ->GetParLimits(i, a, b);
+      else if(fEnCorr_first)
+	fEnCorr_first->GetParLimits(i - nfluxpar, a, b);
+      if(a < b)
+	{
+	  lo[i] = a;
+	  hi[i] = b;
+	}
+    }
+}
+
+TCRFluxFitStats& TCRFluxFit::GetStats()
+{
+  // bring the cache counters up to date
+  for (std::map<TString, TCRFlux*>::iterator iflux = Fluxes.begin(); iflux != Fluxes.end(); iflux++)
+    {
+      TCRFlux &flux = *iflux->second;
+      if(flux.GetEncorrCacheHits() || flux.GetEncorrCacheMisses())
+	stats.SetCacheCounts(TString("encorr_") + iflux->first, flux.GetEncorrCacheHits(), flux.GetEncorrCacheMisses());
+    }
+  return stats;
+}
+
+TMinuit* TCRFluxFit::GetMinuit()
+{
+  // To obtain the Minuit pointer for whatever reason.
+  // In order for it to behave correctly, the global FCN must be
+  // pointed to use this instance of the class.
+  pointer_to_global_instance_of_TCRFluxFit = this;
+  return mFIT;
+}
+
+TGraph* TCRFluxFit::scan_parameter(Int_t ipar, Int_t npts, Double_t par_lo, Double_t par_up, Bool_t calc_deltas)
+{
+  SPECFIT_TRACE("TCRFluxFit::scan_parameter", "fit");
+  TMinuit *m = GetMinuit();
   if(!m)
     {
       fprintf(stderr, "error: no initialized Minuit instance -- do the fit first!\n");
       return (new TGraph(0));
     }
-  if(ipar < 0 || ipar > m->GetNumPars() - 1)
+  Int_t npar = (minuit_par_index.size() ? (Int_t) minuit_par_index.size() : m->GetNumPars());
+  if(ipar < 0 || ipar > npar - 1)
+    {
+      fprintf(stderr, "error: ipar must be in 0 to %d range\n", npar - 1);
+      return (new TGraph(0));
+    }
+  // parameters that are profiled analytically are not known to Minuit
+  if(GetMinuitParIndex(ipar) < 0)
     {
-      fprintf(stderr, "error: ipar must be in 0 to %d range\n", m->GetNumPars() - 1);
+      fprintf(stderr, "error: parameter %d is profiled analytically and can't be scanned\n", ipar);
       return (new TGraph(0));
     }
+  ipar = GetMinuitParIndex(ipar);
   TString chnam = "";
   Double_t val = 0, err = 0, xlolim = 0, xuplim = 0;
   Int_t iuint = 0;
@@ -0,0 +1,287 @@
+// Dmitri Ivanov <dmiivanov@gmail.com>
+
+#include "TCRFluxFit.h"
+#include "specfit_trace.h"
+#include "specfit_irls.h"
+#include <cstdio>
+#include <algorithm>
+#include "TMath.h"
+
+// state shared by the threads that evaluate the cells of the break position grid
+namespace
+{
+  struct grid_context
+  {
+    const specfit_irls::problem *p;      // fitted bins
+    Int_t nbreaks;                       // number of break points
+    const std::vector<Double_t> *breaks; // break positions of the cells
+    const std::vector<Double_t> *theta0; // starting coefficients
+    std::vector<Double_t> *chi2;         // deviance of each cell
+    std::vector<Double_t> *theta;        // solution of each cell
+  };
+
+  // orders the cells by their deviance
+  struct grid_chi2_less
+  {
+    const std::vector<Double_t> *chi2;
+    Bool_t operator()(Int_t i, Int_t j) const
+    {
+      return (*chi2)[i] < (*chi2)[j];
+    }
+  };
+}
+
+static void grid_cell(Int_t icell, void *arg)
+{
+  grid_context &c = *(grid_context*) arg;
+  Int_t ncoef = (Int_t) c.theta0->size();
+  std::vector<Double_t> theta(*c.theta0);
+  Double_t deviance = specfit_irls::solve(*c.p, (c.nbreaks ? &(*c.breaks)[icell * c.nbreaks] : 0), theta);
+  (*c.chi2)[icell] = (deviance >= 0 ? deviance : TMath::Infinity());
+  std::copy(theta.begin(), theta.end(), c.theta->begin() + icell * ncoef);
+}
+
+// largest number of tuples of the break positions on the grid, their positions and coefficients take about 100 bytes each
+static const Long64_t grid_max_cells = 2000000;
+
+Bool_t TCRFluxFit::GridSearchBreaks(Int_t npts, Int_t nbest, Int_t nthreads, Bool_t verbose)
+{
+  SPECFIT_TRACE("TCRFluxFit::GridSearchBreaks", "fit");
+  if(!Fluxes.size())
+    {
+      fprintf(stderr, "ERROR: add some flux results before fitting!\n");
+      return false;
+    }
+  TBPLF1 *fbpl = dynamic_cast<TBPLF1*>(fJ);
+  if(!fbpl || TString(fbpl->GetBplType()) != "J")
+    {
+      fprintf(stderr, "ERROR: grid search requires the flux function to be a TBPLF1 function of type J!\n");
+      return false;
+    }
+  if(npts < 1 || nbest < 1)
+    {
+      fprintf(stderr, "ERROR: grid search requires at least 1 point per break and at least 1 fit to polish!\n");
+      return false;
+    }
+  Int_t nbreaks = fbpl->GetNbreaks();
+  Int_t nbpl = nbreaks + 2;
+
+  // current parameters and step sizes are the starting point
+  nfluxpar = fJ->GetNpar();
+  TF1 *fEnCorr_first = (fEnCorr.size() ? fEnCorr.begin()->second : 0);
+  nencorrpar = (fEnCorr_first ? fEnCorr_first->GetNpar() : 0);
+  nfitpar = nfluxpar + nencorrpar;
+  std::vector<Double_t> parstart(nfitpar), parstep(nfitpar);
+  for (Int_t i = 0; i < nfluxpar; i++)
+    {
+      parstart[i] = fJ->GetParameter(i);
+      parstep[i] = fJ->GetParError(i);
+    }
+  for (Int_t i = 0; i < nencorrpar; i++)
+    {
+      parstart[nfluxpar + i] = fEnCorr_first->GetParameter(i);
+      parstep[nfluxpar + i] = fEnCorr_first->GetParError(i);
+    }
+  std::vector<Double_t> exposure_scale_start;
+  Int_t nprofiled_exposure_scales = 0;
+  for (Int_t iflux = 0; iflux < (Int_t) Fluxes_ordered.size(); iflux++)
+    {
+      exposure_scale_start.push_back(Fluxes_ordered[iflux]->exposure_scale);
+      if(Fluxes_ordered[iflux]->exposure_scale_profiled)
+	nprofiled_exposure_scales++;
+    }
+  if(parstep[0] != 0 && nprofiled_exposure_scales == (Int_t) Fluxes_ordered.size())
+    {
+      fprintf(stderr, "ERROR: normalization can't be profiled together with the exposure scales of all fluxes!\n");
+      return false;
+    }
+
+  // values of each break: centers of npts equal intervals within the limits of the parameter
+  // or within the fitted energy range, a single value if the break is fixed
+  Double_t xmin = TMath::Max(log10en_min, fJ->GetXmin());
+  Double_t xmax = TMath::Min(log10en_max, fJ->GetXmax());
+  std::vector<std::vector<Double_t> > break_values(nbreaks);
+  std::vector<Double_t> break_steps(nbreaks, 0);
+  for (Int_t k = 0; k < nbreaks; k++)
+    {
+      Int_t ipar = nbpl + k;
+      if(parstep[ipar] == 0)
+	{
+	  break_values[k].push_back(parstart[ipar]);
+	  continue;
+	}
+      Double_t lo = 0, up = 0;
+      fJ->GetParLimits(ipar, lo, up);
+      if(!(lo < up))
+	{
+	  lo = xmin;
+	  up = xmax;
+	}
+      break_steps[k] = (up - lo) / (Double_t) npts;
+      for (Int_t j = 0; j < npts; j++)
+	break_values[k].push_back(lo + ((Double_t) j + 0.5) * break_steps[k]);
+    }
+
+  // ordered tuples of the break positions, at most grid_max_cells of all tuples
+  Double_t ntuples = 1;
+  for (Int_t k = 0; k < nbreaks; k++)
+    ntuples *= (Double_t) break_values[k].size();
+  if(ntuples > (Double_t) grid_max_cells)
+    {
+      fprintf(stderr, "ERROR: grid search: %.4g tuples of the break positions exceed the limit of %lld, use fewer points per break!\n", ntuples,
+	  grid_max_cells);
+      return false;
+    }
+  grid_breaks.clear();
+  grid_breaks.reserve((size_t) ntuples * nbreaks);
+  std::vector<Int_t> ival(nbreaks, 0);
+  Long64_t ncells_ordered = 0;
+  while (true)
+    {
+      Bool_t ordered = true;
+      for (Int_t k = 1; k < nbreaks && ordered; k++)
+	ordered = (break_values[k - 1][ival[k - 1]] < break_values[k][ival[k]]);
+      if(ordered)
+	{
+	  for (Int_t k = 0; k < nbreaks; k++)
+	    grid_breaks.push_back(break_values[k][ival[k]]);
+	  ncells_ordered++;
+	}
+      Int_t k = 0;
+      for (; k < nbreaks; k++)
+	{
+	  if(++ival[k] < (Int_t) break_values[k].size())
+	    break;
+	  ival[k] = 0;
+	}
+      if(k == nbreaks)
+	break;
+    }
+  Int_t ncells = (Int_t) ncells_ordered;
+  if(!ncells)
+    {
+      fprintf(stderr, "ERROR: grid search: no ordered break positions within the limits!\n");
+      return false;
+    }
+
+  // fitted bins for the starting values of the energy correction parameters
+  fcn_parameters = parstart;
+  specfit_irls::problem p;
+  std::vector<Double_t> theta0;
+  if(!irls_load(theta0, p.log10scale, p.log10en_ref))
+    {
+      fprintf(stderr, "ERROR: grid search: no bins to fit or acceptances that are not positive!\n");
+      return false;
+    }
+  if(parstep[0] == 0 && !(parstart[0] > 0))
+    {
+      fprintf(stderr, "ERROR: grid search: fixed normalization must be positive!\n");
+      return false;
+    }
+  p.nbreaks = nbreaks;
+  p.x = &irls_x;
+  p.acc = &irls_acc;
+  p.n = &irls_n;
+  p.col = &irls_col;
+  p.profiled.assign(theta0.size(), true);
+  for (Int_t q = 0; q < nbpl; q++)
+    p.profiled[q] = (parstep[q] != 0);
+
+  // evaluate the cells in parallel
+  Int_t ncoef = (Int_t) theta0.size();
+  std::vector<Double_t> grid_theta(ncells * ncoef, 0);
+  grid_chi2.assign(ncells, 0);
+  grid_context c;
+  c.p = &p;
+  c.nbreaks = nbreaks;
+  c.breaks = &grid_breaks;
+  c.theta0 = &theta0;
+  c.chi2 = &grid_chi2;
+  c.theta = &grid_theta;
+  Double_t real_time = TCRFluxFitStats::get_real_time();
+  specfit_uti::parallel_for(ncells, grid_cell, &c, nthreads);
+  real_time = TCRFluxFitStats::get_real_time() - real_time;
+
+  // best cells that are not neighbors of each other on the grid
+  std::vector<Int_t> icells(ncells);
+  for (Int_t i = 0; i < ncells; i++)
+    icells[i] = i;
+  grid_chi2_less chi2_less;
+  chi2_less.chi2 = &grid_chi2;
+  std::sort(icells.begin(), icells.end(), chi2_less);
+  std::vector<Int_t> ibest;
+  for (Int_t i = 0; i < ncells && (Int_t) ibest.size() < nbest; i++)
+    {
+      if(!(grid_chi2[icells[i]] < TMath::Infinity()))
+	break;
+      Bool_t neighbor = false;
+      for (Int_t j = 0; j < (Int_t) ibest.size() && !neighbor; j++)
+	{
+	  neighbor = true;
+	  for (Int_t k = 0; k < nbreaks && neighbor; k++)
+	    neighbor = (TMath::Abs(grid_breaks[icells[i] * nbreaks + k] - grid_breaks[ibest[j] * nbreaks + k]) < 1.5 * break_steps[k] + 1e-9);
+	}
+      if(!neighbor)
+	ibest.push_back(icells[i]);
+    }
+  if(!ibest.size())
+    {
+      fprintf(stderr, "ERROR: grid search: the likelihood could not be evaluated at any break positions!\n");
+      return false;
+    }
+  if(verbose)
+    {
+      fprintf(stdout, "grid search: %d break positions evaluated with %d threads in %.3f s\n", ncells, TMath::Min(specfit_uti::get_nthreads(nthreads), ncells),
+	  real_time);
+      for (Int_t j = 0; j < (Int_t) ibest.size(); j++)
+	{
+	  fprintf(stdout, "grid search: cell %d chi2 = %.4f breaks:", ibest[j], grid_chi2[ibest[j]]);
+	  for (Int_t k = 0; k < nbreaks; k++)
+	    fprintf(stdout, " %.4f", grid_breaks[ibest[j] * nbreaks + k]);
+	  fprintf(stdout, "\n");
+	}
+      fflush(stdout);
+    }
+
+  // polish the best cells with the full fit and keep the best of them
+  Double_t chi2_best = TMath::Infinity();
+  std::vector<Double_t> par_best, exposure_scale_best;
+  for (Int_t j = 0; j < (Int_t) ibest.size(); j++)
+    {
+      std::vector<Double_t> theta(grid_theta.begin() + ibest[j] * ncoef, grid_theta.begin() + (ibest[j] + 1) * ncoef);
+      fcn_parameters = parstart;
+      for (Int_t k = 0; k < nbreaks; k++)
+	fcn_parameters[nbpl + k] = grid_breaks[ibest[j] * nbreaks + k];
+      for (Int_t iflux = 0; iflux < (Int_t) Fluxes_ordered.size(); iflux++)
+	Fluxes_ordered[iflux]->exposure_scale = exposure_scale_start[iflux];
+      irls_store(theta, p.profiled);
+      SetFluxPar(&fcn_parameters[0], &parstep[0]);
+      if(nencorrpar)
+	SetEncorrPar(&fcn_parameters[nfluxpar], &parstep[nfluxpar]);
+      if(!Fit(false))
+	continue;
+      if(verbose)
+	fprintf(stdout, "grid search: cell %d polished chi2 = %.4f\n", ibest[j], chi2);
+      if(chi2 < chi2_best)
+	{
+	  chi2_best = chi2;
+	  par_best = fit_parameters;
+	  exposure_scale_best.clear();
+	  for (Int_t iflux = 0; iflux < (Int_t) Fluxes_ordered.size(); iflux++)
+	    exposure_scale_best.push_back(Fluxes_ordered[iflux]->exposure_scale);
+	}
+    }
+  if(!par_best.size())
+    {
+      fprintf(stderr, "ERROR: grid search: none of the best cells could be fitted!\n");
+      return false;
+    }
+
+  // final fit from the best solution, so that the minimizer and the results correspond to it
+  for (Int_t iflux = 0; iflux < (Int_t) Fluxes_ordered.size(); iflux++)
+    Fluxes_ordered[iflux]->exposure_scale = exposure_scale_best[iflux];
+  SetFluxPar(&par_best[0], &parstep[0]);
+  if(nencorrpar)
+    SetEncorrPar(&par_best[nfluxpar], &parstep[nfluxpar]);
+  return Fit(verbose);
+}
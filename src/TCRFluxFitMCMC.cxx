@@ -0,0 +1,330 @@
+// Dmitri Ivanov <dmiivanov@gmail.com>
+
+#include "TCRFluxFit.h"
+#include "specfit_trace.h"
+#include "specfit_mcmc.h"
+#include <cstdio>
+#include <algorithm>
+#include "TMath.h"
+#include "TRandom3.h"
+
+Bool_t TCRFluxFit::SetPrior(Int_t ipar, Double_t mean, Double_t sigma)
+{
+  if(ipar < 0)
+    {
+      fprintf(stderr, "ERROR: SetPrior: parameter index must be non-negative!\n");
+      return false;
+    }
+  if(ipar >= (Int_t) prior_mean.size())
+    {
+      prior_mean.resize(ipar + 1, 0);
+      prior_sigma.resize(ipar + 1, 0);
+    }
+  prior_mean[ipar] = mean;
+  prior_sigma[ipar] = sigma;
+  return true;
+}
+
+Double_t TCRFluxFit::EvalLogPrior(const Double_t *par)
+{
+  std::vector<Double_t> lo, hi;
+  get_par_limits(lo, hi);
+  Double_t logp = 0;
+  for (Int_t i = 0; i < nfitpar; i++)
+    {
+      if(par[i] < lo[i] || par[i] > hi[i])
+	return -TMath::Infinity();
+      if(i < (Int_t) prior_sigma.size() && prior_sigma[i] > 0)
+	{
+	  Double_t u = (par[i] - prior_mean[i]) / prior_sigma[i];
+	  logp -= 0.5 * u * u;
+	}
+    }
+  return logp;
+}
+
+void TCRFluxFit::EvalLogPosterior(Int_t npoints, const Double_t *par, Double_t *logp)
+{
+  // the FCN is evaluated for the points within the limits
+  fd_points.clear();
+  std::vector<Int_t> ipoint;
+  for (Int_t k = 0; k < npoints; k++)
+    {
+      logp[k] = EvalLogPrior(par + k * nfitpar);
+      if(!TMath::Finite(logp[k]))
+	continue;
+      ipoint.push_back(k);
+      fd_points.insert(fd_points.end(), par + k * nfitpar, par + (k + 1) * nfitpar);
+    }
+  fd_values.assign(ipoint.size(), 0);
+  if(!ipoint.empty())
+    eval_fd_points();
+  for (Int_t j = 0; j < (Int_t) ipoint.size(); j++)
+    logp[ipoint[j]] = (TMath::Finite(fd_values[j]) ? logp[ipoint[j]] - 0.5 * fd_values[j] : -TMath::Infinity());
+}
+
+// state shared by the log posterior and the monitor of SampleMCMC
+namespace
+{
+  struct mcmc_context
+  {
+    TCRFluxFit *fit;                  // fit whose posterior is sampled
+    std::vector<Int_t> ivar;          // fit parameters that are sampled
+    std::vector<Double_t> points;     // all fit parameters of the points
+    const std::vector<Double_t> *chain; // positions of the walkers after each step
+    Int_t nburn;                      // number of steps discarded
+    Int_t nsteps;                     // number of steps
+    Int_t nreport;                    // steps between the reports of the diagnostics, 0 for none
+    Long64_t naccepted;               // number of the walkers that moved, for the reports
+    std::vector<Double_t> x_last;     // positions of the walkers after the previous step
+    std::vector<Double_t> *logp_samples; // log posterior densities of the walkers after the burn-in
+    FILE *fp;                         // samples file, 0 if none
+  };
+}
+
+static void mcmc_log_density(Int_t npoints, const Double_t *x, Double_t *logp, void *arg)
+{
+  mcmc_context &c = *(mcmc_context*) arg;
+  Int_t nvar = (Int_t) c.ivar.size();
+  Int_t npar = c.fit->nfitpar;
+  c.points.resize(npoints * npar);
+  for (Int_t k = 0; k < npoints; k++)
+    {
+      std::copy(c.fit->fit_parameters.begin(), c.fit->fit_parameters.end(), c.points.begin() + k * npar);
+      for (Int_t a = 0; a < nvar; a++)
+	c.points[k * npar + c.ivar[a]] = x[k * nvar + a];
+    }
+  c.fit->EvalLogPosterior(npoints, &c.points[0], logp);
+}
+
+static Bool_t mcmc_monitor(Int_t istep, Int_t nwalkers, const Double_t *x, const Double_t *logp, void *arg)
+{
+  mcmc_context &c = *(mcmc_context*) arg;
+  Int_t nvar = (Int_t) c.ivar.size();
+  for (Int_t w = 0; w < nwalkers; w++)
+    {
+      if(!c.x_last.empty() && !std::equal(x + w * nvar, x + (w + 1) * nvar, c.x_last.begin() + w * nvar))
+	c.naccepted++;
+    }
+  c.x_last.assign(x, x + nwalkers * nvar);
+  if(istep >= c.nburn)
+    c.logp_samples->insert(c.logp_samples->end(), logp, logp + nwalkers);
+  if(istep >= c.nburn && c.fp)
+    {
+      for (Int_t w = 0; w < nwalkers; w++)
+	{
+	  fprintf(c.fp, "%d %d %.8e", istep, w, logp[w]);
+	  for (Int_t a = 0; a < nvar; a++)
+	    fprintf(c.fp, " %.8e", x[w * nvar + a]);
+	  fprintf(c.fp, "\n");
+	}
+      fflush(c.fp);
+    }
+  if(c.nreport > 0 && ((istep + 1) % c.nreport == 0 || istep + 1 == c.nsteps))
+    {
+      // diagnostics of the steps after the burn-in, or of the second half of the steps during the burn-in
+      Int_t nstep_chain = istep + 1;
+      Int_t first_step = (istep >= c.nburn ? c.nburn : nstep_chain / 2);
+      Double_t rhat_max = 0, tau_max = 0;
+      for (Int_t a = 0; a < nvar && nstep_chain - first_step >= 2; a++)
+	{
+	  rhat_max = TMath::Max(rhat_max, specfit_mcmc::gelman_rubin(nvar, nwalkers, nstep_chain, &(*c.chain)[0], a, first_step));
+	  tau_max = TMath::Max(tau_max, specfit_mcmc::autocorrelation_time(nvar, nwalkers, nstep_chain, &(*c.chain)[0], a, first_step));
+	}
+      fprintf(stdout, "MCMC: step %d%s acceptance %.3f max R %.4f max tau %.1f steps\n", istep + 1, (istep < c.nburn ? " (burn-in)" : ""),
+	  (Double_t) c.naccepted / (Double_t) (nwalkers * TMath::Max(istep, 1)), rhat_max, tau_max);
+      fflush(stdout);
+    }
+  return true;
+}
+
+Bool_t TCRFluxFit::SampleMCMC(Int_t nsteps, Int_t nburn, Int_t nwalkers, Int_t nthreads, const char *samples_file, UInt_t seed, Bool_t verbose)
+{
+  SPECFIT_TRACE("TCRFluxFit::SampleMCMC", "fit");
+  mcmc_samples.clear();
+  mcmc_logp.clear();
+  mcmc_mean.clear();
+  mcmc_sigma.clear();
+  mcmc_tau.clear();
+  mcmc_rhat.clear();
+  mcmc_acceptance = 0;
+  if(!fJ || !nfitpar || (Int_t) fit_parameters.size() != nfitpar || (Int_t) fit_parerrors.size() != nfitpar)
+    {
+      fprintf(stderr, "ERROR: SampleMCMC: there are no fit parameters, run Fit first!\n");
+      return false;
+    }
+  if(nsteps <= nburn || nburn < 0)
+    {
+      fprintf(stderr, "ERROR: SampleMCMC: number of steps must be larger than the burn-in!\n");
+      return false;
+    }
+  // the free parameters are sampled
+  mcmc_context c;
+  c.fit = this;
+  std::vector<Double_t> lo, hi;
+  get_par_limits(lo, hi);
+  for (Int_t i = 0; i < nfitpar; i++)
+    {
+      if(fit_parerrors[i] != 0)
+	c.ivar.push_back(i);
+    }
+  Int_t nvar = (Int_t) c.ivar.size();
+  if(!nvar)
+    {
+      fprintf(stderr, "ERROR: SampleMCMC: all fit parameters are fixed!\n");
+      return false;
+    }
+  if(nwalkers <= 0)
+    nwalkers = 4 * nvar;
+  nwalkers = TMath::Max(nwalkers, 2 * nvar + 2);
+  nwalkers += nwalkers % 2;
+
+  // starting positions within a tenth of the errors from the fit parameters, within the limits
+  TRandom3 rnd(seed);
+  std::vector<Double_t> x(nwalkers * nvar), logp(nwalkers, -TMath::Infinity());
+  start_fd_workers(nthreads);
+  for (Int_t itry = 0; itry < 100; itry++)
+    {
+      std::vector<Int_t> iwalker;
+      for (Int_t w = 0; w < nwalkers; w++)
+	{
+	  if(TMath::Finite(logp[w]))
+	    continue;
+	  iwalker.push_back(w);
+	  for (Int_t a = 0; a < nvar; a++)
+	    {
+	      Int_t i = c.ivar[a];
+	      Double_t v = fit_parameters[i] + 0.1 * TMath::Abs(fit_parerrors[i]) * rnd.Gaus(0, 1);
+	      x[w * nvar + a] = TMath::Min(TMath::Max(v, lo[i]), hi[i]);
+	    }
+	}
+      if(iwalker.empty())
+	break;
+      std::vector<Double_t> xs, logps(iwalker.size());
+      for (Int_t k = 0; k < (Int_t) iwalker.size(); k++)
+	xs.insert(xs.end(), x.begin() + iwalker[k] * nvar, x.begin() + (iwalker[k] + 1) * nvar);
+      mcmc_log_density((Int_t) iwalker.size(), &xs[0], &logps[0], &c);
+      for (Int_t k = 0; k < (Int_t) iwalker.size(); k++)
+	logp[iwalker[k]] = logps[k];
+    }
+  for (Int_t w = 0; w < nwalkers; w++)
+    {
+      if(!TMath::Finite(logp[w]))
+	{
+	  fprintf(stderr, "ERROR: SampleMCMC: failed to start the walkers where the posterior isn't zero!\n");
+	  stop_fd_workers();
+	  SetParameters(&fit_parameters[0]);
+	  CalcLogLikelihood();
+	  return false;
+	}
+    }
+
+  // samples file with the names of the sampled parameters
+  c.fp = 0;
+  if(samples_file)
+    {
+      c.fp = fopen(samples_file, "w");
+      if(!c.fp)
+	fprintf(stderr, "ERROR: SampleMCMC: failed to open %s for writing!\n", samples_file);
+    }
+  if(c.fp)
+    {
+      TF1 *fEnCorr_first = (fEnCorr.size() ? fEnCorr.begin()->second : 0);
+      fprintf(c.fp, "#step walker logp");
+      for (Int_t a = 0; a < nvar; a++)
+	{
+	  Int_t i = c.ivar[a];
+	  fprintf(c.fp, " %s", (i < nfluxpar ? fJ->GetParName(i) : (fEnCorr_first ? fEnCorr_first->GetParName(i - nfluxpar) : "encorr")));
+	}
+      fprintf(c.fp, "\n");
+    }
+
+  // sampling
+  Double_t real_time = TCRFluxFitStats::get_real_time();
+  Double_t cpu_time = TCRFluxFitStats::get_cpu_time();
+  Long64_t nfcn = stats.nfcn;
+  std::vector<Double_t> chain;
+  chain.reserve((size_t) nsteps * nwalkers * nvar);
+  c.chain = &chain;
+  c.nburn = nburn;
+  c.nsteps = nsteps;
+  c.nreport = (verbose ? TMath::Max(nsteps / 10, 1) : 0);
+  c.naccepted = 0;
+  c.logp_samples = &mcmc_logp;
+  mcmc_acceptance = specfit_mcmc::ensemble(nvar, mcmc_log_density, &c, nwalkers, &x[0], &logp[0], nsteps, &rnd, &chain, mcmc_monitor);
+  stats.AddPhaseTime("mcmc", TCRFluxFitStats::get_real_time() - real_time, TCRFluxFitStats::get_cpu_time() - cpu_time, stats.nfcn - nfcn);
+  if(c.fp)
+    fclose(c.fp);
+  stop_fd_workers();
+  SetParameters(&fit_parameters[0]);
+  CalcLogLikelihood();
+
+  // samples after the burn-in and the diagnostics
+  Int_t nsteps_done = (Int_t) (chain.size() / (nwalkers * nvar));
+  mcmc_mean = fit_parameters;
+  mcmc_sigma.assign(nfitpar, 0);
+  mcmc_tau.assign(nfitpar, 0);
+  mcmc_rhat.assign(nfitpar, 0);
+  for (Int_t s = nburn; s < nsteps_done; s++)
+    {
+      for (Int_t w = 0; w < nwalkers; w++)
+	{
+	  mcmc_samples.insert(mcmc_samples.end(), fit_parameters.begin(), fit_parameters.end());
+	  Double_t *p = &mcmc_samples[mcmc_samples.size() - nfitpar];
+	  for (Int_t a = 0; a < nvar; a++)
+	    p[c.ivar[a]] = chain[((size_t) s * nwalkers + w) * nvar + a];
+	}
+    }
+  Int_t nsamples = (Int_t) (mcmc_samples.size() / nfitpar);
+  for (Int_t a = 0; a < nvar && nsamples > 1; a++)
+    {
+      Int_t i = c.ivar[a];
+      Double_t m = 0, v = 0;
+      for (Int_t k = 0; k < nsamples; k++)
+	m += mcmc_samples[k * nfitpar + i] / (Double_t) nsamples;
+      for (Int_t k = 0; k < nsamples; k++)
+	v += (mcmc_samples[k * nfitpar + i] - m) * (mcmc_samples[k * nfitpar + i] - m) / (Double_t) (nsamples - 1);
+      mcmc_mean[i] = m;
+      mcmc_sigma[i] = TMath::Sqrt(v);
+      mcmc_tau[i] = specfit_mcmc::autocorrelation_time(nvar, nwalkers, nsteps_done, &chain[0], a, nburn);
+      mcmc_rhat[i] = specfit_mcmc::gelman_rubin(nvar, nwalkers, nsteps_done, &chain[0], a, nburn);
+    }
+  if(verbose)
+    {
+      fprintf(stdout, "MCMC: %d walkers, %d steps after %d burn-in steps, acceptance %.3f\n", nwalkers, nsteps_done - nburn, nburn, mcmc_acceptance);
+      fprintf(stdout, "%4s %14s %14s %14s %14s %10s %8s\n", "ipar", "fit", "mean", "sigma", "median", "tau", "R");
+      for (Int_t a = 0; a < nvar; a++)
+	{
+	  Int_t i = c.ivar[a];
+	  fprintf(stdout, "%4d %14.6e %14.6e %14.6e %14.6e %10.1f %8.4f\n", i, fit_parameters[i], mcmc_mean[i], mcmc_sigma[i], GetPosteriorQuantile(i, 0.5),
+	      mcmc_tau[i], mcmc_rhat[i]);
+	}
+      fflush(stdout);
+    }
+  // the chain should be many autocorrelation times long
+  for (Int_t a = 0; a < nvar; a++)
+    {
+      if(50.0 * mcmc_tau[c.ivar[a]] > (Double_t) (nsteps_done - nburn))
+	{
+	  fprintf(stderr, "WARNING: SampleMCMC: chain is shorter than 50 autocorrelation times of parameter %d, the results may be unreliable\n", c.ivar[a]);
+	  break;
+	}
+    }
+  return true;
+}
+
+Double_t TCRFluxFit::GetPosteriorQuantile(Int_t ipar, Double_t q) const
+{
+  Int_t nsamples = (nfitpar ? (Int_t) (mcmc_samples.size() / nfitpar) : 0);
+  if(ipar < 0 || ipar >= nfitpar || !nsamples)
+    return 0;
+  std::vector<Double_t> v(nsamples);
+  for (Int_t k = 0; k < nsamples; k++)
+    v[k] = mcmc_samples[k * nfitpar + ipar];
+  std::sort(v.begin(), v.end());
+  Double_t pos = TMath::Min(TMath::Max(q, 0.0), 1.0) * (Double_t) (nsamples - 1);
+  Int_t k = (Int_t) pos;
+  if(k >= nsamples - 1)
+    return v[nsamples - 1];
+  return v[k] + (pos - (Double_t) k) * (v[k + 1] - v[k]);
+}
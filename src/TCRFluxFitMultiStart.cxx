@@ -0,0 +1,395 @@
+// Dmitri Ivanov <dmiivanov@gmail.com>
+
+#include "TCRFluxFit.h"
+#include "specfit_trace.h"
+#include <cstdio>
+#include <algorithm>
+#include "TMath.h"
+#include "TRandom3.h"
+
+// state shared by the threads that run the fits of MultiStart
+namespace
+{
+  struct multistart_context
+  {
+    std::vector<TCRFluxFit*> workers;                  // one copy of the fit for each thread
+    Int_t nstarts;                                     // number of fits
+    Int_t nfluxpar;                                    // number of flux function parameters
+    const std::vector<std::vector<Double_t> > *starts; // starting values of the fit parameters
+    const std::vector<Double_t> *parstep;              // step sizes of the fit parameters
+    std::vector<Double_t> exposure_scale_start;        // starting exposure scales of the fluxes
+    std::vector<Bool_t> ok;                            // whether each fit has succeeded
+    std::vector<Double_t> chi2;                        // normalized log likelihood of each fit
+    std::vector<Int_t> status;                         // Migrad status of each fit
+    std::vector<std::vector<Double_t> > parameters;    // fit parameters of each fit
+    std::vector<std::vector<Double_t> > parerrors;     // uncertainties on the fit parameters
+    std::vector<std::vector<Double_t> > exposure_scales; // exposure scales of the fluxes after each fit
+  };
+
+  // orders the fits by their log likelihoods
+  struct multistart_chi2_less
+  {
+    const std::vector<Double_t> *chi2;
+    Bool_t operator()(Int_t i, Int_t j) const
+    {
+      return (*chi2)[i] < (*chi2)[j];
+    }
+  };
+}
+
+// thread iworker runs the fits iworker, iworker + nworkers, ...
+static void multistart_worker(Int_t iworker, void *arg)
+{
+  multistart_context &c = *(multistart_context*) arg;
+  TCRFluxFit &w = *c.workers[iworker];
+  Int_t nfitpar = (Int_t) c.parstep->size();
+  for (Int_t istart = iworker; istart < c.nstarts; istart += (Int_t) c.workers.size())
+    {
+      const std::vector<Double_t> &start = (*c.starts)[istart];
+      for (Int_t iflux = 0; iflux < w.GetNfluxes(); iflux++)
+	w.GetFlux(iflux)->exposure_scale = c.exposure_scale_start[iflux];
+      w.SetFluxPar(&start[0], &(*c.parstep)[0]);
+      if(nfitpar > c.nfluxpar)
+	w.SetEncorrPar(&start[c.nfluxpar], &(*c.parstep)[c.nfluxpar]);
+      c.ok[istart] = (w.Fit(false) && w.chi2 < TMath::Infinity());
+      c.chi2[istart] = w.chi2;
+      c.status[istart] = w.stats.fit_status;
+      c.parameters[istart] = w.fit_parameters;
+      c.parerrors[istart] = w.fit_parerrors;
+      c.exposure_scales[istart].clear();
+      for (Int_t iflux = 0; iflux < w.GetNfluxes(); iflux++)
+	c.exposure_scales[istart].push_back(w.GetFlux(iflux)->exposure_scale);
+    }
+}
+
+Int_t TCRFluxFit::MultiStart(Int_t nstarts, Bool_t latin_hypercube, Int_t nthreads, UInt_t seed, Bool_t verbose)
+{
+  SPECFIT_TRACE("TCRFluxFit::MultiStart", "fit");
+  minima_chi2.clear();
+  minima_nstarts.clear();
+  minima_status.clear();
+  minima_parameters.clear();
+  minima_parerrors.clear();
+  if(!Fluxes.size())
+    {
+      fprintf(stderr, "ERROR: add some flux results before fitting!\n");
+      return 0;
+    }
+  if(!fJ)
+    {
+      fprintf(stderr, "ERROR: set the flux function before fitting!\n");
+      return 0;
+    }
+  if(nstarts < 1)
+    {
+      fprintf(stderr, "ERROR: multistart requires at least 1 start!\n");
+      return 0;
+    }
+
+  // current parameters, step sizes, and limits
+  nfluxpar = fJ->GetNpar();
+  TF1 *fEnCorr_first = (fEnCorr.size() ? fEnCorr.begin()->second : 0);
+  nencorrpar = (fEnCorr_first ? fEnCorr_first->GetNpar() : 0);
+  nfitpar = nfluxpar + nencorrpar;
+  std::vector<Double_t> parstart(nfitpar), parstep(nfitpar), parmin(nfitpar, 0), parmax(nfitpar, 0);
+  for (Int_t i = 0; i < nfitpar; i++)
+    {
+      TF1 *f = (i < nfluxpar ? fJ : fEnCorr_first);
+      Int_t ipar = (i < nfluxpar ? i : i - nfluxpar);
+      parstart[i] = f->GetParameter(ipar);
+      parstep[i] = f->GetParError(ipar);
+      f->GetParLimits(ipar, parmin[i], parmax[i]);
+      if(!(parmin[i] < parmax[i]))
+	{
+	  parmin[i] = parstart[i] - 5.0 * TMath::Abs(parstep[i]);
+	  parmax[i] = parstart[i] + 5.0 * TMath::Abs(parstep[i]);
+	}
+    }
+
+  // starting points: for the Latin hypercube each parameter takes one value from each of nstarts equal intervals
+  // of its range, and the intervals are shuffled independently for each parameter
+  TRandom3 rng(seed);
+  std::vector<std::vector<Double_t> > starts(nstarts, parstart);
+  std::vector<Int_t> strata(nstarts);
+  for (Int_t i = 0; i < nfitpar; i++)
+    {
+      if(parstep[i] == 0)
+	continue;
+      for (Int_t istart = 0; istart < nstarts; istart++)
+	strata[istart] = istart;
+      for (Int_t istart = nstarts - 1; istart > 0; istart--)
+	std::swap(strata[istart], strata[(Int_t) rng.Integer(istart + 1)]);
+      for (Int_t istart = 0; istart < nstarts; istart++)
+	{
+	  Double_t u = (latin_hypercube ? ((Double_t) strata[istart] + rng.Rndm()) / (Double_t) nstarts : rng.Rndm());
+	  starts[istart][i] = parmin[i] + u * (parmax[i] - parmin[i]);
+	}
+    }
+  TBPLF1 *fbpl = dynamic_cast<TBPLF1*>(fJ);
+  if(fbpl && fbpl->GetNbreaks() > 1)
+    {
+      Int_t ibreak = fbpl->GetNbreaks() + 2;
+      for (Int_t istart = 0; istart < nstarts; istart++)
+	std::sort(starts[istart].begin() + ibreak, starts[istart].begin() + ibreak + fbpl->GetNbreaks());
+    }
+
+  // worker copies of the fit are made in this thread
+  Int_t nworkers = get_nworkers(nthreads, nstarts);
+  multistart_context c;
+  for (Int_t iworker = 0; iworker < nworkers; iworker++)
+    c.workers.push_back(MakeWorkerCopy());
+  c.nstarts = nstarts;
+  c.nfluxpar = nfluxpar;
+  c.starts = &starts;
+  c.parstep = &parstep;
+  for (Int_t iflux = 0; iflux < (Int_t) Fluxes_ordered.size(); iflux++)
+    c.exposure_scale_start.push_back(Fluxes_ordered[iflux]->exposure_scale);
+  c.ok.assign(nstarts, false);
+  c.chi2.assign(nstarts, TMath::Infinity());
+  c.status.assign(nstarts, -1);
+  c.parameters.resize(nstarts);
+  c.parerrors.resize(nstarts);
+  c.exposure_scales.resize(nstarts);
+  Double_t real_time = TCRFluxFitStats::get_real_time();
+  specfit_uti::parallel_for(nworkers, multistart_worker, &c, nworkers);
+  real_time = TCRFluxFitStats::get_real_time() - real_time;
+  for (Int_t iworker = 0; iworker < nworkers; iworker++)
+    delete c.workers[iworker];
+
+  // cluster the successful fits in the order of their log likelihoods: a fit belongs to the first minimum
+  // that it's close to
+  std::vector<Int_t> ifits;
+  for (Int_t istart = 0; istart < nstarts; istart++)
+    {
+      if(c.ok[istart])
+	ifits.push_back(istart);
+    }
+  multistart_chi2_less chi2_less;
+  chi2_less.chi2 = &c.chi2;
+  std::sort(ifits.begin(), ifits.end(), chi2_less);
+  std::vector<Int_t> iminima;
+  for (Int_t j = 0; j < (Int_t) ifits.size(); j++)
+    {
+      Int_t ifit = ifits[j];
+      Int_t imin = 0;
+      for (; imin < (Int_t) iminima.size(); imin++)
+	{
+	  Int_t ibest = iminima[imin];
+	  Bool_t same = (TMath::Abs(c.chi2[ifit] - c.chi2[ibest]) < 0.05);
+	  for (Int_t i = 0; i < nfitpar && same; i++)
+	    {
+	      Double_t tolerance = TMath::Max(c.parerrors[ibest][i], 1e-6 * TMath::Abs(c.parameters[ibest][i]));
+	      same = (TMath::Abs(c.parameters[ifit][i] - c.parameters[ibest][i]) <= tolerance);
+	    }
+	  if(same)
+	    break;
+	}
+      if(imin < (Int_t) iminima.size())
+	{
+	  minima_nstarts[imin]++;
+	  continue;
+	}
+      iminima.push_back(ifit);
+      minima_chi2.push_back(c.chi2[ifit]);
+      minima_nstarts.push_back(1);
+      minima_status.push_back(c.status[ifit]);
+      minima_parameters.push_back(c.parameters[ifit]);
+      minima_parerrors.push_back(c.parerrors[ifit]);
+    }
+  if(verbose)
+    {
+      fprintf(stdout, "multistart: %d fits with %d threads in %.3f s, %d succeeded, %d distinct minima\n", nstarts, nworkers, real_time, (Int_t) ifits.size(),
+	  (Int_t) iminima.size());
+      for (Int_t imin = 0; imin < (Int_t) iminima.size(); imin++)
+	{
+	  fprintf(stdout, "multistart: minimum %d chi2 = %.4f starts = %d status = %d parameters:", imin, minima_chi2[imin], minima_nstarts[imin], minima_status[imin]);
+	  for (Int_t i = 0; i < nfitpar; i++)
+	    fprintf(stdout, " %.4g", minima_parameters[imin][i]);
+	  fprintf(stdout, "\n");
+	}
+      fflush(stdout);
+    }
+  if(!iminima.size())
+    {
+      fprintf(stderr, "ERROR: multistart: none of the fits succeeded!\n");
+      return 0;
+    }
+
+  // leave this fit at the best minimum
+  for (Int_t iflux = 0; iflux < (Int_t) Fluxes_ordered.size(); iflux++)
+    Fluxes_ordered[iflux]->exposure_scale = c.exposure_scales[iminima[0]][iflux];
+  SetFluxPar(&minima_parameters[0][0], &parstep[0]);
+  if(nencorrpar)
+    SetEncorrPar(&minima_parameters[0][nfluxpar], &parstep[nfluxpar]);
+  Fit(verbose);
+  return (Int_t) iminima.size();
+}
+
+// fits of several workers that run concurrently, one fit per worker
+namespace
+{
+  struct worker_fits_context
+  {
+    std::vector<TCRFluxFit*> workers;
+    std::vector<Bool_t> ok;
+  };
+}
+
+static void worker_fit(Int_t iworker, void *arg)
+{
+  worker_fits_context &c = *(worker_fits_context*) arg;
+  TCRFluxFit &w = *c.workers[iworker];
+  c.ok[iworker] = (w.Fit(false) && w.chi2 < TMath::Infinity());
+}
+
+Bool_t TCRFluxFit::CompareBreakModels(Int_t kmax, Int_t nthreads, Bool_t verbose)
+{
+  SPECFIT_TRACE("TCRFluxFit::CompareBreakModels", "fit");
+  for (Int_t k = 0; k < (Int_t) models.size(); k++)
+    {
+      TF1_Objects_Created_By_This.Remove(models[k]);
+      delete models[k];
+    }
+  TF1_Objects_Created_By_This.Compress();
+  models.clear();
+  models_chi2.clear();
+  models_npar.clear();
+  models_nbins.clear();
+  models_aic.clear();
+  models_bic.clear();
+  models_dchi2.clear();
+  models_pvalue.clear();
+  if(!Fluxes.size())
+    {
+      fprintf(stderr, "ERROR: add some flux results before fitting!\n");
+      return false;
+    }
+  TBPLF1 *fbpl = dynamic_cast<TBPLF1*>(fJ);
+  if(!fbpl || TString(fbpl->GetBplType()) != "J")
+    {
+      fprintf(stderr, "ERROR: model comparison requires the flux function to be a TBPLF1 function of type J!\n");
+      return false;
+    }
+  if(kmax < 0)
+    {
+      fprintf(stderr, "ERROR: model comparison requires kmax >= 0!\n");
+      return false;
+    }
+  Double_t xmin = TMath::Max(log10en_min, fJ->GetXmin());
+  Double_t xmax = TMath::Min(log10en_max, fJ->GetXmax());
+
+  // free energy correction parameters and exposure scales are the same for all models
+  TF1 *fEnCorr_first = (fEnCorr.size() ? fEnCorr.begin()->second : 0);
+  Int_t npar_other = 0;
+  for (Int_t i = 0; fEnCorr_first && i < fEnCorr_first->GetNpar(); i++)
+    {
+      if(fEnCorr_first->GetParError(i) != 0)
+	npar_other++;
+    }
+  for (Int_t iflux = 0; iflux < (Int_t) Fluxes_ordered.size(); iflux++)
+    {
+      if(Fluxes_ordered[iflux]->exposure_scale_profiled)
+	npar_other++;
+    }
+
+  std::vector<Double_t> solution; // parameters of the model with one break less
+  for (Int_t k = 0; k <= kmax; k++)
+    {
+      // model with k breaks: const, p1, ..., pk+1, logEb1, ..., logEbk
+      TString parnames = "const";
+      for (Int_t j = 1; j <= k + 1; j++)
+	parnames += TString::Format(",p%d", j);
+      for (Int_t j = 1; j <= k; j++)
+	parnames += TString::Format(",logEb%d", j);
+      std::vector<Double_t> parerrors(2 * k + 2, 0.1);
+      TBPLF1 *model = new TBPLF1(specfit_uti::get_unique_object_name(TString::Format("fJ%dB_cmp", k)), k, "J", fbpl->GetBplScaleFactor(),
+	  fbpl->GetBplLog10enMin(), fbpl->GetXmax(), parnames.Data(), 0, &parerrors[0]);
+      model->SetRange(fbpl->GetXmin(), fbpl->GetXmax());
+      for (Int_t j = 0; j < k; j++)
+	model->SetParLimits(k + 2 + j, xmin, xmax);
+      models.push_back(model);
+      TF1_Objects_Created_By_This.Add(model);
+
+      // starting values: each segment of the previous solution split in the middle, so that the fit starts from
+      // the same function, and the starting values of the flux function if it has the same number of breaks
+      std::vector<std::vector<Double_t> > starts;
+      if(k == 0)
+	{
+	  std::vector<Double_t> start(2);
+	  start[0] = fbpl->GetParameter(0);
+	  start[1] = fbpl->GetParameter(1);
+	  starts.push_back(start);
+	}
+      for (Int_t jsplit = 0; k > 0 && jsplit < k; jsplit++)
+	{
+	  // previous solution has k-1 breaks at solution[k+1], ..., solution[2k-1]
+	  const Double_t *breaks_prev = &solution[k + 1];
+	  Double_t xlo = (jsplit > 0 ? breaks_prev[jsplit - 1] : xmin);
+	  Double_t xup = (jsplit < k - 1 ? breaks_prev[jsplit] : xmax);
+	  std::vector<Double_t> start(2 * k + 2);
+	  start[0] = solution[0];
+	  for (Int_t j = 0; j <= k; j++)
+	    start[1 + j] = solution[1 + (j <= jsplit ? j : j - 1)];
+	  for (Int_t j = 0; j < k; j++)
+	    start[k + 2 + j] = (j < jsplit ? breaks_prev[j] : (j == jsplit ? 0.5 * (xlo + xup) : breaks_prev[j - 1]));
+	  starts.push_back(start);
+	}
+      if(k > 0 && fbpl->GetNbreaks() == k)
+	starts.push_back(std::vector<Double_t>(fbpl->GetParameters(), fbpl->GetParameters() + 2 * k + 2));
+
+      // fit from all starting values concurrently
+      worker_fits_context c;
+      for (Int_t istart = 0; istart < (Int_t) starts.size(); istart++)
+	{
+	  model->SetParameters(&starts[istart][0]);
+	  c.workers.push_back(MakeWorkerCopy(model));
+	}
+      c.ok.assign(starts.size(), false);
+      Int_t nworkers = get_nworkers(nthreads, (Int_t) starts.size());
+      specfit_uti::parallel_for((Int_t) starts.size(), worker_fit, &c, nworkers);
+      Int_t ibest = -1;
+      for (Int_t istart = 0; istart < (Int_t) starts.size(); istart++)
+	{
+	  if(c.ok[istart] && (ibest < 0 || c.workers[istart]->chi2 < c.workers[ibest]->chi2))
+	    ibest = istart;
+	}
+      if(ibest >= 0)
+	{
+	  TCRFluxFit &w = *c.workers[ibest];
+	  solution = w.fit_parameters;
+	  model->SetParameters(&w.fit_parameters[0]);
+	  model->SetParErrors(&w.fit_parerrors[0]);
+	  models_chi2.push_back(w.chi2);
+	  models_nbins.push_back(w.log_likelihood.second);
+	}
+      for (Int_t istart = 0; istart < (Int_t) starts.size(); istart++)
+	delete c.workers[istart];
+      if(ibest < 0)
+	{
+	  fprintf(stderr, "ERROR: model comparison: failed to fit the model with %d breaks!\n", k);
+	  models_chi2.clear();
+	  models_nbins.clear();
+	  return false;
+	}
+    }
+
+  // information criteria and likelihood ratio tests of the nested models
+  for (Int_t k = 0; k <= kmax; k++)
+    {
+      Int_t npar = 2 * k + 2 + npar_other;
+      models_npar.push_back(npar);
+      models_aic.push_back(models_chi2[k] + 2.0 * (Double_t) npar);
+      models_bic.push_back(models_chi2[k] + (Double_t) npar * TMath::Log(TMath::Max(models_nbins[k], 1.0)));
+      models_dchi2.push_back(k > 0 ? models_chi2[k - 1] - models_chi2[k] : 0.0);
+      models_pvalue.push_back(k > 0 ? TMath::Prob(TMath::Max(models_dchi2[k], 0.0), 2) : 1.0);
+    }
+  if(verbose)
+    {
+      fprintf(stdout, "%8s %12s %6s %8s %12s %12s %12s %12s\n", "nbreaks", "-2lnL", "npar", "nbins", "AIC", "BIC", "d(-2lnL)", "p-value");
+      for (Int_t k = 0; k <= kmax; k++)
+	fprintf(stdout, "%8d %12.4f %6d %8.0f %12.4f %12.4f %12.4f %12.4e\n", k, models_chi2[k], models_npar[k], models_nbins[k], models_aic[k], models_bic[k],
+	    models_dchi2[k], models_pvalue[k]);
+      fflush(stdout);
+    }
+  return true;
+}
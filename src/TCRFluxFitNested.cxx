@@ -0,0 +1,151 @@
+// Dmitri Ivanov <dmiivanov@gmail.com>
+
+#include "TCRFluxFit.h"
+#include "specfit_trace.h"
+#include "specfit_nested.h"
+#include <cstdio>
+#include <algorithm>
+#include "TMath.h"
+#include "TRandom3.h"
+
+// state shared by the likelihood and the monitor of ComputeEvidence
+namespace
+{
+  struct nested_context
+  {
+    TCRFluxFit *fit;              // fit whose evidence is computed
+    std::vector<Int_t> ivar;      // fit parameters that are sampled
+    std::vector<Double_t> lo;     // lower ends of the prior ranges of the sampled parameters
+    std::vector<Double_t> hi;     // upper ends of the prior ranges
+    Double_t logl_offset;         // normalization of the priors and of the posterior density
+    std::vector<Double_t> points; // all fit parameters of the points
+    Int_t nreport;                // iterations between the reports, 0 for none
+  };
+}
+
+// log likelihood times the prior density relative to the uniform one of the points u of the unit hypercube
+static void nested_log_likelihood(Int_t npoints, const Double_t *u, Double_t *logl, void *arg)
+{
+  nested_context &c = *(nested_context*) arg;
+  Int_t nvar = (Int_t) c.ivar.size();
+  Int_t npar = c.fit->nfitpar;
+  c.points.resize(npoints * npar);
+  for (Int_t k = 0; k < npoints; k++)
+    {
+      std::copy(c.fit->fit_parameters.begin(), c.fit->fit_parameters.end(), c.points.begin() + k * npar);
+      for (Int_t a = 0; a < nvar; a++)
+	c.points[k * npar + c.ivar[a]] = c.lo[a] + u[k * nvar + a] * (c.hi[a] - c.lo[a]);
+    }
+  c.fit->EvalLogPosterior(npoints, &c.points[0], logl);
+  for (Int_t k = 0; k < npoints; k++)
+    logl[k] += c.logl_offset;
+}
+
+static void nested_monitor(Int_t iteration, Double_t logz, Double_t logx, Double_t logl_min, void *arg)
+{
+  nested_context &c = *(nested_context*) arg;
+  if(c.nreport > 0 && (iteration + 1) % c.nreport == 0)
+    {
+      fprintf(stdout, "nested sampling: iteration %d log X %.3f log L min %.4f log Z %.4f\n", iteration + 1, logx, logl_min, logz);
+      fflush(stdout);
+    }
+}
+
+Bool_t TCRFluxFit::ComputeEvidence(Int_t nlive, Int_t nthreads, Double_t nsigma_unbounded, Double_t dlogz, UInt_t seed, Bool_t verbose)
+{
+  SPECFIT_TRACE("TCRFluxFit::ComputeEvidence", "fit");
+  evidence_logz = 0;
+  evidence_logz_error = 0;
+  evidence_h = 0;
+  evidence_niter = 0;
+  if(!fJ || !nfitpar || (Int_t) fit_parameters.size() != nfitpar || (Int_t) fit_parerrors.size() != nfitpar)
+    {
+      fprintf(stderr, "ERROR: ComputeEvidence: there are no fit parameters, run Fit first!\n");
+      return false;
+    }
+  if(!(nsigma_unbounded > 0))
+    {
+      fprintf(stderr, "ERROR: ComputeEvidence: nsigma_unbounded must be positive!\n");
+      return false;
+    }
+  // prior ranges of the free parameters
+  nested_context c;
+  c.fit = this;
+  c.logl_offset = 0;
+  std::vector<Double_t> lo, hi;
+  get_par_limits(lo, hi);
+  Bool_t unbounded = false;
+  for (Int_t i = 0; i < nfitpar; i++)
+    {
+      Bool_t gaussian = (i < (Int_t) prior_sigma.size() && prior_sigma[i] > 0);
+      Double_t u = (gaussian ? (fit_parameters[i] - prior_mean[i]) / prior_sigma[i] : 0);
+      if(fit_parerrors[i] == 0)
+	{
+	  // EvalLogPrior counts the Gaussian priors of the fixed parameters too
+	  c.logl_offset += 0.5 * u * u;
+	  continue;
+	}
+      Double_t a = lo[i], b = hi[i];
+      if(!TMath::Finite(a) || !TMath::Finite(b))
+	{
+	  Double_t center = (gaussian ? prior_mean[i] : fit_parameters[i]);
+	  Double_t width = nsigma_unbounded * (gaussian ? prior_sigma[i] : TMath::Abs(fit_parerrors[i]));
+	  a = TMath::Max(a, center - width);
+	  b = TMath::Min(b, center + width);
+	  if(!gaussian)
+	    unbounded = true;
+	}
+      if(!(a < b))
+	{
+	  fprintf(stderr, "ERROR: ComputeEvidence: empty prior range of parameter %d!\n", i);
+	  return false;
+	}
+      c.ivar.push_back(i);
+      c.lo.push_back(a);
+      c.hi.push_back(b);
+      // the sampling is uniform in [a, b], a Gaussian prior is normalized within it
+      if(gaussian)
+	{
+	  Double_t norm = TMath::Sqrt(2.0 * TMath::Pi()) * prior_sigma[i]
+	      * (TMath::Freq((b - prior_mean[i]) / prior_sigma[i]) - TMath::Freq((a - prior_mean[i]) / prior_sigma[i]));
+	  c.logl_offset += TMath::Log(b - a) - TMath::Log(norm);
+	}
+    }
+  Int_t nvar = (Int_t) c.ivar.size();
+  if(!nvar)
+    {
+      fprintf(stderr, "ERROR: ComputeEvidence: all fit parameters are fixed!\n");
+      return false;
+    }
+  if(unbounded)
+    fprintf(stderr, "WARNING: ComputeEvidence: parameters without limits have priors within %g errors from their fitted values\n", nsigma_unbounded);
+
+  // as many live points are replaced at a time as there are copies of the fit to evaluate the random walks
+  TRandom3 rnd(seed);
+  start_fd_workers(nthreads);
+  Int_t nreplace = TMath::Max((Int_t) fd_workers.size(), 1);
+  nreplace = TMath::Min(nreplace, TMath::Max(nlive / 10, 1));
+  c.nreport = (verbose ? TMath::Max(nlive / nreplace, 1) : 0);
+  Double_t real_time = TCRFluxFitStats::get_real_time();
+  Double_t cpu_time = TCRFluxFitStats::get_cpu_time();
+  Long64_t nfcn = stats.nfcn;
+  evidence_niter = specfit_nested::run(nvar, nested_log_likelihood, &c, nlive, &rnd, evidence_logz, evidence_logz_error, evidence_h, nreplace, 25, dlogz,
+      1000000, 0, 0, nested_monitor);
+  stats.AddPhaseTime("evidence", TCRFluxFitStats::get_real_time() - real_time, TCRFluxFitStats::get_cpu_time() - cpu_time, stats.nfcn - nfcn);
+  stop_fd_workers();
+  SetParameters(&fit_parameters[0]);
+  CalcLogLikelihood();
+  if(evidence_niter < 0)
+    {
+      evidence_niter = 0;
+      evidence_logz = 0;
+      return false;
+    }
+  if(verbose)
+    {
+      fprintf(stdout, "evidence of %s: log Z = %.4f +/- %.4f, information %.3f nats, %d live points, %d iterations\n", fJ->GetName(), evidence_logz,
+	  evidence_logz_error, evidence_h, nlive, evidence_niter);
+      fflush(stdout);
+    }
+  return true;
+}
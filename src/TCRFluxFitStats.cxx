@@ -0,0 +1,198 @@
+// Dmitri Ivanov <dmiivanov@gmail.com>
+
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <sys/time.h>
+#include "TCRFluxFitStats.h"
+
+ClassImp(TCRFluxFitStats);
+
+TCRFluxFitStats::~TCRFluxFitStats()
+{
+  ;
+}
+
+void TCRFluxFitStats::Reset()
+{
+  nfcn = 0;
+  ngrad = 0;
+  fit_real_time = 0;
+  fit_cpu_time = 0;
+  fit_status = 0;
+  flux_real_time.clear();
+  flux_cpu_time.clear();
+  flux_ncalls.clear();
+  phase_names.clear();
+  phase_real_time.clear();
+  phase_cpu_time.clear();
+  phase_ncalls.clear();
+  cache_hits.clear();
+  cache_misses.clear();
+  iter_phase.clear();
+  iter_ncalls.clear();
+  iter_fval.clear();
+  iter_edm.clear();
+  iter_status.clear();
+}
+
+void TCRFluxFitStats::AddFluxTime(const char *flux_name, Double_t real_time, Double_t cpu_time)
+{
+  flux_real_time[flux_name] += real_time;
+  flux_cpu_time[flux_name] += cpu_time;
+  flux_ncalls[flux_name]++;
+}
+
+void TCRFluxFitStats::AddPhaseTime(const char *phase_name, Double_t real_time, Double_t cpu_time, Long64_t ncalls)
+{
+  if(phase_ncalls.find(phase_name) == phase_ncalls.end())
+    phase_names.push_back(phase_name);
+  phase_real_time[phase_name] += real_time;
+  phase_cpu_time[phase_name] += cpu_time;
+  phase_ncalls[phase_name] += ncalls;
+}
+
+void TCRFluxFitStats::SetCacheCounts(const char *cache_name, Long64_t nhits, Long64_t nmisses)
+{
+  cache_hits[cache_name] = nhits;
+  cache_misses[cache_name] = nmisses;
+}
+
+void TCRFluxFitStats::AddIteration(const char *phase_name, Long64_t ncalls, Double_t fval, Double_t edm, Int_t status)
+{
+  iter_phase.push_back(phase_name);
+  iter_ncalls.push_back(ncalls);
+  iter_fval.push_back(fval);
+  iter_edm.push_back(edm);
+  iter_status.push_back(status);
+}
+
+Double_t TCRFluxFitStats::GetCacheHitRate(const char *cache_name) const
+{
+  std::map<TString, Long64_t>::const_iterator ih = cache_hits.find(cache_name);
+  std::map<TString, Long64_t>::const_iterator im = cache_misses.find(cache_name);
+  Double_t nhits = (ih != cache_hits.end() ? (Double_t) ih->second : 0.0);
+  Double_t nmisses = (im != cache_misses.end() ? (Double_t) im->second : 0.0);
+  return (nhits + nmisses > 0 ? nhits / (nhits + nmisses) : 0.0);
+}
+
+// to look up a value in a map, zero if not found
+template<class T> static T get_value(const std::map<TString, T> &m, const char *key)
+{
+  typename std::map<TString, T>::const_iterator i = m.find(key);
+  return (i != m.end() ? i->second : (T) 0);
+}
+
+Double_t TCRFluxFitStats::GetPhaseRealTime(const char *phase_name) const
+{
+  return get_value(phase_real_time, phase_name);
+}
+
+Double_t TCRFluxFitStats::GetPhaseCpuTime(const char *phase_name) const
+{
+  return get_value(phase_cpu_time, phase_name);
+}
+
+Long64_t TCRFluxFitStats::GetPhaseNcalls(const char *phase_name) const
+{
+  return get_value(phase_ncalls, phase_name);
+}
+
+Double_t TCRFluxFitStats::GetFluxRealTime(const char *flux_name) const
+{
+  return get_value(flux_real_time, flux_name);
+}
+
+Double_t TCRFluxFitStats::GetFluxCpuTime(const char *flux_name) const
+{
+  return get_value(flux_cpu_time, flux_name);
+}
+
+TString TCRFluxFitStats::ToJSON() const
+{
+  TString json = "{\n";
+  json += TString::Format("  \"nfcn\": %lld,\n", nfcn);
+  json += TString::Format("  \"ngrad\": %lld,\n", ngrad);
+  json += TString::Format("  \"fit_real_time\": %.6e,\n", fit_real_time);
+  json += TString::Format("  \"fit_cpu_time\": %.6e,\n", fit_cpu_time);
+  json += TString::Format("  \"fit_status\": %d,\n", fit_status);
+  json += "  \"fluxes\": {";
+  for (std::map<TString, Long64_t>::const_iterator i = flux_ncalls.begin(); i != flux_ncalls.end(); i++)
+    {
+      json += (i == flux_ncalls.begin() ? "\n" : ",\n");
+      json += TString::Format("    \"%s\": { \"ncalls\": %lld, \"real_time\": %.6e, \"cpu_time\": %.6e }", i->first.Data(), i->second,
+	  GetFluxRealTime(i->first), GetFluxCpuTime(i->first));
+    }
+  json += (flux_ncalls.empty() ? "},\n" : "\n  },\n");
+  json += "  \"phases\": {";
+  for (Int_t i = 0; i < (Int_t) phase_names.size(); i++)
+    {
+      json += (i == 0 ? "\n" : ",\n");
+      json += TString::Format("    \"%s\": { \"ncalls\": %lld, \"real_time\": %.6e, \"cpu_time\": %.6e }", phase_names[i].Data(), GetPhaseNcalls(phase_names[i]),
+	  GetPhaseRealTime(phase_names[i]), GetPhaseCpuTime(phase_names[i]));
+    }
+  json += (phase_names.empty() ? "},\n" : "\n  },\n");
+  json += "  \"caches\": {";
+  for (std::map<TString, Long64_t>::const_iterator i = cache_hits.begin(); i != cache_hits.end(); i++)
+    {
+      json += (i == cache_hits.begin() ? "\n" : ",\n");
+      json += TString::Format("    \"%s\": { \"hits\": %lld, \"misses\": %lld, \"hit_rate\": %.6f }", i->first.Data(), i->second,
+	  get_value(cache_misses, i->first), GetCacheHitRate(i->first));
+    }
+  json += (cache_hits.empty() ? "},\n" : "\n  },\n");
+  json += "  \"iterations\": [";
+  for (Int_t i = 0; i < (Int_t) iter_ncalls.size(); i++)
+    {
+      json += (i == 0 ? "\n" : ",\n");
+      json += TString::Format("    { \"phase\": \"%s\", \"ncalls\": %lld, \"fval\": %.9e, \"edm\": %.6e, \"status\": %d }", iter_phase[i].Data(), iter_ncalls[i],
+	  iter_fval[i], iter_edm[i], iter_status[i]);
+    }
+  json += (iter_ncalls.empty() ? "]\n" : "\n  ]\n");
+  json += "}\n";
+  return json;
+}
+
+Bool_t TCRFluxFitStats::DumpJSON(const char *json_file) const
+{
+  FILE *fp = fopen(json_file, "w");
+  if(!fp)
+    {
+      fprintf(stderr, "ERROR: failed to open %s for writing!\n", json_file);
+      return false;
+    }
+  fprintf(fp, "%s", ToJSON().Data());
+  fclose(fp);
+  return true;
+}
+
+void TCRFluxFitStats::Print(Option_t *opt) const
+{
+  (void) (opt);
+  fprintf(stdout, "FCN calls: %lld gradient calls: %lld fit time: %.3f s (CPU %.3f s) status: %d\n", nfcn, ngrad, fit_real_time, fit_cpu_time, fit_status);
+  for (Int_t i = 0; i < (Int_t) phase_names.size(); i++)
+    fprintf(stdout, "phase %-10s FCN calls: %10lld time: %.3f s (CPU %.3f s)\n", phase_names[i].Data(), GetPhaseNcalls(phase_names[i]), GetPhaseRealTime(phase_names[i]),
+	GetPhaseCpuTime(phase_names[i]));
+  for (std::map<TString, Long64_t>::const_iterator i = flux_ncalls.begin(); i != flux_ncalls.end(); i++)
+    fprintf(stdout, "flux %-25s evaluations: %10lld time: %.3f s (CPU %.3f s)\n", i->first.Data(), i->second, GetFluxRealTime(i->first), GetFluxCpuTime(i->first));
+  for (std::map<TString, Long64_t>::const_iterator i = cache_hits.begin(); i != cache_hits.end(); i++)
+    fprintf(stdout, "cache %-25s hits: %10lld misses: %10lld hit rate: %.3f\n", i->first.Data(), i->second, get_value(cache_misses, i->first), GetCacheHitRate(i->first));
+  if(iter_ncalls.size())
+    fprintf(stdout, "iterations: %d, last EDM: %.3e\n", (Int_t) iter_ncalls.size(), iter_edm.back());
+  fflush(stdout);
+}
+
+Double_t TCRFluxFitStats::get_real_time()
+{
+  struct timeval tv;
+  gettimeofday(&tv, 0);
+  return (Double_t) tv.tv_sec + 1e-6 * (Double_t) tv.tv_usec;
+}
+
+Double_t TCRFluxFitStats::get_cpu_time()
+{
+  // the CPU time of the process would include the other threads that evaluate the FCN
+  struct timespec ts;
+  if(clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0)
+    return (Double_t) clock() / (Double_t) CLOCKS_PER_SEC;
+  return (Double_t) ts.tv_sec + 1e-9 * (Double_t) ts.tv_nsec;
+}
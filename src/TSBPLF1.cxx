@@ -0,0 +1,266 @@
+#include "TSBPLF1.h"
+#include "TMath.h"
+#include <cmath>
+#include <algorithm>
+
+ClassImp(TSBPLF1);
+
+namespace
+{
+  enum sbpl_type
+  {
+    sbpl_J = 0, sbpl_E3J, sbpl_EJ, sbpl_JG, sbpl_E2JG
+  };
+
+  // widths of a break (in units of its width) beyond which the function is taken as the power law after the break
+  const Double_t sbpl_break_extent = 15.0;
+
+  // longest interval of the quadrature, in log10(E/eV)
+  const Double_t sbpl_max_interval = 0.25;
+
+  // 8 point Gauss-Legendre quadrature on [-1, 1]
+  const Int_t sbpl_gl_npts = 8;
+  const Double_t sbpl_gl_x[sbpl_gl_npts] =
+    { -0.9602898564975363, -0.7966664774136267, -0.5255324099163290, -0.1834346424956498, 0.1834346424956498, 0.5255324099163290, 0.7966664774136267,
+	0.9602898564975363 };
+  const Double_t sbpl_gl_w[sbpl_gl_npts] =
+    { 0.1012285362903763, 0.2223810344533745, 0.3137066458778873, 0.3626837833783620, 0.3626837833783620, 0.3137066458778873, 0.2223810344533745,
+	0.1012285362903763 };
+
+  // w x log10(1 + 10^((x - b) / w)), the change of log10 J over a break relative to the change of the power law index,
+  // and its derivatives with respect to x (-derivative with respect to b) and w.  Sharp break if w isn't positive.
+  inline Double_t sbpl_softplus(Double_t x, Double_t b, Double_t w, Double_t *dx = 0, Double_t *dw = 0)
+  {
+    if(!(w > 0))
+      {
+	if(dx)
+	  *dx = (b <= x ? 1.0 : 0.0);
+	if(dw)
+	  *dw = 0;
+	return (b <= x ? x - b : 0.0);
+      }
+    Double_t u = (x - b) / w;
+    // 10^(-|u|) doesn't overflow
+    Double_t t = TMath::Power(10.0, -TMath::Abs(u));
+    Double_t l = log1p(t) / TMath::Ln10();
+    Double_t sp = (u > 0 ? u + l : l);
+    Double_t sigma = (u > 0 ? 1.0 / (1.0 + t) : t / (1.0 + t));
+    if(dx)
+      *dx = sigma;
+    if(dw)
+      *dw = sp - u * sigma;
+    return w * sp;
+  }
+
+  // log10 of the shape of the function (J without the constant factors) at x, the softplus terms are kept in terms
+  inline Double_t sbpl_log10_shape(Double_t x, const Double_t *p, Int_t nbreaks, Double_t x0, Double_t *terms = 0, Double_t *dx = 0,
+      Double_t *dw = 0)
+  {
+    Double_t s = p[1] * (x - x0);
+    for (Int_t k = 0; k < nbreaks; k++)
+      {
+	Double_t l = sbpl_softplus(x, p[nbreaks + 2 + k], p[2 * nbreaks + 2 + k], (dx ? dx + k : 0), (dw ? dw + k : 0));
+	if(terms)
+	  terms[k] = l;
+	s += (p[k + 2] - p[k + 1]) * l;
+      }
+    return s;
+  }
+}
+
+TSBPLF1* TSBPLF1::NewTSBPLF1(const char *newname, const char *ftype) const
+{
+  TSBPLF1 *f = new TSBPLF1(newname, GetNbreaks(), ftype, GetSbplScaleFactor(), GetSbplLog10enMin(), GetXmax(), &GetParNames().front(), GetParameters(),
+      GetParErrors());
+  f->SetRange(GetXmin(), GetXmax());
+  return f;
+}
+
+void TSBPLF1::init(const char *ftype)
+{
+  fSbplType.ToUpper();
+  if(get_type() < 0)
+    std::cerr << "ERROR: TSBPLF1: function type '" << ftype << "' not understood; use 'J', 'J>', 'EJ', 'E3J', or 'E2J>'" << std::endl;
+  set_default_title(fSbplType);
+}
+
+void TSBPLF1::set_default_title(const char *ftype)
+{
+  TString s_ftype(ftype);
+  if(s_ftype == "J")
+    SetTitle(";log_{10}(E/eV);J");
+  if(s_ftype == "E3J")
+    SetTitle(";log_{10}(E/eV);E^{3}J");
+  if(s_ftype == "EJ")
+    SetTitle(";log_{10}(E/eV);EJ");
+  if(s_ftype == "J>")
+    SetTitle(";log_{10}(E/eV);J_{>}");
+  if(s_ftype == "E2J>")
+    SetTitle(";log_{10}(E/eV);E^{2}J_{>}");
+}
+
+Int_t TSBPLF1::get_type()
+{
+  if(fSbplTypeIndex >= 0)
+    return fSbplTypeIndex;
+  TString s_ftype = fSbplType;
+  s_ftype.ToUpper();
+  if(s_ftype == "J")
+    fSbplTypeIndex = sbpl_J;
+  else if(s_ftype == "E3J")
+    fSbplTypeIndex = sbpl_E3J;
+  else if(s_ftype == "EJ")
+    fSbplTypeIndex = sbpl_EJ;
+  else if(s_ftype == "J>")
+    fSbplTypeIndex = sbpl_JG;
+  else if(s_ftype == "E2J>")
+    fSbplTypeIndex = sbpl_E2JG;
+  return fSbplTypeIndex;
+}
+
+Double_t TSBPLF1::sbpl_fcn(Double_t *x, Double_t *params)
+{
+  (void) (x);
+  (void) (params);
+  return 0;
+}
+
+Double_t TSBPLF1::EvalPar(const Double_t *x, const Double_t *params)
+{
+  Int_t itype = get_type();
+  if(itype < 0)
+    return 0;
+  const Double_t *p = (params ? params : GetParameters());
+  Double_t v = fSbplScaleFactor * p[0];
+  if(itype == sbpl_E3J)
+    v *= TMath::Power(10.0, 3.0 * x[0]);
+  if(itype == sbpl_EJ)
+    v *= TMath::Power(10.0, x[0]);
+  if(itype == sbpl_J || itype == sbpl_E3J || itype == sbpl_EJ)
+    return v * TMath::Power(10.0, sbpl_log10_shape(x[0], p, GetNbreaks(), fSbplLog10enMin));
+  if(itype == sbpl_E2JG)
+    v *= TMath::Power(10.0, 2.0 * x[0]);
+  return v * TMath::Power(10.0, fSbplLog10enMin) * integrate_shape(x[0], p);
+}
+
+Double_t TSBPLF1::integrate_shape(Double_t x, const Double_t *p)
+{
+  Int_t nbreaks = GetNbreaks();
+  Double_t x0 = fSbplLog10enMin;
+  // beyond x_tail all breaks have been passed and the function is the last power law
+  Double_t x_tail = x;
+  for (Int_t k = 0; k < nbreaks; k++)
+    x_tail = TMath::Max(x_tail, p[nbreaks + 2 + k] + sbpl_break_extent * TMath::Max(p[2 * nbreaks + 2 + k], 0.0));
+  // intervals are short across the breaks, where the index changes, and elsewhere
+  fSbplNodes.clear();
+  fSbplNodes.push_back(x);
+  fSbplNodes.push_back(x_tail);
+  Int_t ninterval = (Int_t) TMath::Ceil((x_tail - x) / sbpl_max_interval);
+  for (Int_t i = 1; i < ninterval; i++)
+    fSbplNodes.push_back(x + (x_tail - x) * (Double_t) i / (Double_t) ninterval);
+  for (Int_t k = 0; k < nbreaks; k++)
+    {
+      Double_t b = p[nbreaks + 2 + k];
+      Double_t w = TMath::Max(p[2 * nbreaks + 2 + k], 0.0);
+      for (Int_t m = -(Int_t) sbpl_break_extent; m <= (Int_t) sbpl_break_extent; m++)
+	{
+	  Double_t xm = b + (Double_t) m * w;
+	  if(x < xm && xm < x_tail)
+	    fSbplNodes.push_back(xm);
+	  if(w == 0)
+	    break;
+	}
+    }
+  std::sort(fSbplNodes.begin(), fSbplNodes.end());
+  Double_t s = 0;
+  for (Int_t i = 0; i + 1 < (Int_t) fSbplNodes.size(); i++)
+    {
+      Double_t half = 0.5 * (fSbplNodes[i + 1] - fSbplNodes[i]);
+      if(!(half > 0))
+	continue;
+      Double_t mid = 0.5 * (fSbplNodes[i + 1] + fSbplNodes[i]);
+      for (Int_t j = 0; j < sbpl_gl_npts; j++)
+	{
+	  Double_t xj = mid + half * sbpl_gl_x[j];
+	  s += half * sbpl_gl_w[j] * TMath::Power(10.0, xj - x0 + sbpl_log10_shape(xj, p, nbreaks, x0));
+	}
+    }
+  s *= TMath::Ln10();
+  // last power law from x_tail to infinity: the sum of the power coefficients of the breaks plus the last index times (x - x0)
+  Double_t pcf = 0;
+  for (Int_t k = 0; k < nbreaks; k++)
+    pcf += (p[k + 1] - p[k + 2]) * (p[nbreaks + 2 + k] - x0);
+  Double_t pw = 1.0 + p[nbreaks + 1];
+  s -= TMath::Power(10.0, pcf + pw * (x_tail - x0)) / pw;
+  return s;
+}
+
+Bool_t TSBPLF1::HasAnalyticGradient() const
+{
+  TString s_ftype = fSbplType;
+  s_ftype.ToUpper();
+  return (s_ftype == "J" || s_ftype == "E3J" || s_ftype == "EJ");
+}
+
+void TSBPLF1::EvalGradient(const Double_t *x, Double_t *grad, const Double_t *params)
+{
+  Int_t itype = get_type();
+  if(!(itype == sbpl_J || itype == sbpl_E3J || itype == sbpl_EJ))
+    {
+      TSPECFITF1::EvalGradient(x, grad, params);
+      return;
+    }
+  const Double_t *p = (params ? params : GetParameters());
+  Int_t nbreaks = GetNbreaks();
+  Double_t x0 = fSbplLog10enMin;
+  // softplus terms and their derivatives with respect to x and the widths for each break
+  fSbplTerms.resize(3 * nbreaks + 1);
+  Double_t *terms = &fSbplTerms[0];
+  Double_t *dx = terms + nbreaks;
+  Double_t *dw = dx + nbreaks;
+  Double_t v = fSbplScaleFactor;
+  if(itype == sbpl_E3J)
+    v *= TMath::Power(10.0, 3.0 * x[0]);
+  if(itype == sbpl_EJ)
+    v *= TMath::Power(10.0, x[0]);
+  v *= TMath::Power(10.0, sbpl_log10_shape(x[0], p, nbreaks, x0, terms, dx, dw));
+  // d J / d [0] and ln(10) x J, which multiplies the derivatives of log10 J
+  grad[0] = v;
+  Double_t c = TMath::Ln10() * p[0] * v;
+  // power law indices
+  for (Int_t j = 0; j <= nbreaks; j++)
+    grad[j + 1] = c * ((j == 0 ? x[0] - x0 : terms[j - 1]) - (j < nbreaks ? terms[j] : 0.0));
+  // break points and widths
+  for (Int_t k = 0; k < nbreaks; k++)
+    {
+      Double_t dp = p[k + 2] - p[k + 1];
+      grad[nbreaks + 2 + k] = -c * dp * dx[k];
+      grad[2 * nbreaks + 2 + k] = c * dp * dw[k];
+    }
+}
+
+TString TSBPLF1::GetSbplFormula(Int_t n_offset) const
+{
+  TString s_ftype = fSbplType;
+  s_ftype.ToUpper();
+  if(!(s_ftype == "J" || s_ftype == "E3J" || s_ftype == "EJ"))
+    {
+      std::cerr << "ERROR: GetSbplFormula: there is no formula for the function type '" << fSbplType << "'" << std::endl;
+      return TString("");
+    }
+  Int_t nbreaks = GetNbreaks();
+  TString frm = TString::Format("%.9e*[%d]*", fSbplScaleFactor, n_offset);
+  if(s_ftype == "E3J")
+    frm += "10^(3.0*x)*";
+  if(s_ftype == "EJ")
+    frm += "10^(x)*";
+  frm += TString::Format("10^([%d]*(x-%.9f)", n_offset + 1, fSbplLog10enMin);
+  for (Int_t k = 0; k < nbreaks; k++)
+    {
+      Int_t ib = n_offset + nbreaks + 2 + k;
+      Int_t iw = n_offset + 2 * nbreaks + 2 + k;
+      frm += TString::Format("+([%d]-[%d])*[%d]*log10(1+10^((x-[%d])/[%d]))", n_offset + k + 2, n_offset + k + 1, iw, ib, iw);
+    }
+  frm += ")";
+  return frm;
+}
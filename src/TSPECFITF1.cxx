@@ -1,7 +1,64 @@
 #include "TSPECFITF1.h"
+#include "TCOMPOSITEF1.h"
+#include "TSBPLF1.h"
+#if ROOT_VERSION_CODE >= ROOT_VERSION(6,12,0) && defined(R__HAS_VECCORE)
+#define TSPECFITF1_VECCORE
+#include "Math/Types.h"
+#endif
+
+// derivatives of the formulas by automatic differentiation
+#if ROOT_VERSION_CODE >= ROOT_VERSION(6,20,0)
+#define TSPECFITF1_FORMULA_GRADIENT
+#include "TFormula.h"
+#endif
+
+#include <map>
+#include <set>
+#include "TROOT.h"
+#if __cplusplus >= 201103L
+#include <mutex>
+#define TSPECFITF1_CACHE_LOCK std::lock_guard<std::mutex> formula_cache_lock(formula_cache_mutex)
+#else
+#define TSPECFITF1_CACHE_LOCK
+#endif
 
 ClassImp(TSPECFITF1);
 
+// compiled prototypes of the formulas, keyed by the normalized expression
+namespace
+{
+  std::map<TString, TF1*> formula_cache;
+  Long64_t formula_cache_hits = 0;
+  Long64_t formula_cache_misses = 0;
+  // expressions whose derivatives couldn't be generated, so that it's not tried again for each fit and each copy
+  std::set<TString> formula_gradient_failed;
+#if __cplusplus >= 201103L
+  std::mutex formula_cache_mutex;
+#endif
+
+  // The white space is removed and the variable x[0] is written as x.  The parameters are not renumbered here:
+  // the expressions that TSPECFITF1 builds come from GetExpFormula and have the parameters numbered already, while
+  // in a raw expression the order of the named parameters is only known after ROOT has parsed it.
+  TString formula_cache_key(const char *frm)
+  {
+    TString key = frm;
+    key.ReplaceAll(" ", "");
+    key.ReplaceAll("\t", "");
+    key.ReplaceAll("\n", "");
+    key.ReplaceAll("x[0]", "x");
+    return key;
+  }
+
+  Bool_t formula_is_valid(const TF1 *f)
+  {
+#if ROOT_VERSION_CODE >= ROOT_VERSION(6,0,0)
+    return (f->GetFormula() && f->GetFormula()->IsValid());
+#else
+    return (f->GetNdim() > 0);
+#endif
+  }
+}
+
 TSPECFITF1::~TSPECFITF1()
 {
   ;
@@ -211,7 +268,12 @@ void TSPECFITF1::GetParNames(TString *parnames) const
 
 TSPECFITF1* TSPECFITF1::Add(const char *newname, const char *frm_start, const TF1 *f1, const TF1 *f2, Double_t c1, Double_t c2)
 {
-  TF1 *f0 = new TF1(TString(f1->GetName()) + TString(f2->GetName()) + "_tmp", frm_start);
+  const TF1 *f0 = GetFormulaPrototype(frm_start);
+  if(!f0)
+    {
+      fprintf(stderr, "ERROR: Add: starting formula '%s' is not valid!\n", frm_start);
+      return 0;
+    }
   TString frm_0 = GetExpFormula(f0, 0);
   TString frm_1 = GetExpFormula(f1, f0->GetNpar());
   TString frm_2 = GetExpFormula(f2, f0->GetNpar() + f1->GetNpar());
@@ -226,7 +288,6 @@ TSPECFITF1* TSPECFITF1::Add(const char *newname, const char *frm_start, const TF
       params.push_back(f0->GetParameter(i));
       parerrors.push_back(f0->GetParError(i));
     }
-  delete f0; // clean up
 // put in whatever values were stored in f1, f2
   for (Int_t i = 0; i < f1->GetNpar(); i++)
     {
@@ -251,15 +312,21 @@ TSPECFITF1* TSPECFITF1::Add(const char *newname, const char *frm_start, const TF
 
 TSPECFITF1* TSPECFITF1::Add(const char *newname, const char *frm_start, const TF1 *f, Double_t c)
 {
-  TF1 *f2 = new TF1(TString(f->GetName()) + "_tmp_2", "0.0");
-  TSPECFITF1 *ff = Add(newname, frm_start, f, f2, c, 1.0);
-  delete f2;
-  return ff;
+  const TF1 *f2 = GetFormulaPrototype("0.0");
+  if(!f2)
+    return 0;
+  return Add(newname, frm_start, f, f2, c, 1.0);
 }
 
 
 TString TSPECFITF1::GetExpFormula(const TF1 *f, Int_t n_offset)
 {
+  const TCOMPOSITEF1 *fcomposite = dynamic_cast<const TCOMPOSITEF1*>(f);
+  if(fcomposite)
+    return fcomposite->GetCompositeFormula(n_offset);
+  const TSBPLF1 *fsbpl = dynamic_cast<const TSBPLF1*>(f);
+  if(fsbpl)
+    return fsbpl->GetSbplFormula(n_offset);
   TString frm = f->GetExpFormula();
   for (Int_t i = 0; i < f->GetNpar(); i++)
     {
@@ -313,8 +380,19 @@ void TSPECFITF1::Scale(Double_t c)
   TString frm_0 = GetExpFormula(this, 0);
   TString frm = TString::Format("%e * (%s)", c, frm_0.Data());
 #if ROOT_VERSION_CODE >= ROOT_VERSION(6,0,0)
-  GetFormula()->SetTitle(frm); // In ROOT6 and above TFormula is embedded
-  GetFormula()->Compile(frm);
+  const TF1 *prototype = GetFormulaPrototype(frm);
+  if(prototype)
+    {
+      // In ROOT6 and above TFormula is embedded, take the compiled one
+      TString formula_name = GetFormula()->GetName();
+      prototype->GetFormula()->Copy(*GetFormula());
+      GetFormula()->SetName(formula_name);
+    }
+  else
+    {
+      GetFormula()->SetTitle(frm);
+      GetFormula()->Compile(frm);
+    }
 #else
   SetTitle(frm); // Before ROOT6, TF1 inherited from TFormula
   Compile(frm);
@@ -323,3 +401,223 @@ void TSPECFITF1::Scale(Double_t c)
   SetParameters(&parameters.front());
   SetParErrors(&parerrors.front());
 }
+
+
+void TSPECFITF1::EvalBatch(const Double_t *x, Double_t *out, size_t n)
+{
+  const Double_t *params = GetParameters();
+  size_t i = 0;
+#ifdef TSPECFITF1_VECCORE
+  if(IsVectorized())
+    {
+      const size_t nlanes = vecCore::VectorSize<ROOT::Double_v>();
+      for (; i + nlanes <= n; i += nlanes)
+	{
+	  ROOT::Double_v xv;
+	  vecCore::Load<ROOT::Double_v>(xv, x + i);
+	  vecCore::Store<ROOT::Double_v>(EvalParVec(&xv, params), out + i);
+	}
+    }
+#endif
+  for (; i < n; i++)
+    out[i] = EvalPar(x + i, params);
+}
+
+void TSPECFITF1::EvalBatch(TF1 *f, const Double_t *x, Double_t *out, size_t n)
+{
+  TSPECFITF1 *fspecfit = dynamic_cast<TSPECFITF1*>(f);
+  if(fspecfit)
+    {
+      fspecfit->EvalBatch(x, out, n);
+      return;
+    }
+  const Double_t *params = f->GetParameters();
+  for (size_t i = 0; i < n; i++)
+    out[i] = f->EvalPar(x + i, params);
+}
+
+// whether the derivatives of the formula of the function with respect to its parameters have been generated
+static Bool_t formula_has_gradient(const TF1 *f)
+{
+#ifdef TSPECFITF1_FORMULA_GRADIENT
+  const TFormula *formula = f->GetFormula();
+  return (formula && f->GetNpar() > 0 && formula->HasGeneratedGradient());
+#else
+  (void) (f);
+  return false;
+#endif
+}
+
+// generate the derivatives of the formula of the function, if it has a formula
+static Bool_t generate_formula_gradient(TF1 *f)
+{
+#ifdef TSPECFITF1_FORMULA_GRADIENT
+  TFormula *formula = f->GetFormula();
+  if(!formula || f->GetNpar() < 1)
+    return false;
+  if(formula->HasGeneratedGradient())
+    return true;
+  TString key = formula_cache_key(formula->GetExpFormula());
+  {
+    TSPECFITF1_CACHE_LOCK;
+    if(formula_gradient_failed.count(key))
+      return false;
+  }
+  if(formula->GenerateGradientPar())
+    return true;
+  TSPECFITF1_CACHE_LOCK;
+  formula_gradient_failed.insert(key);
+  return false;
+#else
+  (void) (f);
+  return false;
+#endif
+}
+
+// derivatives of the formula of the function with the current parameters
+static void eval_formula_gradient(TF1 *f, const Double_t *x, Double_t *grad)
+{
+#ifdef TSPECFITF1_FORMULA_GRADIENT
+  // the generated derivatives are added to the array
+  for (Int_t ipar = 0; ipar < f->GetNpar(); ipar++)
+    grad[ipar] = 0;
+  f->GetFormula()->GradientPar(x, grad);
+#else
+  f->GradientPar(x, grad);
+#endif
+}
+
+void TSPECFITF1::EvalGradient(const Double_t *x, Double_t *grad, const Double_t *params)
+{
+  std::vector<Double_t> params_current;
+  if(params)
+    {
+      params_current.assign(GetParameters(), GetParameters() + GetNpar());
+      SetParameters(params);
+    }
+  if(formula_has_gradient(this))
+    eval_formula_gradient(this, x, grad);
+  else
+    GradientPar(x, grad);
+  if(params)
+    SetParameters(&params_current[0]);
+}
+
+Bool_t TSPECFITF1::HasAnalyticGradient() const
+{
+  return formula_has_gradient(this);
+}
+
+Bool_t TSPECFITF1::GenerateGradient()
+{
+  generate_formula_gradient(this);
+  return HasAnalyticGradient();
+}
+
+void TSPECFITF1::EvalGradient(TF1 *f, const Double_t *x, Double_t *grad)
+{
+  TSPECFITF1 *fspecfit = dynamic_cast<TSPECFITF1*>(f);
+  if(fspecfit)
+    fspecfit->EvalGradient(x, grad);
+  else if(formula_has_gradient(f))
+    eval_formula_gradient(f, x, grad);
+  else
+    f->GradientPar(x, grad);
+}
+
+Bool_t TSPECFITF1::HasAnalyticGradient(const TF1 *f)
+{
+  const TSPECFITF1 *fspecfit = dynamic_cast<const TSPECFITF1*>(f);
+  if(fspecfit)
+    return fspecfit->HasAnalyticGradient();
+  return formula_has_gradient(f);
+}
+
+Bool_t TSPECFITF1::GenerateGradient(TF1 *f)
+{
+  TSPECFITF1 *fspecfit = dynamic_cast<TSPECFITF1*>(f);
+  if(fspecfit)
+    return fspecfit->GenerateGradient();
+  return generate_formula_gradient(f);
+}
+
+const TF1* TSPECFITF1::GetFormulaPrototype(const char *frm)
+{
+  TString key = formula_cache_key(frm);
+  Long64_t prototype_number = 0;
+  {
+    TSPECFITF1_CACHE_LOCK;
+    std::map<TString, TF1*>::const_iterator i = formula_cache.find(key);
+    if(i != formula_cache.end())
+      {
+	formula_cache_hits++;
+	return i->second;
+      }
+    prototype_number = ++formula_cache_misses;
+  }
+  // compile outside of the lock, ROOT serializes the compilation itself
+  TF1 *prototype = new TF1(TString::Format("__specfit_formula_%lld", prototype_number), frm);
+  gROOT->GetListOfFunctions()->Remove(prototype);
+  if(!formula_is_valid(prototype))
+    {
+      delete prototype;
+      return 0;
+    }
+  TSPECFITF1_CACHE_LOCK;
+  std::map<TString, TF1*>::const_iterator i = formula_cache.find(key);
+  if(i != formula_cache.end())
+    {
+      // another thread has compiled the same expression in the meantime
+      delete prototype;
+      return i->second;
+    }
+  formula_cache[key] = prototype;
+  return prototype;
+}
+
+Int_t TSPECFITF1::GetFormulaCacheSize()
+{
+  TSPECFITF1_CACHE_LOCK;
+  return (Int_t) formula_cache.size();
+}
+
+Long64_t TSPECFITF1::GetFormulaCacheHits()
+{
+  TSPECFITF1_CACHE_LOCK;
+  return formula_cache_hits;
+}
+
+Long64_t TSPECFITF1::GetFormulaCacheMisses()
+{
+  TSPECFITF1_CACHE_LOCK;
+  return formula_cache_misses;
+}
+
+void TSPECFITF1::ClearFormulaCache()
+{
+  TSPECFITF1_CACHE_LOCK;
+  for (std::map<TString, TF1*>::iterator i = formula_cache.begin(); i != formula_cache.end(); i++)
+    delete i->second;
+  formula_cache.clear();
+}
+
+void TSPECFITF1::init_formula(const char *name, const char *frm, Double_t log10en_min, Double_t log10en_max)
+{
+  const TF1 *prototype = GetFormulaPrototype(frm);
+  if(prototype)
+    prototype->Copy(*this);
+  else
+    {
+      // not valid, let ROOT report the problem as it would for any TF1
+      TF1 f(name, frm, log10en_min, log10en_max);
+      gROOT->GetListOfFunctions()->Remove(&f);
+      f.Copy(*this);
+    }
+  SetName(name);
+  SetRange(log10en_min, log10en_max);
+  // a function with the same name is replaced in ROOT's list, the same way as by the TF1 constructor
+  TObject *f_old = gROOT->GetListOfFunctions()->FindObject(name);
+  if(f_old)
+    gROOT->GetListOfFunctions()->Remove(f_old);
+  gROOT->GetListOfFunctions()->Add(this);
+}
@@ -0,0 +1,175 @@
+#include "TSPLINEF1.h"
+#include "TMath.h"
+
+ClassImp(TSPLINEF1);
+
+namespace
+{
+  enum spline_type
+  {
+    spline_J = 0, spline_E3J, spline_EJ
+  };
+
+  // second differences of the coefficients that enter the roughness penalty
+  const Double_t spline_d2[3] =
+    { 1.0, -2.0, 1.0 };
+}
+
+TSPLINEF1* TSPLINEF1::NewTSPLINEF1(const char *newname, const char *ftype) const
+{
+  TSPLINEF1 *f = new TSPLINEF1(newname, GetNcoef(), ftype, GetSplineScaleFactor(), GetSplineLog10enMin(), GetSplineLog10enMax(), &GetParNames().front(),
+      GetParameters(), GetParErrors());
+  f->SetSmoothing(GetSmoothing());
+  f->SetRange(GetXmin(), GetXmax());
+  return f;
+}
+
+void TSPLINEF1::init(const char *ftype)
+{
+  fSplineType.ToUpper();
+  if(get_type() < 0)
+    std::cerr << "ERROR: TSPLINEF1: function type '" << ftype << "' not understood; use 'J', 'EJ', or 'E3J'" << std::endl;
+  if(!(fSplineLog10enMax > fSplineLog10enMin))
+    std::cerr << "ERROR: TSPLINEF1: highest energy must be above the lowest energy" << std::endl;
+  set_default_title(fSplineType);
+  for (Int_t i = 0; i < GetNpar(); i++)
+    SetParName(i, TString::Format("c%d", i));
+}
+
+void TSPLINEF1::set_default_title(const char *ftype)
+{
+  TString s_ftype(ftype);
+  if(s_ftype == "J")
+    SetTitle(";log_{10}(E/eV);J");
+  if(s_ftype == "E3J")
+    SetTitle(";log_{10}(E/eV);E^{3}J");
+  if(s_ftype == "EJ")
+    SetTitle(";log_{10}(E/eV);EJ");
+}
+
+Int_t TSPLINEF1::get_type()
+{
+  if(fSplineTypeIndex >= 0)
+    return fSplineTypeIndex;
+  TString s_ftype = fSplineType;
+  s_ftype.ToUpper();
+  if(s_ftype == "J")
+    fSplineTypeIndex = spline_J;
+  else if(s_ftype == "E3J")
+    fSplineTypeIndex = spline_E3J;
+  else if(s_ftype == "EJ")
+    fSplineTypeIndex = spline_EJ;
+  return fSplineTypeIndex;
+}
+
+Double_t TSPLINEF1::spline_fcn(Double_t *x, Double_t *params)
+{
+  (void) (x);
+  (void) (params);
+  return 0;
+}
+
+void TSPLINEF1::GetBasis(Double_t x, Int_t &first, Double_t *basis) const
+{
+  Int_t nintervals = GetNpar() - 3;
+  Double_t h = (fSplineLog10enMax - fSplineLog10enMin) / (Double_t) nintervals;
+  Double_t u = (x - fSplineLog10enMin) / h;
+  // interval of the knots and the position within it; linear continuation outside of the knots
+  Double_t dt = 0;
+  if(u < 0)
+    {
+      first = 0;
+      dt = u;
+      u = 0;
+    }
+  else if(u > (Double_t) nintervals)
+    {
+      first = nintervals - 1;
+      dt = u - (Double_t) nintervals;
+      u = 1.0;
+    }
+  else
+    {
+      first = TMath::Min((Int_t) u, nintervals - 1);
+      u -= (Double_t) first;
+    }
+  Double_t t = u, s = 1.0 - u;
+  basis[0] = s * s * s / 6.0;
+  basis[1] = (3.0 * t * t * t - 6.0 * t * t + 4.0) / 6.0;
+  basis[2] = (-3.0 * t * t * t + 3.0 * t * t + 3.0 * t + 1.0) / 6.0;
+  basis[3] = t * t * t / 6.0;
+  if(dt != 0)
+    {
+      basis[0] += dt * (-0.5 * s * s);
+      basis[1] += dt * (1.5 * t * t - 2.0 * t);
+      basis[2] += dt * (-1.5 * t * t + t + 0.5);
+      basis[3] += dt * (0.5 * t * t);
+    }
+}
+
+Double_t TSPLINEF1::EvalPar(const Double_t *x, const Double_t *params)
+{
+  Int_t itype = get_type();
+  if(itype < 0)
+    return 0;
+  const Double_t *p = (params ? params : GetParameters());
+  Int_t first = 0;
+  Double_t basis[4];
+  GetBasis(x[0], first, basis);
+  Double_t s = 0;
+  for (Int_t k = 0; k < 4; k++)
+    s += basis[k] * p[first + k];
+  if(itype == spline_E3J)
+    s += 3.0 * x[0];
+  if(itype == spline_EJ)
+    s += x[0];
+  return fSplineScaleFactor * TMath::Power(10.0, s);
+}
+
+void TSPLINEF1::EvalGradient(const Double_t *x, Double_t *grad, const Double_t *params)
+{
+  for (Int_t i = 0; i < GetNpar(); i++)
+    grad[i] = 0;
+  Int_t first = 0;
+  Double_t basis[4];
+  GetBasis(x[0], first, basis);
+  Double_t c = TMath::Ln10() * EvalPar(x, params);
+  for (Int_t k = 0; k < 4; k++)
+    grad[first + k] = c * basis[k];
+}
+
+Double_t TSPLINEF1::GetPenalty(const Double_t *params) const
+{
+  const Double_t *p = (params ? params : GetParameters());
+  Double_t penalty = 0;
+  for (Int_t j = 1; j + 1 < GetNpar(); j++)
+    {
+      Double_t d2 = p[j - 1] - 2.0 * p[j] + p[j + 1];
+      penalty += d2 * d2;
+    }
+  return fSplineSmoothing * penalty;
+}
+
+void TSPLINEF1::AddPenaltyGradient(Double_t *grad, const Double_t *params) const
+{
+  const Double_t *p = (params ? params : GetParameters());
+  for (Int_t j = 1; j + 1 < GetNpar(); j++)
+    {
+      Double_t d2 = p[j - 1] - 2.0 * p[j] + p[j + 1];
+      for (Int_t a = 0; a < 3; a++)
+	grad[j - 1 + a] += 2.0 * fSplineSmoothing * d2 * spline_d2[a];
+    }
+}
+
+void TSPLINEF1::AddPenaltyHessian(Int_t m, std::vector<Double_t> &h) const
+{
+  Int_t w = m + 1;
+  for (Int_t j = 1; j + 1 < GetNpar(); j++)
+    {
+      for (Int_t a = 0; a < 3; a++)
+	{
+	  for (Int_t b = 0; b <= a; b++)
+	    h[(j - 1 + a) * w + m - (a - b)] += 2.0 * fSplineSmoothing * spline_d2[a] * spline_d2[b];
+	}
+    }
+}
@@ -9,6 +9,7 @@
 #include "TCollection.h"
 #include "TObjArray.h"
 #include "specfit_canv.h"
+#include "specfit_trace.h"
 
 
 // Collection of routines for manipulating canvases
@@ -403,12 +404,14 @@ void specfit_canv::save_plots(const char* basename,
 			      const char* fExt,
 			      Int_t xysize)
 {
+  SPECFIT_TRACE("specfit_canv::save_plots", "plot");
   for (Int_t icanvas = 0; icanvas < (Int_t) AllCanvases.GetEntries(); icanvas++)
     {
       TCanvas *canv = (TCanvas *)AllCanvases[icanvas];
       if(xysize)
 	zoomin(canv,xysize);
       canv->cd(); // so that it works correctly in batch mode
+      SPECFIT_TRACE(canv->GetName(), "plot");
       TString fname = basename;
       fname += canv->GetName();
       fname+=fExt;
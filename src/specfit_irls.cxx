@@ -0,0 +1,198 @@
+// Dmitri Ivanov <dmiivanov@gmail.com>
+
+#include <vector>
+#include <algorithm>
+#include "specfit_irls.h"
+#include "specfit_uti.h"
+#include "TMath.h"
+
+// -2 ln(likelihood ratio) summed over the fitted bins, same as TCRFlux::CalcLogLikelihood, and the expected numbers of events
+static Double_t calc_deviance(const specfit_irls::problem &p, const std::vector<Double_t> &z, const std::vector<Double_t> &theta, std::vector<Double_t> &mu)
+{
+  Int_t nbins = (Int_t) p.n->size();
+  Int_t ncoef = (Int_t) theta.size();
+  Double_t deviance = 0;
+  mu.resize(nbins);
+  for (Int_t i = 0; i < nbins; i++)
+    {
+      const Double_t *zi = &z[i * ncoef];
+      Double_t log10mu = p.log10scale;
+      for (Int_t q = 0; q < ncoef; q++)
+	log10mu += zi[q] * theta[q];
+      Double_t n = (*p.n)[i];
+      mu[i] = (*p.acc)[i] * TMath::Power(10.0, log10mu);
+      if(n > 1e-3)
+	deviance += 2.0 * ((mu[i] - n) + n * TMath::Log(n / mu[i]));
+      else
+	deviance += 2.0 * mu[i];
+    }
+  return deviance;
+}
+
+Double_t specfit_irls::solve(const problem &p, const Double_t *breaks, std::vector<Double_t> &theta, std::vector<Double_t> *cov)
+{
+  for (Int_t k = 1; k < p.nbreaks; k++)
+    {
+      if(breaks[k] < breaks[k - 1])
+	return -1;
+    }
+  Int_t nbins = (Int_t) p.n->size();
+  Int_t ncoef = (Int_t) theta.size();
+  if(!nbins)
+    return -1;
+  const std::vector<Double_t> &x = *p.x;
+  const std::vector<Double_t> &n = *p.n;
+  const std::vector<Int_t> &col = *p.col;
+
+  // design matrix
+  std::vector<Double_t> z(nbins * ncoef, 0);
+  for (Int_t i = 0; i < nbins; i++)
+    {
+      Double_t *zi = &z[i * ncoef];
+      zi[0] = 1.0;
+      for (Int_t j = 0; j <= p.nbreaks; j++)
+	{
+	  Double_t xlo = (j > 0 ? breaks[j - 1] : x[i]);
+	  Double_t xup = (j < p.nbreaks ? breaks[j] : x[i]);
+	  Double_t xref = (j > 0 ? breaks[j - 1] : p.log10en_ref);
+	  zi[1 + j] = TMath::Min(TMath::Max(x[i], xlo), xup) - xref;
+	}
+      if(col[i] >= 0)
+	zi[col[i]] = 1.0;
+    }
+
+  std::vector<Double_t> mu;
+  Double_t deviance = calc_deviance(p, z, theta, mu);
+
+  // the normalization is known in closed form for the other coefficients fixed, which makes a good starting point
+  if(p.profiled[0])
+    {
+      Double_t nobserved = 0, nexpected = 0;
+      for (Int_t i = 0; i < nbins; i++)
+	{
+	  if(col[i] >= 0)
+	    continue;
+	  nobserved += (n[i] > 1e-3 ? n[i] : 0.0);
+	  nexpected += mu[i];
+	}
+      if(nobserved > 0 && nexpected > 0)
+	{
+	  theta[0] += TMath::Log10(nobserved / nexpected);
+	  deviance = calc_deviance(p, z, theta, mu);
+	}
+    }
+
+  const Double_t ln10 = TMath::Ln10();
+  std::vector<Int_t> ifree;
+  std::vector<Double_t> g, hfull, h, l, step, theta_new, mu_new;
+  for (Int_t iter = 0; iter < 100; iter++)
+    {
+      // gradient and Hessian with respect to the profiled coefficients
+      g.assign(ncoef, 0);
+      hfull.assign(ncoef * ncoef, 0);
+      for (Int_t i = 0; i < nbins; i++)
+	{
+	  const Double_t *zi = &z[i * ncoef];
+	  Double_t r = mu[i] - (n[i] > 1e-3 ? n[i] : 0.0);
+	  for (Int_t q = 0; q < ncoef; q++)
+	    {
+	      if(!p.profiled[q] || zi[q] == 0)
+		continue;
+	      g[q] += ln10 * r * zi[q];
+	      for (Int_t s = 0; s <= q; s++)
+		{
+		  if(p.profiled[s])
+		    hfull[q * ncoef + s] += ln10 * ln10 * mu[i] * zi[q] * zi[s];
+		}
+	    }
+	}
+      // coefficients that the data don't constrain (no bins in a power law segment) are left as they are
+      Double_t hmax = 0;
+      for (Int_t q = 0; q < ncoef; q++)
+	hmax = TMath::Max(hmax, hfull[q * ncoef + q]);
+      ifree.clear();
+      for (Int_t q = 0; q < ncoef; q++)
+	{
+	  if(p.profiled[q] && hfull[q * ncoef + q] > 1e-12 * hmax)
+	    ifree.push_back(q);
+	}
+      Int_t nfree = (Int_t) ifree.size();
+      if(!nfree)
+	break;
+      h.assign(nfree * nfree, 0);
+      step.assign(nfree, 0);
+      for (Int_t a = 0; a < nfree; a++)
+	{
+	  step[a] = -g[ifree[a]];
+	  for (Int_t b = 0; b <= a; b++)
+	    h[a * nfree + b] = h[b * nfree + a] = hfull[ifree[a] * ncoef + ifree[b]];
+	}
+      l = h;
+      if(!specfit_uti::cholesky_decompose(nfree, l))
+	{
+	  l = h;
+	  for (Int_t a = 0; a < nfree; a++)
+	    l[a * nfree + a] += 1e-10 * hmax;
+	  if(!specfit_uti::cholesky_decompose(nfree, l))
+	    return -1;
+	}
+      specfit_uti::cholesky_solve(nfree, l, step);
+      // Newton decrement
+      Double_t decrement = 0;
+      for (Int_t a = 0; a < nfree; a++)
+	decrement -= g[ifree[a]] * step[a];
+      if(decrement < 1e-10)
+	break;
+      // step halving
+      theta_new = theta;
+      Double_t deviance_new = deviance;
+      Bool_t accepted = false;
+      for (Double_t t = 1.0; t > 1e-10; t *= 0.5)
+	{
+	  for (Int_t a = 0; a < nfree; a++)
+	    theta_new[ifree[a]] = theta[ifree[a]] + t * step[a];
+	  deviance_new = calc_deviance(p, z, theta_new, mu_new);
+	  if(deviance_new <= deviance)
+	    {
+	      accepted = true;
+	      break;
+	    }
+	}
+      if(!accepted)
+	break;
+      theta.swap(theta_new);
+      mu.swap(mu_new);
+      deviance = deviance_new;
+    }
+  if(!(deviance < TMath::Infinity()))
+    return -1;
+
+  // covariance matrix of the profiled coefficients at the solution, zero for the unconstrained ones
+  if(cov)
+    {
+      std::vector<Int_t> icov;
+      for (Int_t q = 0; q < ncoef; q++)
+	{
+	  if(p.profiled[q])
+	    icov.push_back(q);
+	}
+      Int_t ncov = (Int_t) icov.size();
+      cov->assign(ncov * ncov, 0);
+      Int_t nfree = (Int_t) ifree.size();
+      if(nfree)
+	{
+	  std::vector<Double_t> h_inv;
+	  specfit_uti::cholesky_invert(nfree, l, h_inv);
+	  for (Int_t a = 0; a < nfree; a++)
+	    {
+	      Int_t ia = (Int_t) (std::find(icov.begin(), icov.end(), ifree[a]) - icov.begin());
+	      for (Int_t b = 0; b < nfree; b++)
+		{
+		  Int_t ib = (Int_t) (std::find(icov.begin(), icov.end(), ifree[b]) - icov.begin());
+		  (*cov)[ia * ncov + ib] = h_inv[a * nfree + b];
+		}
+	    }
+	}
+    }
+  return deviance;
+}
@@ -0,0 +1,142 @@
+// Dmitri Ivanov <dmiivanov@gmail.com>
+
+#include <cstdio>
+#include <vector>
+#include "specfit_mcmc.h"
+#include "TMath.h"
+#include "TRandom.h"
+
+using namespace std;
+
+Double_t specfit_mcmc::ensemble(Int_t n, log_density fcn, void *arg, Int_t nwalkers, Double_t *x, Double_t *logp, Int_t nsteps, TRandom *rnd,
+    vector<Double_t> *chain, monitor mon, Double_t a)
+{
+  if(nwalkers < 2 || nwalkers % 2)
+    {
+      fprintf(stderr, "ERROR: ensemble: number of walkers must be even and at least 2!\n");
+      return 0;
+    }
+  if(!(a > 1))
+    {
+      fprintf(stderr, "ERROR: ensemble: scale of the stretch move must be above 1!\n");
+      return 0;
+    }
+  Int_t nhalf = nwalkers / 2;
+  vector<Double_t> y(nhalf * n), logp_y(nhalf), z(nhalf);
+  Long64_t naccepted = 0, nmoves = 0;
+  for (Int_t istep = 0; istep < nsteps; istep++)
+    {
+      for (Int_t ihalf = 0; ihalf < 2; ihalf++)
+	{
+	  Int_t first = ihalf * nhalf;
+	  Int_t other = (1 - ihalf) * nhalf;
+	  // stretch z has the density 1 / sqrt(z) in [1 / a, a]
+	  for (Int_t k = 0; k < nhalf; k++)
+	    {
+	      Double_t u = (a - 1.0) * rnd->Rndm() + 1.0;
+	      z[k] = u * u / a;
+	      Int_t j = other + TMath::Min((Int_t) (rnd->Rndm() * (Double_t) nhalf), nhalf - 1);
+	      const Double_t *xk = x + (first + k) * n;
+	      const Double_t *xj = x + j * n;
+	      for (Int_t i = 0; i < n; i++)
+		y[k * n + i] = xj[i] + z[k] * (xk[i] - xj[i]);
+	    }
+	  fcn(nhalf, &y[0], &logp_y[0], arg);
+	  for (Int_t k = 0; k < nhalf; k++)
+	    {
+	      nmoves++;
+	      if(!TMath::Finite(logp_y[k]))
+		continue;
+	      Double_t log_ratio = (Double_t) (n - 1) * TMath::Log(z[k]) + logp_y[k] - logp[first + k];
+	      if(TMath::Log(rnd->Rndm()) < log_ratio)
+		{
+		  for (Int_t i = 0; i < n; i++)
+		    x[(first + k) * n + i] = y[k * n + i];
+		  logp[first + k] = logp_y[k];
+		  naccepted++;
+		}
+	    }
+	}
+      if(chain)
+	chain->insert(chain->end(), x, x + nwalkers * n);
+      if(mon && !mon(istep, nwalkers, x, logp, arg))
+	break;
+    }
+  return (nmoves ? (Double_t) naccepted / (Double_t) nmoves : 0.0);
+}
+
+Double_t specfit_mcmc::autocorrelation_time(Int_t n, Int_t nwalkers, Int_t nsteps, const Double_t *chain, Int_t i, Int_t first_step)
+{
+  Int_t m = nsteps - first_step;
+  if(m < 2 || nwalkers < 1)
+    return 0;
+  // means and variances of the walkers
+  vector<Double_t> mean(nwalkers, 0), var(nwalkers, 0);
+  for (Int_t w = 0; w < nwalkers; w++)
+    {
+      for (Int_t s = first_step; s < nsteps; s++)
+	mean[w] += chain[((Long64_t) s * nwalkers + w) * n + i];
+      mean[w] /= (Double_t) m;
+      for (Int_t s = first_step; s < nsteps; s++)
+	{
+	  Double_t d = chain[((Long64_t) s * nwalkers + w) * n + i] - mean[w];
+	  var[w] += d * d;
+	}
+      var[w] /= (Double_t) m;
+    }
+  Double_t tau = 1.0;
+  for (Int_t t = 1; t < m; t++)
+    {
+      Double_t rho = 0;
+      Int_t nw = 0;
+      for (Int_t w = 0; w < nwalkers; w++)
+	{
+	  if(!(var[w] > 0))
+	    continue;
+	  Double_t c = 0;
+	  for (Int_t s = first_step; s + t < nsteps; s++)
+	    c += (chain[((Long64_t) s * nwalkers + w) * n + i] - mean[w]) * (chain[((Long64_t) (s + t) * nwalkers + w) * n + i] - mean[w]);
+	  rho += c / ((Double_t) m * var[w]);
+	  nw++;
+	}
+      if(!nw)
+	return 0;
+      tau += 2.0 * rho / (Double_t) nw;
+      if((Double_t) t >= 5.0 * tau)
+	break;
+    }
+  return tau;
+}
+
+Double_t specfit_mcmc::gelman_rubin(Int_t n, Int_t nwalkers, Int_t nsteps, const Double_t *chain, Int_t i, Int_t first_step)
+{
+  Int_t m = nsteps - first_step;
+  if(m < 2 || nwalkers < 2)
+    return 0;
+  // variances within the walkers and between their means
+  Double_t w_var = 0, mean_all = 0;
+  vector<Double_t> mean(nwalkers, 0);
+  for (Int_t w = 0; w < nwalkers; w++)
+    {
+      for (Int_t s = first_step; s < nsteps; s++)
+	mean[w] += chain[((Long64_t) s * nwalkers + w) * n + i];
+      mean[w] /= (Double_t) m;
+      mean_all += mean[w] / (Double_t) nwalkers;
+      Double_t v = 0;
+      for (Int_t s = first_step; s < nsteps; s++)
+	{
+	  Double_t d = chain[((Long64_t) s * nwalkers + w) * n + i] - mean[w];
+	  v += d * d;
+	}
+      w_var += v / (Double_t) (m - 1) / (Double_t) nwalkers;
+    }
+  Double_t b_var = 0;
+  for (Int_t w = 0; w < nwalkers; w++)
+    b_var += (mean[w] - mean_all) * (mean[w] - mean_all) / (Double_t) (nwalkers - 1);
+  if(!(w_var > 0))
+    return 1.0;
+  Double_t var_plus = (Double_t) (m - 1) / (Double_t) m * w_var + b_var;
+  return TMath::Sqrt(var_plus / w_var);
+}
+
+NamespaceImp(specfit_mcmc);
@@ -0,0 +1,363 @@
+// Dmitri Ivanov <dmiivanov@gmail.com>
+
+#include <cstdio>
+#include <vector>
+#include <numeric>
+#include "specfit_min.h"
+#include "specfit_uti.h"
+#include "TMath.h"
+
+using namespace std;
+
+namespace
+{
+  // largest number of halvings of the step in the line search
+  const Int_t min_max_halvings = 40;
+
+  // sufficient decrease of the function in the line search
+  const Double_t min_armijo = 1e-4;
+
+  // x inside of the bounds
+  void min_project(Int_t n, const Double_t *xmin, const Double_t *xmax, Double_t *x)
+  {
+    for (Int_t i = 0; i < n; i++)
+      {
+	if(!(xmin[i] < xmax[i]))
+	  continue;
+	if(x[i] < xmin[i])
+	  x[i] = xmin[i];
+	if(x[i] > xmax[i])
+	  x[i] = xmax[i];
+      }
+  }
+
+  // variables that can change: not fixed and not held at a bound by the gradient; returns their number
+  Int_t min_free_variables(Int_t n, const Double_t *x, const Double_t *g, const Double_t *xmin, const Double_t *xmax, vector<Int_t> &ifree)
+  {
+    ifree.clear();
+    for (Int_t i = 0; i < n; i++)
+      {
+	if(!(xmin[i] < xmax[i]))
+	  continue;
+	if(x[i] <= xmin[i] && g[i] > 0)
+	  continue;
+	if(x[i] >= xmax[i] && g[i] < 0)
+	  continue;
+	ifree.push_back(i);
+      }
+    return (Int_t) ifree.size();
+  }
+
+  Double_t min_dot(const vector<Int_t> &ifree, const Double_t *a, const Double_t *b)
+  {
+    Double_t s = 0;
+    for (Int_t k = 0; k < (Int_t) ifree.size(); k++)
+      s += a[ifree[k]] * b[ifree[k]];
+    return s;
+  }
+
+  // minimum of g^T p + 1/2 p^T H p for |p| <= delta (Moré and Sorensen), H is nf x nf, returns false if no step was found
+  Bool_t min_trust_region_step(Int_t nf, const vector<Double_t> &h, const vector<Double_t> &g, Double_t delta, vector<Double_t> &p)
+  {
+    vector<Double_t> a, q;
+    Double_t hmax = 0;
+    for (Int_t i = 0; i < nf; i++)
+      hmax = TMath::Max(hmax, TMath::Abs(h[i * nf + i]));
+    Double_t lambda = 0, lambda_lo = 0;
+    Bool_t found = false;
+    for (Int_t iter = 0; iter < 50; iter++)
+      {
+	a = h;
+	for (Int_t i = 0; i < nf; i++)
+	  a[i * nf + i] += lambda;
+	if(!specfit_uti::cholesky_decompose(nf, a))
+	  {
+	    // H + lambda I isn't positive definite, lambda must be larger
+	    lambda_lo = lambda;
+	    lambda = (lambda > 0 ? 2.0 * lambda : 1e-8 * (1.0 + hmax));
+	    continue;
+	  }
+	p.resize(nf);
+	for (Int_t i = 0; i < nf; i++)
+	  p[i] = -g[i];
+	specfit_uti::cholesky_solve(nf, a, p);
+	found = true;
+	Double_t np = TMath::Sqrt(inner_product(p.begin(), p.end(), p.begin(), 0.0));
+	if((lambda == 0 && np <= delta) || TMath::Abs(np - delta) <= 0.1 * delta)
+	  return true;
+	// Newton's iteration for 1/|p(lambda)| = 1/delta with q = L^-1 p
+	q = p;
+	for (Int_t i = 0; i < nf; i++)
+	  {
+	    Double_t s = q[i];
+	    for (Int_t k = 0; k < i; k++)
+	      s -= a[i * nf + k] * q[k];
+	    q[i] = s / a[i * nf + i];
+	  }
+	Double_t nq2 = inner_product(q.begin(), q.end(), q.begin(), 0.0);
+	Double_t lambda_new = lambda + (np * np / nq2) * (np - delta) / delta;
+	lambda = (lambda_new > lambda_lo ? lambda_new : 0.5 * (lambda + lambda_lo));
+      }
+    if(!found)
+      return false;
+    // the last step, shortened to the trust region if needed
+    Double_t np = TMath::Sqrt(inner_product(p.begin(), p.end(), p.begin(), 0.0));
+    if(np > delta)
+      {
+	for (Int_t i = 0; i < nf; i++)
+	  p[i] *= delta / np;
+      }
+    return true;
+  }
+}
+
+Int_t specfit_min::lbfgsb(Int_t n, objective fcn, void *arg, Double_t *x, const Double_t *xmin, const Double_t *xmax, Int_t *niter, Double_t *fval,
+    Int_t maxiter, Double_t edm_max, Int_t m, monitor mon)
+{
+  if(niter)
+    (*niter) = 0;
+  if(m < 1)
+    m = 1;
+  min_project(n, xmin, xmax, x);
+  vector<Double_t> g(n), xn(n), gn(n), d(n), a(m);
+  Double_t f = fcn(x, &g[0], arg);
+  if(fval)
+    (*fval) = f;
+  if(!TMath::Finite(f))
+    return 3;
+  // last m steps and changes of the gradient, the newest is at inewest
+  vector<vector<Double_t> > s(m, vector<Double_t>(n)), y(m, vector<Double_t>(n));
+  vector<Double_t> rho(m);
+  Int_t npairs = 0, inewest = -1;
+  vector<Int_t> ifree;
+  Int_t status = 1;
+  Int_t iter = 0;
+  for (iter = 0; iter < maxiter; iter++)
+    {
+      Int_t nfree = min_free_variables(n, x, &g[0], xmin, xmax, ifree);
+      // two-loop recursion for d = -H g over the free variables
+      for (Int_t i = 0; i < n; i++)
+	d[i] = 0;
+      for (Int_t k = 0; k < nfree; k++)
+	d[ifree[k]] = -g[ifree[k]];
+      for (Int_t j = 0; j < npairs; j++)
+	{
+	  Int_t k = (inewest - j + m) % m;
+	  a[k] = rho[k] * min_dot(ifree, &s[k][0], &d[0]);
+	  for (Int_t l = 0; l < nfree; l++)
+	    d[ifree[l]] -= a[k] * y[k][ifree[l]];
+	}
+      if(npairs)
+	{
+	  Double_t yy = min_dot(ifree, &y[inewest][0], &y[inewest][0]);
+	  Double_t sy = min_dot(ifree, &s[inewest][0], &y[inewest][0]);
+	  Double_t gamma = (yy > 0 && sy > 0 ? sy / yy : 1.0);
+	  for (Int_t l = 0; l < nfree; l++)
+	    d[ifree[l]] *= gamma;
+	}
+      for (Int_t j = npairs - 1; j >= 0; j--)
+	{
+	  Int_t k = (inewest - j + m) % m;
+	  Double_t b = rho[k] * min_dot(ifree, &y[k][0], &d[0]);
+	  for (Int_t l = 0; l < nfree; l++)
+	    d[ifree[l]] += s[k][ifree[l]] * (a[k] - b);
+	}
+      Double_t gd = min_dot(ifree, &g[0], &d[0]);
+      if(!(gd < 0) && nfree)
+	{
+	  // not a descent direction, start again from the steepest descent
+	  npairs = 0;
+	  for (Int_t l = 0; l < nfree; l++)
+	    d[ifree[l]] = -g[ifree[l]];
+	  gd = min_dot(ifree, &g[0], &d[0]);
+	}
+      Double_t edm = -0.5 * gd;
+      if(mon)
+	mon(iter, f, edm, arg);
+      if(!nfree || (npairs && edm < edm_max))
+	{
+	  status = 0;
+	  break;
+	}
+      // backtracking along the projection of the direction onto the bounds
+      Double_t alpha = 1.0;
+      if(!npairs)
+	alpha = TMath::Min(1.0, 1.0 / TMath::Sqrt(min_dot(ifree, &d[0], &d[0])));
+      Bool_t accepted = false;
+      Double_t fn = f;
+      for (Int_t ihalf = 0; ihalf < min_max_halvings && !accepted; ihalf++, alpha *= 0.5)
+	{
+	  for (Int_t i = 0; i < n; i++)
+	    xn[i] = x[i] + alpha * d[i];
+	  min_project(n, xmin, xmax, &xn[0]);
+	  Double_t dec = 0;
+	  for (Int_t i = 0; i < n; i++)
+	    dec += g[i] * (xn[i] - x[i]);
+	  if(!(dec < 0))
+	    continue;
+	  fn = fcn(&xn[0], &gn[0], arg);
+	  accepted = (TMath::Finite(fn) && fn <= f + min_armijo * dec);
+	}
+      if(!accepted)
+	{
+	  if(npairs)
+	    {
+	      // the quasi-Newton direction has failed, try the steepest descent
+	      npairs = 0;
+	      continue;
+	    }
+	  status = 2;
+	  break;
+	}
+      // keep the step if the curvature along it is positive, in place of the oldest one
+      Double_t sy = 0, yy = 0;
+      for (Int_t i = 0; i < n; i++)
+	{
+	  sy += (xn[i] - x[i]) * (gn[i] - g[i]);
+	  yy += (gn[i] - g[i]) * (gn[i] - g[i]);
+	}
+      if(sy > 1e-10 * yy)
+	{
+	  inewest = (inewest + 1) % m;
+	  for (Int_t i = 0; i < n; i++)
+	    {
+	      s[inewest][i] = xn[i] - x[i];
+	      y[inewest][i] = gn[i] - g[i];
+	    }
+	  rho[inewest] = 1.0 / sy;
+	  npairs = TMath::Min(npairs + 1, m);
+	}
+      for (Int_t i = 0; i < n; i++)
+	{
+	  x[i] = xn[i];
+	  g[i] = gn[i];
+	}
+      f = fn;
+    }
+  if(niter)
+    (*niter) = iter;
+  if(fval)
+    (*fval) = f;
+  return status;
+}
+
+Int_t specfit_min::trust_region(Int_t n, objective fcn, void *arg, Double_t *x, const Double_t *xmin, const Double_t *xmax, Int_t *niter,
+    Double_t *fval, Int_t maxiter, Double_t edm_max, monitor mon)
+{
+  if(niter)
+    (*niter) = 0;
+  min_project(n, xmin, xmax, x);
+  vector<Double_t> g(n), xn(n), gn(n), xh(n), gh(n);
+  Double_t f = fcn(x, &g[0], arg);
+  if(fval)
+    (*fval) = f;
+  if(!TMath::Finite(f))
+    return 3;
+  vector<Int_t> ifree;
+  vector<Double_t> h, hl, gf, p, pc;
+  Double_t delta = 1.0;
+  Int_t status = 1;
+  Int_t iter = 0;
+  for (iter = 0; iter < maxiter && status == 1; iter++)
+    {
+      Int_t nf = min_free_variables(n, x, &g[0], xmin, xmax, ifree);
+      if(!nf)
+	{
+	  if(mon)
+	    mon(iter, f, 0, arg);
+	  status = 0;
+	  break;
+	}
+      // Hessian over the free variables from the differences of the gradients
+      h.assign(nf * nf, 0);
+      gf.resize(nf);
+      for (Int_t k = 0; k < nf; k++)
+	gf[k] = g[ifree[k]];
+      for (Int_t k = 0; k < nf; k++)
+	{
+	  Int_t i = ifree[k];
+	  Double_t step = 1e-5 * TMath::Max(TMath::Abs(x[i]), 1.0);
+	  if(x[i] + step > xmax[i])
+	    step = -step;
+	  xh.assign(x, x + n);
+	  xh[i] += step;
+	  fcn(&xh[0], &gh[0], arg);
+	  for (Int_t l = 0; l < nf; l++)
+	    h[l * nf + k] = (gh[ifree[l]] - g[ifree[l]]) / step;
+	}
+      for (Int_t k = 0; k < nf; k++)
+	{
+	  for (Int_t l = 0; l < k; l++)
+	    h[k * nf + l] = h[l * nf + k] = 0.5 * (h[k * nf + l] + h[l * nf + k]);
+	}
+      // estimated distance to the minimum from the Newton step, if the Hessian is positive definite
+      Double_t edm = 0.5 * inner_product(gf.begin(), gf.end(), gf.begin(), 0.0);
+      Bool_t newton = false;
+      hl = h;
+      if(specfit_uti::cholesky_decompose(nf, hl))
+	{
+	  p = gf;
+	  specfit_uti::cholesky_solve(nf, hl, p);
+	  edm = 0.5 * inner_product(gf.begin(), gf.end(), p.begin(), 0.0);
+	  newton = true;
+	}
+      if(mon)
+	mon(iter, f, edm, arg);
+      if(newton && edm < edm_max)
+	{
+	  status = 0;
+	  break;
+	}
+      // shrink the trust region until the step decreases the function
+      Bool_t accepted = false;
+      while (!accepted)
+	{
+	  if(!min_trust_region_step(nf, h, gf, delta, p))
+	    {
+	      status = 2;
+	      break;
+	    }
+	  xn.assign(x, x + n);
+	  for (Int_t k = 0; k < nf; k++)
+	    xn[ifree[k]] += p[k];
+	  min_project(n, xmin, xmax, &xn[0]);
+	  // decrease predicted by the quadratic model for the projected step
+	  pc.resize(nf);
+	  for (Int_t k = 0; k < nf; k++)
+	    pc[k] = xn[ifree[k]] - x[ifree[k]];
+	  Double_t pred = -inner_product(gf.begin(), gf.end(), pc.begin(), 0.0);
+	  for (Int_t k = 0; k < nf; k++)
+	    {
+	      for (Int_t l = 0; l < nf; l++)
+		pred -= 0.5 * pc[k] * h[k * nf + l] * pc[l];
+	    }
+	  Double_t npc = TMath::Sqrt(inner_product(pc.begin(), pc.end(), pc.begin(), 0.0));
+	  Double_t fn = (pred > 0 ? fcn(&xn[0], &gn[0], arg) : f);
+	  Double_t ratio = ((pred > 0 && TMath::Finite(fn)) ? (f - fn) / pred : -1.0);
+	  if(ratio < 0.25)
+	    delta = 0.25 * npc;
+	  else if(ratio > 0.75 && npc >= 0.99 * delta)
+	    delta *= 2.0;
+	  if(ratio > 1e-4)
+	    {
+	      accepted = true;
+	      f = fn;
+	      for (Int_t i = 0; i < n; i++)
+		{
+		  x[i] = xn[i];
+		  g[i] = gn[i];
+		}
+	    }
+	  else if(!(delta > 1e-12 * (1.0 + TMath::Sqrt(min_dot(ifree, x, x)))))
+	    {
+	      status = 2;
+	      break;
+	    }
+	}
+    }
+  if(niter)
+    (*niter) = iter;
+  if(fval)
+    (*fval) = f;
+  return status;
+}
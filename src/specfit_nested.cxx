@@ -0,0 +1,215 @@
+// Dmitri Ivanov <dmiivanov@gmail.com>
+
+#include <cstdio>
+#include <vector>
+#include <algorithm>
+#include "specfit_nested.h"
+#include "TMath.h"
+#include "TRandom.h"
+
+using namespace std;
+
+// log(e^a + e^b) with -TMath::Infinity() for zero
+static Double_t log_add_exp(Double_t a, Double_t b)
+{
+  if(!TMath::Finite(a))
+    return b;
+  if(!TMath::Finite(b))
+    return a;
+  if(a < b)
+    return b + TMath::Log(1.0 + TMath::Exp(a - b));
+  return a + TMath::Log(1.0 + TMath::Exp(b - a));
+}
+
+// adds the point of the log likelihood logl and the log weight logw to the evidence and the information
+static void add_point(Double_t logl, Double_t logw, Double_t &logz, Double_t &h)
+{
+  if(!TMath::Finite(logw))
+    return;
+  Double_t logz_new = log_add_exp(logz, logw);
+  Double_t h_new = TMath::Exp(logw - logz_new) * logl - logz_new;
+  if(TMath::Finite(logz))
+    h_new += TMath::Exp(logz - logz_new) * (h + logz);
+  logz = logz_new;
+  h = h_new;
+}
+
+// orders the live points by their log likelihoods
+namespace
+{
+  struct logl_order
+  {
+    const Double_t *logl;
+    bool operator()(Int_t a, Int_t b) const
+    {
+      return logl[a] < logl[b];
+    }
+  };
+}
+
+Int_t specfit_nested::run(Int_t n, log_likelihood fcn, void *arg, Int_t nlive, TRandom *rnd, Double_t &logz, Double_t &logz_error, Double_t &h,
+    Int_t nreplace, Int_t nwalk, Double_t dlogz, Int_t maxiter, vector<Double_t> *samples, vector<Double_t> *log_weights, monitor mon)
+{
+  logz = -TMath::Infinity();
+  logz_error = 0;
+  h = 0;
+  if(n < 1 || nlive < 2)
+    {
+      fprintf(stderr, "ERROR: nested sampling: need at least 1 variable and 2 live points!\n");
+      return -1;
+    }
+  nreplace = TMath::Max(1, TMath::Min(nreplace, nlive - 1));
+  nwalk = TMath::Max(1, nwalk);
+
+  // live points from the prior, the ones of zero likelihood are drawn again
+  vector<Double_t> u(nlive * n), logl(nlive, -TMath::Infinity());
+  vector<Int_t> redo;
+  for (Int_t itry = 0; itry < 100; itry++)
+    {
+      redo.clear();
+      for (Int_t k = 0; k < nlive; k++)
+	{
+	  if(TMath::Finite(logl[k]))
+	    continue;
+	  redo.push_back(k);
+	}
+      if(redo.empty())
+	break;
+      Int_t nredo = (Int_t) redo.size();
+      vector<Double_t> y(nredo * n), logl_y(nredo);
+      for (Int_t k = 0; k < nredo * n; k++)
+	y[k] = rnd->Rndm();
+      fcn(nredo, &y[0], &logl_y[0], arg);
+      for (Int_t k = 0; k < nredo; k++)
+	{
+	  for (Int_t i = 0; i < n; i++)
+	    u[redo[k] * n + i] = y[k * n + i];
+	  logl[redo[k]] = (TMath::IsNaN(logl_y[k]) ? -TMath::Infinity() : logl_y[k]);
+	}
+    }
+  if(!redo.empty())
+    {
+      fprintf(stderr, "ERROR: nested sampling: likelihood is zero almost everywhere in the prior!\n");
+      return -1;
+    }
+
+  vector<Int_t> order(nlive);
+  logl_order by_logl;
+  by_logl.logl = &logl[0];
+  vector<Double_t> sigma(n), x(nreplace * n), logl_x(nreplace), y(nreplace * n), logl_y(nreplace);
+  vector<Int_t> inside(nreplace), naccepted(nreplace);
+  Double_t logx = 0, scale = 1.0;
+  Int_t iter = 0;
+  for (iter = 0; iter < maxiter; iter++)
+    {
+      for (Int_t k = 0; k < nlive; k++)
+	order[k] = k;
+      sort(order.begin(), order.end(), by_logl);
+      // stop when the live points can't change the evidence by more than dlogz
+      Double_t logl_max = logl[order[nlive - 1]];
+      if(TMath::Finite(logz) && log_add_exp(logz, logl_max + logx) - logz < dlogz)
+	break;
+      // the worst points are removed, the prior volume shrinks by the order statistics of the live points
+      for (Int_t j = 0; j < nreplace; j++)
+	{
+	  Int_t k = order[j];
+	  Double_t d = 1.0 / (Double_t) (nlive - j);
+	  Double_t logw = logl[k] + logx + TMath::Log(1.0 - TMath::Exp(-d));
+	  add_point(logl[k], logw, logz, h);
+	  if(samples)
+	    samples->insert(samples->end(), &u[k * n], &u[k * n] + n);
+	  if(log_weights)
+	    log_weights->push_back(logw);
+	  logx -= d;
+	}
+      Double_t logl_min = logl[order[nreplace - 1]];
+
+      // widths of the surviving points
+      for (Int_t i = 0; i < n; i++)
+	{
+	  Double_t s = 0, s2 = 0;
+	  for (Int_t j = nreplace; j < nlive; j++)
+	    {
+	      s += u[order[j] * n + i];
+	      s2 += u[order[j] * n + i] * u[order[j] * n + i];
+	    }
+	  Double_t m = (Double_t) (nlive - nreplace);
+	  sigma[i] = TMath::Sqrt(TMath::Max(s2 / m - (s / m) * (s / m), 0.0));
+	  if(!(sigma[i] > 0))
+	    sigma[i] = 1e-3;
+	}
+
+      // random walks within the likelihood contour from the surviving points, kept going while a walk hasn't moved
+      for (Int_t r = 0; r < nreplace; r++)
+	{
+	  Int_t j = nreplace + TMath::Min((Int_t) (rnd->Rndm() * (Double_t) (nlive - nreplace)), nlive - nreplace - 1);
+	  for (Int_t i = 0; i < n; i++)
+	    x[r * n + i] = u[order[j] * n + i];
+	  logl_x[r] = logl[order[j]];
+	  naccepted[r] = 0;
+	}
+      Int_t ntotal = 0, ntotal_accepted = 0;
+      for (Int_t istep = 0; istep < 4 * nwalk; istep++)
+	{
+	  if(istep >= nwalk && *min_element(naccepted.begin(), naccepted.end()) > 0)
+	    break;
+	  Int_t ninside = 0;
+	  for (Int_t r = 0; r < nreplace; r++)
+	    {
+	      Bool_t in = true;
+	      for (Int_t i = 0; i < n; i++)
+		{
+		  Double_t v = x[r * n + i] + scale * sigma[i] * rnd->Gaus(0, 1);
+		  if(v < 0 || v > 1)
+		    in = false;
+		  y[ninside * n + i] = v;
+		}
+	      if(in)
+		inside[ninside++] = r;
+	    }
+	  if(ninside)
+	    fcn(ninside, &y[0], &logl_y[0], arg);
+	  for (Int_t k = 0; k < ninside; k++)
+	    {
+	      Int_t r = inside[k];
+	      if(!(logl_y[k] > logl_min))
+		continue;
+	      for (Int_t i = 0; i < n; i++)
+		x[r * n + i] = y[k * n + i];
+	      logl_x[r] = logl_y[k];
+	      naccepted[r]++;
+	      ntotal_accepted++;
+	    }
+	  ntotal += nreplace;
+	}
+      // steps are made longer or shorter to keep about half of them accepted
+      scale *= (2 * ntotal_accepted > ntotal ? 1.1 : 1.0 / 1.1);
+      for (Int_t r = 0; r < nreplace; r++)
+	{
+	  Int_t k = order[r];
+	  for (Int_t i = 0; i < n; i++)
+	    u[k * n + i] = x[r * n + i];
+	  logl[k] = logl_x[r];
+	}
+      if(mon)
+	mon(iter, logz, logx, logl_min, arg);
+    }
+  if(iter == maxiter)
+    fprintf(stderr, "WARNING: nested sampling: maximum number of iterations %d reached!\n", maxiter);
+
+  // the remaining live points share the remaining prior volume
+  for (Int_t k = 0; k < nlive; k++)
+    {
+      Double_t logw = logl[k] + logx - TMath::Log((Double_t) nlive);
+      add_point(logl[k], logw, logz, h);
+      if(samples)
+	samples->insert(samples->end(), &u[k * n], &u[k * n] + n);
+      if(log_weights)
+	log_weights->push_back(logw);
+    }
+  h = TMath::Max(h, 0.0);
+  logz_error = TMath::Sqrt(h / (Double_t) nlive);
+  return iter;
+}
+
+NamespaceImp(specfit_nested);
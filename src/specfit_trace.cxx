@@ -0,0 +1,212 @@
+// Dmitri Ivanov <dmiivanov@gmail.com>
+
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <map>
+#include <sys/time.h>
+#include "specfit_trace.h"
+#if __cplusplus >= 201103L
+#include <mutex>
+#define SPECFIT_TRACE_LOCK std::lock_guard<std::mutex> specfit_trace_lock(trace_mutex)
+#define SPECFIT_TRACE_THREAD_LOCAL thread_local
+#else
+#define SPECFIT_TRACE_LOCK
+#define SPECFIT_TRACE_THREAD_LOCAL
+#endif
+
+using namespace std;
+
+#if __cplusplus >= 201103L
+std::atomic<bool> specfit_trace::enabled(false);
+#else
+Bool_t specfit_trace::enabled = false;
+#endif
+
+// recorded events and the state of the tracing, shared by all threads
+namespace
+{
+  struct trace_event
+  {
+    TString name;
+    TString category;
+    Double_t ts;
+    Double_t dur;
+    Int_t tid;
+  };
+  vector<trace_event> trace_events;
+  map<Int_t, TString> trace_thread_names;
+  TString trace_json_file = "specfit_trace.json";
+  Double_t trace_t0 = 0;
+  Int_t trace_nthreads = 0;
+#if __cplusplus >= 201103L
+  std::mutex trace_mutex;
+#endif
+
+  // lane of the calling thread, assigned when the thread records its first event
+  SPECFIT_TRACE_THREAD_LOCAL Int_t trace_tid = -1;
+
+  // events that have been started by Begin() and not yet ended in the calling thread
+  struct open_event
+  {
+    TString name;
+    TString category;
+    Double_t ts;
+  };
+  SPECFIT_TRACE_THREAD_LOCAL open_event trace_open_events[64];
+  SPECFIT_TRACE_THREAD_LOCAL Int_t trace_nopen = 0;
+
+  Double_t get_clock_us()
+  {
+    struct timeval tv;
+    gettimeofday(&tv, 0);
+    return 1e6 * (Double_t) tv.tv_sec + (Double_t) tv.tv_usec;
+  }
+
+  // must be called with the lock held
+  Int_t get_tid()
+  {
+    if(trace_tid < 0)
+      {
+	trace_tid = trace_nthreads++;
+	if(trace_thread_names.find(trace_tid) == trace_thread_names.end())
+	  trace_thread_names[trace_tid] = (trace_tid == 0 ? TString("main") : TString::Format("worker %d", trace_tid));
+      }
+    return trace_tid;
+  }
+
+  // JSON strings can't have quotes, backslashes and control characters
+  TString json_escape(const TString &s)
+  {
+    TString e = "";
+    for (Int_t i = 0; i < s.Length(); i++)
+      {
+	char c = s[i];
+	if(c == '"' || c == '\\')
+	  {
+	    e += '\\';
+	    e += c;
+	  }
+	else if((unsigned char) c < 0x20)
+	  e += TString::Format("\\u%04x", (Int_t) c);
+	else
+	  e += c;
+      }
+    return e;
+  }
+}
+
+void specfit_trace::Enable(const char *json_file)
+{
+  SPECFIT_TRACE_LOCK;
+  if(json_file)
+    trace_json_file = json_file;
+  if(!is_on())
+    {
+      trace_t0 = get_clock_us();
+      enabled = true;
+    }
+  // the thread that enables the tracing gets the first lane
+  get_tid();
+}
+
+Bool_t specfit_trace::Disable()
+{
+  if(!is_on())
+    return true;
+  Bool_t written = Write();
+  enabled = false;
+  return written;
+}
+
+Bool_t specfit_trace::IsEnabled()
+{
+  return is_on();
+}
+
+Bool_t specfit_trace::Write(const char *json_file)
+{
+  SPECFIT_TRACE_LOCK;
+  TString fname = (json_file ? TString(json_file) : trace_json_file);
+  FILE *fp = fopen(fname.Data(), "w");
+  if(!fp)
+    {
+      fprintf(stderr, "ERROR: specfit_trace: failed to open %s for writing!\n", fname.Data());
+      return false;
+    }
+  fprintf(fp, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+  fprintf(fp, "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": 0, \"args\": {\"name\": \"specfit\"}}");
+  for (map<Int_t, TString>::const_iterator i = trace_thread_names.begin(); i != trace_thread_names.end(); i++)
+    fprintf(fp, ",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"args\": {\"name\": \"%s\"}}", i->first, json_escape(i->second).Data());
+  for (Int_t i = 0; i < (Int_t) trace_events.size(); i++)
+    {
+      const trace_event &e = trace_events[i];
+      fprintf(fp, ",\n{\"name\": \"%s\", \"cat\": \"%s\", \"ph\": \"X\", \"ts\": %.3f, \"dur\": %.3f, \"pid\": 1, \"tid\": %d}", json_escape(e.name).Data(),
+	  json_escape(e.category).Data(), e.ts, e.dur, e.tid);
+    }
+  fprintf(fp, "\n]}\n");
+  fclose(fp);
+  return true;
+}
+
+void specfit_trace::Clear()
+{
+  SPECFIT_TRACE_LOCK;
+  trace_events.clear();
+}
+
+void specfit_trace::SetThreadName(const char *thread_name)
+{
+  SPECFIT_TRACE_LOCK;
+  trace_thread_names[get_tid()] = thread_name;
+}
+
+void specfit_trace::Begin(const char *name, const char *category)
+{
+  // events that begin while the tracing is disabled are still counted so that Begin() and End() stay paired
+  if(trace_nopen >= (Int_t) (sizeof(trace_open_events) / sizeof(open_event)))
+    {
+      if(is_on())
+	fprintf(stderr, "WARNING: specfit_trace: too many nested events, '%s' is not recorded\n", name);
+      trace_nopen++;
+      return;
+    }
+  open_event &e = trace_open_events[trace_nopen++];
+  e.ts = -1;
+  if(!is_on())
+    return;
+  e.name = name;
+  e.category = category;
+  e.ts = get_time_us();
+}
+
+void specfit_trace::End()
+{
+  if(trace_nopen <= 0)
+    return;
+  trace_nopen--;
+  if(!is_on() || trace_nopen >= (Int_t) (sizeof(trace_open_events) / sizeof(open_event)))
+    return;
+  const open_event &e = trace_open_events[trace_nopen];
+  if(e.ts >= 0)
+    add_event(e.name, e.category, e.ts, get_time_us() - e.ts);
+}
+
+Double_t specfit_trace::get_time_us()
+{
+  return get_clock_us() - trace_t0;
+}
+
+void specfit_trace::add_event(const char *name, const char *category, Double_t ts_us, Double_t dur_us)
+{
+  SPECFIT_TRACE_LOCK;
+  trace_event e;
+  e.name = name;
+  e.category = category;
+  e.ts = ts_us;
+  e.dur = dur_us;
+  e.tid = get_tid();
+  trace_events.push_back(e);
+}
+
+NamespaceImp(specfit_trace);
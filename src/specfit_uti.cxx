@@ -4,14 +4,20 @@
 #include <cstdlib>
 #include <vector>
 #include "specfit_uti.h"
+#include "specfit_trace.h"
 #include "TF1.h"
+#include "TSPECFITF1.h"
+#include "TSPLINEF1.h"
 #include "TAxis.h"
 #include "TGraph.h"
 #include "TROOT.h"
 #include "TFeldmanCousins.h"
 #include "TMath.h"
+#include "Math/SpecFuncMathCore.h"
 #if __cplusplus >= 201103L
 #include <cstdint>
+#include <thread>
+#include <atomic>
 #else
 #include <stdint.h>
 #endif
@@ -95,6 +101,29 @@ Double_t specfit_uti::pchance2sigma(Double_t pchance, Bool_t pwarning)
   return sqrt(2.0) * TMath::ErfcInverse(2.0 * pchance);
 }
 
+// the tail of the normal distribution is solved for the significance z by iterating
+// log p = -z^2/2 - log(z sqrt(2 pi)) + log(1 - 1/z^2 + 3/z^4)
+Double_t specfit_uti::log_pchance2sigma(Double_t log_pchance, Double_t max_sigma)
+{
+  if(!(log_pchance < TMath::Log(1e-300)))
+    return (log_pchance < 0 ? pchance2sigma(TMath::Exp(log_pchance), false) : 0.0);
+  if(!TMath::Finite(log_pchance))
+    return max_sigma;
+  Double_t z = TMath::Sqrt(-2.0 * log_pchance);
+  for (Int_t iter = 0; iter < 20; iter++)
+    {
+      Double_t z2 = z * z;
+      Double_t z_new = TMath::Sqrt(-2.0 * (log_pchance + TMath::Log(z * TMath::Sqrt(2.0 * TMath::Pi())) - TMath::Log(1.0 - 1.0 / z2 + 3.0 / (z2 * z2))));
+      if(TMath::Abs(z_new - z) < 1e-10 * z)
+	{
+	  z = z_new;
+	  break;
+	}
+      z = z_new;
+    }
+  return TMath::Min(z, max_sigma);
+}
+
 // express chance probability in sigma units
 Double_t specfit_uti::Sigma2Pchance(Double_t pchange_in_sigma)
 {
@@ -128,17 +157,36 @@ Double_t specfit_uti::PoissonPchance(Int_t nobserved, Double_t nexpected, Bool_t
   return (in_sigma_units ? pchance2sigma(pchance) : pchance);
 }
 
+// P(N <= n) = Q(n + 1, mu) and P(N >= n) = P(n, mu) for the Poisson distribution with the mean mu
+Double_t specfit_uti::PoissonPchanceFast(Int_t nobserved, Double_t nexpected, Bool_t in_sigma_units)
+{
+  Double_t pchance = 0.0;
+  if(!(nexpected > 0))
+    pchance = (nobserved > 0 ? 0.0 : 1.0);
+  else if((Double_t) nobserved <= nexpected)
+    pchance = ROOT::Math::inc_gamma_c((Double_t) nobserved + 1.0, nexpected);
+  else
+    pchance = ROOT::Math::inc_gamma((Double_t) nobserved, nexpected);
+  if(!in_sigma_units)
+    return pchance;
+  if(pchance >= 1e-300)
+    return pchance2sigma(pchance, false);
+  if(!(nexpected > 0))
+    return log_pchance2sigma(-TMath::Infinity());
+  // far in the tail the probability is the term of nobserved times the sum of the geometric series
+  // that bounds the ratios of the next terms, mu / (n + 1) above the mean and n / mu below it
+  Double_t n = (Double_t) nobserved;
+  Double_t log_term = n * TMath::Log(nexpected) - nexpected - TMath::LnGamma(n + 1.0);
+  Double_t ratio = (n > nexpected ? nexpected / (n + 1.0) : n / nexpected);
+  return log_pchance2sigma(log_term - TMath::Log(1.0 - ratio));
+}
+
 // to obtain E^{3}J function from J if J was constructed using formula
 TF1* specfit_uti::get_e3j_from_j(TF1 *f_J)
 {
+  SPECFIT_TRACE("specfit_uti::get_e3j_from_j", "formula");
   if(!f_J)
     return 0;
-  TString frm = f_J->GetExpFormula();
-  for (Int_t i = 0; i < f_J->GetNpar(); i++)
-    (void) (frm.ReplaceAll(TString::Format("[%s]", f_J->GetParName(i)), TString::Format("[%d]", i)));
-  if(!frm.Length())
-    return 0;
-  frm = TString("10^(3.0*x)*") + frm;
   TString name = f_J->GetName();
   if(name.BeginsWith("fJ"))
     {
@@ -147,7 +195,20 @@ TF1* specfit_uti::get_e3j_from_j(TF1 *f_J)
     }
   else
     name += "_E3";
-  TF1 *f = new TF1(specfit_uti::get_unique_object_name(name), frm, f_J->GetXmin(), f_J->GetXmax());
+  // spline functions have no formula
+  TSPLINEF1 *f_spline = dynamic_cast<TSPLINEF1*>(f_J);
+  if(f_spline && TString(f_spline->GetSplineType()) == "J")
+    {
+      TF1 *f = f_spline->NewTSPLINEF1(specfit_uti::get_unique_object_name(name), "E3J");
+      f->SetLineStyle(f_J->GetLineStyle());
+      f->SetLineColor(f_J->GetLineColor());
+      return f;
+    }
+  TString frm = TSPECFITF1::GetExpFormula(f_J, 0);
+  if(!frm.Length())
+    return 0;
+  frm = TString("10^(3.0*x)*") + frm;
+  TF1 *f = new TSPECFITF1(specfit_uti::get_unique_object_name(name), frm, f_J->GetXmin(), f_J->GetXmax());
   for (Int_t i = 0; i < f_J->GetNpar(); i++)
     {
       f->SetParName(i, f_J->GetParName(i));
@@ -396,4 +457,174 @@ TGraphErrors* specfit_uti::FluxRatio_Energy_Bins(const TGraphErrors* flux1, cons
   return gRat;
 }
 
+Bool_t specfit_uti::cholesky_decompose(Int_t n, std::vector<Double_t> &a)
+{
+  if((Int_t) a.size() < n * n)
+    {
+      fprintf(stderr, "ERROR: cholesky_decompose: matrix must have %d elements\n", n * n);
+      return false;
+    }
+  for (Int_t j = 0; j < n; j++)
+    {
+      Double_t d = a[j * n + j];
+      for (Int_t k = 0; k < j; k++)
+	d -= a[j * n + k] * a[j * n + k];
+      if(!(d > 0))
+	return false;
+      d = TMath::Sqrt(d);
+      a[j * n + j] = d;
+      for (Int_t i = j + 1; i < n; i++)
+	{
+	  Double_t s = a[i * n + j];
+	  for (Int_t k = 0; k < j; k++)
+	    s -= a[i * n + k] * a[j * n + k];
+	  a[i * n + j] = s / d;
+	}
+      // zero the upper triangle so that a holds L
+      for (Int_t i = 0; i < j; i++)
+	a[i * n + j] = 0;
+    }
+  return true;
+}
+
+void specfit_uti::cholesky_solve(Int_t n, const std::vector<Double_t> &l, std::vector<Double_t> &b)
+{
+  // L y = b
+  for (Int_t i = 0; i < n; i++)
+    {
+      Double_t s = b[i];
+      for (Int_t k = 0; k < i; k++)
+	s -= l[i * n + k] * b[k];
+      b[i] = s / l[i * n + i];
+    }
+  // L^T x = y
+  for (Int_t i = n - 1; i >= 0; i--)
+    {
+      Double_t s = b[i];
+      for (Int_t k = i + 1; k < n; k++)
+	s -= l[k * n + i] * b[k];
+      b[i] = s / l[i * n + i];
+    }
+}
+
+void specfit_uti::cholesky_invert(Int_t n, const std::vector<Double_t> &l, std::vector<Double_t> &a_inv)
+{
+  a_inv.assign(n * n, 0);
+  std::vector<Double_t> e(n);
+  for (Int_t j = 0; j < n; j++)
+    {
+      std::fill(e.begin(), e.end(), 0.0);
+      e[j] = 1.0;
+      cholesky_solve(n, l, e);
+      for (Int_t i = 0; i < n; i++)
+	a_inv[i * n + j] = e[i];
+    }
+}
+
+Bool_t specfit_uti::band_cholesky_decompose(Int_t n, Int_t m, std::vector<Double_t> &a)
+{
+  Int_t w = m + 1;
+  if((Int_t) a.size() < n * w)
+    {
+      fprintf(stderr, "ERROR: band_cholesky_decompose: matrix must have %d elements\n", n * w);
+      return false;
+    }
+  for (Int_t j = 0; j < n; j++)
+    {
+      Int_t kmin = TMath::Max(0, j - m);
+      Double_t d = a[j * w + m];
+      for (Int_t k = kmin; k < j; k++)
+	d -= a[j * w + m - (j - k)] * a[j * w + m - (j - k)];
+      if(!(d > 0))
+	return false;
+      d = TMath::Sqrt(d);
+      a[j * w + m] = d;
+      for (Int_t i = j + 1; i < n && i <= j + m; i++)
+	{
+	  Int_t kmin_i = TMath::Max(0, i - m);
+	  Double_t s = a[i * w + m - (i - j)];
+	  for (Int_t k = kmin_i; k < j; k++)
+	    s -= a[i * w + m - (i - k)] * a[j * w + m - (j - k)];
+	  a[i * w + m - (i - j)] = s / d;
+	}
+    }
+  return true;
+}
+
+void specfit_uti::band_cholesky_solve(Int_t n, Int_t m, const std::vector<Double_t> &l, std::vector<Double_t> &b)
+{
+  Int_t w = m + 1;
+  // L y = b
+  for (Int_t i = 0; i < n; i++)
+    {
+      Double_t s = b[i];
+      for (Int_t k = TMath::Max(0, i - m); k < i; k++)
+	s -= l[i * w + m - (i - k)] * b[k];
+      b[i] = s / l[i * w + m];
+    }
+  // L^T x = y
+  for (Int_t i = n - 1; i >= 0; i--)
+    {
+      Double_t s = b[i];
+      for (Int_t k = i + 1; k < n && k <= i + m; k++)
+	s -= l[k * w + m - (k - i)] * b[k];
+      b[i] = s / l[i * w + m];
+    }
+}
+
+void specfit_uti::band_cholesky_invert_diagonal(Int_t n, Int_t m, const std::vector<Double_t> &l, std::vector<Double_t> &a_inv_diag)
+{
+  a_inv_diag.assign(n, 0);
+  std::vector<Double_t> e(n);
+  for (Int_t j = 0; j < n; j++)
+    {
+      std::fill(e.begin(), e.end(), 0.0);
+      e[j] = 1.0;
+      band_cholesky_solve(n, m, l, e);
+      a_inv_diag[j] = e[j];
+    }
+}
+
+Int_t specfit_uti::get_nthreads(Int_t nthreads)
+{
+#if __cplusplus >= 201103L
+  if(nthreads <= 0)
+    nthreads = (Int_t) std::thread::hardware_concurrency();
+  return (nthreads > 0 ? nthreads : 1);
+#else
+  (void) (nthreads);
+  return 1;
+#endif
+}
+
+#if __cplusplus >= 201103L
+// each worker takes the next index until all are done
+static void parallel_for_worker(Int_t n, void (*fun)(Int_t i, void *arg), void *arg, std::atomic<Int_t> *next)
+{
+  SPECFIT_TRACE("specfit_uti::parallel_for", "parallel");
+  for (Int_t i = (*next)++; i < n; i = (*next)++)
+    fun(i, arg);
+}
+#endif
+
+void specfit_uti::parallel_for(Int_t n, void (*fun)(Int_t i, void *arg), void *arg, Int_t nthreads)
+{
+  nthreads = TMath::Min(get_nthreads(nthreads), n);
+#if __cplusplus >= 201103L
+  if(nthreads > 1)
+    {
+      std::atomic<Int_t> next(0);
+      std::vector<std::thread> workers;
+      for (Int_t ithread = 1; ithread < nthreads; ithread++)
+	workers.push_back(std::thread(parallel_for_worker, n, fun, arg, &next));
+      parallel_for_worker(n, fun, arg, &next);
+      for (Int_t ithread = 0; ithread < (Int_t) workers.size(); ithread++)
+	workers[ithread].join();
+      return;
+    }
+#endif
+  for (Int_t i = 0; i < n; i++)
+    fun(i, arg);
+}
+
 NamespaceImp(specfit_uti);